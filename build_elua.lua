@@ -20,6 +20,7 @@
 local args = { ... }
 local b = require "utils.build"
 local mkfs = require "utils.mkfs"
+local mkbind = require "utils.mkbind"
 local bconf = require "config.config"
 local board_base_dir = "boards"
 local bd = require "build_data"
@@ -122,6 +123,7 @@ builder:add_option( 'toolchain', 'specifies toolchain to use (auto=search for us
 builder:add_option( 'optram', 'enables Lua Tiny RAM enhancements', true )
 builder:add_option( 'boot', 'boot mode, standard will boot to shell, luarpc boots to an rpc server', 'standard', { 'standard' , 'luarpc' } )
 builder:add_option( 'romfs', 'ROMFS compilation mode', 'verbatim', { 'verbatim' , 'compress', 'compile' } )
+builder:add_option( 'romfs_opt', 'optimize the ROMFS bytecode (romfs=compile only)', false )
 builder:add_option( 'cpumode', 'ARM CPU compilation mode (only affects certain ARM targets)', nil, { 'arm', 'thumb' } )
 builder:add_option( 'bootloader', 'Build for bootloader usage (AVR32 only)', 'none', { 'none', 'emblod' } )
 builder:add_option( "output_dir", "choose executable directory", "." )
@@ -264,7 +266,7 @@ if comp.romfs == 'compile' then
     print "Build it by running 'lua cross-lua.lua'"
     os.exit( -1 )
   end
-  local cmdpath = { lfs.currentdir(), sf( 'luac.cross%s -ccn %s -cce %s -o %%s -s %%s', suffix, toolset[ "cross_" .. comp.target:lower() ], toolset.cross_cpumode:lower() ) }
+  local cmdpath = { lfs.currentdir(), sf( 'luac.cross%s -ccn %s -cce %s%s -o %%s -s %%s', suffix, toolset[ "cross_" .. comp.target:lower() ], toolset.cross_cpumode:lower(), comp.romfs_opt and ' -O -r' or '' ) }
   fscompcmd = table.concat( cmdpath, utils.dir_sep )
 elseif comp.romfs == 'compress' then
   if comp.target == 'lualong' or comp.target == 'lualonglong' then fscompoptnums = '' else fscompoptnums = '--opt-numbers' end
@@ -414,6 +416,26 @@ local function make_romfs( target, deps )
   return 0
 end
 
+-- Native binding generator: expands every 'name.bind.lua' spec in the source
+-- tree into a 'name_bind.h' header next to it
+local function make_bindings( target, deps )
+  local flist = utils.string_to_table( utils.get_files( "src", "%.bind%.lua$" ) )
+  local res = 1
+  for _, spec in ipairs( flist ) do
+    local outname = spec:gsub( "%.bind%.lua$", "_bind" )
+    local written, err = mkbind.mkbind( spec, outname )
+    if written == nil then
+      print( utils.col_red( sf( "[BIND] Error: %s", err ) ) )
+      return -1
+    end
+    if written then
+      print( sf( "Generated bindings %s.h", outname ) )
+      res = 0
+    end
+  end
+  return res
+end
+
 -- Generic 'prog' action function
 local function genprog( target, deps )
   local outname = deps[ 1 ]:target_name()
@@ -444,9 +466,13 @@ builder:set_asm_cmd( ascmd )
 local romfs_target = builder:target( "#phony:romfs", nil, make_romfs )
 romfs_target:force_rebuild( true )
 
+-- Create the native bindings target
+local bind_target = builder:target( "#phony:bindings", nil, make_bindings )
+bind_target:force_rebuild( true )
+
 -- Create executable targets
 odeps = builder:create_compile_targets( source_files )
-exetarget = builder:link_target( output, { romfs_target, odeps } )
+exetarget = builder:link_target( output, { romfs_target, bind_target, odeps } )
 -- This is also the default target
 builder:default( builder:add_target( exetarget, 'build eLua executable' ) )
 
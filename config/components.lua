@@ -140,7 +140,12 @@ function init()
       timer = at.timer_attr( 'RFS_TIMER_ID' ),
       flow = at.flow_control_attr( 'RFS_FLOW_TYPE' ),
       buf_size = at.int_log2_attr( 'RFS_BUFFER_SIZE', nil, nil, 9 ),
-      timeout = at.int_attr( 'RFS_TIMEOUT', nil, nil, 100000 )
+      timeout = at.int_attr( 'RFS_TIMEOUT', nil, nil, 100000 ),
+      window = at.int_attr( 'RFS_WINDOW', 1, 32, 4 ),
+      cache_slots = at.int_attr( 'RFS_CACHE_SLOTS', 0, 16, 2 ),
+      cache_ttl = at.int_attr( 'RFS_CACHE_TTL', nil, nil, 1000000 ),
+      dir_batch = at.int_attr( 'RFS_DIR_BATCH_SIZE', 0, 4096, 128 ),
+      compress = at.int_attr( 'RFS_COMPRESS', 0, 1, 0 )
     }
   }
   -- MMCFS
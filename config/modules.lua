@@ -25,6 +25,7 @@ local lua_modules = {
 local elua_generic_modules = { 
   adc = { guards = { "BUILD_ADC", "NUM_ADC > 0" } }, 
   bit = {}, 
+  bitarray = {},
   can = { guards = { "NUM_CAN > 0" } }, 
   cpu = {}, 
   elua = {}, 
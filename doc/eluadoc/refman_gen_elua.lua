@@ -29,6 +29,34 @@ data_en =
       args = "$filename$ - the name of the file where the history will be saved. $CAUTION$: the file will be overwritten.",
     },    
 
+    { sig = "size, mtime, isdir = #elua.rfs_stat#( path )",
+      desc = "Get information about a file on the remote file system server. Only available if RFS is enabled.",
+      args = "$path$ - the name of the file on the server (without the $/rfs$ prefix).",
+      ret =
+      {
+        "$size$ - the size of the file.",
+        "$mtime$ - the modification time of the file.",
+        "$isdir$ - $true$ if $path$ is a directory, $false$ otherwise.",
+        "On error, returns $nil$ and an error message."
+      }
+    },
+
+    { sig = "data = #elua.rfs_readfile#( path )",
+      desc = "Fetch a whole file from the remote file system server by name, without opening it. Only available if RFS is enabled.",
+      args = "$path$ - the name of the file on the server (without the $/rfs$ prefix).",
+      ret = "the contents of the file as a string, or $nil$ and an error message."
+    },
+
+    { sig = "written = #elua.rfs_writefile#( path, data )",
+      desc = "Store a whole file on the remote file system server by name, without opening it (useful for deploying files). Only available if RFS is enabled.",
+      args =
+      {
+        "$path$ - the name of the file on the server (without the $/rfs$ prefix). $CAUTION$: the file will be overwritten.",
+        "$data$ - the new contents of the file."
+      },
+      ret = "the number of bytes written, or $nil$ and an error message."
+    },
+
     { sig = "version = #elua.version#()",
       desc = "Returns the current eLua version as a string",
       ret = "the eLua version currently running."
@@ -28,6 +28,8 @@ data_en =
     <li>Linux/Mac OS X luarpc: $transport_identifiers$ = $uart_path$
       <ul>
         <li>$uart_path$ - the path to the serial port to use (e.g.: "/dev/ttyS0")</li>
+        <li>$"tcp:[host:]port"$ - a TCP socket (the host defaults to 127.0.0.1); a server listens on it</li>
+        <li>$"unix:path"$ - a UNIX domain socket; a server listens on it</li>
       </ul>
     </li>
   </ul>
@@ -107,6 +109,75 @@ data_en =
       desc = "Read transport and handle incoming command.",
       args = "$server_handle$ - handle to refer to server session, created by @#rpc.listen@rpc.listen@",
     },
+
+    { sig = "count = #rpc.adispatch#( server_handle )",
+      desc = [[Non-blocking version of @#rpc.dispatch@rpc.dispatch@: read the data already received, and run the commands that arrived 
+  completely. Partial commands are kept in a buffer in $server_handle$ until the rest arrives, so a slow client never blocks the caller 
+  (commands larger than the buffer are finished with blocking reads). This is meant to be called from an event loop, for example 
+  $storm.os.invokePeriodically( 10 * storm.os.MILLISECOND, rpc.adispatch, server_handle )$.]],
+      args = "$server_handle$ - handle to refer to server session, created by @#rpc.listen@rpc.listen@",
+      ret = "$count$ - the number of commands run."
+    },
+
+    { sig = "results = #rpc.batch#( handle, call1, [call2], ..., [calln] )",
+      desc = [[Call several remote functions at once. If the server supports the version 2 protocol (see @#rpc.fastpath@rpc.fastpath@) all the calls 
+  are sent before reading any reply, so the whole batch costs a single round trip.]],
+      args = 
+      {
+        "$handle$ - handle associated with the connection.",
+        "$call1, call2, ..., calln$ - the calls, each one is a table with the name of the remote function (for example $\"pio.pin.setval\"$) followed by its arguments."
+      },
+      ret = "$results$ - a table with the result of each call: ${ true, ret1, ret2, ... }$ if the call succeeded, ${ false, error_message }$ otherwise."
+    },
+
+    { sig = "enabled = #rpc.fastpath#( [enabled] )",
+      desc = [[Enable or disable the version 2 protocol for the connections opened after this call (it is enabled by default and used only if the 
+  server supports it). Version 2 requests don't wait for the server's acknowledge, use a compact encoding for small integers, short strings and 
+  lengths, and replace function names with small handles after the first call.]],
+      args = "$enabled$ (optional) - $true$ to enable the version 2 protocol, $false$ to disable it.",
+      ret = "$enabled$ - the current setting."
+    },
+
+    { sig = "future = #rpc.async#( handle, call, [callback] )",
+      desc = [[Call a remote function without waiting for its reply. With the version 2 protocol any number of calls can be in flight on each 
+  connection, and calls on different connections run in parallel. The reply is read by @#future:wait@future:wait@, @#future:ready@future:ready@, 
+  @#rpc.wait@rpc.wait@ or @#rpc.poll@rpc.poll@. A synchronous call on the same connection first reads the replies to the calls still in flight 
+  (running their callbacks). With the version 1 protocol the call completes before $rpc.async$ returns.]],
+      args = 
+      {
+        "$handle$ - handle associated with the connection.",
+        "$call$ - a table with the name of the remote function followed by its arguments (as in @#rpc.batch@rpc.batch@). An optional $timeout$ field gives the time (in milliseconds) after which the call fails with a $\"timeout\"$ error.",
+        "$callback$ (optional) - function called with the values returned by @#future:wait@future:wait@ when the call completes."
+      },
+      ret = "$future$ - the future for the result of the call."
+    },
+
+    { sig = "ok, ret1, ret2, ... = #future:wait#( [timeout] )",
+      desc = "Wait until the call of $future$ completes, or until $timeout$ milliseconds passed.",
+      args = "$timeout$ (optional) - the longest time to wait in milliseconds. By default the function waits until the call completes or its own timeout expires.",
+      ret = "$true$ followed by the results of the call if it succeeded, $false$ and the error message if it failed, $nil$ if the call didn't complete yet."
+    },
+
+    { sig = "done = #future:ready#()",
+      desc = "Handle the replies received so far without waiting.",
+      ret = "$done$ - $true$ if the call of $future$ completed."
+    },
+
+    { sig = "done = #rpc.wait#( futures, [timeout] )",
+      desc = "Wait until all the calls in the $futures$ table complete.",
+      args = 
+      {
+        "$futures$ - an array of futures returned by @#rpc.async@rpc.async@.",
+        "$timeout$ (optional) - the longest time to wait in milliseconds (no limit by default)."
+      },
+      ret = "$done$ - $true$ if all the calls completed."
+    },
+
+    { sig = "pending = #rpc.poll#( [timeout] )",
+      desc = "Wait up to $timeout$ milliseconds for replies to the asynchronous calls, then handle all the replies received (running their callbacks).",
+      args = "$timeout$ (optional) - the longest time to wait in milliseconds, 0 (the default) only handles the replies already received.",
+      ret = "$pending$ - the number of calls still waiting for a reply."
+    },
    
   },
 
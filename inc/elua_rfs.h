@@ -7,5 +7,10 @@
 
 int remotefs_init( void );
 
+// Whole file operations by server path (see elua.rfs_*)
+int remotefs_stat( const char *path, u32 *psize, u32 *pmtime, int *pisdir );
+s32 remotefs_readfile( const char *path, void *buf, u32 count );
+s32 remotefs_writefile( const char *path, const void *buf, u32 count );
+
 #endif
 
@@ -24,20 +24,92 @@
 #define   ELUARPC_U16_SIZE        3
 #define   ELUARPC_U8_SIZE         2
 #define   ELUARPC_OP_ID_SIZE      2
+#define   ELUARPC_TAG_SIZE        2
 #define   ELUARPC_READ_BUF_OFFSET ( ELUARPC_START_OFFSET + ELUARPC_START_SIZE + ELUARPC_RESPONSE_SIZE + ELUARPC_PTR_HEADER_SIZE )
 #define   ELUARPC_SMALL_READ_BUF_OFFSET ( ELUARPC_START_OFFSET + ELUARPC_START_SIZE + ELUARPC_RESPONSE_SIZE + ELUARPC_SMALL_PTR_HEADER_SIZE )
-#define   ELUARPC_WRITE_REQUEST_EXTRA ( ELUARPC_START_OFFSET + ELUARPC_START_SIZE + ELUARPC_OP_ID_SIZE + ELUARPC_U32_SIZE + ELUARPC_PTR_HEADER_SIZE + ELUARPC_END_SIZE )
+#define   ELUARPC_WRITE_REQUEST_EXTRA ( ELUARPC_START_OFFSET + ELUARPC_START_SIZE + ELUARPC_OP_ID_SIZE + ELUARPC_TAG_SIZE + ELUARPC_U32_SIZE + ELUARPC_PTR_HEADER_SIZE + ELUARPC_END_SIZE )
+
+// Request tags
+// A tagged packet carries an extra TYPE_REQ_TAG/u8 pair right after its
+// operation (or response) byte. The tag is written by eluarpc_gen_write when
+// one is set and captured by eluarpc_gen_read/eluarpc_get_request_id, so a
+// server that reads a tagged request automatically tags its response.
+// Untagged packets are unchanged from the original protocol.
+#define   ELUARPC_NO_TAG          ( -1 )
 
 // Public interface
 // Get request ID
 int eluarpc_get_request_id( const u8 *p, u8 *pid );
 
+// Set the tag used by the next writes (ELUARPC_NO_TAG for untagged packets)
+void eluarpc_set_tag( int tag );
+
+// Get the tag of the last packet read (ELUARPC_NO_TAG if it was untagged)
+int eluarpc_get_tag( void );
+
+// Offset of the inline data in a read response with the current tag
+#define   ELUARPC_TAGGED_READ_BUF_OFFSET  ( ELUARPC_READ_BUF_OFFSET + ( eluarpc_get_tag() == ELUARPC_NO_TAG ? 0 : ELUARPC_TAG_SIZE ) )
+
 // Replace a flag with another flag
 u32 eluarpc_replace_flag( u32 val, u32 origflag, u32 newflag );
 
 // Get packet size
 int eluarpc_get_packet_size( const u8 *p, u16 *psize );
 
+// Packed entry lists
+// Variable length records for batched replies, carried as a 'p' field:
+// [u8 len][name, len bytes including the final '\0'][u32 a][u32 b]
+#define   ELUARPC_ENTRY_SIZE( namelen ) ( 1 + ( namelen ) + 1 + 8 )
+
+// Append an entry at 'p', returns its size (0 if it doesn't fit in 'maxlen')
+u32 eluarpc_put_entry( u8 *p, u32 maxlen, const char *name, u32 a, u32 b );
+
+// Decode the entry at 'p', returns the next entry (NULL at 'pend' or on error)
+const u8* eluarpc_get_entry( const u8 *p, const u8 *pend, const char **pname, u32 *pa, u32 *pb );
+
+// LZ codec
+// Byte oriented LZ77 (LZF style) with an 8k window. Compression uses a hash
+// table of 2^ELUARPC_LZ_HASH_BITS u16 entries on the stack, expansion needs
+// no memory besides the output buffer.
+#ifndef ELUARPC_LZ_HASH_BITS
+#define   ELUARPC_LZ_HASH_BITS    8
+#endif
+
+// Compress 'len' bytes, returns the compressed size (0 if it doesn't fit in
+// 'maxlen' bytes)
+u32 eluarpc_lz_compress( const u8 *src, u32 len, u8 *dst, u32 maxlen );
+
+// Expand 'len' compressed bytes, returns the expanded size (-1 on error)
+int eluarpc_lz_expand( const u8 *src, u32 len, u8 *dst, u32 maxlen );
+
+// Compressed packets
+// A sender that accepts compressed packets starts its packets with
+// TYPE_START_LZ instead of TYPE_START. A compressed packet keeps the size,
+// start and end fields and replaces everything in between with TYPE_LZ_BODY,
+// the u16 size of the original body and the LZ data. Packets are only
+// compressed for peers that advertised it in their last packet, so peers
+// that don't know about compression never see a compressed packet.
+#define   ELUARPC_LZ_OFF          0       // never advertise
+#define   ELUARPC_LZ_ON           1       // always advertise (clients)
+#define   ELUARPC_LZ_AUTO         2       // advertise to peers that do (servers)
+#define   ELUARPC_LZ_MIN_BODY     32      // smaller packets are sent as they are
+
+// Set the compression mode (ELUARPC_LZ_OFF by default)
+void eluarpc_set_compress( int mode );
+
+// Check if the peer that sent the last packet accepts compressed packets
+int eluarpc_peer_compress( void );
+
+// Check if the packet at 'p' is compressed
+int eluarpc_is_compressed( const u8 *p );
+
+// Compress the packet at 'p' to 'pdest', returns ELUARPC_ERR if it doesn't
+// get smaller (in which case 'p' should be sent as it is)
+int eluarpc_compress_packet( const u8 *p, u8 *pdest, u32 maxsize );
+
+// Expand the compressed packet at 'p' to 'pdest'
+int eluarpc_expand_packet( const u8 *p, u8 *pdest, u32 maxsize );
+
 // Generic write function
 // Specifiers: o - operation
 //             r - response
@@ -10,6 +10,14 @@
 
 #define MAX_LINK_ERRS ( 2 ) // Maximum number of framing errors before connection reset
 
+#define RPC_WRITE_BUF_SIZE 128 // Outgoing data is gathered in this buffer before being written
+
+#define RPC_MAX_NAMES 64 // Maximum number of function handles per connection (protocol v2)
+
+#define RPC_READ_BUF_SIZE 128 // Commands up to this size are received without blocking by rpc.adispatch
+
+#define RPC_ASYNC_POLL_TIME 1000 // Longest wait (ms) for a reply while waiting for futures without a timeout
+
 #define LUARPC_MODE "elua"
 
 // a kind of silly way to get the maximum int, but oh well ...
@@ -88,8 +96,15 @@ struct _Transport
          loc_armflt: 1,               // local float representation is arm float?
          loc_intnum: 1,               // Local is integer only?
          net_little: 1,               // Network is little endian?
-         net_intnum: 1;               // Network is integer only?
+         net_intnum: 1,               // Network is integer only?
+         net_lz: 1,                   // Long strings are sent compressed?
+         net_v2: 1,                   // Protocol v2 (compact encoding, function handles)?
+         sock: 1;                     // Listening socket (connections must be accepted)?
   u8     lnum_bytes;
+  u16    wlen;                        // Bytes waiting in wbuf
+  u8     wbuf[ RPC_WRITE_BUF_SIZE ];
+  const u8 *rsrc;                     // Received bytes read before the transport
+  u16    rleft;                       // Bytes left in rsrc
 };
 
 typedef struct _Handle Handle;
@@ -97,8 +112,22 @@ struct _Handle
 {
   Transport tpt;                      // the handle socket
   int error_handler;                  // function reference
-  int async;                          // nonzero if async mode being used
-  int read_reply_count;               // number of async call return values to read
+  int names_ref;                      // function path -> handle table (protocol v2)
+  int queue_ref;                      // futures waiting for a reply (async calls)
+  int qhead, qtail;                   // queue indexes
+};
+
+// Future states
+enum { FUTURE_PENDING, FUTURE_DONE, FUTURE_FAILED };
+
+typedef struct _Future Future;
+struct _Future {
+  Handle *handle;                     // connection of the call
+  int ref;                            // table with the path, callback and results
+  u32 deadline;                       // transport_clock() value for the timeout
+  u8 state;
+  u8 has_deadline: 1,
+     newref: 1;                       // the server will send a handle for the path
 };
 
 typedef struct _Helper Helper;
@@ -115,6 +144,12 @@ struct _ServerHandle {
   Transport ltpt;   // listening transport, always valid if no error
   Transport atpt;   // accepting transport, valid if connection established
   int link_errs;
+  int names_ref;    // function handle -> path table (protocol v2)
+  u16 nnames;       // number of function handles given to the client
+  u16 rlen;         // bytes received in rbuf (rpc.adispatch)
+  u8 acked: 1,      // RPC_READY already sent for the command in rbuf
+     negotiated: 1; // connection header received
+  u8 rbuf[ RPC_READ_BUF_SIZE ];
 };
 
 
@@ -156,6 +191,9 @@ void transport_accept (Transport *tpt, Transport *atpt);
 void transport_read_buffer (Transport *tpt, u8 *buffer, int length);
 void transport_write_buffer (Transport *tpt, const u8 *buffer, int length);
 
+// Read up to 'length' bytes without blocking, returns the number of bytes read
+int transport_read_available( Transport *tpt, u8 *buffer, int length );
+
 // Check if data is available on connection without reading:
 //     - 1 = data available, 0 = no data available
 int transport_readable (Transport *tpt);
@@ -166,3 +204,10 @@ int transport_is_open (Transport *tpt);
 
 // Shut down connection
 void transport_close (Transport *tpt);
+
+// Wait until one of the transports has data to read, or until 'timeout'
+// milliseconds elapsed: returns the index of the transport or -1
+int transport_select( Transport **tpts, int n, u32 timeout );
+
+// Millisecond counter used for timeouts
+u32 transport_clock( void );
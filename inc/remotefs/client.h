@@ -10,6 +10,12 @@
 #define CLIENT_OK   0
 #define CLIENT_ERR  1
 
+// Result of requests the server doesn't support
+#define RFSC_UNSUPPORTED  ( -2 )
+
+// Maximum number of requests in flight for windowed transfers
+#define RFSC_MAX_WINDOW   32
+
 // RFS client send/receive functions
 typedef u32 ( *p_rfsc_send )( const u8 *p, u32 size );
 typedef u32 ( *p_rfsc_recv )( u8 *p, u32 size, timer_data_type timeout );
@@ -17,14 +23,23 @@ typedef u32 ( *p_rfsc_recv )( u8 *p, u32 size, timer_data_type timeout );
 // Public interface
 void rfsc_setup( u8 *pbuf, p_rfsc_send rfsc_send_func, p_rfsc_recv rfsc_recv_func, timer_data_type timeout );
 void rfsc_set_timeout( timer_data_type timeout );
+void rfsc_set_window( unsigned window );
+void rfsc_set_compress( u8 *pzbuf, u32 bufsize );
+u32 rfsc_get_caps( void );
 int rfsc_open( const char* pathname, int flags, int mode );
 s32 rfsc_write( int fd, const void *buf, u32 count );
 s32 rfsc_read( int fd, void *buf, u32 count );
+s32 rfsc_write_chunked( int fd, const void *buf, u32 count, u32 chunk );
+s32 rfsc_read_chunked( int fd, void *buf, u32 count, u32 chunk );
 s32 rfsc_lseek( int fd, s32 offset, int whence );
 int rfsc_close( int fd );
 u32 rfsc_opendir( const char* name );
 void rfsc_readdir( u32 d, const char **pname, u32 *psize, u32 *ptime );
 int rfsc_closedir( u32 d );
+int rfsc_stat( const char *pathname, u32 *psize, u32 *pmtime, u8 *pflags );
+int rfsc_readdir_batch( u32 d, u8 *buf, u32 bufsize, u32 *plen );
+s32 rfsc_readfile( const char *pathname, void *buf, u32 count, u32 chunk );
+s32 rfsc_writefile( const char *pathname, const void *buf, u32 count, u32 chunk );
 
 #endif
 
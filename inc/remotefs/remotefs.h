@@ -4,6 +4,7 @@
 #define __REMOTEFS_H__
 
 #include "type.h"
+#include "eluarpc.h"
 
 // Operation IDs
 #define   RFS_OP_OPEN     0x01
@@ -15,9 +16,23 @@
 #define   RFS_OP_OPENDIR  0x06
 #define   RFS_OP_READDIR  0x07
 #define   RFS_OP_CLOSEDIR 0x08
-#define   RFS_OP_LAST     RFS_OP_CLOSEDIR
+#define   RFS_OP_STAT     0x09
+#define   RFS_OP_READDIRB 0x0A
+#define   RFS_OP_READFILE 0x0B
+#define   RFS_OP_WRITEFILE 0x0C
+#define   RFS_OP_CAPS     0x0D
+#define   RFS_OP_LAST     RFS_OP_CAPS
 #define   RFS_OP_RES_MOD  0x80
 
+// Operation ID of the response to requests the server doesn't know
+#define   RFS_OP_UNSUPPORTED 0x7F
+
+// Capabilities reported by "caps"
+#define   RFS_CAP_TAGS              0x01    // tagged requests (windowed transfers)
+#define   RFS_CAP_READDIRB          0x02    // batched directory listings
+#define   RFS_CAP_LZ                0x04    // compressed packets
+#define   RFS_CAP_FILES             0x08    // stat, readfile and writefile
+
 // Platform independent constants for "flags" in "open"
 #define   RFS_OPEN_FLAG_APPEND      0x01
 #define   RFS_OPEN_FLAG_CREAT       0x02
@@ -33,6 +48,22 @@
 #define   RFS_LSEEK_CUR             0x02
 #define   RFS_LSEEK_END             0x03
 
+// Flags for "stat"
+#define   RFS_STAT_FLAG_DIR         0x01
+
+// Flags for "writefile"
+#define   RFS_WRITEFILE_FLAG_TRUNC  0x01
+
+// Offset of the inline data in readfile and readdirb responses
+#define   RFS_READFILE_BUF_OFFSET   ( ELUARPC_TAGGED_READ_BUF_OFFSET + ELUARPC_U32_SIZE )
+#define   RFS_READDIRB_BUF_OFFSET   RFS_READFILE_BUF_OFFSET
+
+// Bytes of a readfile/readdirb response that are not data
+#define   RFS_READFILE_EXTRA        ( ELUARPC_READ_BUF_OFFSET + ELUARPC_TAG_SIZE + ELUARPC_U32_SIZE + ELUARPC_END_SIZE )
+
+// Bytes of a writefile request that are not data
+#define   RFS_WRITEFILE_EXTRA( pathlen ) ( ELUARPC_WRITE_REQUEST_EXTRA + ELUARPC_PTR_HEADER_SIZE + ( pathlen ) + 1 + ELUARPC_U8_SIZE )
+
 // R/W pipe names (used only with the simulator)
 #define   RFS_SRV_WRITE_PIPE        "/tmp/elua_srv_write"
 #define   RFS_SRV_READ_PIPE         "/tmp/elua_srv_read"
@@ -89,5 +120,45 @@ int remotefs_closedir_read_response( const u8 *p, int *pd );
 void remotefs_closedir_write_request( u8 *p, u32 d );
 int remotefs_closedir_read_request( const u8 *p, u32 *pd );
 
+// Function: int stat( const char *pathname, u32 *psize, u32 *pmtime, u8 *pflags )
+void remotefs_stat_write_response( u8 *p, int result, u32 size, u32 mtime, u8 flags );
+int remotefs_stat_read_response( const u8 *p, int *presult, u32 *psize, u32 *pmtime, u8 *pflags );
+void remotefs_stat_write_request( u8 *p, const char *pathname );
+int remotefs_stat_read_request( const u8 *p, const char **ppathname );
+
+// Function: int readdirb( u32 d, u32 maxbytes )
+// Returns as many entries as fit in 'maxbytes' (packed with eluarpc_put_entry)
+void remotefs_readdirb_write_response( u8 *p, int count, const void *entries, u32 len );
+int remotefs_readdirb_read_response( const u8 *p, int *pcount, const u8 **pentries, u32 *plen );
+void remotefs_readdirb_write_request( u8 *p, u32 d, u32 maxbytes );
+int remotefs_readdirb_read_request( const u8 *p, u32 *pd, u32 *pmaxbytes );
+
+// Function: s32 readfile( const char *pathname, u32 offset, void *buf, u32 count )
+// Reads a chunk of a file by name, returns the file size (-1 for error)
+// The data is left at RFS_READFILE_BUF_OFFSET by the server
+void remotefs_readfile_write_response( u8 *p, s32 filesize, u32 readbytes );
+int remotefs_readfile_read_response( const u8 *p, s32 *pfilesize, const u8 **ppdata, u32 *preadbytes );
+void remotefs_readfile_write_request( u8 *p, const char *pathname, u32 offset, u32 count );
+int remotefs_readfile_read_request( const u8 *p, const char **ppathname, u32 *poffset, u32 *pcount );
+
+// Function: s32 writefile( const char *pathname, u32 offset, u8 flags, const void *buf, u32 count )
+// Writes a chunk of a file by name, creating it if needed
+void remotefs_writefile_write_response( u8 *p, s32 result );
+int remotefs_writefile_read_response( const u8 *p, s32 *presult );
+void remotefs_writefile_write_request( u8 *p, const char *pathname, u32 offset, u8 flags, const void *buf, u32 count );
+int remotefs_writefile_read_request( const u8 *p, const char **ppathname, u32 *poffset, u8 *pflags, const void **pbuf, u32 *pcount );
+
+// Function: u32 caps( u32 *pwindow )
+// Returns the RFS_CAP_* flags of the server and the number of requests a
+// client can keep in flight
+void remotefs_caps_write_response( u8 *p, u32 caps, u32 window );
+int remotefs_caps_read_response( const u8 *p, u32 *pcaps, u32 *pwindow );
+void remotefs_caps_write_request( u8 *p );
+int remotefs_caps_read_request( const u8 *p );
+
+// Response to an unknown operation 'op'
+void remotefs_unsupported_write_response( u8 *p, u8 op );
+int remotefs_unsupported_read_response( const u8 *p, u8 *pop );
+
 #endif
 
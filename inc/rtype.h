@@ -12,6 +12,9 @@
 #define   TYPE_END        0x06
 #define   TYPE_OP_ID      0x07
 #define   TYPE_SMALL_PTR  0x08
+#define   TYPE_REQ_TAG    0x09
+#define   TYPE_START_LZ   0x0A
+#define   TYPE_LZ_BODY    0x0B
 #define   TYPE_PKT_SIZE   0xA5
                                     
 #endif
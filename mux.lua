@@ -16,6 +16,7 @@ if utils.is_windows() then
   socklib = "ws2_32"
 else
   rfs_flist = rfs_flist .. " os_io_posix.c serial_posix.c net_posix.c"
+  flist = flist .. " endpoint.c"
   exeprefix = ""
 end
 
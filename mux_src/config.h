@@ -9,5 +9,21 @@
 #define NET_TIMEOUT_MS              100
 #define MEM_BUF_SIZE                ( 6 * 1024 )
 
+// Block size for reads from the transport and the services (data sent to
+// the transport can grow to twice this size because of escaping)
+#define MUX_BLOCK_SIZE              4096
+#define MUX_TX_BUF_SIZE             ( 2 * MUX_BLOCK_SIZE + 16 )
+
+// A write to the transport gives up when the port takes no data for this
+// long (for example when the peer holds the flow control lines)
+#define MUX_WRITE_TIMEOUT_MS        ( 10 * SER_TIMEOUT_MS )
+
+// Per-service output queue. While a service can't take another block, the
+// transport is not read, so the mote is held back instead of losing data. A
+// client that takes nothing for MUX_SERVICE_STALL_S seconds is disconnected
+// so it can't stall the other services for good.
+#define MUX_SERVICE_QUEUE_SIZE      ( 4 * MUX_BLOCK_SIZE )
+#define MUX_SERVICE_STALL_S         10
+
 #endif
 
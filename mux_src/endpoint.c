@@ -0,0 +1,171 @@
+// Non-serial service endpoints for the multiplexer (POSIX only)
+// A service can be a TCP listener, a UNIX domain socket listener or a PTY
+// pair. Listeners accept one client at a time; the PTY slave is kept open by
+// the multiplexer, so tools can come and go without the master hanging up.
+
+#define _GNU_SOURCE
+#include "endpoint.h"
+#include "log.h"
+#include "deskutils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+int endpoint_set_nonblocking( int fd )
+{
+  int flags;
+
+  if( ( flags = fcntl( fd, F_GETFL, 0 ) ) == -1 )
+    return 0;
+  return fcntl( fd, F_SETFL, flags | O_NONBLOCK ) != -1;
+}
+
+// Helper: make the listening socket non-blocking and start listening on it
+static int endpoint_listen( int fd, const char *name )
+{
+  if( listen( fd, ENDPOINT_LISTEN_BACKLOG ) == -1 || !endpoint_set_nonblocking( fd ) )
+  {
+    log_err( "Unable to listen on %s: %s\n", name, strerror( errno ) );
+    close( fd );
+    return -1;
+  }
+  return fd;
+}
+
+// 'spec' is '[<host>:]<port>', host defaults to the loopback interface
+int endpoint_tcp_listen( const char *spec )
+{
+  const char *c;
+  char *host, port[ 16 ];
+  struct addrinfo hints, *res;
+  int fd, err, on = 1;
+
+  if( ( c = strrchr( spec, ':' ) ) != NULL )
+    host = l_strndup( spec, c - spec );
+  else
+  {
+    host = l_strndup( ENDPOINT_TCP_DEFAULT_HOST, strlen( ENDPOINT_TCP_DEFAULT_HOST ) );
+    c = spec - 1;
+  }
+  snprintf( port, sizeof( port ), "%s", c + 1 );
+  memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  err = getaddrinfo( host, port, &hints, &res );
+  free( host );
+  if( err != 0 )
+  {
+    log_err( "Invalid TCP address %s: %s\n", spec, gai_strerror( err ) );
+    return -1;
+  }
+  if( ( fd = socket( res->ai_family, res->ai_socktype, res->ai_protocol ) ) == -1 )
+  {
+    log_err( "Unable to create socket for %s: %s\n", spec, strerror( errno ) );
+    freeaddrinfo( res );
+    return -1;
+  }
+  setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+  err = bind( fd, res->ai_addr, res->ai_addrlen );
+  freeaddrinfo( res );
+  if( err == -1 )
+  {
+    log_err( "Unable to bind to %s: %s\n", spec, strerror( errno ) );
+    close( fd );
+    return -1;
+  }
+  return endpoint_listen( fd, spec );
+}
+
+// A stale socket file left by a previous run is removed first
+int endpoint_unix_listen( const char *path )
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if( strlen( path ) >= sizeof( addr.sun_path ) )
+  {
+    log_err( "UNIX socket path too long: %s\n", path );
+    return -1;
+  }
+  if( ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) == -1 )
+  {
+    log_err( "Unable to create socket for %s: %s\n", path, strerror( errno ) );
+    return -1;
+  }
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  strcpy( addr.sun_path, path );
+  unlink( path );
+  if( bind( fd, ( struct sockaddr* )&addr, sizeof( addr ) ) == -1 )
+  {
+    log_err( "Unable to bind to %s: %s\n", path, strerror( errno ) );
+    close( fd );
+    return -1;
+  }
+  return endpoint_listen( fd, path );
+}
+
+// Open a raw PTY pair and return the master. The slave name is returned in
+// 'pname'; if 'link' is not NULL a symlink to the slave is created there.
+int endpoint_pty_open( const char *link, int *pslave, char **pname )
+{
+  int fd;
+  const char *sname;
+  struct termios termdata;
+
+  if( ( fd = posix_openpt( O_RDWR | O_NOCTTY ) ) == -1 || grantpt( fd ) == -1 || unlockpt( fd ) == -1 || ( sname = ptsname( fd ) ) == NULL )
+  {
+    log_err( "Unable to create PTY: %s\n", strerror( errno ) );
+    if( fd != -1 )
+      close( fd );
+    return -1;
+  }
+  *pname = l_strndup( sname, strlen( sname ) );
+  if( ( *pslave = open( *pname, O_RDWR | O_NOCTTY ) ) == -1 )
+  {
+    log_err( "Unable to open %s: %s\n", *pname, strerror( errno ) );
+    close( fd );
+    return -1;
+  }
+  tcgetattr( *pslave, &termdata );
+  cfmakeraw( &termdata );
+  tcsetattr( *pslave, TCSANOW, &termdata );
+  if( link )
+  {
+    unlink( link );
+    if( symlink( *pname, link ) == -1 )
+    {
+      log_err( "Unable to create link %s to %s: %s\n", link, *pname, strerror( errno ) );
+      close( *pslave );
+      close( fd );
+      return -1;
+    }
+  }
+  endpoint_set_nonblocking( fd );
+  return fd;
+}
+
+// Accept a client on a listening socket, returns -1 if none is pending
+int endpoint_accept( int lfd )
+{
+  int fd, on = 1;
+
+  if( ( fd = accept( lfd, NULL, NULL ) ) == -1 )
+    return -1;
+  endpoint_set_nonblocking( fd );
+  // Interactive tools (consoles) want their bytes right away; this fails
+  // harmlessly on UNIX sockets
+  setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+  return fd;
+}
@@ -0,0 +1,20 @@
+// Non-serial service endpoints for the multiplexer (POSIX only)
+
+#ifndef __ENDPOINT_H__
+#define __ENDPOINT_H__
+
+// Service name prefixes
+#define ENDPOINT_TCP_PREFIX     "tcp:"
+#define ENDPOINT_UNIX_PREFIX    "unix:"
+#define ENDPOINT_PTY_PREFIX     "pty"
+
+#define ENDPOINT_TCP_DEFAULT_HOST "127.0.0.1"
+#define ENDPOINT_LISTEN_BACKLOG   4
+
+int endpoint_tcp_listen( const char *spec );
+int endpoint_unix_listen( const char *path );
+int endpoint_pty_open( const char *link, int *pslave, char **pname );
+int endpoint_accept( int lfd );
+int endpoint_set_nonblocking( int fd );
+
+#endif
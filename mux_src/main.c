@@ -14,6 +14,13 @@
 #include "sermux.h"
 #include "rfs.h"
 #include "deskutils.h"
+#include "endpoint.h"
+#include <time.h>
+#ifndef WIN32_BUILD
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
 
 // ****************************************************************************
 // Data structures and local variables
@@ -26,15 +33,40 @@
 
 #define RFS_PSEUDO_SELIDX     0xFF
 
+// Service types
+#define SERVICE_SERIAL        0
+#define SERVICE_TCP           1
+#define SERVICE_UNIX          2
+#define SERVICE_PTY           3
+
+// Poll slots of service 'i' (its data handle and its listening socket)
+#define PFD_DATA( i )         ( HND_FIRST_VOFFSET + 2 * ( i ) )
+#define PFD_LISTEN( i )       ( PFD_DATA( i ) + 1 )
+
 // Send/receive/init function pointers
 typedef u32 ( *p_recv_func )( u8 *p, u32 size );
 typedef u32 ( *p_send_func )( const u8 *p, u32 size );
 typedef int ( *p_init_func )( void );
 
+// Service statistics ("in" is mote to service, "out" is service to mote)
+typedef struct {
+  u32 in_bytes, in_frames;
+  u32 out_bytes, out_frames;
+  u32 dropped;                        // bytes for the service that had no client
+  unsigned queue_hw;                  // output queue high-water mark (since the last report)
+} SERVICE_STATS;
+
 // Serial thread buffer structure
 typedef struct {
   const char *pname;
-  ser_handler fd;
+  int type;
+  ser_handler fd;                     // serial port, PTY master or connected client
+  int listen_fd;                      // listening socket (TCP and UNIX services)
+  int pty_slave;                      // kept open so the PTY master never hangs up
+  u8 *outbuf;                         // data waiting to be written to the service
+  unsigned outlen;
+  time_t stalled;                     // since when the full queue holds the transport back (0 if it doesn't)
+  SERVICE_STATS stats;
 } SERVICE_DATA;
 
 // Serial transport data structure
@@ -59,14 +91,67 @@ static int mux_mode;
 static int verbose_mode;
 static int rfs_service_id = -1, service_offset;
 
+// Data waiting to be sent on the transport
+static u8 mux_txbuf[ MUX_TX_BUF_SIZE ];
+static unsigned mux_txlen;
+
+// Decoder/encoder state
+static int prev_sent = -1;
+static int got_esc;
+
+// Statistics
+static long stats_interval;
+static time_t stats_next;
+static u32 transport_in_bytes, transport_out_bytes;
+static unsigned mux_tx_hw;
+
 // ***************************************************************************
 // Serial transport implementation
 
+// Write a complete block (the ports are in non-blocking mode). Returns the
+// number of bytes written, which is short if the port fails or takes no
+// data for MUX_WRITE_TIMEOUT_MS.
+static u32 mux_write_all( ser_handler fd, const u8 *p, u32 size )
+{
+#ifdef WIN32_BUILD
+  return ser_write( fd, p, size );
+#else
+  u32 done = 0;
+  int res, stalled = 0;
+  struct pollfd pfd;
+
+  while( done < size )
+  {
+    if( ( res = write( fd, p + done, size - done ) ) > 0 )
+    {
+      done += res;
+      stalled = 0;
+    }
+    else if( res == -1 && errno == EINTR )
+      continue;
+    else if( res == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+    {
+      if( stalled >= MUX_WRITE_TIMEOUT_MS )
+        break;
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      if( ( res = poll( &pfd, 1, SER_TIMEOUT_MS ) ) == 0 )
+        stalled += SER_TIMEOUT_MS;
+      else if( res > 0 && ( pfd.revents & ( POLLERR | POLLHUP | POLLNVAL ) ) )
+        break;
+    }
+    else
+      break;
+  }
+  return done;
+#endif
+}
+
 static u32 transport_ser_send( const u8 *p, u32 size )
 {
   TRANSPORT_SER *pser = ( TRANSPORT_SER* )transport_data;
 
-  return ser_write( pser->fd, p, size );
+  return mux_write_all( pser->fd, p, size );
 }
 
 static int transport_ser_init()
@@ -92,9 +177,232 @@ static int transport_ser_init()
 // ****************************************************************************
 // Utility functions and helpers
 
+static void transport_flush()
+{
+  if( mux_txlen > 0 )
+  {
+    if( mux_txlen > mux_tx_hw )
+      mux_tx_hw = mux_txlen;
+    if( transport_send( mux_txbuf, mux_txlen ) != mux_txlen )
+      log_err( "Unable to write %u bytes to the transport\n", mux_txlen );
+    transport_out_bytes += mux_txlen;
+    mux_txlen = 0;
+  }
+}
+
 static void transport_send_byte( u8 data )
 {
-  transport_send( &data, 1 );
+  if( mux_txlen == MUX_TX_BUF_SIZE )
+    transport_flush();
+  mux_txbuf[ mux_txlen ++ ] = data;
+}
+
+// Return the local service with the given ID or NULL if there isn't one
+// (RFS in rfsmux mode is not a local service)
+static SERVICE_DATA* service_from_id( int sid )
+{
+  int idx = sid - SERMUX_SERVICE_ID_FIRST - service_offset;
+
+  return sid != rfs_service_id && idx >= 0 && idx < ( int )vport_num ? services + idx : NULL;
+}
+
+// Close the service handle. Listening services go back to waiting for a new
+// client, the others are ignored from now on.
+static void service_disconnect( SERVICE_DATA *pservice )
+{
+  if( pservice->type == SERVICE_TCP || pservice->type == SERVICE_UNIX )
+  {
+    log_msg( "Client disconnected from %s\n", pservice->pname );
+#ifndef WIN32_BUILD
+    close( pservice->fd );
+#endif
+  }
+  else
+  {
+    log_msg( "Port %s closed, ignoring it from now on\n", pservice->pname );
+    ser_close( pservice->fd );
+  }
+  pservice->fd = SER_HANDLER_INVALID;
+  pservice->stats.dropped += pservice->outlen;
+  pservice->outlen = 0;
+  pservice->stalled = 0;
+}
+
+// Write as much of the output queue as the service accepts without blocking
+static void service_flush( SERVICE_DATA *pservice )
+{
+#ifndef WIN32_BUILD
+  int res;
+#endif
+
+  if( pservice->outlen == 0 || pservice->fd == SER_HANDLER_INVALID )
+    return;
+#ifdef WIN32_BUILD
+  if( ser_write( pservice->fd, pservice->outbuf, pservice->outlen ) != pservice->outlen )
+    log_msg( "Unable to write %u bytes to %s\n", pservice->outlen, pservice->pname );
+  pservice->outlen = 0;
+#else
+  if( ( res = write( pservice->fd, pservice->outbuf, pservice->outlen ) ) > 0 )
+  {
+    pservice->outlen -= res;
+    memmove( pservice->outbuf, pservice->outbuf + res, pservice->outlen );
+    pservice->stalled = 0;
+  }
+  else if( res == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+    service_disconnect( pservice );
+#endif
+}
+
+// A connected service that can't take another block from the transport
+static int service_is_full( SERVICE_DATA *pservice )
+{
+  return pservice->fd != SER_HANDLER_INVALID && pservice->outlen > MUX_SERVICE_QUEUE_SIZE - MUX_BLOCK_SIZE;
+}
+
+// Queue a byte for the service. The transport is only read while all the
+// services can take a whole block, so the queue never overflows; if it does
+// anyway, the client is disconnected rather than given a stream with a gap.
+static void service_send_byte( SERVICE_DATA *pservice, u8 data )
+{
+  if( pservice->outlen == MUX_SERVICE_QUEUE_SIZE )
+    service_flush( pservice );
+  if( pservice->fd != SER_HANDLER_INVALID && pservice->outlen == MUX_SERVICE_QUEUE_SIZE )
+  {
+    log_err( "Output queue of %s overflowed\n", pservice->pname );
+    service_disconnect( pservice );
+  }
+  if( pservice->fd == SER_HANDLER_INVALID )
+  {
+    pservice->stats.dropped ++;
+    return;
+  }
+  pservice->outbuf[ pservice->outlen ++ ] = data;
+  pservice->stats.in_bytes ++;
+  if( pservice->outlen > pservice->stats.queue_hw )
+    pservice->stats.queue_hw = pservice->outlen;
+}
+
+static void services_flush()
+{
+  unsigned i;
+
+  for( i = 0; i < vport_num; i ++ )
+    service_flush( services + i );
+}
+
+// ****************************************************************************
+// Buffered mux engine
+// Blocks of data are encoded into (or decoded from) memory buffers; the
+// transport buffer is written after each block read from a service and the
+// service buffers after each block read from the transport, so the number of
+// system calls depends on the number of blocks, not on the number of bytes.
+
+// Encode data from service 'sid' to the transport
+static void mux_encode( int sid, const u8 *p, u32 size )
+{
+  u8 c;
+  SERVICE_DATA *pservice = service_from_id( sid );
+
+  if( pservice )
+    pservice->stats.out_bytes += size;
+  while( size -- )
+  {
+    c = *p ++;
+    prev_sent = c;
+    // Send the service ID first if needed
+    if( sid != service_id_out )
+    {
+      log_msg( "Changed service_id_out from %d(%X) to %d(%X).\n", service_id_out, service_id_out, sid, sid );
+      transport_send_byte( sid );
+      service_id_out = sid;
+      if( pservice )
+        pservice->stats.out_frames ++;
+    }
+    // Then send the actual data byte, escaping it if needed
+    if( c == SERMUX_ESCAPE_CHAR || c == SERMUX_FORCE_SID_CHAR || ( c >= SERMUX_SERVICE_ID_FIRST && c <= SERMUX_SERVICE_ID_LAST ) )
+    {
+      transport_send_byte( SERMUX_ESCAPE_CHAR );
+      transport_send_byte( c ^ SERMUX_ESCAPE_XOR_MASK );
+      prev_sent = SERMUX_ESC_MASK | ( c ^ SERMUX_ESCAPE_XOR_MASK );
+    }
+    else
+      transport_send_byte( c );
+  }
+}
+
+// Decode data received on the transport, returns 0 on protocol error
+static int mux_decode( const u8 *p, u32 size )
+{
+  int c;
+  u16 rfs_size;
+  u8 *rfs_ptr;
+  SERVICE_DATA *pservice;
+
+  transport_in_bytes += size;
+  while( size -- )
+  {
+    c = *p ++;
+    if( c == SERMUX_ESCAPE_CHAR )
+    {
+      got_esc = 1;
+      continue;
+    }
+    if( c >= SERMUX_SERVICE_ID_FIRST && c <= SERMUX_SERVICE_ID_LAST )
+    {
+      log_msg( "Changed service_id_in from %d(%X) to %d(%X).\n", service_id_in, service_id_in, c, c );
+      service_id_in = c;
+      if( ( pservice = service_from_id( c ) ) != NULL )
+        pservice->stats.in_frames ++;
+      continue;
+    }
+    if( c == SERMUX_FORCE_SID_CHAR )
+    {
+      if( prev_sent == -1 )
+      {
+        log_err( "Protocol error: got request to resend service ID when the last char sent was not set.\n" );
+        return 0;
+      }
+      log_msg( "Got request to resend service_id_out %d(%X).\n", service_id_out, service_id_out );
+      // Re-transmit the last data AND the service ID
+      transport_send_byte( service_id_out );
+      if( prev_sent & SERMUX_ESC_MASK )
+        transport_send_byte( SERMUX_ESCAPE_CHAR );
+      transport_send_byte( prev_sent & 0xFF );
+      prev_sent = -1;
+      continue;
+    }
+    if( got_esc )
+    {
+      // Got an escape last time, check the char now (with the 5th bit flipped)
+      c ^= SERMUX_ESCAPE_XOR_MASK;
+      if( c != SERMUX_ESCAPE_CHAR && c != SERMUX_FORCE_SID_CHAR && ( c < SERMUX_SERVICE_ID_FIRST || c > SERMUX_SERVICE_ID_LAST ) )
+      {
+         log_err( "Protocol error: invalid escape sequence\n" );
+         return 0;
+      }
+      got_esc = 0;
+    }
+    if( service_id_in == -1 )
+    {
+      transport_send_byte( SERMUX_FORCE_SID_CHAR );
+      log_msg( "Requested resend of service ID for byte %3d ('%c').\n", c, isprint( c ) ? c : ' ' );
+    }
+    else if( service_id_in == rfs_service_id ) // this request is for the RFS server
+    {
+      rfs_mem_read_request_packet( c );
+      if( rfs_mem_has_response() ) // we have a response from the RFS server
+      {
+        rfs_mem_write_response( &rfs_size, &rfs_ptr );
+        mux_encode( rfs_service_id, rfs_ptr, rfs_size );
+        rfs_mem_start_request(); // initialize the RFS server for a new request
+      }
+    }
+    else if( ( pservice = service_from_id( service_id_in ) ) != NULL )
+      service_send_byte( pservice, c );
+    else
+      log_msg( "Dropped byte %3d for unknown service %d(%X).\n", c, service_id_in, service_id_in );
+  }
+  return 1;
 }
 
 // Transport parser
@@ -137,6 +445,132 @@ static int parse_transport( const char* s )
   return 1;
 }
 
+// Service parser: open a serial port ('<port>'), a TCP listener
+// ('tcp:[<host>:]<port>'), a UNIX socket listener ('unix:<path>') or a PTY
+// pair ('pty' or 'pty:<link>')
+static int service_open( SERVICE_DATA *pservice, const char *s )
+{
+  pservice->pname = s;
+  pservice->fd = SER_HANDLER_INVALID;
+  pservice->listen_fd = pservice->pty_slave = -1;
+  if( !strncmp( s, ENDPOINT_TCP_PREFIX, strlen( ENDPOINT_TCP_PREFIX ) ) )
+    pservice->type = SERVICE_TCP;
+  else if( !strncmp( s, ENDPOINT_UNIX_PREFIX, strlen( ENDPOINT_UNIX_PREFIX ) ) )
+    pservice->type = SERVICE_UNIX;
+  else if( !strcmp( s, ENDPOINT_PTY_PREFIX ) || !strncmp( s, ENDPOINT_PTY_PREFIX ":", strlen( ENDPOINT_PTY_PREFIX ":" ) ) )
+    pservice->type = SERVICE_PTY;
+  else
+    pservice->type = SERVICE_SERIAL;
+  switch( pservice->type )
+  {
+    case SERVICE_SERIAL:
+      if( ( pservice->fd = ser_open( s ) ) == SER_HANDLER_INVALID )
+      {
+        log_err( "Unable to open port %s\n", s );
+        return 0;
+      }
+      if( ser_setup( pservice->fd, transport_data->speed, SER_DATABITS_8, SER_PARITY_NONE, SER_STOPBITS_1, SER_FLOW_NONE ) != SER_OK )
+      {
+        log_err( "Unable to setup serial port %s\n", s );
+        return 0;
+      }
+      break;
+
+#ifdef WIN32_BUILD
+    default:
+      log_err( "Service %s: only serial ports are supported on this platform\n", s );
+      return 0;
+#else
+    case SERVICE_TCP:
+      if( ( pservice->listen_fd = endpoint_tcp_listen( s + strlen( ENDPOINT_TCP_PREFIX ) ) ) == -1 )
+        return 0;
+      printf( "Service %s: waiting for clients\n", s );
+      break;
+
+    case SERVICE_UNIX:
+      if( ( pservice->listen_fd = endpoint_unix_listen( s + strlen( ENDPOINT_UNIX_PREFIX ) ) ) == -1 )
+        return 0;
+      printf( "Service %s: waiting for clients\n", s );
+      break;
+
+    case SERVICE_PTY:
+    {
+      char *pname;
+      const char *link = s[ strlen( ENDPOINT_PTY_PREFIX ) ] == ':' ? s + strlen( ENDPOINT_PTY_PREFIX ) + 1 : NULL;
+
+      if( ( pservice->fd = endpoint_pty_open( link, &pservice->pty_slave, &pname ) ) == -1 )
+        return 0;
+      printf( "Service %s: PTY %s\n", s, pname );
+      free( pname );
+      break;
+    }
+#endif
+  }
+  if( ( pservice->outbuf = ( u8* )malloc( MUX_SERVICE_QUEUE_SIZE ) ) == NULL )
+  {
+    log_err( "Not enough memory\n" );
+    return 0;
+  }
+  return 1;
+}
+
+#ifndef WIN32_BUILD
+// Accept a new client on a listening service
+static void service_accept( SERVICE_DATA *pservice )
+{
+  if( ( pservice->fd = endpoint_accept( pservice->listen_fd ) ) != SER_HANDLER_INVALID )
+    log_msg( "Client connected to %s\n", pservice->pname );
+}
+#endif
+
+// ****************************************************************************
+// Statistics
+
+static void mux_report_stats()
+{
+  unsigned i;
+  SERVICE_DATA *pservice;
+
+  printf( "[stats] transport: %lu bytes in, %lu bytes out, queue high-water %u/%u\n",
+          ( unsigned long )transport_in_bytes, ( unsigned long )transport_out_bytes, mux_tx_hw, ( unsigned )MUX_TX_BUF_SIZE );
+  mux_tx_hw = 0;
+  for( i = 0; i < vport_num; i ++ )
+  {
+    pservice = services + i;
+    printf( "[stats] %s%s: in %lu bytes/%lu frames, out %lu bytes/%lu frames, dropped %lu, queue high-water %u/%u\n",
+            pservice->pname, pservice->fd == SER_HANDLER_INVALID ? " (idle)" : "",
+            ( unsigned long )pservice->stats.in_bytes, ( unsigned long )pservice->stats.in_frames,
+            ( unsigned long )pservice->stats.out_bytes, ( unsigned long )pservice->stats.out_frames,
+            ( unsigned long )pservice->stats.dropped, pservice->stats.queue_hw, ( unsigned )MUX_SERVICE_QUEUE_SIZE );
+    pservice->stats.queue_hw = pservice->outlen;
+  }
+}
+
+// Report the statistics if the reporting interval elapsed
+static void mux_check_stats()
+{
+  time_t now;
+
+  if( stats_interval > 0 && ( now = time( NULL ) ) >= stats_next )
+  {
+    mux_report_stats();
+    stats_next = now + stats_interval;
+  }
+}
+
+#ifndef WIN32_BUILD
+// Poll timeout (in ms) needed to report the statistics on time
+static int mux_stats_timeout()
+{
+  time_t now;
+
+  if( stats_interval <= 0 )
+    return -1;
+  now = time( NULL );
+  return stats_next > now ? ( int )( stats_next - now ) * 1000 : 0;
+}
+#endif
+
 // ****************************************************************************
 // Program entry point
 
@@ -154,25 +588,32 @@ int main( int argc, char **argv )
 {
   unsigned i;
   SERVICE_DATA *tservice;
-  int c, prev_sent = -1;
-  int temp;
-  int got_esc = 0;
   char* rfs_dir_name;
   ser_handler *phandlers;
-  int selidx;
-  u16 rfs_size = 0;
-  u8 *rfs_ptr;
+  static u8 rxbuf[ MUX_BLOCK_SIZE ];
+#ifdef WIN32_BUILD
+  int c, selidx;
+#else
+  struct pollfd *pfds;
+  int res, held, timeout;
+  time_t now;
+#endif
 
   // Interpret arguments
   setvbuf( stdout, NULL, _IONBF, 0 );  
   if( argc < MIN_ARGC_COUNT )
   {
-    log_err( "Usage: %s <mode> <transport> <vcom1> [<vcom2>] ... [<vcomn>] [-v]\n", argv[ 0 ] );
+    log_err( "Usage: %s <mode> <transport> <vcom1> [<vcom2>] ... [<vcomn>] [-s<seconds>] [-v]\n", argv[ 0 ] );
     log_err( "  mode: \n" );
     log_err( "    'mux':                 serial multiplexer mode\n" );
     log_err( "    'rfsmux:<directory>':  combined RFS and multiplexer mode.\n" );
     log_err( "  transport: '<port>,<baud>,<flow>' ('flow' specifies the flow control type and can be 'none' or 'rtscts').\n" );
-    log_err( "  vcom1, ..., vcomn: multiplexer serial ports.\n" );
+    log_err( "  vcom1, ..., vcomn: multiplexer services, each one can be:\n" );
+    log_err( "    '<port>':                a serial port\n" );
+    log_err( "    'tcp:[<host>:]<port>':   a TCP listener (host defaults to %s)\n", ENDPOINT_TCP_DEFAULT_HOST );
+    log_err( "    'unix:<path>':           a UNIX socket listener\n" );
+    log_err( "    'pty[:<link>]':          a PTY pair (optionally linked to <link>)\n" );
+    log_err( "  Use '-s<seconds>' to report statistics periodically.\n" );
     log_err( "  Use '-v' for verbose output.\n" );
     return 1;
   }
@@ -193,19 +634,31 @@ int main( int argc, char **argv )
     return 1;
   } 
   
-  // Check verbose
-  i = argc - 1;
-  if( !strcasecmp( argv[ i ], "-v" ) )
+  // Check options
+  log_init( LOG_NONE );
+  for( i = argc - 1; i >= FIRST_SERVICE_IDX && argv[ i ][ 0 ] == '-'; i -- )
   {
-    i --;
-    log_init( LOG_ALL );
-    verbose_mode = 1;
+    if( !strcasecmp( argv[ i ], "-v" ) )
+    {
+      log_init( LOG_ALL );
+      verbose_mode = 1;
+    }
+    else if( argv[ i ][ 1 ] == 's' && secure_atoi( argv[ i ] + 2, &stats_interval ) && stats_interval > 0 )
+      stats_next = time( NULL ) + stats_interval;
+    else
+    {
+      log_err( "Invalid option %s\n", argv[ i ] );
+      return 1;
+    }
   }
-  else
-    log_init( LOG_NONE );
   
   // Get number of virtual UARTs     
-  if( ( vport_num = i - FIRST_SERVICE_IDX + 1 ) > SERMUX_SERVICE_MAX )
+  if( ( vport_num = i - FIRST_SERVICE_IDX + 1 ) == 0 )
+  {
+    log_err( "No services specified\n" );
+    return 1;
+  }
+  if( vport_num > SERMUX_SERVICE_MAX )
   {
     log_err( "Too many service ports, maximum is %d\n", SERMUX_SERVICE_MAX );
     return 1;
@@ -231,20 +684,15 @@ int main( int argc, char **argv )
   phandlers[ HND_TRANSPORT_OFFSET ] = transport_hnd;
 
   memset( services, 0, sizeof( SERVICE_DATA ) * vport_num );
+#ifndef WIN32_BUILD
+  // Clients of socket services can go away at any time
+  signal( SIGPIPE, SIG_IGN );
+#endif
   for( i = 0; i < vport_num; i ++ ) 
   {
     tservice = services + i;
-    if( ( tservice->fd = ser_open( argv[ i + FIRST_SERVICE_IDX ] ) ) == SER_HANDLER_INVALID )
-    {
-      log_err( "Unable to open port %s\n", argv[ i + FIRST_SERVICE_IDX ] );
-      return 1;
-    }
-    if( ser_setup( tservice->fd, transport_data->speed, SER_DATABITS_8, SER_PARITY_NONE, SER_STOPBITS_1, SER_FLOW_NONE ) != SER_OK )
-    {
-      log_err( "Unable to setup serial port %s\n", argv[ i + FIRST_SERVICE_IDX ] );
+    if( service_open( tservice, argv[ i + FIRST_SERVICE_IDX ] ) == 0 )
       return 1;
-    }
-    tservice->pname = argv[ i + FIRST_SERVICE_IDX ];
     phandlers[ i + HND_FIRST_VOFFSET ] = tservice->fd;
   }
   
@@ -260,117 +708,106 @@ int main( int argc, char **argv )
 
   log_msg( "Starting service multiplexer on %u port(s)\n", vport_num );
   
-  // Main service thread
+#ifdef WIN32_BUILD
+  // Main service thread (one byte at a time)
   while( 1 )
   {
-    if( rfs_size > 0 ) // Response packet from RFS
+    if( ( c = ser_select_byte( phandlers, vport_num + 1, SER_INF_TIMEOUT ) ) == -1 )
     {
-      c = *rfs_ptr ++;
-      rfs_size --;
-      selidx = RFS_PSEUDO_SELIDX;
+      log_err( "Error on select, aborting program\n" );
+      return 1;
     }
-    else
+    selidx = c >> 8;
+    rxbuf[ 0 ] = c & 0xFF;
+    if( selidx == HND_TRANSPORT_OFFSET ) // Got byte on transport interface
     {
-      if( ( c = ser_select_byte( phandlers, vport_num + 1, SER_INF_TIMEOUT ) ) == -1 )
-      {
-        log_err( "Error on select, aborting program\n" );
+      if( mux_decode( rxbuf, 1 ) == 0 )
         return 1;
-      }
-      selidx = c >> 8;
-      c = c & 0xFF;
+      services_flush();
     }
-    //log_msg( "Got byte %d from idx %d\n", c, selidx );
-    if( selidx == HND_TRANSPORT_OFFSET ) // Got byte on transport interface
+    else
+      mux_encode( SERMUX_SERVICE_ID_FIRST + selidx - HND_FIRST_VOFFSET + service_offset, rxbuf, 1 );
+    transport_flush();
+    mux_check_stats();
+  }
+#else
+  // Main service thread
+  // Every handle that has data gets one block read per iteration, so a busy
+  // service can't starve the others. The poll set is rebuilt every time since
+  // clients connect and disconnect and output queues fill and drain. The
+  // transport is left out while a service can't take another block.
+  if( ( pfds = ( struct pollfd* )malloc( sizeof( struct pollfd ) * ( 2 * vport_num + 1 ) ) ) == NULL )
+  {
+    log_err( "Not enough memory\n" );
+    return 1;
+  }
+  pfds[ HND_TRANSPORT_OFFSET ].events = POLLIN;
+  while( 1 )
+  {
+    held = 0;
+    now = time( NULL );
+    for( i = 0; i < vport_num; i ++ )
     {
-      // Interpret byte
-      if( c != SERMUX_ESCAPE_CHAR )
+      tservice = services + i;
+      if( service_is_full( tservice ) )
       {
-        if( c >= SERMUX_SERVICE_ID_FIRST && c <= SERMUX_SERVICE_ID_LAST )
-        {
-          log_msg( "Changed service_id_in from %d(%X) to %d(%X).\n", service_id_in, service_id_in, c, c );
-          service_id_in = c;
-        } 
-        else if( c == SERMUX_FORCE_SID_CHAR )
-        {
-          if( prev_sent == -1 )
-          {
-            log_err( "Protocol error: got request to resend service ID when the last char sent was not set.\n" );
-            return 1;
-          }
-          log_msg( "Got request to resend service_id_out %d(%X).\n", service_id_out, service_id_out );
-          // Re-transmit the last data AND the service ID
-          transport_send_byte( service_id_out );
-          if( prev_sent & SERMUX_ESC_MASK )
-            transport_send_byte( SERMUX_ESCAPE_CHAR );
-          transport_send_byte( prev_sent & 0xFF );
-          prev_sent = -1;
-        }          
-        else
+        if( tservice->stalled == 0 )
+          tservice->stalled = now;
+        else if( now - tservice->stalled >= MUX_SERVICE_STALL_S )
         {
-          if( got_esc )
-          {
-            // Got an escape last time, check the char now (with the 5th bit flipped)
-            c ^= SERMUX_ESCAPE_XOR_MASK;
-            if( c != SERMUX_ESCAPE_CHAR && c != SERMUX_FORCE_SID_CHAR && ( c < SERMUX_SERVICE_ID_FIRST || c > SERMUX_SERVICE_ID_LAST ) )
-            {
-               log_err( "Protocol error: invalid escape sequence\n" );
-               return 1;
-            }
-            got_esc = 0;
-          }  
-          if( service_id_in == -1 )
-          {
-            transport_send_byte( SERMUX_FORCE_SID_CHAR );
-            log_msg( "Requested resend of service ID for byte %3d ('%c').\n", c, isprint( c ) ? c : ' ' );
-          }
-          else
-          {
-            if( service_id_in == rfs_service_id ) // this request is for the RFS server
-            {
-              rfs_mem_read_request_packet( c );
-              if( rfs_mem_has_response() ) // we have a response from the RFS server
-              {
-                rfs_mem_write_response( &rfs_size, &rfs_ptr );                  
-                rfs_mem_start_request(); // initialize the RFS server for a new request  
-              }
-            }
-            else
-            {
-              //log_msg( "Sending byte %d to %s\n", c, services[ service_id_in - SERMUX_SERVICE_ID_FIRST - service_offset ].pname );
-              ser_write_byte( services[ service_id_in - SERMUX_SERVICE_ID_FIRST - service_offset ].fd, c );
-            }
-          }
+          log_err( "%s takes no data, disconnecting it\n", tservice->pname );
+          service_disconnect( tservice );
         }
+        held |= service_is_full( tservice );
       }
-      else
-        got_esc = 1;                          
+      pfds[ PFD_DATA( i ) ].fd = tservice->fd;
+      pfds[ PFD_DATA( i ) ].events = POLLIN | ( tservice->outlen > 0 ? POLLOUT : 0 );
+      pfds[ PFD_LISTEN( i ) ].fd = tservice->fd == SER_HANDLER_INVALID ? tservice->listen_fd : -1;
+      pfds[ PFD_LISTEN( i ) ].events = POLLIN;
     }
-    else
+    pfds[ HND_TRANSPORT_OFFSET ].fd = held ? -1 : transport_hnd;
+    timeout = mux_stats_timeout();
+    if( held && ( timeout == -1 || timeout > 1000 ) )
+      timeout = 1000;
+    if( poll( pfds, 2 * vport_num + 1, timeout ) == -1 )
+    {
+      if( errno == EINTR )
+        continue;
+      log_err( "Error on poll, aborting program\n" );
+      return 1;
+    }
+    if( pfds[ HND_TRANSPORT_OFFSET ].revents )
     {
-      // No byte to read, there must be something to send
-      if( selidx == RFS_PSEUDO_SELIDX )
-        temp = SERMUX_SERVICE_ID_FIRST;
-      else        
-        temp = SERMUX_SERVICE_ID_FIRST + selidx - HND_FIRST_VOFFSET + service_offset;
-      prev_sent = c;
-      // Send the service ID first if needed
-      if( temp != service_id_out )
+      if( ( res = read( transport_hnd, rxbuf, MUX_BLOCK_SIZE ) ) > 0 )
       {
-        log_msg( "Changed service_id_out from %d(%X) to %d(%X).\n", service_id_out, service_id_out, temp, temp );
-        transport_send_byte( temp );
+        if( mux_decode( rxbuf, res ) == 0 )
+          return 1;
+        services_flush();
       }
-      // Then send the actual data byte, escaping it if needed
-      if( c == SERMUX_ESCAPE_CHAR || c == SERMUX_FORCE_SID_CHAR || ( c >= SERMUX_SERVICE_ID_FIRST && c <= SERMUX_SERVICE_ID_LAST ) )
+      else if( res == 0 || ( errno != EAGAIN && errno != EINTR ) )
       {
-        transport_send_byte( SERMUX_ESCAPE_CHAR );
-        transport_send_byte( ( u8 )c ^ SERMUX_ESCAPE_XOR_MASK );
-        prev_sent = SERMUX_ESC_MASK | ( ( u8 )c ^ SERMUX_ESCAPE_XOR_MASK );
+        log_err( "Error reading from transport, aborting program\n" );
+        return 1;
       }
-      else
-        transport_send_byte( c );
-      service_id_out = temp;
     }
+    for( i = 0; i < vport_num; i ++ )
+    {
+      tservice = services + i;
+      if( pfds[ PFD_LISTEN( i ) ].revents )
+        service_accept( tservice );
+      if( pfds[ PFD_DATA( i ) ].revents & POLLOUT )
+        service_flush( tservice );
+      if( ( pfds[ PFD_DATA( i ) ].revents & ~POLLOUT ) == 0 || tservice->fd != pfds[ PFD_DATA( i ) ].fd )
+        continue;
+      if( ( res = read( tservice->fd, rxbuf, MUX_BLOCK_SIZE ) ) > 0 )
+        mux_encode( SERMUX_SERVICE_ID_FIRST + i + service_offset, rxbuf, res );
+      else if( res == 0 || ( errno != EAGAIN && errno != EINTR ) )
+        service_disconnect( tservice );
+    }
+    transport_flush();
+    mux_check_stats();
   }
+#endif
 
   return 0;
 }
@@ -26,6 +26,12 @@ if utils.is_windows() then
   socklib = 'ws2_32'
 else
   flist = mainname .. " server.c os_io_posix.c log.c net_posix.c serial_posix.c deskutils.c rfs_transports.c"
+  if sim == 0 then
+    -- Event driven multi client mode
+    flist = flist .. " rfs_multi.c"
+    cdefs = cdefs .. " ELUARPC_THREADS"
+    socklib = 'pthread'
+  end
 end
 
 local output = sim == 0 and 'rfs_server' or 'rfs_sim_server'
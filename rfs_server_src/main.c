@@ -16,10 +16,19 @@
 #include "rfs.h"
 #include "deskutils.h"
 #include "rfs_transports.h"
+#ifndef WIN32_BUILD
+#include "rfs_multi.h"
+#endif
 
 #ifdef RFS_STANDALONE_MODE
 int main( int argc, const char **argv )
 {  
+#ifndef WIN32_BUILD
+  // Event driven server for many clients
+  if( argc >= 3 && strstr( argv[ 1 ], RFS_MULTI_PREFIX ) == argv[ 1 ] )
+    return rfs_multi_main( argc, argv );
+#endif
+
   // Initialize data
   if( rfs_init( argc, argv ) != 0 )
     return 1;
@@ -119,7 +119,7 @@ u32 os_opendir( const char* name )
 void os_readdir( u32 d, const char **pname )
 {
   struct dirent *ent;
-  static char realname[ RFS_MAX_FNAME_SIZE + 1 ]; 
+  static __thread char realname[ RFS_MAX_FNAME_SIZE + 1 ]; 
 
   while( 1 )
   {
@@ -144,3 +144,28 @@ int os_closedir( u32 d )
   return closedir( ( DIR* )d );
 }
 
+int os_stat( const char *name, u32 *psize, u32 *pmtime, int *pisdir )
+{
+  struct stat res;
+
+  if( stat( name, &res ) == -1 )
+    return -1;
+  *psize = ( u32 )res.st_size;
+  *pmtime = ( u32 )res.st_mtime;
+  *pisdir = S_ISDIR( res.st_mode );
+  return 0;
+}
+
+// Like os_readdir, but also returns the size and modification time
+void os_readdir_stat( u32 d, const char **pname, u32 *psize, u32 *pmtime )
+{
+  struct stat res;
+
+  os_readdir( d, pname );
+  *psize = *pmtime = 0;
+  if( *pname && fstatat( dirfd( ( DIR* )d ), *pname, &res, 0 ) == 0 )
+  {
+    *psize = ( u32 )res.st_size;
+    *pmtime = ( u32 )res.st_mtime;
+  }
+}
@@ -153,3 +153,48 @@ int os_closedir( u32 d )
 {
   return FindClose( win32_dir_hnd ) == 0 ? -1 : 0;
 }
+
+int os_stat( const char *name, u32 *psize, u32 *pmtime, int *pisdir )
+{
+  struct _stat res;
+
+  if( _stat( name, &res ) == -1 )
+    return -1;
+  *psize = ( u32 )res.st_size;
+  *pmtime = ( u32 )res.st_mtime;
+  *pisdir = ( res.st_mode & _S_IFDIR ) != 0;
+  return 0;
+}
+
+// Like os_readdir, but also returns the size and modification time
+void os_readdir_stat( u32 d, const char **pname, u32 *psize, u32 *pmtime )
+{
+  static char realname[ RFS_MAX_FNAME_SIZE + 1 ]; 
+  ULARGE_INTEGER t;
+
+  *pname = NULL;
+  *psize = *pmtime = 0;
+  if( found_last_file )
+    return;  
+  while( 1 )
+  {
+    if( ( win32_dir_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) == 0 )
+    {
+      realname[ 0 ] = realname[ RFS_MAX_FNAME_SIZE ] = '\0';    
+      if( win32_dir_data.cFileName[ 0 ] )
+        strncpy( realname, win32_dir_data.cFileName, RFS_MAX_FNAME_SIZE );
+      else
+        strncpy( realname, win32_dir_data.cAlternateFileName, RFS_MAX_FNAME_SIZE );
+      *pname = realname;
+      *psize = win32_dir_data.nFileSizeLow;
+      // FILETIME counts 100ns intervals from 1601, convert to a UNIX time
+      t.LowPart = win32_dir_data.ftLastWriteTime.dwLowDateTime;
+      t.HighPart = win32_dir_data.ftLastWriteTime.dwHighDateTime;
+      *pmtime = ( u32 )( t.QuadPart / 10000000ULL - 11644473600ULL );
+    }    
+    if( FindNextFile( win32_dir_hnd, &win32_dir_data ) == 0 )
+      found_last_file = 1;  
+    if( *pname || found_last_file )
+      break;
+  }
+}
@@ -0,0 +1,533 @@
+// Event driven RFS server for multiple clients (Linux, epoll)
+// A single process serves any number of UDP peers and serial ports. Every
+// client gets its own sandboxed SERVER_CLIENT (base directory and descriptor
+// tables). Complete requests are executed by a pool of worker threads, so a
+// slow disk operation doesn't stall the other clients. The requests of a
+// client run one at a time and in arrival order (pipelined requests rely on
+// this) and clients with pending work are served round robin.
+
+#include "net.h"
+#include "remotefs.h"
+#include "eluarpc.h"
+#include "rfs_serial.h"
+#include "server.h"
+#include "type.h"
+#include "log.h"
+#include "os_io.h"
+#include "deskutils.h"
+#include "rfs_transports.h"
+#include "rfs_multi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+
+// ****************************************************************************
+// Local definitions and variables
+
+#define MULTI_MAX_ENDPOINTS   32
+#define MULTI_MAX_CLIENTS     128
+#define MULTI_QUEUE_LEN       SERVER_MAX_WINDOW
+#define MULTI_DEF_THREADS     4
+#define MULTI_MAX_THREADS     32
+#define MULTI_IDLE_TIMEOUT    600
+#define MULTI_TICK_MS         1000
+#define MULTI_BUF_SIZE        ( MAX_PACKET_SIZE + ELUARPC_WRITE_REQUEST_EXTRA )
+
+enum
+{
+  MULTI_EP_UDP,
+  MULTI_EP_SER
+};
+
+typedef struct
+{
+  int type;
+  int fd;
+  char *basedir;
+  char *name;
+} MULTI_ENDPOINT;
+
+typedef struct
+{
+  int used;
+  MULTI_ENDPOINT *pep;
+  struct sockaddr_in addr;              // peer address (UDP only)
+  SERVER_CLIENT srv;
+  u8 rxbuf[ MULTI_BUF_SIZE ];           // request being received
+  u32 rxlen, rxsize;
+  u8 *queue[ MULTI_QUEUE_LEN ];         // requests waiting for a worker
+  unsigned qhead, qcount;
+  int busy;                             // a worker runs one of its requests
+  int ready;                            // queued in multi_ready
+  time_t last_seen;
+} MULTI_CLIENT;
+
+static MULTI_ENDPOINT multi_endpoints[ MULTI_MAX_ENDPOINTS ];
+static unsigned multi_num_endpoints;
+static MULTI_CLIENT multi_clients[ MULTI_MAX_CLIENTS ];
+static unsigned multi_num_threads = MULTI_DEF_THREADS;
+
+// Clients with pending requests, served in FIFO order
+static MULTI_CLIENT *multi_ready[ MULTI_MAX_CLIENTS ];
+static unsigned multi_ready_head, multi_ready_count;
+static pthread_mutex_t multi_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t multi_cond = PTHREAD_COND_INITIALIZER;
+
+// ****************************************************************************
+// Client management (multi_lock must be held)
+
+static void multi_make_ready( MULTI_CLIENT *pc )
+{
+  if( pc->busy || pc->ready || pc->qcount == 0 )
+    return;
+  multi_ready[ ( multi_ready_head + multi_ready_count ) % MULTI_MAX_CLIENTS ] = pc;
+  multi_ready_count ++;
+  pc->ready = 1;
+  pthread_cond_signal( &multi_cond );
+}
+
+static MULTI_CLIENT* multi_new_client( MULTI_ENDPOINT *pep, const struct sockaddr_in *paddr )
+{
+  unsigned i;
+  MULTI_CLIENT *pc;
+
+  for( i = 0; i < MULTI_MAX_CLIENTS; i ++ )
+    if( !multi_clients[ i ].used )
+      break;
+  if( i == MULTI_MAX_CLIENTS )
+    return NULL;
+  pc = multi_clients + i;
+  memset( pc, 0, sizeof( MULTI_CLIENT ) );
+  pc->used = 1;
+  pc->pep = pep;
+  if( paddr )
+    pc->addr = *paddr;
+  pc->last_seen = time( NULL );
+  server_client_init( &pc->srv, pep->basedir, 1 );
+  return pc;
+}
+
+static MULTI_CLIENT* multi_find_udp_client( MULTI_ENDPOINT *pep, const struct sockaddr_in *paddr )
+{
+  unsigned i;
+  MULTI_CLIENT *pc;
+
+  for( i = 0; i < MULTI_MAX_CLIENTS; i ++ )
+  {
+    pc = multi_clients + i;
+    if( pc->used && pc->pep == pep && pc->addr.sin_port == paddr->sin_port && pc->addr.sin_addr.s_addr == paddr->sin_addr.s_addr )
+      return pc;
+  }
+  if( ( pc = multi_new_client( pep, paddr ) ) != NULL )
+    log_msg( "multi: new client %s:%u on %s\n", inet_ntoa( paddr->sin_addr ), ( unsigned )ntohs( paddr->sin_port ), pep->name );
+  return pc;
+}
+
+// Drop UDP peers that have been silent for too long, closing their files
+static void multi_expire_clients()
+{
+  unsigned i;
+  MULTI_CLIENT *pc;
+  time_t now = time( NULL );
+
+  for( i = 0; i < MULTI_MAX_CLIENTS; i ++ )
+  {
+    pc = multi_clients + i;
+    if( pc->used && pc->pep->type == MULTI_EP_UDP && !pc->busy && pc->qcount == 0 && now - pc->last_seen > MULTI_IDLE_TIMEOUT )
+    {
+      log_msg( "multi: dropping idle client %s:%u\n", inet_ntoa( pc->addr.sin_addr ), ( unsigned )ntohs( pc->addr.sin_port ) );
+      server_client_cleanup( &pc->srv );
+      pc->used = 0;
+    }
+  }
+}
+
+// ****************************************************************************
+// Request assembly (event loop thread)
+
+// Add received data to the client's current packet, queueing every request
+// that becomes complete. A bad header drops the rest of the data, which is
+// how the serial transport resynchronizes too.
+static void multi_feed( MULTI_CLIENT *pc, const u8 *data, u32 len )
+{
+  u16 pktsize;
+  u32 need, chunk;
+  u8 *preq;
+
+  pc->last_seen = time( NULL );
+  while( len )
+  {
+    need = pc->rxlen < ELUARPC_START_OFFSET ? ELUARPC_START_OFFSET : pc->rxsize;
+    chunk = need - pc->rxlen > len ? len : need - pc->rxlen;
+    memcpy( pc->rxbuf + pc->rxlen, data, chunk );
+    pc->rxlen += chunk;
+    data += chunk;
+    len -= chunk;
+    if( pc->rxlen == ELUARPC_START_OFFSET )
+    {
+      if( eluarpc_get_packet_size( pc->rxbuf, &pktsize ) == ELUARPC_ERR || pktsize <= ELUARPC_START_OFFSET || pktsize > MULTI_BUF_SIZE )
+      {
+        log_msg( "multi: invalid packet header from %s\n", pc->pep->name );
+        pc->rxlen = 0;
+        return;
+      }
+      pc->rxsize = pktsize;
+    }
+    else if( pc->rxlen == need )
+    {
+      pc->rxlen = 0;
+      // Requests are executed in place, so leave room for the response
+      if( ( preq = ( u8* )malloc( MULTI_BUF_SIZE ) ) == NULL )
+        continue;
+      memcpy( preq, pc->rxbuf, need );
+      pthread_mutex_lock( &multi_lock );
+      if( pc->qcount == MULTI_QUEUE_LEN )
+      {
+        log_msg( "multi: request queue full for client on %s\n", pc->pep->name );
+        free( preq );
+      }
+      else
+      {
+        pc->queue[ ( pc->qhead + pc->qcount ) % MULTI_QUEUE_LEN ] = preq;
+        pc->qcount ++;
+        multi_make_ready( pc );
+      }
+      pthread_mutex_unlock( &multi_lock );
+    }
+  }
+}
+
+static void multi_read_endpoint( MULTI_ENDPOINT *pep )
+{
+  static u8 data[ MULTI_BUF_SIZE ];
+  struct sockaddr_in from;
+  socklen_t fromlen;
+  ssize_t res;
+  MULTI_CLIENT *pc;
+  unsigned i;
+
+  while( 1 )
+  {
+    if( pep->type == MULTI_EP_UDP )
+    {
+      fromlen = sizeof( from );
+      if( ( res = recvfrom( pep->fd, data, sizeof( data ), MSG_DONTWAIT, ( struct sockaddr* )&from, &fromlen ) ) <= 0 )
+        break;
+      pthread_mutex_lock( &multi_lock );
+      pc = multi_find_udp_client( pep, &from );
+      pthread_mutex_unlock( &multi_lock );
+      if( pc == NULL )
+      {
+        log_msg( "multi: too many clients, ignoring %s\n", inet_ntoa( from.sin_addr ) );
+        continue;
+      }
+    }
+    else
+    {
+      if( ( res = read( pep->fd, data, sizeof( data ) ) ) <= 0 )
+        break;
+      for( i = 0, pc = NULL; i < MULTI_MAX_CLIENTS; i ++ )
+        if( multi_clients[ i ].used && multi_clients[ i ].pep == pep )
+          pc = multi_clients + i;
+      if( pc == NULL )
+        break;
+    }
+    multi_feed( pc, data, ( u32 )res );
+  }
+}
+
+// ****************************************************************************
+// Worker threads
+
+static void multi_send_response( MULTI_CLIENT *pc, const u8 *p )
+{
+  u16 len;
+  ssize_t res;
+  struct pollfd pfd;
+
+  if( eluarpc_get_packet_size( p, &len ) == ELUARPC_ERR )
+    return;
+  if( pc->pep->type == MULTI_EP_UDP )
+  {
+    sendto( pc->pep->fd, p, len, 0, ( struct sockaddr* )&pc->addr, sizeof( pc->addr ) );
+    return;
+  }
+  // Serial ports are non-blocking, so wait for room when needed
+  while( len )
+  {
+    if( ( res = write( pc->pep->fd, p, len ) ) > 0 )
+    {
+      p += res;
+      len -= ( u16 )res;
+    }
+    else if( res == -1 && errno != EAGAIN && errno != EINTR )
+      break;
+    else
+    {
+      pfd.fd = pc->pep->fd;
+      pfd.events = POLLOUT;
+      poll( &pfd, 1, MULTI_TICK_MS );
+    }
+  }
+}
+
+static void* multi_worker( void *arg )
+{
+  MULTI_CLIENT *pc;
+  u8 *preq;
+
+  ( void )arg;
+  while( 1 )
+  {
+    pthread_mutex_lock( &multi_lock );
+    while( multi_ready_count == 0 )
+      pthread_cond_wait( &multi_cond, &multi_lock );
+    pc = multi_ready[ multi_ready_head ];
+    multi_ready_head = ( multi_ready_head + 1 ) % MULTI_MAX_CLIENTS;
+    multi_ready_count --;
+    pc->ready = 0;
+    pc->busy = 1;
+    preq = pc->queue[ pc->qhead ];
+    pthread_mutex_unlock( &multi_lock );
+
+    if( server_execute_client_request( &pc->srv, preq ) == SERVER_OK )
+      multi_send_response( pc, preq );
+    else
+      log_msg( "multi: invalid request from client on %s\n", pc->pep->name );
+    free( preq );
+
+    // Back to the end of the line if it has more work
+    pthread_mutex_lock( &multi_lock );
+    pc->qhead = ( pc->qhead + 1 ) % MULTI_QUEUE_LEN;
+    pc->qcount --;
+    pc->busy = 0;
+    multi_make_ready( pc );
+    pthread_mutex_unlock( &multi_lock );
+  }
+  return NULL;
+}
+
+// ****************************************************************************
+// Endpoint setup
+
+static int multi_add_udp( const char *spec )
+{
+  long port;
+  int fd;
+  struct sockaddr_in server;
+  MULTI_ENDPOINT *pep = multi_endpoints + multi_num_endpoints;
+
+  if( secure_atoi( spec, &port ) == 0 )
+  {
+    log_err( "Invalid port number %s\n", spec );
+    return 0;
+  }
+  if( ( fd = socket( AF_INET, SOCK_DGRAM, 0 ) ) == -1 )
+  {
+    log_err( "Unable to create socket\n" );
+    return 0;
+  }
+  memset( &server, 0, sizeof( server ) );
+  server.sin_family = AF_INET;
+  server.sin_addr.s_addr = htonl( INADDR_ANY );
+  server.sin_port = htons( ( u16 )port );
+  if( bind( fd, ( struct sockaddr* )&server, sizeof( server ) ) == -1 )
+  {
+    log_err( "Unable to bind socket on port %ld\n", port );
+    close( fd );
+    return 0;
+  }
+  fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+  pep->type = MULTI_EP_UDP;
+  pep->fd = fd;
+  return 1;
+}
+
+static int multi_add_serial( const char *spec )
+{
+  const char *c, *c2;
+  char *portname, *tempb;
+  long speed;
+  int flow;
+  ser_handler ser;
+  MULTI_ENDPOINT *pep = multi_endpoints + multi_num_endpoints;
+
+  if( ( c = strchr( spec, ',' ) ) == NULL || ( c2 = strchr( c + 1, ',' ) ) == NULL )
+  {
+    log_err( "Invalid serial transport syntax\n" );
+    return 0;
+  }
+  tempb = l_strndup( c + 1, c2 - c - 1 );
+  flow = secure_atoi( tempb, &speed );
+  free( tempb );
+  if( flow == 0 )
+  {
+    log_err( "Invalid port speed\n" );
+    return 0;
+  }
+  if( !strcmp( c2 + 1, "none" ) )
+    flow = SER_FLOW_NONE;
+  else if( !strcmp( c2 + 1, "rtscts" ) )
+    flow = SER_FLOW_RTSCTS;
+  else
+  {
+    log_err( "Invalid flow control type.\n" );
+    return 0;
+  }
+  portname = l_strndup( spec, c - spec );
+  ser = ser_open( portname );
+  if( ser == SER_HANDLER_INVALID || ser_setup( ser, ( u32 )speed, SER_DATABITS_8, SER_PARITY_NONE, SER_STOPBITS_1, flow ) != SER_OK )
+  {
+    log_err( "Unable to initialize serial port %s\n", portname );
+    free( portname );
+    return 0;
+  }
+  free( portname );
+  pep->type = MULTI_EP_SER;
+  pep->fd = ( int )ser;
+  return 1;
+}
+
+// Parse one endpoint: 'udp:<port>' or 'ser:<name>,<speed>,<flow>', with an
+// optional '@<dirname>' suffix that overrides the shared directory
+static int multi_add_endpoint( const char *spec, const char *defdir )
+{
+  char *s, *dir;
+  const char *basedir = defdir;
+  int res = 0;
+
+  if( multi_num_endpoints == MULTI_MAX_ENDPOINTS )
+  {
+    log_err( "Too many endpoints\n" );
+    return 0;
+  }
+  s = strdup( spec );
+  if( ( dir = strchr( s, '@' ) ) != NULL )
+  {
+    *dir ++ = '\0';
+    basedir = dir;
+  }
+  if( !os_isdir( basedir ) )
+    log_err( "Invalid directory %s\n", basedir );
+  else if( strstr( s, "udp:" ) == s )
+    res = multi_add_udp( s + strlen( "udp:" ) );
+  else if( strstr( s, "ser:" ) == s )
+    res = multi_add_serial( s + strlen( "ser:" ) );
+  else
+    log_err( "Error: unsupported transport %s\n", s );
+  if( res )
+  {
+    multi_endpoints[ multi_num_endpoints ].basedir = strdup( basedir );
+    multi_endpoints[ multi_num_endpoints ].name = strdup( s );
+    // A serial port is a single client for the whole session
+    if( multi_endpoints[ multi_num_endpoints ].type == MULTI_EP_SER )
+      multi_new_client( multi_endpoints + multi_num_endpoints, NULL );
+    log_msg( "multi: serving %s from %s\n", s, basedir );
+    multi_num_endpoints ++;
+  }
+  free( s );
+  return res;
+}
+
+static int multi_parse_spec( const char *spec, const char *defdir )
+{
+  char *s = strdup( spec ), *item, *next;
+  long tempi;
+  int res = 1;
+
+  for( item = s; item && res; item = next )
+  {
+    if( ( next = strchr( item, ';' ) ) != NULL )
+      *next ++ = '\0';
+    if( *item == '\0' )
+      continue;
+    if( strstr( item, "threads=" ) == item )
+    {
+      if( secure_atoi( item + strlen( "threads=" ), &tempi ) == 0 || tempi < 1 || tempi > MULTI_MAX_THREADS )
+      {
+        log_err( "Invalid number of threads\n" );
+        res = 0;
+      }
+      else
+        multi_num_threads = ( unsigned )tempi;
+    }
+    else
+      res = multi_add_endpoint( item, defdir );
+  }
+  free( s );
+  return res && multi_num_endpoints > 0;
+}
+
+// ****************************************************************************
+// Entry point
+
+#define TRANSPORT_ARG_IDX     1
+#define DIRNAME_ARG_IDX       2
+#define VERBOSE_ARG_IDX       3
+#define VERBOSE_ARGC_COUNT    4
+#define MULTI_MAX_EVENTS      16
+
+int rfs_multi_main( int argc, const char **argv )
+{
+  int epfd, n, i;
+  unsigned u;
+  pthread_t tid;
+  struct epoll_event ev, events[ MULTI_MAX_EVENTS ];
+  time_t last_expire = time( NULL );
+
+  setvbuf( stdout, NULL, _IONBF, 0 );
+  if( ( argc >= VERBOSE_ARGC_COUNT ) && !strcmp( argv[ VERBOSE_ARG_IDX ], "-v" ) )
+    log_init( LOG_ALL );
+  else
+    log_init( LOG_NONE );
+  if( multi_parse_spec( argv[ TRANSPORT_ARG_IDX ] + strlen( RFS_MULTI_PREFIX ), argv[ DIRNAME_ARG_IDX ] ) == 0 )
+    return 1;
+  if( ( epfd = epoll_create1( 0 ) ) == -1 )
+  {
+    log_err( "Unable to create epoll instance\n" );
+    return 1;
+  }
+  for( u = 0; u < multi_num_endpoints; u ++ )
+  {
+    ev.events = EPOLLIN;
+    ev.data.ptr = multi_endpoints + u;
+    if( epoll_ctl( epfd, EPOLL_CTL_ADD, multi_endpoints[ u ].fd, &ev ) == -1 )
+    {
+      log_err( "Unable to watch %s\n", multi_endpoints[ u ].name );
+      return 1;
+    }
+  }
+  for( u = 0; u < multi_num_threads; u ++ )
+    if( pthread_create( &tid, NULL, multi_worker, NULL ) != 0 )
+    {
+      log_err( "Unable to start worker thread\n" );
+      return 1;
+    }
+  log_msg( "multi: %u endpoint(s), %u worker thread(s)\n", multi_num_endpoints, multi_num_threads );
+
+  // Event loop
+  while( 1 )
+  {
+    if( ( n = epoll_wait( epfd, events, MULTI_MAX_EVENTS, MULTI_TICK_MS ) ) == -1 && errno != EINTR )
+      break;
+    for( i = 0; i < n; i ++ )
+      multi_read_endpoint( ( MULTI_ENDPOINT* )events[ i ].data.ptr );
+    if( time( NULL ) - last_expire >= MULTI_TICK_MS / 1000 )
+    {
+      pthread_mutex_lock( &multi_lock );
+      multi_expire_clients();
+      pthread_mutex_unlock( &multi_lock );
+      last_expire = time( NULL );
+    }
+  }
+  close( epfd );
+  return 1;
+}
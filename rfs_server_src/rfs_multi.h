@@ -0,0 +1,10 @@
+// Event driven RFS server for multiple clients
+
+#ifndef __RFS_MULTI_H__
+#define __RFS_MULTI_H__
+
+#define RFS_MULTI_PREFIX      "multi:"
+
+int rfs_multi_main( int argc, const char **argv );
+
+#endif
@@ -388,6 +388,10 @@ int rfs_init( int argc, const char **argv )
     log_err( "Usage: %s <transport> <dirname> [-v]\n", argv[ 0 ] );
     log_err( "  Serial transport: 'ser:<sername>,<serspeed>,<flow> ('flow' defines the flow control and can be either 'none' or 'rtscts')\n" );
     log_err( "  UDP transport: 'udp:<port>'\n" );
+#if defined( RFS_STANDALONE_MODE ) && !defined( WIN32_BUILD )
+    log_err( "  Multiple clients: 'multi:<transport>[@<dirname>];<transport>[@<dirname>]...[;threads=<n>]'\n" );
+    log_err( "    (every client is restricted to its own directory, <dirname> by default)\n" );
+#endif
     log_err( "Use -v for verbose output.\n" );
     return 1;
   }
@@ -9,19 +9,111 @@
 #include "os_io.h"
 #include "log.h"
 
-static char* server_basedir;
-static char server_fullname[ PLATFORM_MAX_FNAME_LEN + 1 ];
+// Default client, used by the single transport modes
+static SERVER_CLIENT server_default_client;
 
-typedef int ( *p_server_handler )( u8 *p );
+typedef int ( *p_server_handler )( SERVER_CLIENT *pclient, u8 *p );
+
+// *****************************************************************************
+// Internal helpers: names and descriptors
+
+// Build the full name of 'name' in pclient->fullname
+// Returns 0 if the name tries to escape from a sandboxed base directory
+static int server_get_fullname( SERVER_CLIENT *pclient, const char *name )
+{
+  char separator[ 2 ] = { PLATFORM_PATH_SEPARATOR, 0 };
+  const char *c;
+
+  if( pclient->sandboxed && name )
+    for( c = name; ( c = strstr( c, ".." ) ) != NULL; c += 2 )
+      if( ( c == name || c[ -1 ] == '/' || c[ -1 ] == '\\' ) && ( c[ 2 ] == '\0' || c[ 2 ] == '/' || c[ 2 ] == '\\' ) )
+      {
+        log_msg( "server_get_fullname: rejected name %s\n", name );
+        return 0;
+      }
+  pclient->fullname[ 0 ] = pclient->fullname[ PLATFORM_MAX_FNAME_LEN ] = 0;
+  strncpy( pclient->fullname, pclient->basedir, PLATFORM_MAX_FNAME_LEN );
+  if( name && strlen( name ) > 0 )
+  {
+    if( pclient->fullname[ strlen( pclient->fullname ) - 1 ] != PLATFORM_PATH_SEPARATOR )
+      strncat( pclient->fullname, separator, PLATFORM_MAX_FNAME_LEN - strlen( pclient->fullname ) );
+    strncat( pclient->fullname, name, PLATFORM_MAX_FNAME_LEN - strlen( pclient->fullname ) );
+  }
+  return 1;
+}
+
+// Sandboxed clients see handles into their own descriptor tables, others
+// see the OS descriptors directly
+static int server_add_fd( SERVER_CLIENT *pclient, int fd )
+{
+  unsigned i;
+
+  if( !pclient->sandboxed || fd == -1 )
+    return fd;
+  for( i = 0; i < SERVER_MAX_FDS; i ++ )
+    if( pclient->fds[ i ] == -1 )
+    {
+      pclient->fds[ i ] = fd;
+      return ( int )i;
+    }
+  log_msg( "server_add_fd: descriptor table full\n" );
+  os_close( fd );
+  return -1;
+}
+
+static int server_get_fd( SERVER_CLIENT *pclient, int handle )
+{
+  if( !pclient->sandboxed )
+    return handle;
+  if( handle < 0 || handle >= SERVER_MAX_FDS )
+    return -1;
+  return pclient->fds[ handle ];
+}
+
+static u32 server_add_dir( SERVER_CLIENT *pclient, u32 d )
+{
+  unsigned i;
+
+  if( !pclient->sandboxed || d == 0 )
+    return d;
+  for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+    if( pclient->dirs[ i ] == 0 )
+    {
+      pclient->dirs[ i ] = d;
+      return i + 1;
+    }
+  log_msg( "server_add_dir: directory table full\n" );
+  os_closedir( d );
+  return 0;
+}
+
+static u32 server_get_dir( SERVER_CLIENT *pclient, u32 handle )
+{
+  if( !pclient->sandboxed )
+    return handle;
+  if( handle == 0 || handle > SERVER_MAX_DIRS )
+    return 0;
+  return pclient->dirs[ handle - 1 ];
+}
+
+// Pending entry of OS directory 'd' ('d' = 0 finds a free slot)
+static SERVER_DIR_ENTRY* server_find_pending( SERVER_CLIENT *pclient, u32 d )
+{
+  unsigned i;
+
+  for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+    if( pclient->pending[ i ].dir == d )
+      return pclient->pending + i;
+  return NULL;
+}
 
 // *****************************************************************************
 // Internal helpers: execute the given request, build the response
 
-static int server_open( u8 *p )
+static int server_open( SERVER_CLIENT *pclient, u8 *p )
 {
   const char *filename;
   int mode, flags, fd;
-  char separator[ 2 ] = { PLATFORM_PATH_SEPARATOR, 0 };
   
   // Validate request
   log_msg( "server_open: request handler starting\n" );
@@ -31,22 +123,19 @@ static int server_open( u8 *p )
     return SERVER_ERR;
   }
   // Get real filename
-  server_fullname[ 0 ] = server_fullname[ PLATFORM_MAX_FNAME_LEN ] = 0;
-  strncpy( server_fullname, server_basedir, PLATFORM_MAX_FNAME_LEN );
-  if( filename && strlen( filename ) > 0 )
+  if( server_get_fullname( pclient, filename ) )
   {
-    if( server_fullname[ strlen( server_fullname ) - 1 ] != PLATFORM_PATH_SEPARATOR )
-      strncat( server_fullname, separator, PLATFORM_MAX_FNAME_LEN );
-    strncat( server_fullname, filename, PLATFORM_MAX_FNAME_LEN );
+    log_msg( "server_open: full file path is %s\n", pclient->fullname ); 
+    fd = server_add_fd( pclient, os_open( pclient->fullname, flags, mode ) );
   }
-  log_msg( "server_open: full file path is %s\n", server_fullname ); 
-  fd = os_open( server_fullname, flags, mode );
+  else
+    fd = -1;
   log_msg( "server_open: OS file handler is %d\n", fd );
   remotefs_open_write_response( p, fd );
   return SERVER_OK;
 }
 
-static int server_write( u8 *p )
+static int server_write( SERVER_CLIENT *pclient, u8 *p )
 {
   int fd;
   const void *buf;
@@ -59,13 +148,13 @@ static int server_write( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_write: fd = %d, buf = %p, count = %u\n", fd, buf, ( unsigned )count );
-  count = ( u32 )os_write( fd, buf, count );
+  count = ( u32 )os_write( server_get_fd( pclient, fd ), buf, count );
   log_msg( "server_write: OS response is %u\n", ( unsigned )count );
   remotefs_write_write_response( p, count );
   return SERVER_OK;
 }
 
-static int server_read( u8 *p )
+static int server_read( SERVER_CLIENT *pclient, u8 *p )
 {
   int fd;
   u32 count;
@@ -77,15 +166,15 @@ static int server_read( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_read: fd = %d, count = %u\n", fd, ( unsigned )count );
-  count = ( u32 )os_read( fd, p + ELUARPC_READ_BUF_OFFSET, count );
+  count = ( u32 )os_read( server_get_fd( pclient, fd ), p + ELUARPC_TAGGED_READ_BUF_OFFSET, count );
   log_msg( "server_read: OS response is %u\n", ( unsigned )count );
   remotefs_read_write_response( p, count );
   return SERVER_OK;
 }
 
-static int server_close( u8 *p )
+static int server_close( SERVER_CLIENT *pclient, u8 *p )
 {
-  int fd;
+  int fd, osfd;
   
   log_msg( "server_close: request handler starting\n" );
   if( remotefs_close_read_request( p, &fd ) == ELUARPC_ERR )
@@ -94,13 +183,15 @@ static int server_close( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_close: fd = %d\n", fd );
-  fd = os_close( fd );
+  if( ( osfd = server_get_fd( pclient, fd ) ) != -1 && pclient->sandboxed )
+    pclient->fds[ fd ] = -1;
+  fd = osfd == -1 ? -1 : os_close( osfd );
   log_msg( "server_close: OS response is %d\n", fd );
   remotefs_close_write_response( p, fd );
   return SERVER_OK;
 }
 
-static int server_lseek( u8 *p )
+static int server_lseek( SERVER_CLIENT *pclient, u8 *p )
 {
   int fd, whence;
   s32 offset;
@@ -112,17 +203,16 @@ static int server_lseek( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_lseek: fd = %d, offset = %d, whence = %d\n", fd, ( int )offset, whence );
-  offset = os_lseek( fd, offset, whence );
+  offset = os_lseek( server_get_fd( pclient, fd ), offset, whence );
   log_msg( "server_lseek: OS response is %d\n", ( int )offset );
   remotefs_lseek_write_response( p, offset );
   return SERVER_OK;
 }
 
-static int server_opendir( u8 *p )
+static int server_opendir( SERVER_CLIENT *pclient, u8 *p )
 {
   const char* name;
   u32 d;
-  char separator[ 2 ] = { PLATFORM_PATH_SEPARATOR, 0 };
 
   log_msg( "server_opendir: request handler starting\n" );
   if( remotefs_opendir_read_request( p, &name ) == ELUARPC_ERR )
@@ -131,27 +221,23 @@ static int server_opendir( u8 *p )
     return SERVER_ERR;
   }
   // Get real filename
-  server_fullname[ 0 ] = server_fullname[ PLATFORM_MAX_FNAME_LEN ] = 0;
-  strncpy( server_fullname, server_basedir, PLATFORM_MAX_FNAME_LEN );
-  if( name && strlen( name ) > 0 )
+  if( server_get_fullname( pclient, name ) )
   {
-    if( server_fullname[ strlen( server_fullname ) - 1 ] != PLATFORM_PATH_SEPARATOR )
-      strncat( server_fullname, separator, PLATFORM_MAX_FNAME_LEN );
-    strncat( server_fullname, name, PLATFORM_MAX_FNAME_LEN );
+    log_msg( "server_opendir: full dirname is %s\n", pclient->fullname );
+    d = server_add_dir( pclient, os_opendir( pclient->fullname ) );
   }
-  log_msg( "server_opendir: full dirname is %s\n", server_fullname );
-  d = os_opendir( server_fullname );
+  else
+    d = 0;
   log_msg( "server_opendir: OS response is %08X\n", d );
   remotefs_opendir_write_response( p, d );
   return SERVER_OK;
 }
 
-static int server_readdir( u8 *p )
+static int server_readdir( SERVER_CLIENT *pclient, u8 *p )
 {
-  const char* name;
+  const char* name = NULL;
   u32 fsize = 0, d;
   int fd;
-  char separator[ 2 ] = { PLATFORM_PATH_SEPARATOR, 0 };
 
   log_msg( "server_readdir: request handler starting\n" );
   if( remotefs_readdir_read_request( p, &d ) == ELUARPC_ERR )
@@ -160,20 +246,14 @@ static int server_readdir( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_readdir: DIR = %08X\n", d );
-  os_readdir( d, &name );
+  if( ( d = server_get_dir( pclient, d ) ) != 0 )
+    os_readdir( d, &name );
   if( name )
   {
     // Need to compute size now
     // Get real filename
-    server_fullname[ 0 ] = server_fullname[ PLATFORM_MAX_FNAME_LEN ] = 0;
-    strncpy( server_fullname, server_basedir, PLATFORM_MAX_FNAME_LEN );
-    if( name && strlen( name ) > 0 )
-    {
-      if( server_fullname[ strlen( server_fullname ) - 1 ] != PLATFORM_PATH_SEPARATOR )
-        strncat( server_fullname, separator, PLATFORM_MAX_FNAME_LEN );
-      strncat( server_fullname, name, PLATFORM_MAX_FNAME_LEN );
-    }
-    fd = os_open( server_fullname, RFS_OPEN_FLAG_RDONLY, 0 );
+    server_get_fullname( pclient, name );
+    fd = os_open( pclient->fullname, RFS_OPEN_FLAG_RDONLY, 0 );
     if( fd )
     {
       fsize = os_lseek( fd, 0, RFS_LSEEK_END );
@@ -181,7 +261,7 @@ static int server_readdir( u8 *p )
     }
     else
     {
-      log_msg( "server_readdir: unable to open file %s\n", server_fullname );
+      log_msg( "server_readdir: unable to open file %s\n", pclient->fullname );
       name = NULL;
     }
   }
@@ -190,10 +270,11 @@ static int server_readdir( u8 *p )
   return SERVER_OK;
 }
 
-static int server_closedir( u8 *p )
+static int server_closedir( SERVER_CLIENT *pclient, u8 *p )
 {
-  u32 d;
+  u32 d, osd;
   int res;
+  SERVER_DIR_ENTRY *pe;
 
   log_msg( "server_closedir: request handler starting\n" );
   if( remotefs_closedir_read_request( p, &d ) == ELUARPC_ERR )
@@ -202,42 +283,275 @@ static int server_closedir( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_closedir: DIR = %08X\n", d );
-  res = os_closedir( d );
+  if( ( osd = server_get_dir( pclient, d ) ) != 0 && pclient->sandboxed )
+    pclient->dirs[ d - 1 ] = 0;
+  if( osd != 0 && ( pe = server_find_pending( pclient, osd ) ) != NULL )
+    pe->dir = 0;
+  res = osd == 0 ? -1 : os_closedir( osd );
   log_msg( "server_closedir: OS response is %d\n", res );
   remotefs_closedir_write_response( p, d );
   return SERVER_OK;
 }
 
+static int server_stat( SERVER_CLIENT *pclient, u8 *p )
+{
+  const char *name;
+  u32 size = 0, mtime = 0;
+  int isdir = 0, res = -1;
+
+  log_msg( "server_stat: request handler starting\n" );
+  if( remotefs_stat_read_request( p, &name ) == ELUARPC_ERR )
+  {
+    log_msg( "server_stat: unable to read request\n" );
+    return SERVER_ERR;
+  }
+  if( server_get_fullname( pclient, name ) )
+    res = os_stat( pclient->fullname, &size, &mtime, &isdir );
+  log_msg( "server_stat: OS response is %d, size = %u, mtime = %u, dir = %d\n", res, ( unsigned )size, ( unsigned )mtime, isdir );
+  remotefs_stat_write_response( p, res, size, mtime, isdir ? RFS_STAT_FLAG_DIR : 0 );
+  return SERVER_OK;
+}
+
+// Pack as many directory entries as fit in the response
+static int server_readdirb( SERVER_CLIENT *pclient, u8 *p )
+{
+  const char *name;
+  u32 d, maxbytes, size, mtime, len = 0, entsize;
+  u8 *pdata;
+  int count = 0;
+  SERVER_DIR_ENTRY *pe;
+
+  log_msg( "server_readdirb: request handler starting\n" );
+  if( remotefs_readdirb_read_request( p, &d, &maxbytes ) == ELUARPC_ERR )
+  {
+    log_msg( "server_readdirb: unable to read request\n" );
+    return SERVER_ERR;
+  }
+  if( maxbytes > SERVER_MAX_DATA_SIZE )
+    maxbytes = SERVER_MAX_DATA_SIZE;
+  pdata = p + RFS_READDIRB_BUF_OFFSET;
+  if( ( d = server_get_dir( pclient, d ) ) != 0 )
+  {
+    // Each directory keeps its own entry that didn't fit, so interleaved
+    // listings don't lose entries. If no slot is free, only entries that
+    // surely fit are read.
+    if( ( pe = server_find_pending( pclient, d ) ) == NULL )
+      pe = server_find_pending( pclient, 0 );
+    while( 1 )
+    {
+      // An entry that doesn't fit any more is returned by the next request
+      if( pe && pe->dir == d )
+      {
+        name = pe->name;
+        size = pe->size;
+        mtime = pe->mtime;
+      }
+      else
+      {
+        if( pe == NULL && len > 0 && maxbytes - len < ELUARPC_ENTRY_SIZE( RFS_MAX_FNAME_SIZE ) )
+          break;
+        os_readdir_stat( d, &name, &size, &mtime );
+        if( name == NULL )
+          break;
+      }
+      if( ( entsize = eluarpc_put_entry( pdata + len, maxbytes - len, name, size, mtime ) ) == 0 )
+      {
+        if( pe )
+        {
+          if( name != pe->name )
+          {
+            strncpy( pe->name, name, RFS_MAX_FNAME_SIZE );
+            pe->name[ RFS_MAX_FNAME_SIZE ] = '\0';
+          }
+          pe->dir = d;
+          pe->size = size;
+          pe->mtime = mtime;
+        }
+        break;
+      }
+      if( pe )
+        pe->dir = 0;
+      len += entsize;
+      count ++;
+    }
+  }
+  log_msg( "server_readdirb: returning %d entries (%u bytes)\n", count, ( unsigned )len );
+  remotefs_readdirb_write_response( p, count, NULL, len );
+  return SERVER_OK;
+}
+
+static int server_readfile( SERVER_CLIENT *pclient, u8 *p )
+{
+  const char *name;
+  u32 offset, count;
+  s32 filesize = -1, readbytes = 0;
+  int fd = -1;
+
+  log_msg( "server_readfile: request handler starting\n" );
+  if( remotefs_readfile_read_request( p, &name, &offset, &count ) == ELUARPC_ERR )
+  {
+    log_msg( "server_readfile: unable to read request\n" );
+    return SERVER_ERR;
+  }
+  if( count > SERVER_MAX_DATA_SIZE )
+    count = SERVER_MAX_DATA_SIZE;
+  if( server_get_fullname( pclient, name ) && ( fd = os_open( pclient->fullname, RFS_OPEN_FLAG_RDONLY, 0 ) ) != -1 )
+  {
+    filesize = os_lseek( fd, 0, RFS_LSEEK_END );
+    if( os_lseek( fd, ( s32 )offset, RFS_LSEEK_SET ) != -1 )
+      readbytes = os_read( fd, p + RFS_READFILE_BUF_OFFSET, count );
+    os_close( fd );
+    if( readbytes < 0 )
+      filesize = -1, readbytes = 0;
+  }
+  log_msg( "server_readfile: file size is %d, read %d bytes at %u\n", ( int )filesize, ( int )readbytes, ( unsigned )offset );
+  remotefs_readfile_write_response( p, filesize, ( u32 )readbytes );
+  return SERVER_OK;
+}
+
+static int server_writefile( SERVER_CLIENT *pclient, u8 *p )
+{
+  const char *name;
+  const void *buf;
+  u32 offset, count;
+  u8 flags;
+  s32 res = -1;
+  int fd;
+
+  log_msg( "server_writefile: request handler starting\n" );
+  if( remotefs_writefile_read_request( p, &name, &offset, &flags, &buf, &count ) == ELUARPC_ERR )
+  {
+    log_msg( "server_writefile: unable to read request\n" );
+    return SERVER_ERR;
+  }
+  if( server_get_fullname( pclient, name ) )
+  {
+    fd = os_open( pclient->fullname, RFS_OPEN_FLAG_WRONLY | RFS_OPEN_FLAG_CREAT | ( flags & RFS_WRITEFILE_FLAG_TRUNC ? RFS_OPEN_FLAG_TRUNC : 0 ), 0 );
+    if( fd != -1 )
+    {
+      if( os_lseek( fd, ( s32 )offset, RFS_LSEEK_SET ) != -1 )
+        res = count ? os_write( fd, buf, count ) : 0;
+      os_close( fd );
+    }
+  }
+  log_msg( "server_writefile: wrote %d bytes at %u\n", ( int )res, ( unsigned )offset );
+  remotefs_writefile_write_response( p, res );
+  return SERVER_OK;
+}
+
+static int server_caps( SERVER_CLIENT *pclient, u8 *p )
+{
+  log_msg( "server_caps: request handler starting\n" );
+  if( remotefs_caps_read_request( p ) == ELUARPC_ERR )
+  {
+    log_msg( "server_caps: unable to read request\n" );
+    return SERVER_ERR;
+  }
+  remotefs_caps_write_response( p, RFS_CAP_TAGS | RFS_CAP_READDIRB | RFS_CAP_LZ | RFS_CAP_FILES, SERVER_MAX_WINDOW );
+  return SERVER_OK;
+}
+
 // *****************************************************************************
 // Server public interface
 
 static const p_server_handler server_handlers[] = 
 { 
-  server_open, server_write, server_read, server_close, server_lseek, server_opendir, server_readdir, server_closedir
+  server_open, server_write, server_read, server_close, server_lseek, server_opendir, server_readdir, server_closedir,
+  server_stat, server_readdirb, server_readfile, server_writefile, server_caps
 };
 
-void server_setup( const char* basedir )
+void server_client_init( SERVER_CLIENT *pclient, const char *basedir, int sandboxed )
 {
-  server_basedir = strdup( basedir );
+  unsigned i;
+
+  // Compress responses for the clients that ask for it
+  eluarpc_set_compress( ELUARPC_LZ_AUTO );
+  pclient->basedir = strdup( basedir );
+  pclient->sandboxed = sandboxed;
+  for( i = 0; i < SERVER_MAX_FDS; i ++ )
+    pclient->fds[ i ] = -1;
+  for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+  {
+    pclient->dirs[ i ] = 0;
+    pclient->pending[ i ].dir = 0;
+  }
 }
 
-void server_cleanup()
+// Releases everything the client left open
+void server_client_cleanup( SERVER_CLIENT *pclient )
 {
-  free( server_basedir );
-  server_basedir = NULL;
+  unsigned i;
+
+  for( i = 0; i < SERVER_MAX_FDS; i ++ )
+    if( pclient->fds[ i ] != -1 )
+    {
+      os_close( pclient->fds[ i ] );
+      pclient->fds[ i ] = -1;
+    }
+  for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+    if( pclient->dirs[ i ] != 0 )
+    {
+      os_closedir( pclient->dirs[ i ] );
+      pclient->dirs[ i ] = 0;
+    }
+  free( pclient->basedir );
+  pclient->basedir = NULL;
 }
-int server_execute_request( u8 *pdata )
+
+// Compressed requests are expanded in place and responses are compressed
+// in place for clients that accept it ('pdata' holds SERVER_MAX_PACKET_SIZE
+// bytes)
+int server_execute_client_request( SERVER_CLIENT *pclient, u8 *pdata )
 {
   u8 req;
+  u8 zbuf[ SERVER_MAX_PACKET_SIZE ];
+  u16 len;
+  int res;
   
   // Decode request
+  if( eluarpc_is_compressed( pdata ) )
+  {
+    if( eluarpc_get_packet_size( pdata, &len ) == ELUARPC_ERR || len > SERVER_MAX_PACKET_SIZE )
+      return SERVER_ERR;
+    memcpy( zbuf, pdata, len );
+    if( eluarpc_expand_packet( zbuf, pdata, SERVER_MAX_PACKET_SIZE ) == ELUARPC_ERR )
+    {
+      log_msg( "server_execute_request: unable to expand request\n" );
+      return SERVER_ERR;
+    }
+  }
   if( eluarpc_get_request_id( pdata, &req ) == ELUARPC_ERR )
     return SERVER_ERR;
   log_msg( "server_execute_request: got request with ID %d\n", req );
   if( req >= RFS_OP_FIRST && req <= RFS_OP_LAST ) 
-    return server_handlers[ req - RFS_OP_FIRST ]( pdata );
+    res = server_handlers[ req - RFS_OP_FIRST ]( pclient, pdata );
   else
-    return SERVER_ERR;
+  {
+    // Tell the client instead of leaving it waiting for a timeout
+    log_msg( "server_execute_request: unsupported request %d\n", req );
+    remotefs_unsupported_write_response( pdata, req );
+    res = SERVER_OK;
+  }
+  if( res == SERVER_OK && eluarpc_peer_compress() && eluarpc_compress_packet( pdata, zbuf, sizeof( zbuf ) ) == ELUARPC_OK )
+  {
+    eluarpc_get_packet_size( zbuf, &len );
+    memcpy( pdata, zbuf, len );
+  }
+  return res;
+}
 
+void server_setup( const char* basedir )
+{
+  server_client_init( &server_default_client, basedir, 0 );
 }
 
+void server_cleanup()
+{
+  free( server_default_client.basedir );
+  server_default_client.basedir = NULL;
+}
+
+int server_execute_request( u8 *pdata )
+{
+  return server_execute_client_request( &server_default_client, pdata );
+}
@@ -4,12 +4,51 @@
 #define __SERVER_H__
 
 #include "type.h"
+#include "os_io.h"
+#include "remotefs.h"
 
 // Error codes
 #define SERVER_OK     0
 #define SERVER_ERR    1
 
+// Per client state
+// A sandboxed client can only reach names under its base directory and
+// sees handles into its own descriptor tables instead of OS descriptors.
+#define SERVER_MAX_FDS    16
+#define SERVER_MAX_DIRS   4
+
+// Largest data block returned by a single response
+#define SERVER_MAX_DATA_SIZE  4096
+
+// Requests a client can keep in flight (reported by "caps")
+#define SERVER_MAX_WINDOW     16
+
+// Largest (expanded) packet
+#define SERVER_MAX_PACKET_SIZE  ( SERVER_MAX_DATA_SIZE + ELUARPC_WRITE_REQUEST_EXTRA )
+
+// Entry of directory 'dir' that didn't fit in the last readdir batch
+typedef struct
+{
+  u32 dir;
+  char name[ RFS_MAX_FNAME_SIZE + 1 ];
+  u32 size, mtime;
+} SERVER_DIR_ENTRY;
+
+typedef struct
+{
+  char *basedir;
+  int sandboxed;
+  int fds[ SERVER_MAX_FDS ];
+  u32 dirs[ SERVER_MAX_DIRS ];
+  char fullname[ PLATFORM_MAX_FNAME_LEN + 1 ];
+  // Directory entries read but not sent by readdir batches
+  SERVER_DIR_ENTRY pending[ SERVER_MAX_DIRS ];
+} SERVER_CLIENT;
+
 // Server function                     
+void server_client_init( SERVER_CLIENT *pclient, const char *basedir, int sandboxed );
+void server_client_cleanup( SERVER_CLIENT *pclient );
+int server_execute_client_request( SERVER_CLIENT *pclient, u8 *pdata );
 void server_setup( const char *basedir );
 void server_cleanup();
 int server_execute_request( u8 *pdata );
@@ -14,7 +14,7 @@ local lua_files = [[lapi.c lcode.c ldebug.c ldo.c ldump.c lfunc.c lgc.c llex.c l
    ldblib.c liolib.c lmathlib.c loslib.c ltablib.c lstrlib.c loadlib.c linit.c lua.c print.c lrotable.c]]
 lua_files = lua_files:gsub( "\n", "" )
 local lua_full_files = utils.prepend_path( lua_files, "src/lua" )
-lua_full_files = lua_full_files .. " src/modules/luarpc.c src/modules/lpack.c src/modules/bitarray.c src/modules/bit.c src/luarpc_desktop_serial.c "
+lua_full_files = lua_full_files .. " src/modules/luarpc.c src/modules/lpack.c src/modules/bitarray.c src/modules/bit.c src/luarpc_desktop_serial.c src/eluarpc.c "
 local local_include = "-Isrc/lua -Iinc -Isrc/modules -Iinc/desktop"
 
 if utils.is_windows() then
@@ -6,7 +6,17 @@
 #include "eluarpc.h"
 #include "rtype.h"
 
-static u8 eluarpc_err_flag;
+// Host servers can decode and build packets on more than one thread
+#ifdef ELUARPC_THREADS
+#define ELUARPC_STATE static __thread
+#else
+#define ELUARPC_STATE static
+#endif
+
+ELUARPC_STATE u8 eluarpc_err_flag;
+ELUARPC_STATE int eluarpc_tag = ELUARPC_NO_TAG;
+ELUARPC_STATE int eluarpc_lz_peer;
+static int eluarpc_lz_mode = ELUARPC_LZ_OFF;
 
 // *****************************************************************************
 // Internal functions: fdata serialization
@@ -25,6 +35,16 @@ static u8* eluarpc_write_op_id( u8 *p, u8 fdata )
   return p;    
 }
 
+static u8* eluarpc_write_tag( u8 *p )
+{
+  if( eluarpc_tag != ELUARPC_NO_TAG )
+  {
+    *p ++ = TYPE_REQ_TAG;
+    *p ++ = ( u8 )eluarpc_tag;
+  }
+  return p;
+}
+
 static u8 *eluarpc_write_u16( u8 *p, u16 fdata )
 {
   *p ++ = TYPE_INT_16;
@@ -96,6 +116,19 @@ static const u8* eluarpc_expect_op_id( const u8 *p, u8 id )
   return p;
 }
 
+// The tag is optional, so its absence is not an error
+static const u8* eluarpc_read_tag( const u8 *p )
+{
+  if( *p == TYPE_REQ_TAG )
+  {
+    eluarpc_tag = p[ 1 ];
+    p += ELUARPC_TAG_SIZE;
+  }
+  else
+    eluarpc_tag = ELUARPC_NO_TAG;
+  return p;
+}
+
 static const u8 *eluarpc_read_u16( const u8 *p, u16 *pfdata )
 {
   p = eluarpc_read_expect( p, TYPE_INT_16 );
@@ -136,13 +169,15 @@ static const u8 *eluarpc_read_small_ptr( const u8 *p, void* src, u16 *psrclen )
 // *****************************************************************************
 // Internal functions: packet handling (read and write)
 
-static u8* eluarpc_packet_ptr;
+ELUARPC_STATE u8* eluarpc_packet_ptr;
 
 static u8* eluarpc_start_packet( u8 *p )
 {
+  int lz = eluarpc_lz_mode == ELUARPC_LZ_ON || ( eluarpc_lz_mode == ELUARPC_LZ_AUTO && eluarpc_lz_peer );
+
   eluarpc_packet_ptr = p;
   p += ELUARPC_START_OFFSET;
-  *p ++ = TYPE_START;
+  *p ++ = lz ? TYPE_START_LZ : TYPE_START;
   p = eluarpc_write_u32( p, PACKET_SIG );
   return p;
 }
@@ -165,7 +200,9 @@ static const u8* eluarpc_match_packet_start( const u8 *p )
   u32 fdata;
   
   p += ELUARPC_START_OFFSET;
-  p = eluarpc_read_expect( p, TYPE_START );
+  eluarpc_lz_peer = *p == TYPE_START_LZ;
+  if( *p ++ != TYPE_START && !eluarpc_lz_peer )
+    eluarpc_err_flag = ELUARPC_ERR;
   p = eluarpc_read_u32( p, &fdata );
   if( fdata != PACKET_SIG )
     eluarpc_err_flag = ELUARPC_ERR;
@@ -191,9 +228,20 @@ int eluarpc_get_request_id( const u8 *p, u8 *pid )
   eluarpc_err_flag = ELUARPC_OK;
   p = eluarpc_match_packet_start( p );
   p = eluarpc_read_op_id( p, pid );
+  eluarpc_read_tag( p );
   return eluarpc_err_flag;
 }
 
+void eluarpc_set_tag( int tag )
+{
+  eluarpc_tag = tag == ELUARPC_NO_TAG ? ELUARPC_NO_TAG : ( tag & 0xFF );
+}
+
+int eluarpc_get_tag( void )
+{
+  return eluarpc_tag;
+}
+
 u32 eluarpc_replace_flag( u32 val, u32 origflag, u32 newflag )
 {
   return ( val & origflag ) ? newflag : 0; 
@@ -207,6 +255,233 @@ int eluarpc_get_packet_size( const u8 *p, u16 *psize )
   return eluarpc_err_flag;
 }
 
+// Packed entry lists
+
+u32 eluarpc_put_entry( u8 *p, u32 maxlen, const char *name, u32 a, u32 b )
+{
+  u32 namelen = strlen( name );
+  u32 size = ELUARPC_ENTRY_SIZE( namelen );
+
+  if( namelen > 0xFE || size > maxlen )
+    return 0;
+  *p ++ = ( u8 )( namelen + 1 );
+  memcpy( p, name, namelen + 1 );
+  p += namelen + 1;
+  *p ++ = a & 0xFF;
+  *p ++ = ( a >> 8 ) & 0xFF;
+  *p ++ = ( a >> 16 ) & 0xFF;
+  *p ++ = ( a >> 24 ) & 0xFF;
+  *p ++ = b & 0xFF;
+  *p ++ = ( b >> 8 ) & 0xFF;
+  *p ++ = ( b >> 16 ) & 0xFF;
+  *p ++ = ( b >> 24 ) & 0xFF;
+  return size;
+}
+
+const u8* eluarpc_get_entry( const u8 *p, const u8 *pend, const char **pname, u32 *pa, u32 *pb )
+{
+  u8 len;
+
+  if( p == NULL || p >= pend )
+    return NULL;
+  len = *p ++;
+  if( len == 0 || p + len + 8 > pend || p[ len - 1 ] != '\0' )
+    return NULL;
+  *pname = ( const char* )p;
+  p += len;
+  *pa = p[ 0 ] | ( ( u32 )p[ 1 ] << 8 ) | ( ( u32 )p[ 2 ] << 16 ) | ( ( u32 )p[ 3 ] << 24 );
+  *pb = p[ 4 ] | ( ( u32 )p[ 5 ] << 8 ) | ( ( u32 )p[ 6 ] << 16 ) | ( ( u32 )p[ 7 ] << 24 );
+  return p + 8;
+}
+
+// *****************************************************************************
+// LZ codec
+// Control byte formats:
+//   000LLLLL                      literal run of L + 1 bytes
+//   LLLddddd dddddddd             match of L + 2 bytes (L < 7), distance d + 1
+//   111ddddd LLLLLLLL dddddddd    match of L + 9 bytes, distance d + 1
+
+#define ELUARPC_LZ_MAX_LIT      32
+#define ELUARPC_LZ_MAX_MATCH    ( 7 + 255 + 2 )
+#define ELUARPC_LZ_MAX_DIST     8192
+#define ELUARPC_LZ_HASH( p )    ( ( ( ( ( u32 )p[ 0 ] << 16 ) | ( ( u32 )p[ 1 ] << 8 ) | p[ 2 ] ) * 2654435761UL >> ( 32 - ELUARPC_LZ_HASH_BITS ) ) & ( ( 1 << ELUARPC_LZ_HASH_BITS ) - 1 ) )
+
+u32 eluarpc_lz_compress( const u8 *src, u32 len, u8 *dst, u32 maxlen )
+{
+  u16 htab[ 1 << ELUARPC_LZ_HASH_BITS ];
+  const u8 *ip = src, *iend = src + len, *ref;
+  u8 *op = dst, *oend = dst + maxlen, *lit = NULL;
+  u32 h, pos, dist, mlen, maxm;
+
+  memset( htab, 0, sizeof( htab ) );
+  while( ip < iend )
+  {
+    if( ip + 2 < iend )
+    {
+      // Look for a match of at least 3 bytes (positions are kept modulo 64k,
+      // so candidates are always checked)
+      h = ELUARPC_LZ_HASH( ip );
+      pos = ip - src;
+      dist = ( u16 )( pos - htab[ h ] );
+      htab[ h ] = ( u16 )pos;
+      ref = ip - dist;
+      if( dist > 0 && dist <= ELUARPC_LZ_MAX_DIST && dist <= pos && ref[ 0 ] == ip[ 0 ] && ref[ 1 ] == ip[ 1 ] && ref[ 2 ] == ip[ 2 ] )
+      {
+        maxm = iend - ip < ELUARPC_LZ_MAX_MATCH ? iend - ip : ELUARPC_LZ_MAX_MATCH;
+        for( mlen = 3; mlen < maxm && ref[ mlen ] == ip[ mlen ]; mlen ++ );
+        if( op + 3 > oend )
+          return 0;
+        dist --;
+        if( mlen - 2 < 7 )
+          *op ++ = ( u8 )( ( ( mlen - 2 ) << 5 ) | ( dist >> 8 ) );
+        else
+        {
+          *op ++ = ( u8 )( ( 7 << 5 ) | ( dist >> 8 ) );
+          *op ++ = ( u8 )( mlen - 9 );
+        }
+        *op ++ = ( u8 )dist;
+        ip += mlen;
+        lit = NULL;
+        // Remember the positions at the end of the match too
+        if( ip + 2 < iend )
+        {
+          htab[ ELUARPC_LZ_HASH( ( ip - 1 ) ) ] = ( u16 )( ip - 1 - src );
+          htab[ ELUARPC_LZ_HASH( ( ip - 2 ) ) ] = ( u16 )( ip - 2 - src );
+        }
+        continue;
+      }
+    }
+    // Append a literal, starting a new run if needed
+    if( lit == NULL || *lit == ELUARPC_LZ_MAX_LIT - 1 )
+    {
+      if( op + 2 > oend )
+        return 0;
+      lit = op ++;
+      *lit = 0;
+    }
+    else
+    {
+      if( op >= oend )
+        return 0;
+      ( *lit ) ++;
+    }
+    *op ++ = *ip ++;
+  }
+  return op - dst;
+}
+
+int eluarpc_lz_expand( const u8 *src, u32 len, u8 *dst, u32 maxlen )
+{
+  const u8 *ip = src, *iend = src + len, *ref;
+  u8 *op = dst, *oend = dst + maxlen;
+  u32 c, n, dist;
+
+  while( ip < iend )
+  {
+    c = *ip ++;
+    if( c < ELUARPC_LZ_MAX_LIT )
+    {
+      n = c + 1;
+      if( ip + n > iend || op + n > oend )
+        return -1;
+      memcpy( op, ip, n );
+      ip += n;
+      op += n;
+    }
+    else
+    {
+      n = c >> 5;
+      if( n == 7 )
+      {
+        if( ip >= iend )
+          return -1;
+        n += *ip ++;
+      }
+      n += 2;
+      if( ip >= iend )
+        return -1;
+      dist = ( ( ( c & 0x1F ) << 8 ) | *ip ++ ) + 1;
+      if( dist > ( u32 )( op - dst ) || op + n > oend )
+        return -1;
+      // Byte by byte, the match can overlap its own output
+      for( ref = op - dist; n; n -- )
+        *op ++ = *ref ++;
+    }
+  }
+  return op - dst;
+}
+
+// *****************************************************************************
+// Compressed packets
+
+#define ELUARPC_BODY_OFFSET     ( ELUARPC_START_OFFSET + ELUARPC_START_SIZE )
+#define ELUARPC_LZ_HEADER_SIZE  ( 1 + ELUARPC_U16_SIZE )
+
+void eluarpc_set_compress( int mode )
+{
+  eluarpc_lz_mode = mode;
+}
+
+int eluarpc_peer_compress( void )
+{
+  return eluarpc_lz_peer;
+}
+
+int eluarpc_is_compressed( const u8 *p )
+{
+  return p[ ELUARPC_BODY_OFFSET ] == TYPE_LZ_BODY;
+}
+
+int eluarpc_compress_packet( const u8 *p, u8 *pdest, u32 maxsize )
+{
+  u16 size;
+  u32 bodylen, zlen, limit;
+  u8 *pd;
+
+  if( eluarpc_get_packet_size( p, &size ) == ELUARPC_ERR || size < ELUARPC_BODY_OFFSET + ELUARPC_END_SIZE )
+    return ELUARPC_ERR;
+  bodylen = size - ELUARPC_BODY_OFFSET - ELUARPC_END_SIZE;
+  if( bodylen < ELUARPC_LZ_MIN_BODY || eluarpc_is_compressed( p ) )
+    return ELUARPC_ERR;
+  // The result must be smaller than the original and fit in 'pdest'
+  limit = size - 1 < maxsize ? size - 1 : maxsize;
+  if( limit <= ELUARPC_BODY_OFFSET + ELUARPC_LZ_HEADER_SIZE + ELUARPC_END_SIZE )
+    return ELUARPC_ERR;
+  limit -= ELUARPC_BODY_OFFSET + ELUARPC_LZ_HEADER_SIZE + ELUARPC_END_SIZE;
+  pd = pdest + ELUARPC_BODY_OFFSET + ELUARPC_LZ_HEADER_SIZE;
+  if( ( zlen = eluarpc_lz_compress( p + ELUARPC_BODY_OFFSET, bodylen, pd, limit ) ) == 0 )
+    return ELUARPC_ERR;
+  memcpy( pdest, p, ELUARPC_BODY_OFFSET );
+  pd = pdest + ELUARPC_BODY_OFFSET;
+  *pd ++ = TYPE_LZ_BODY;
+  pd = eluarpc_write_u16( pd, ( u16 )bodylen );
+  memcpy( pd + zlen, p + size - ELUARPC_END_SIZE, ELUARPC_END_SIZE );
+  size = ELUARPC_BODY_OFFSET + ELUARPC_LZ_HEADER_SIZE + zlen + ELUARPC_END_SIZE;
+  eluarpc_write_u16( pdest + 1, size );
+  return ELUARPC_OK;
+}
+
+int eluarpc_expand_packet( const u8 *p, u8 *pdest, u32 maxsize )
+{
+  u16 size, bodylen;
+  u32 zlen;
+
+  eluarpc_err_flag = ELUARPC_OK;
+  if( eluarpc_get_packet_size( p, &size ) == ELUARPC_ERR || size < ELUARPC_BODY_OFFSET + ELUARPC_LZ_HEADER_SIZE + ELUARPC_END_SIZE )
+    return ELUARPC_ERR;
+  eluarpc_read_expect( p + ELUARPC_BODY_OFFSET, TYPE_LZ_BODY );
+  eluarpc_read_u16( p + ELUARPC_BODY_OFFSET + 1, &bodylen );
+  if( eluarpc_err_flag == ELUARPC_ERR || ( u32 )ELUARPC_BODY_OFFSET + bodylen + ELUARPC_END_SIZE > maxsize )
+    return ELUARPC_ERR;
+  zlen = size - ELUARPC_BODY_OFFSET - ELUARPC_LZ_HEADER_SIZE - ELUARPC_END_SIZE;
+  if( eluarpc_lz_expand( p + ELUARPC_BODY_OFFSET + ELUARPC_LZ_HEADER_SIZE, zlen, pdest + ELUARPC_BODY_OFFSET, bodylen ) != bodylen )
+    return ELUARPC_ERR;
+  memcpy( pdest, p, ELUARPC_BODY_OFFSET );
+  memcpy( pdest + ELUARPC_BODY_OFFSET + bodylen, p + size - ELUARPC_END_SIZE, ELUARPC_END_SIZE );
+  eluarpc_write_u16( pdest + 1, ELUARPC_BODY_OFFSET + bodylen + ELUARPC_END_SIZE );
+  return ELUARPC_OK;
+}
+
 // Generic write function
 // Specifiers: o - operation
 //             r - response
@@ -230,10 +505,12 @@ void eluarpc_gen_write( u8 *p, const char *fmt, ... )
     {
       case 'o':
         p = eluarpc_write_op_id( p, va_arg( ap, int ) );
+        p = eluarpc_write_tag( p );
         break;
         
       case 'r':
         *p++ = ELUARPC_OP_RES_MOD | ( u8 )va_arg( ap, int );
+        p = eluarpc_write_tag( p );
         break;
         
       case 'c':
@@ -299,10 +576,12 @@ int eluarpc_gen_read( const u8 *p, const char *fmt, ... )
     {
       case 'o':
         p = eluarpc_expect_op_id( p, va_arg( ap, int ) );
+        p = eluarpc_read_tag( p );
         break;
         
       case 'r':
         p = eluarpc_read_expect( p, ELUARPC_OP_RES_MOD | ( u8 )va_arg( ap, int ) );
+        p = eluarpc_read_tag( p );
         break;
         
       case 'c':
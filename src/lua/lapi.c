@@ -1022,6 +1022,12 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = cast_int(g->memlimit >> 10);
       break;
     }
+    case LUA_GCDEBT: {
+      /* bytes allocated past the point where the next GC step was due
+         (negative: headroom left before the collector runs again) */
+      res = cast_int(g->totalbytes) - cast_int(g->GCthreshold);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1078,6 +1084,17 @@ LUA_API void lua_concat (lua_State *L, int n) {
 }
 
 
+/* remove all entries of a table, keeping its storage for reuse */
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId o;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  api_check(L, ttistable(o));
+  luaH_clear(hvalue(o));
+  lua_unlock(L);
+}
+
+
 LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
   lua_Alloc f;
   lua_lock(L);
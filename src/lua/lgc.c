@@ -391,7 +391,8 @@ static void freeobj (lua_State *L, GCObject *o) {
       break;
     }
     case LUA_TSTRING: {
-      G(L)->strt.nuse--;
+      if (!luaS_islong(rawgco2ts(o)))  /* long strings are not in `strt' */
+        G(L)->strt.nuse--;
       luaM_freemem(L, o, sizestring(gco2ts(o)));
       break;
     }
@@ -678,6 +679,7 @@ void luaC_fullgc (lua_State *L) {
   while (g->gcstate != GCSpause) {
     singlestep(L);
   }
+  luaE_freethreadpool(L);  /* full collections also release recycled threads */
   setthreshold(g);
   unset_block_gc(L);
 }
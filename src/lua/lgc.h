@@ -63,6 +63,7 @@
 ** bit 3 - for thread: Don't resize thread's stack
 ** bit 3 - for userdata: has been finalized
 ** bit 3 - for tables: has weak keys
+** bit 3 - for long strings: hash has been computed
 ** bit 4 - for tables: has weak values
 ** bit 5 - object is fixed (should not be collected)
 ** bit 6 - object is "super" fixed (only the main thread)
@@ -77,6 +78,7 @@
 #define FINALIZEDBIT	3
 #define KEYWEAKBIT	3
 #define VALUEWEAKBIT	4
+#define LNGHASHBIT	3
 #define FIXEDBIT	5
 #define SFIXEDBIT	6
 #define READONLYBIT 7
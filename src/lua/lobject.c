@@ -82,6 +82,8 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
     case LUA_TROTABLE:
     case LUA_TLIGHTFUNCTION:
       return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING:
+      return luaS_eqstr(rawtsvalue(t1), rawtsvalue(t2));
     default:
       lua_assert(iscollectable(t1));
       return gcvalue(t1) == gcvalue(t2);
@@ -0,0 +1,1018 @@
+/*
+** Bytecode optimizer for the cross compiler
+** Works on the Protos produced by the parser, before they are dumped.
+** See Copyright Notice in lua.h
+*/
+
+#include <math.h>
+#include <string.h>
+
+#define lopt_c
+#define luac_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "lundump.h"
+
+
+/* per instruction flags */
+#define OPT_DATA	1	/* not an instruction (CLOSURE upvalue, SETLIST count) */
+#define OPT_TARGET	2	/* reached from somewhere else than the previous one */
+#define OPT_REACHED	4	/* reachable from the function entry */
+#define OPT_KEEP	8	/* survives compaction */
+
+/* give up threading jump chains longer than this */
+#define MAXTHREAD	16
+
+/* marks 'all registers from here on' in the read/write helpers */
+#define ALLREGS		MAXSTACK
+
+typedef struct ConstLocal {
+  int reg;
+  int startpc, endpc;  /* where the value holds */
+  TValue v;
+} ConstLocal;
+
+typedef struct OptState {
+  lua_State *L;
+  Proto *f;
+  const DumpTargetInfo *target;
+  int strip;
+  lu_byte *flags;  /* per instruction */
+  int nflags;
+  lu_byte *captured;  /* per register: a closure may change it as an upvalue */
+  lu_byte *known;  /* per register: value known at the current pc */
+  TValue *kv;  /* ... and that value */
+  ConstLocal *cl;  /* locals holding a constant */
+  int ncl;
+  const lu_byte *upknown;  /* per upvalue: value known in the enclosing function */
+  const TValue *upv;  /* ... and that value */
+} OptState;
+
+
+#define sizeflags(f)	((f)->sizecode + 1)
+
+#define isnop(i)	(GET_OPCODE(i) == OP_JMP && GETARG_sBx(i) == 0)
+
+#define codejmp(sbx)	CREATE_ABx(OP_JMP, 0, (sbx) + MAXARG_sBx)
+
+static int hasjump (OpCode op) {
+  return op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP;
+}
+
+
+/* does 'i' conditionally skip the next instruction? */
+static int skips (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return testTMode(op) || (op == OP_LOADBOOL && GETARG_C(i) != 0);
+}
+
+
+/* can execution continue with the next instruction? */
+static int fallsthrough (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_FORPREP: case OP_RETURN: return 0;
+    case OP_LOADBOOL: return GETARG_C(i) == 0;
+    default: return 1;
+  }
+}
+
+
+static int iskload (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return op == OP_LOADK || op == OP_LOADNIL ||
+         (op == OP_LOADBOOL && GETARG_C(i) == 0);
+}
+
+
+/*
+** Registers written by 'i' are [*lo, *hi]; conservative: calls and
+** iterators may clobber everything above their base.
+*/
+static int written (Instruction i, int *lo, int *hi) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  *lo = *hi = a;
+  switch (op) {
+    case OP_LOADNIL: *hi = GETARG_B(i); break;
+    case OP_SELF: *hi = a + 1; break;
+    case OP_CONCAT: *lo = (GETARG_B(i) < a) ? GETARG_B(i) : a;
+      *hi = (GETARG_C(i) > a) ? GETARG_C(i) : a; break;
+    case OP_FORLOOP: *hi = a + 3; break;
+    case OP_CALL: case OP_TAILCALL: case OP_VARARG: *hi = ALLREGS; break;
+    case OP_TFORLOOP: *lo = a + 2; *hi = ALLREGS; break;
+    case OP_TEST: return 0;
+    default:
+      if (!testAMode(op)) return 0;
+  }
+  return 1;
+}
+
+
+static int writes (Instruction i, int reg) {
+  int lo, hi;
+  return written(i, &lo, &hi) && lo <= reg && reg <= hi;
+}
+
+
+static int readsrk (int rk, int reg) {
+  return !ISK(rk) && rk == reg;
+}
+
+
+/* conservative: an open range ('B' == 0) reads everything above its base */
+static int reads (Instruction i, int reg) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_UNM: case OP_NOT: case OP_LEN:
+    case OP_TESTSET:
+      return b == reg;
+    case OP_GETTABLE: case OP_SELF:
+      return b == reg || readsrk(c, reg);
+    case OP_SETTABLE:
+      return a == reg || readsrk(b, reg) || readsrk(c, reg);
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+    case OP_POW: case OP_EQ: case OP_LT: case OP_LE:
+      return readsrk(b, reg) || readsrk(c, reg);
+    case OP_SETGLOBAL: case OP_SETUPVAL: case OP_TEST:
+      return a == reg;
+    case OP_CONCAT:
+      return b <= reg && reg <= c;
+    case OP_CALL: case OP_TAILCALL:
+      return reg >= a && (b == 0 || reg <= a + b - 1);
+    case OP_RETURN:
+      return reg >= a && (b == 0 || reg <= a + b - 2);
+    case OP_SETLIST:
+      return reg >= a && (b == 0 || reg <= a + b);
+    case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP:
+      return a <= reg && reg <= a + 2;
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** {======================================================
+** Constant pool
+** =======================================================
+*/
+
+static int samek (const TValue *a, const TValue *b) {
+  if (ttype(a) != ttype(b)) return 0;
+  switch (ttype(a)) {
+    case LUA_TNIL: return 1;
+    case LUA_TBOOLEAN: return bvalue(a) == bvalue(b);
+    case LUA_TNUMBER:  /* bitwise, so that 0 and -0 stay apart */
+      return memcmp(&nvalue(a), &nvalue(b), sizeof(lua_Number)) == 0;
+    case LUA_TSTRING: return luaS_eqstr(rawtsvalue(a), rawtsvalue(b));
+    default: return 0;
+  }
+}
+
+
+static int findk (const Proto *f, const TValue *v) {
+  int i;
+  for (i = 0; i < f->sizek; i++)
+    if (samek(&f->k[i], v)) return i;
+  return -1;
+}
+
+#define hask(f,v)	(findk(f, v) >= 0)
+
+
+static int addk (OptState *s, const TValue *v) {
+  Proto *f = s->f;
+  int i = findk(f, v);
+  if (i >= 0) return i;
+  if (f->sizek >= MAXARG_Bx) return -1;
+  luaM_reallocvector(s->L, f->k, f->sizek, f->sizek + 1, TValue);
+  setobj(s->L, &f->k[f->sizek], v);
+  return f->sizek++;
+}
+
+
+/* number that can be represented exactly on the target */
+static int validnumber (OptState *s, lua_Number r) {
+  if (luai_numisnan(r)) return 0;
+  if (s->target->lua_Number_integral) {
+    lua_Number max = ldexp(1.0, 8 * s->target->sizeof_lua_Number - 1);
+    return r == floor(r) && r >= -max && r < max;
+  }
+  return 1;
+}
+
+
+static int foldarith (OptState *s, OpCode op, lua_Number v1, lua_Number v2,
+                      lua_Number *r) {
+  if (s->target->lua_Number_integral &&
+      (op == OP_DIV || op == OP_MOD || op == OP_POW))
+    return 0;  /* leave integer semantics to the target */
+  switch (op) {
+    case OP_ADD: *r = luai_numadd(v1, v2); break;
+    case OP_SUB: *r = luai_numsub(v1, v2); break;
+    case OP_MUL: *r = luai_nummul(v1, v2); break;
+    case OP_DIV:
+      if (v2 == 0) return 0;  /* do not attempt to divide by 0 */
+      *r = luai_numdiv(v1, v2); break;
+    case OP_MOD:
+      if (v2 == 0) return 0;  /* do not attempt to divide by 0 */
+      *r = luai_nummod(v1, v2); break;
+    case OP_POW: *r = luai_numpow(v1, v2); break;
+    case OP_UNM: *r = luai_numunm(v1); break;
+    default: return 0;
+  }
+  return validnumber(s, *r);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Flow information
+** =======================================================
+*/
+
+/* can closures of 'p' (or nested ones) change its upvalue 'idx'? */
+static int upvalwritten (const Proto *p, int idx) {
+  int pc, j;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction i = p->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (op == OP_SETUPVAL && GETARG_B(i) == idx) return 1;
+    if (op == OP_CLOSURE) {
+      const Proto *c = p->p[GETARG_Bx(i)];
+      for (j = 1; j <= c->nups; j++) {
+        Instruction u = p->code[pc + j];
+        if (GET_OPCODE(u) == OP_GETUPVAL && GETARG_B(u) == idx &&
+            upvalwritten(c, j - 1))
+          return 1;
+      }
+      pc += c->nups;
+    }
+    else if (op == OP_SETLIST && GETARG_C(i) == 0)
+      pc++;
+  }
+  return 0;
+}
+
+
+/*
+** Does the CLOSURE at 'pc' capture register 'reg'? 1 if read only,
+** 2 if the closure may change it.
+*/
+static int captures (const Proto *f, int pc, int reg) {
+  const Proto *c = f->p[GETARG_Bx(f->code[pc])];
+  int j;
+  for (j = 1; j <= c->nups; j++) {
+    Instruction u = f->code[pc + j];
+    if (GET_OPCODE(u) == OP_MOVE && GETARG_B(u) == reg)
+      return upvalwritten(c, j - 1) ? 2 : 1;
+  }
+  return 0;
+}
+
+
+static void markflags (OptState *s) {
+  Proto *f = s->f;
+  Instruction *code = f->code;
+  int pc, j;
+  memset(s->flags, 0, sizeflags(f));
+  memset(s->captured, 0, f->maxstacksize);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (hasjump(op))
+      s->flags[pc + 1 + GETARG_sBx(i)] |= OPT_TARGET;
+    else if (skips(i))
+      s->flags[pc + 2] |= OPT_TARGET;
+    if (op == OP_CLOSURE) {
+      int nup = f->p[GETARG_Bx(i)]->nups;
+      for (j = 1; j <= nup; j++) {
+        Instruction u = code[pc + j];
+        s->flags[pc + j] |= OPT_DATA;
+        if (GET_OPCODE(u) == OP_MOVE && captures(f, pc, GETARG_B(u)) == 2)
+          s->captured[GETARG_B(u)] = 1;
+      }
+      pc += nup;
+    }
+    else if (op == OP_SETLIST && GETARG_C(i) == 0)
+      s->flags[++pc] |= OPT_DATA;
+  }
+}
+
+
+/* number of instruction words used by the instruction at 'pc' */
+static int width (const Proto *f, int pc) {
+  Instruction i = f->code[pc];
+  if (GET_OPCODE(i) == OP_CLOSURE) return 1 + f->p[GETARG_Bx(i)]->nups;
+  if (GET_OPCODE(i) == OP_SETLIST && GETARG_C(i) == 0) return 2;
+  return 1;
+}
+
+
+/* where can execution go after the instruction at 'pc'? */
+static int successors (const Proto *f, int pc, int *succ) {
+  Instruction i = f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  int n = 0;
+  if (hasjump(op)) succ[n++] = pc + 1 + GETARG_sBx(i);
+  if (skips(i)) succ[n++] = pc + 2;
+  if (fallsthrough(i)) succ[n++] = pc + width(f, pc);
+  return n;
+}
+
+
+static void reach (OptState *s, int *stack) {
+  Proto *f = s->f;
+  int top = 0;
+  stack[top++] = 0;
+  s->flags[0] |= OPT_REACHED;
+  while (top > 0) {
+    int pc = stack[--top];
+    int succ[3], n, j;
+    for (j = 1; j < width(f, pc); j++) s->flags[pc + j] |= OPT_REACHED;
+    n = successors(f, pc, succ);
+    for (j = 0; j < n; j++)
+      if (succ[j] < f->sizecode && !(s->flags[succ[j]] & OPT_REACHED)) {
+        s->flags[succ[j]] |= OPT_REACHED;
+        stack[top++] = succ[j];
+      }
+  }
+}
+
+
+/* is the instruction before 'pc' a skip that survives compaction? */
+static int afterskip (OptState *s, int pc) {
+  return pc > 0 && !(s->flags[pc - 1] & OPT_DATA) &&
+         skips(s->f->code[pc - 1]) && (s->flags[pc - 1] & OPT_KEEP);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Constant propagation
+** =======================================================
+*/
+
+/* register of local 'v': number of locals active where it starts */
+static int localreg (const Proto *f, int v) {
+  int j, reg = 0;
+  int pc = f->locvars[v].startpc;
+  for (j = 0; j < v; j++)
+    if (f->locvars[j].startpc <= pc && pc < f->locvars[j].endpc) reg++;
+  return reg;
+}
+
+
+static void loadvalue (OptState *s, Instruction i, TValue *v) {
+  switch (GET_OPCODE(i)) {
+    case OP_LOADK: setobj(s->L, v, &s->f->k[GETARG_Bx(i)]); break;
+    case OP_LOADBOOL: setbvalue(v, GETARG_B(i)); break;
+    default: setnilvalue(v); break;
+  }
+}
+
+
+/*
+** A local holds a constant for its whole scope when it is initialized
+** from a constant load that every path goes through, it is never written
+** while in scope (directly or by a closure through an upvalue) and no
+** jump enters the scope from outside.
+*/
+static int constlocal (OptState *s, int var, ConstLocal *c) {
+  Proto *f = s->f;
+  int startpc = f->locvars[var].startpc;
+  int endpc = f->locvars[var].endpc;
+  int reg, p, pc;
+  if (startpc == 0 || startpc >= endpc) return 0;
+  reg = localreg(f, var);
+  if (reg >= f->maxstacksize) return 0;
+  if (s->flags[startpc] & OPT_DATA) return 0;
+  for (p = startpc - 1; p >= 0; p--) {
+    Instruction i = f->code[p];
+    if ((s->flags[p] & OPT_DATA) || !iskload(i)) return 0;
+    if (writes(i, reg)) break;
+    if (s->flags[p] & OPT_TARGET) return 0;
+  }
+  if (p < 0 || (s->flags[startpc] & OPT_TARGET) ||
+      (p > 0 && !(s->flags[p - 1] & OPT_DATA) && skips(f->code[p - 1])))
+    return 0;
+  for (pc = p + 1; pc < startpc; pc++)
+    if (s->flags[pc] & OPT_TARGET) return 0;
+  /* the initialization must be a plain load, not part of a LOADNIL range */
+  if (GET_OPCODE(f->code[p]) == OP_LOADNIL &&
+      (GETARG_A(f->code[p]) != reg || GETARG_B(f->code[p]) != reg))
+    return 0;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    int inside = startpc <= pc && pc < endpc;
+    if (s->flags[pc] & OPT_DATA) continue;
+    if (inside && (writes(i, reg) ||
+                   (GET_OPCODE(i) == OP_CLOSURE && captures(f, pc, reg) == 2)))
+      return 0;
+    if (!inside && hasjump(GET_OPCODE(i))) {
+      int dest = pc + 1 + GETARG_sBx(i);
+      if (p < dest && dest < endpc) return 0;
+    }
+  }
+  c->reg = reg;
+  c->startpc = startpc;
+  c->endpc = endpc;
+  loadvalue(s, f->code[p], &c->v);
+  return 1;
+}
+
+
+static void findconstlocals (OptState *s) {
+  int v;
+  s->ncl = 0;
+  for (v = 0; v < s->f->sizelocvars; v++)
+    if (constlocal(s, v, &s->cl[s->ncl])) s->ncl++;
+}
+
+
+static const TValue *constlocalvalue (OptState *s, int pc, int reg) {
+  int j;
+  for (j = 0; j < s->ncl; j++) {
+    ConstLocal *c = &s->cl[j];
+    if (c->reg == reg && c->startpc <= pc && pc < c->endpc) return &c->v;
+  }
+  return NULL;
+}
+
+
+static const TValue *value (OptState *s, int pc, int reg) {
+  if (ISK(reg)) return &s->f->k[INDEXK(reg)];
+  if (s->known[reg]) return &s->kv[reg];
+  return constlocalvalue(s, pc, reg);
+}
+
+
+/* load 'v' into register 'a' */
+static int codeload (OptState *s, int pc, int a, const TValue *v) {
+  Instruction *i = &s->f->code[pc];
+  int k;
+  switch (ttype(v)) {
+    case LUA_TNIL: *i = CREATE_ABC(OP_LOADNIL, a, a, 0); return 1;
+    case LUA_TBOOLEAN: *i = CREATE_ABC(OP_LOADBOOL, a, bvalue(v), 0); return 1;
+    default:
+      if ((k = addk(s, v)) < 0) return 0;
+      *i = CREATE_ABx(OP_LOADK, a, k);
+      return 1;
+  }
+}
+
+
+/* replace register operand '*rk' by a constant when its value is known */
+static int constrk (OptState *s, int pc, int *rk) {
+  const TValue *v;
+  int k;
+  if (ISK(*rk) || (v = value(s, pc, *rk)) == NULL) return 0;
+  if ((k = addk(s, v)) < 0 || k > MAXINDEXRK) return 0;
+  *rk = RKASK(k);
+  return 1;
+}
+
+
+/* replace the test at 'pc' by its outcome: is the following jump taken? */
+static void resolvetest (OptState *s, int pc, int taken) {
+  Instruction i = s->f->code[pc];
+  if (taken && GET_OPCODE(i) == OP_TESTSET)
+    s->f->code[pc] = CREATE_ABC(OP_MOVE, GETARG_A(i), GETARG_B(i), 0);
+  else
+    s->f->code[pc] = codejmp(taken ? 0 : 1);
+}
+
+
+static int rewrite (OptState *s, int pc) {
+  Instruction *pi = &s->f->code[pc];
+  Instruction i = *pi;
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  int changed = 0;
+  const TValue *v1, *v2;
+  switch (op) {
+    case OP_MOVE:
+      if ((v1 = value(s, pc, b)) != NULL) return codeload(s, pc, a, v1);
+      break;
+    case OP_GETUPVAL:
+      if (s->upknown != NULL && s->upknown[b])
+        return codeload(s, pc, a, &s->upv[b]);
+      break;
+    case OP_GETTABLE: case OP_SELF:
+      if (constrk(s, pc, &c)) { SETARG_C(*pi, c); changed = 1; }
+      break;
+    case OP_SETTABLE:
+      if (constrk(s, pc, &b)) { SETARG_B(*pi, b); changed = 1; }
+      if (constrk(s, pc, &c)) { SETARG_C(*pi, c); changed = 1; }
+      break;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+    case OP_POW: case OP_EQ: case OP_LT: case OP_LE: {
+      if (constrk(s, pc, &b)) { SETARG_B(*pi, b); changed = 1; }
+      if (constrk(s, pc, &c)) { SETARG_C(*pi, c); changed = 1; }
+      if (!ISK(b) || !ISK(c)) break;
+      v1 = &s->f->k[INDEXK(b)];
+      v2 = &s->f->k[INDEXK(c)];
+      if (op == OP_EQ) {
+        int eq = ttisnumber(v1) && ttisnumber(v2) ?
+                 luai_numeq(nvalue(v1), nvalue(v2)) : samek(v1, v2);
+        resolvetest(s, pc, eq == a);
+        return 1;
+      }
+      if (!ttisnumber(v1) || !ttisnumber(v2)) break;
+      if (op == OP_LT || op == OP_LE) {
+        int res = (op == OP_LT) ? luai_numlt(nvalue(v1), nvalue(v2)) :
+                                  luai_numle(nvalue(v1), nvalue(v2));
+        resolvetest(s, pc, res == a);
+        return 1;
+      }
+      else {
+        TValue r;
+        lua_Number n;
+        if (foldarith(s, op, nvalue(v1), nvalue(v2), &n)) {
+          setnvalue(&r, n);
+          return codeload(s, pc, a, &r) || changed;
+        }
+      }
+      break;
+    }
+    case OP_UNM: case OP_NOT: case OP_LEN: {
+      TValue r;
+      lua_Number n;
+      if ((v1 = value(s, pc, b)) == NULL) break;
+      if (op == OP_NOT) {
+        setbvalue(&r, l_isfalse(v1));
+      }
+      else if (op == OP_LEN && ttisstring(v1)) {
+        setnvalue(&r, cast_num(tsvalue(v1)->len));
+      }
+      else if (op == OP_UNM && ttisnumber(v1) &&
+               foldarith(s, op, nvalue(v1), 0, &n)) {
+        setnvalue(&r, n);
+      }
+      else
+        break;
+      return codeload(s, pc, a, &r);
+    }
+    case OP_TEST:
+      if ((v1 = value(s, pc, a)) == NULL) break;
+      resolvetest(s, pc, l_isfalse(v1) != c);
+      return 1;
+    case OP_TESTSET:
+      if ((v1 = value(s, pc, b)) == NULL) break;
+      resolvetest(s, pc, l_isfalse(v1) != c);
+      return 1;
+    default:
+      break;
+  }
+  return changed;
+}
+
+
+/* track the registers holding a known value along straight code */
+static void track (OptState *s, Instruction i) {
+  int lo, hi, r;
+  if (written(i, &lo, &hi)) {
+    if (hi >= s->f->maxstacksize) hi = s->f->maxstacksize - 1;
+    for (r = lo; r <= hi; r++) s->known[r] = 0;
+  }
+  if (iskload(i)) {
+    int a = GETARG_A(i);
+    hi = (GET_OPCODE(i) == OP_LOADNIL) ? GETARG_B(i) : a;
+    for (r = a; r <= hi; r++) {
+      if (s->captured[r]) continue;
+      loadvalue(s, i, &s->kv[r]);
+      s->known[r] = 1;
+    }
+  }
+}
+
+
+/*
+** Registers surely written by 'i' (the opposite of 'written'): an
+** earlier value of them is never observed.
+*/
+static int killed (Instruction i, int *lo, int *hi) {
+  int a = GETARG_A(i);
+  *lo = *hi = a;
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: case OP_GETGLOBAL:
+    case OP_GETTABLE: case OP_NEWTABLE: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_DIV: case OP_MOD: case OP_POW: case OP_UNM:
+    case OP_NOT: case OP_LEN: case OP_CONCAT: case OP_CLOSURE:
+    case OP_FORLOOP: case OP_FORPREP: case OP_LOADBOOL:
+      return 1;
+    case OP_LOADNIL: *hi = GETARG_B(i); return 1;
+    case OP_SELF: *hi = a + 1; return 1;
+    case OP_CALL: *hi = a + GETARG_C(i) - 2; return GETARG_C(i) > 1;
+    case OP_VARARG: *hi = a + GETARG_B(i) - 2; return GETARG_B(i) > 1;
+    case OP_TFORLOOP: *lo = a + 3; *hi = a + 2 + GETARG_C(i); return 1;
+    default: return 0;
+  }
+}
+
+
+/* can the instruction be removed when the registers it sets are dead? */
+static int pure (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_LOADNIL: case OP_GETUPVAL:
+    case OP_NOT:
+      return 1;
+    case OP_LOADBOOL:
+      return GETARG_C(i) == 0;
+    default:
+      return 0;
+  }
+}
+
+
+#define SETWORDS	((MAXSTACK + 31) / 32)
+#define inset(set,r)	((set)[(r) >> 5] & (1u << ((r) & 31)))
+#define addset(set,r)	((set)[(r) >> 5] |= (1u << ((r) & 31)))
+
+/* named local in register 'reg' at 'pc' (only matters with debug info) */
+static int namedlocal (OptState *s, int pc, int reg) {
+  Proto *f = s->f;
+  int v, n = 0;
+  if (s->strip) return 0;
+  for (v = 0; v < f->sizelocvars; v++)
+    if (f->locvars[v].startpc <= pc && pc < f->locvars[v].endpc) n++;
+  return reg < n;
+}
+
+
+/*
+** Removes pure instructions whose results are never read, using a
+** backward liveness analysis. Registers captured by closures are always
+** live: the closure sees their value.
+*/
+static int deadstores (OptState *s) {
+  lua_State *L = s->L;
+  Proto *f = s->f;
+  int n = f->sizecode, nregs = f->maxstacksize;
+  unsigned *live = luaM_newvector(L, n * SETWORDS, unsigned);
+  unsigned pinned[SETWORDS];
+  int pc, r, w, j, changed;
+  memset(live, 0, n * SETWORDS * sizeof(unsigned));
+  memset(pinned, 0, sizeof(pinned));
+  for (pc = 0; pc < n; pc++)
+    if (!(s->flags[pc] & OPT_DATA) && GET_OPCODE(f->code[pc]) == OP_CLOSURE)
+      for (r = 0; r < nregs; r++)
+        if (captures(f, pc, r)) addset(pinned, r);
+  do {  /* live[pc] is the set of registers live before 'pc' */
+    changed = 0;
+    for (pc = n - 1; pc >= 0; pc--) {
+      Instruction i = f->code[pc];
+      unsigned in[SETWORDS];
+      int succ[3], ns, lo, hi;
+      if (s->flags[pc] & OPT_DATA) continue;
+      memcpy(in, pinned, sizeof(in));
+      ns = successors(f, pc, succ);
+      for (j = 0; j < ns; j++)
+        if (succ[j] < n)
+          for (w = 0; w < SETWORDS; w++) in[w] |= live[succ[j] * SETWORDS + w];
+      if (killed(i, &lo, &hi))
+        for (r = lo; r <= hi && r < nregs; r++)
+          if (!inset(pinned, r)) in[r >> 5] &= ~(1u << (r & 31));
+      for (r = 0; r < nregs; r++)
+        if (reads(i, r)) addset(in, r);
+      if (memcmp(in, &live[pc * SETWORDS], sizeof(in)) != 0) {
+        memcpy(&live[pc * SETWORDS], in, sizeof(in));
+        changed = 1;
+      }
+    }
+  } while (changed);
+  changed = 0;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    int lo, hi, used = 0;
+    if ((s->flags[pc] & OPT_DATA) || !pure(i) || isnop(i)) continue;
+    killed(i, &lo, &hi);
+    for (r = lo; r <= hi && !used; r++) {
+      int next = pc + 1;  /* pure instructions fall through */
+      used = inset(pinned, r) || namedlocal(s, next, r) ||
+             (next < n && inset(&live[next * SETWORDS], r));
+    }
+    if (!used) {
+      f->code[pc] = codejmp(0);
+      changed = 1;
+    }
+  }
+  luaM_freearray(L, live, n * SETWORDS, unsigned);
+  return changed;
+}
+
+
+static int propagate (OptState *s) {
+  Proto *f = s->f;
+  int pc, flow = 0, changed = 0;
+  markflags(s);
+  findconstlocals(s);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    if (s->flags[pc] & OPT_DATA) continue;
+    if (!flow || (s->flags[pc] & OPT_TARGET))
+      memset(s->known, 0, f->maxstacksize);
+    if (rewrite(s, pc)) changed = 1;
+    track(s, f->code[pc]);
+    flow = fallsthrough(f->code[pc]);
+  }
+  markflags(s);
+  if (deadstores(s)) changed = 1;
+  return changed;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Jumps, unreachable and redundant code
+** =======================================================
+*/
+
+static int threadjumps (OptState *s) {
+  Proto *f = s->f;
+  int pc, changed = 0;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    int dest, n;
+    if ((s->flags[pc] & OPT_DATA) || GET_OPCODE(i) != OP_JMP) continue;
+    dest = pc + 1 + GETARG_sBx(i);
+    for (n = 0; n < MAXTHREAD; n++) {
+      Instruction d = f->code[dest];
+      if ((s->flags[dest] & OPT_DATA) || GET_OPCODE(d) != OP_JMP ||
+          dest == pc)
+        break;
+      dest = dest + 1 + GETARG_sBx(d);
+    }
+    if (dest != pc + 1 + GETARG_sBx(i)) {
+      SETARG_sBx(f->code[pc], dest - (pc + 1));
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* is the instruction at 'pc' redundant given the previous one? */
+static int redundant (OptState *s, int pc) {
+  Instruction *code = s->f->code;
+  Instruction i = code[pc];
+  if (isnop(i)) return 1;
+  if (GET_OPCODE(i) == OP_MOVE && GETARG_A(i) == GETARG_B(i)) return 1;
+  if (pc == 0 || (s->flags[pc] & OPT_TARGET) ||
+      (s->flags[pc - 1] & (OPT_DATA | OPT_KEEP)) != OPT_KEEP)
+    return 0;
+  if (GET_OPCODE(i) == OP_MOVE && GET_OPCODE(code[pc - 1]) == OP_MOVE &&
+      GETARG_A(code[pc - 1]) == GETARG_B(i) &&
+      GETARG_B(code[pc - 1]) == GETARG_A(i))
+    return 1;  /* MOVE a b; MOVE b a */
+  if (GET_OPCODE(i) == OP_LOADNIL && GET_OPCODE(code[pc - 1]) == OP_LOADNIL) {
+    Instruction *prev = &code[pc - 1];
+    int a = GETARG_A(*prev), b = GETARG_B(*prev);
+    if (GETARG_A(i) >= a && GETARG_A(i) <= b + 1) {
+      if (GETARG_B(i) > b) SETARG_B(*prev, GETARG_B(i));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static int markkeep (OptState *s) {
+  Proto *f = s->f;
+  int pc, removed = 0;
+  int *stack = luaM_newvector(s->L, f->sizecode, int);
+  markflags(s);
+  reach(s, stack);
+  luaM_freearray(s->L, stack, f->sizecode, int);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    lu_byte *fl = &s->flags[pc];
+    if ((*fl & OPT_REACHED) || pc == f->sizecode - 1 || afterskip(s, pc))
+      *fl |= OPT_KEEP;
+    else if ((*fl & OPT_DATA) && (s->flags[pc - 1] & OPT_KEEP))
+      *fl |= OPT_KEEP;  /* data of an instruction kept after a skip */
+    if ((*fl & OPT_KEEP) && !(*fl & OPT_DATA) && !afterskip(s, pc) &&
+        pc != f->sizecode - 1 && redundant(s, pc))
+      *fl &= ~OPT_KEEP;
+    if (!(*fl & OPT_KEEP)) removed++;
+  }
+  return removed;
+}
+
+
+static void compact (OptState *s) {
+  lua_State *L = s->L;
+  Proto *f = s->f;
+  int n = f->sizecode;
+  int *newpc = luaM_newvector(L, n + 1, int);
+  int pc, j = 0;
+  for (pc = 0; pc < n; pc++) {
+    newpc[pc] = j;
+    if (s->flags[pc] & OPT_KEEP) j++;
+  }
+  newpc[n] = j;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    if (!(s->flags[pc] & OPT_KEEP)) continue;
+    if (!(s->flags[pc] & OPT_DATA) && hasjump(GET_OPCODE(i)))
+      SETARG_sBx(i, newpc[pc + 1 + GETARG_sBx(i)] - (newpc[pc] + 1));
+    f->code[newpc[pc]] = i;
+    if (f->sizelineinfo == n) f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+  }
+  for (pc = 0; pc < f->sizelocvars; pc++) {
+    f->locvars[pc].startpc = newpc[f->locvars[pc].startpc];
+    f->locvars[pc].endpc = newpc[f->locvars[pc].endpc];
+  }
+  luaM_reallocvector(L, f->code, n, j, Instruction);
+  f->sizecode = j;
+  if (f->sizelineinfo == n) {
+    luaM_reallocvector(L, f->lineinfo, n, j, int);
+    f->sizelineinfo = j;
+  }
+  luaM_freearray(L, newpc, n + 1, int);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Constants and nested functions
+** =======================================================
+*/
+
+#define mapk(map,rk)	(ISK(rk) ? RKASK(map[INDEXK(rk)]) : (rk))
+
+/* drops unused constants and merges duplicates */
+static void compactk (OptState *s) {
+  lua_State *L = s->L;
+  Proto *f = s->f;
+  int n = f->sizek;
+  int *map = luaM_newvector(L, n, int);
+  int pc, k, j, nk = 0;
+  for (k = 0; k < n; k++) map[k] = -1;
+  markflags(s);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (s->flags[pc] & OPT_DATA) continue;
+    if (getOpMode(op) == iABx && getBMode(op) == OpArgK)
+      map[GETARG_Bx(i)] = 0;
+    else if (getOpMode(op) == iABC) {
+      if (getBMode(op) == OpArgK && ISK(GETARG_B(i))) map[INDEXK(GETARG_B(i))] = 0;
+      if (getCMode(op) == OpArgK && ISK(GETARG_C(i))) map[INDEXK(GETARG_C(i))] = 0;
+    }
+  }
+  for (k = 0; k < n; k++) {
+    if (map[k] < 0) continue;
+    for (j = 0; j < nk && !samek(&f->k[j], &f->k[k]); j++) ;
+    if (j == nk) setobj(L, &f->k[nk++], &f->k[k]);
+    map[k] = j;
+  }
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction *i = &f->code[pc];
+    OpCode op = GET_OPCODE(*i);
+    if (s->flags[pc] & OPT_DATA) continue;
+    if (getOpMode(op) == iABx && getBMode(op) == OpArgK)
+      SETARG_Bx(*i, map[GETARG_Bx(*i)]);
+    else if (getOpMode(op) == iABC) {
+      if (getBMode(op) == OpArgK) SETARG_B(*i, mapk(map, GETARG_B(*i)));
+      if (getCMode(op) == OpArgK) SETARG_C(*i, mapk(map, GETARG_C(*i)));
+    }
+  }
+  luaM_reallocvector(L, f->k, n, nk, TValue);
+  f->sizek = nk;
+  luaM_freearray(L, map, n, int);
+}
+
+
+/* drops functions whose closure is never created */
+static void compactp (OptState *s) {
+  lua_State *L = s->L;
+  Proto *f = s->f;
+  int n = f->sizep;
+  int *map = luaM_newvector(L, n, int);
+  int pc, j, np = 0;
+  for (j = 0; j < n; j++) map[j] = -1;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    if (!(s->flags[pc] & OPT_DATA) && GET_OPCODE(i) == OP_CLOSURE)
+      map[GETARG_Bx(i)] = 0;
+  }
+  for (j = 0; j < n; j++)
+    if (map[j] >= 0) {
+      f->p[np] = f->p[j];
+      map[j] = np++;
+    }
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction *i = &f->code[pc];
+    if (!(s->flags[pc] & OPT_DATA) && GET_OPCODE(*i) == OP_CLOSURE)
+      SETARG_Bx(*i, map[GETARG_Bx(*i)]);
+  }
+  luaM_reallocvector(L, f->p, n, np, Proto *);
+  f->sizep = np;
+  luaM_freearray(L, map, n, int);
+}
+
+/* }====================================================== */
+
+
+static int optimize (lua_State *L, Proto *f, int strip,
+                     const DumpTargetInfo *target,
+                     const lu_byte *upknown, const TValue *upv);
+
+
+/* optimizes nested functions, telling them which upvalues are constant */
+static int optimizenested (OptState *s) {
+  lua_State *L = s->L;
+  Proto *f = s->f;
+  int pc, j, ok = 1;
+  markflags(s);
+  findconstlocals(s);
+  for (pc = 0; pc < f->sizecode && ok; pc++) {
+    Instruction i = f->code[pc];
+    Proto *p;
+    lu_byte *known;
+    TValue *v;
+    if ((s->flags[pc] & OPT_DATA) || GET_OPCODE(i) != OP_CLOSURE) continue;
+    p = f->p[GETARG_Bx(i)];
+    known = luaM_newvector(L, p->nups, lu_byte);
+    v = luaM_newvector(L, p->nups, TValue);
+    for (j = 0; j < p->nups; j++) {
+      Instruction u = f->code[pc + 1 + j];
+      const TValue *c = NULL;
+      if (GET_OPCODE(u) == OP_MOVE)
+        c = constlocalvalue(s, pc, GETARG_B(u));
+      else if (s->upknown != NULL && s->upknown[GETARG_B(u)])
+        c = &s->upv[GETARG_B(u)];
+      if (c != NULL && (ttisstring(c) || ttisnumber(c)) && !hask(p, c))
+        c = NULL;  /* a copy in the constants of 'p' would grow the image */
+      known[j] = (c != NULL);
+      if (c != NULL) setobj(L, &v[j], c);
+    }
+    ok = optimize(L, p, s->strip, s->target, known, v);
+    luaM_freearray(L, v, p->nups, TValue);
+    luaM_freearray(L, known, p->nups, lu_byte);
+  }
+  return ok;
+}
+
+
+static int optimize (lua_State *L, Proto *f, int strip,
+                     const DumpTargetInfo *target,
+                     const lu_byte *upknown, const TValue *upv) {
+  OptState s;
+  int changed, ok;
+  s.L = L;
+  s.f = f;
+  s.target = target;
+  s.strip = strip;
+  s.upknown = upknown;
+  s.upv = upv;
+  s.nflags = sizeflags(f);
+  s.flags = luaM_newvector(L, s.nflags, lu_byte);
+  s.captured = luaM_newvector(L, f->maxstacksize, lu_byte);
+  s.known = luaM_newvector(L, f->maxstacksize, lu_byte);
+  s.kv = luaM_newvector(L, f->maxstacksize, TValue);
+  s.cl = luaM_newvector(L, f->sizelocvars, ConstLocal);
+  do {
+    changed = propagate(&s);
+    markflags(&s);
+    if (threadjumps(&s)) changed = 1;
+    if (markkeep(&s) > 0) {
+      compact(&s);
+      changed = 1;
+    }
+  } while (changed);
+  compactk(&s);
+  compactp(&s);
+  ok = optimizenested(&s);
+  luaM_freearray(L, s.cl, f->sizelocvars, ConstLocal);
+  luaM_freearray(L, s.kv, f->maxstacksize, TValue);
+  luaM_freearray(L, s.known, f->maxstacksize, lu_byte);
+  luaM_freearray(L, s.captured, f->maxstacksize, lu_byte);
+  luaM_freearray(L, s.flags, s.nflags, lu_byte);
+  return ok && luaG_checkcode(f);
+}
+
+
+int luaU_optimize (lua_State *L, Proto *f, int strip,
+                   const DumpTargetInfo *target) {
+  return optimize(L, f, strip, target, NULL, NULL);
+}
@@ -28,6 +28,29 @@ void* luaR_findglobal(const char *name, unsigned len) {
   return NULL;
 }
 
+/* Find a string key in a rotable that starts with a LRO_SORTEDKEY entry */
+static const TValue* luaR_sortedfind(const luaR_entry *pentry, const char *strkey, unsigned *ppos) {
+  unsigned lo = 1, hi = (unsigned)pentry->key.id.numkey + 1, mid;
+  int cmp;
+
+  if (strkey == NULL)
+    return NULL;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    cmp = strcmp(strkey, pentry[mid].key.id.strkey);
+    if (cmp == 0) {
+      if (ppos)
+        *ppos = mid;
+      return &pentry[mid].value;
+    }
+    if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return NULL;
+}
+
 /* Find an entry in a rotable and return it */
 static const TValue* luaR_auxfind(const luaR_entry *pentry, const char *strkey, luaR_numkey numkey, unsigned *ppos) {
   const TValue *res = NULL;
@@ -35,6 +58,8 @@ static const TValue* luaR_auxfind(const luaR_entry *pentry, const char *strkey,
   
   if (pentry == NULL)
     return NULL;  
+  if (pentry->key.type == LUAR_TSORTED)
+    return luaR_sortedfind(pentry, strkey, ppos);
   while(pentry->key.type != LUA_TNIL) {
     if ((strkey && (pentry->key.type == LUA_TSTRING) && (!strcmp(pentry->key.id.strkey, strkey))) || 
         (!strkey && (pentry->key.type == LUA_TNUMBER) && ((luaR_numkey)pentry->key.id.numkey == numkey))) {
@@ -99,7 +124,7 @@ void luaR_next(lua_State *L, void *data, TValue *key, TValue *val) {
   
   /* Special case: if key is nil, return the first element of the rotable */
   if (ttisnil(key)) 
-    luaR_next_helper(L, pentries, 0, key, val);
+    luaR_next_helper(L, pentries, pentries[0].key.type == LUAR_TSORTED ? 1 : 0, key, val);
   else if (ttisstring(key) || ttisnumber(key)) {
     /* Find the previoud key again */  
     if (ttisstring(key)) {
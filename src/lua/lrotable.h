@@ -31,6 +31,12 @@
 #define LRO_NUMKEY(k)   {LUA_TNUMBER, {.numkey = k}}
 #define LRO_NILKEY      {LUA_TNIL, {.strkey=NULL}}
 
+/* A rotable can start with a LRO_SORTEDKEY(n) entry, meaning that the n entries
+   after it all have string keys in strcmp order; it is then searched by
+   bisection. utils/mkbind.lua generates such rotables */
+#define LUAR_TSORTED    (-2)
+#define LRO_SORTEDKEY(n) {LUAR_TSORTED, {.numkey = n}}
+
 /* Maximum length of a rotable name and of a string key*/
 #define LUA_MAX_ROTABLE_NAME      32
 
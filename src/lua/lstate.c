@@ -46,15 +46,9 @@ typedef struct LG {
   
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
-  /* initialize CallInfo array */
-  L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo);
+static void stack_reset (lua_State *L1) {
   L1->ci = L1->base_ci;
-  L1->size_ci = BASIC_CI_SIZE;
   L1->end_ci = L1->base_ci + L1->size_ci - 1;
-  /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, TValue);
-  L1->stacksize = BASIC_STACK_SIZE + EXTRA_STACK;
   L1->top = L1->stack;
   L1->stack_last = L1->stack+(L1->stacksize - EXTRA_STACK)-1;
   /* initialize first ci */
@@ -65,12 +59,47 @@ static void stack_init (lua_State *L1, lua_State *L) {
 }
 
 
+static void stack_init (lua_State *L1, lua_State *L) {
+  /* initialize CallInfo array */
+  L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo);
+  L1->size_ci = BASIC_CI_SIZE;
+  /* initialize stack array */
+  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, TValue);
+  L1->stacksize = BASIC_STACK_SIZE + EXTRA_STACK;
+  stack_reset(L1);
+}
+
+
+/*
+** give back the memory a recycled thread grew while it was running; errors
+** are raised on `L' and leave `L1' consistent
+*/
+static void stack_shrink (lua_State *L, lua_State *L1) {
+  if (L1->size_ci > BASIC_CI_SIZE) {
+    luaM_reallocvector(L, L1->base_ci, L1->size_ci, BASIC_CI_SIZE, CallInfo);
+    L1->size_ci = BASIC_CI_SIZE;
+    stack_reset(L1);
+  }
+  if (L1->stacksize > BASIC_STACK_SIZE + EXTRA_STACK) {
+    luaM_reallocvector(L, L1->stack, L1->stacksize,
+                       BASIC_STACK_SIZE + EXTRA_STACK, TValue);
+    L1->stacksize = BASIC_STACK_SIZE + EXTRA_STACK;
+    stack_reset(L1);
+  }
+}
+
+
 static void freestack (lua_State *L, lua_State *L1) {
   luaM_freearray(L, L1->base_ci, L1->size_ci, CallInfo);
   luaM_freearray(L, L1->stack, L1->stacksize, TValue);
 }
 
 
+#define threadsize(L1)	(state_size(lua_State) + \
+                         (L1)->size_ci * sizeof(CallInfo) + \
+                         (L1)->stacksize * sizeof(TValue))
+
+
 /*
 ** open parts that may cause memory-allocation errors
 */
@@ -113,6 +142,7 @@ static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeall(L);  /* collect all objects */
+  luaE_freethreadpool(L);
   lua_assert(g->rootgc == obj2gco(L));
   lua_assert(g->strt.nuse == 0);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
@@ -123,13 +153,39 @@ static void close_state (lua_State *L) {
 }
 
 
+/*
+** reuse a dead thread if there is one; its stack arrays are kept and only
+** shrunk once the new thread is safely linked
+*/
 lua_State *luaE_newthread (lua_State *L) {
-  lua_State *L1 = tostate(luaM_malloc(L, state_size(lua_State)));
-  luaC_link(L, obj2gco(L1), LUA_TTHREAD);
-  setthvalue(L, L->top, L1); /* put thread on stack */
-  incr_top(L);
-  preinit_state(L1, G(L));
-  stack_init(L1, L);  /* init stack */
+  global_State *g = G(L);
+  lua_State *L1 = g->threadpool;
+  if (L1 != NULL) {
+    StkId stack = L1->stack;
+    CallInfo *base_ci = L1->base_ci;
+    int stacksize = L1->stacksize;
+    int size_ci = L1->size_ci;
+    g->threadpool = cast(lua_State *, L1->next);
+    g->poolbytes -= threadsize(L1);
+    preinit_state(L1, g);
+    L1->stack = stack;
+    L1->base_ci = base_ci;
+    L1->stacksize = stacksize;
+    L1->size_ci = size_ci;
+    stack_reset(L1);
+    luaC_link(L, obj2gco(L1), LUA_TTHREAD);
+    setthvalue(L, L->top, L1); /* put thread on stack */
+    incr_top(L);
+    stack_shrink(L, L1);
+  }
+  else {
+    L1 = tostate(luaM_malloc(L, state_size(lua_State)));
+    luaC_link(L, obj2gco(L1), LUA_TTHREAD);
+    setthvalue(L, L->top, L1); /* put thread on stack */
+    incr_top(L);
+    preinit_state(L1, g);
+    stack_init(L1, L);  /* init stack */
+  }
   setobj2n(L, gt(L1), gt(L));  /* share table of globals */
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
@@ -141,15 +197,38 @@ lua_State *luaE_newthread (lua_State *L) {
 }
 
 
+/*
+** dead threads go to the pool while it is below LUAI_THREADPOOL bytes;
+** nothing is allocated here, as this runs inside the collector
+*/
 void luaE_freethread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
   luaF_close(L1, L1->stack);  /* close all upvalues for this thread */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L1);
+  if (g->poolbytes + threadsize(L1) <= LUAI_THREADPOOL) {
+    g->poolbytes += threadsize(L1);
+    L1->next = obj2gco(g->threadpool);
+    g->threadpool = L1;
+    return;
+  }
   freestack(L, L1);
   luaM_freemem(L, fromstate(L1), state_size(lua_State));
 }
 
 
+void luaE_freethreadpool (lua_State *L) {
+  global_State *g = G(L);
+  while (g->threadpool != NULL) {
+    lua_State *L1 = g->threadpool;
+    g->threadpool = cast(lua_State *, L1->next);
+    freestack(L, L1);
+    luaM_freemem(L, fromstate(L1), state_size(lua_State));
+  }
+  g->poolbytes = 0;
+}
+
+
 LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   int i;
   lua_State *L;
@@ -167,6 +246,8 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->frealloc = f;
   g->ud = ud;
   g->mainthread = L;
+  g->threadpool = NULL;
+  g->poolbytes = 0;
   g->uvhead.u.l.prev = &g->uvhead;
   g->uvhead.u.l.next = &g->uvhead;
   g->GCthreshold = 0;  /* mark it as unfinished state */
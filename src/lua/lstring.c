@@ -51,20 +51,26 @@ void luaS_resize (lua_State *L, int newsize) {
   unset_resizing_strings_gc(L);
 }
 
-static TString *newlstr (lua_State *L, const char *str, size_t l,
-                                       unsigned int h, int readonly) {
-  TString *ts;
-  stringtable *tb;
+static unsigned int hashlstr (const char *str, size_t l) {
+  unsigned int h = cast(unsigned int, l);  /* seed */
+  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
+  size_t l1;
+  for (l1=l; l1>=step; l1-=step)  /* compute hash */
+    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+  return h;
+}
+
+
+static TString *allocstr (lua_State *L, size_t l, int readonly) {
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
     luaM_toobig(L);
-  tb = &G(L)->strt;
-  if ((tb->nuse + 1) > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
-    luaS_resize(L, tb->size*2);  /* too crowded */
-  ts = cast(TString *, luaM_malloc(L, readonly ? sizeof(char**)+sizeof(TString) : (l+1)*sizeof(char)+sizeof(TString)));
+  return cast(TString *, luaM_malloc(L, readonly ? sizeof(char**)+sizeof(TString) : (l+1)*sizeof(char)+sizeof(TString)));
+}
+
+
+static void setcontents (TString *ts, const char *str, size_t l,
+                                      int readonly) {
   ts->tsv.len = l;
-  ts->tsv.hash = h;
-  ts->tsv.marked = luaC_white(G(L));
-  ts->tsv.tt = LUA_TSTRING;
   if (!readonly) {
     memcpy(ts+1, str, l*sizeof(char));
     ((char *)(ts+1))[l] = '\0';  /* ending 0 */
@@ -72,6 +78,20 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
     *(char **)(ts+1) = (char *)str;
     luaS_readonly(ts);
   }
+}
+
+
+static TString *newlstr (lua_State *L, const char *str, size_t l,
+                                       unsigned int h, int readonly) {
+  TString *ts;
+  stringtable *tb = &G(L)->strt;
+  if ((tb->nuse + 1) > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
+    luaS_resize(L, tb->size*2);  /* too crowded */
+  ts = allocstr(L, l, readonly);
+  ts->tsv.hash = h;
+  ts->tsv.marked = luaC_white(G(L));
+  ts->tsv.tt = LUA_TSTRING;
+  setcontents(ts, str, l, readonly);
   h = lmod(h, tb->size);
   ts->tsv.next = tb->hash[h];  /* chain new entry */
   tb->hash[h] = obj2gco(ts);
@@ -80,13 +100,26 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
 }
 
 
+/*
+** long strings skip the string table: they are linked like any other
+** object and their hash is computed by `luaS_hashlong' when first needed
+*/
+static TString *newlngstr (lua_State *L, const char *str, size_t l,
+                                         int readonly) {
+  TString *ts = allocstr(L, l, readonly);
+  luaC_link(L, obj2gco(ts), LUA_TSTRING);
+  ts->tsv.hash = 0;
+  setcontents(ts, str, l, readonly);
+  return ts;
+}
+
+
 static TString *luaS_newlstr_helper (lua_State *L, const char *str, size_t l, int readonly) {
   GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
-  size_t l1;
-  for (l1=l; l1>=step; l1-=step)  /* compute hash */
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+  unsigned int h;
+  if (l > LUAI_MAXSHORTLEN)
+    return newlngstr(L, str, l, readonly);
+  h = hashlstr(str, l);
   for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
        o != NULL;
        o = o->gch.next) {
@@ -100,6 +133,25 @@ static TString *luaS_newlstr_helper (lua_State *L, const char *str, size_t l, in
   return newlstr(L, str, l, h, readonly);  /* not found */
 }
 
+
+int luaS_eqlngstr (TString *a, TString *b) {
+  size_t len = a->tsv.len;
+  lua_assert(luaS_islong(a));
+  return (a == b) ||  /* same instance or... */
+    ((len == b->tsv.len) &&  /* equal length and ... */
+     (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
+}
+
+
+unsigned int luaS_hashlong (TString *ts) {
+  lua_assert(luaS_islong(ts));
+  if (!testbit(ts->tsv.marked, LNGHASHBIT)) {
+    ts->tsv.hash = hashlstr(getstr(ts), ts->tsv.len);
+    l_setbit(ts->tsv.marked, LNGHASHBIT);
+  }
+  return ts->tsv.hash;
+}
+
 extern char stext;
 extern char etext;
 
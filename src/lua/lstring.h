@@ -22,6 +22,11 @@
 #define luaS_newliteral(L, s)  (luaS_newlstr(L, "" s, \
                                   (sizeof(s)/sizeof(char))-1))
 
+/* long strings are not interned, so they cannot be compared by address */
+#define luaS_islong(s)	((s)->tsv.len > LUAI_MAXSHORTLEN)
+#define luaS_eqstr(a,b)	((a) == (b) || (luaS_islong(a) && luaS_eqlngstr(a, b)))
+#define luaS_hash(s)	(luaS_islong(s) ? luaS_hashlong(s) : (s)->tsv.hash)
+
 #define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
 #define luaS_readonly(s) l_setbit((s)->tsv.marked, READONLYBIT)
 #define luaS_isreadonly(s) testbit((s)->marked, READONLYBIT)
@@ -30,5 +35,7 @@ LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_newrolstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
+LUAI_FUNC unsigned int luaS_hashlong (TString *ts);
 
 #endif
@@ -19,6 +19,9 @@
 #include "lauxlib.h"
 #include "lualib.h"
 #include "lrotable.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lstate.h"
 
 /* macro to `unsign' a character */
 #define uchar(c)        ((unsigned char)(c))
@@ -771,7 +774,7 @@ static int str_format (lua_State *L) {
       luaL_addchar(&b, *strfrmt++);  /* %% */
     else { /* format item */
       char form[MAX_FORMAT];  /* to store the format (`%...') */
-      char buff[MAX_ITEM];  /* to store the formatted item */
+      char *buff = luaL_prepbuffsize(&b, MAX_ITEM);  /* formatted item */
       if (++arg > top)
         luaL_argerror(L, arg, "no value");
       strfrmt = scanformat(L, strfrmt, form);
@@ -821,16 +824,197 @@ static int str_format (lua_State *L) {
                                LUA_QL("format"), *(strfrmt - 1));
         }
       }
-      luaL_addlstring(&b, buff, strlen(buff));
+      luaL_addsize(&b, strlen(buff));
     }
   }
   luaL_pushresult(&b);
   return 1;
 }
 
+/*
+** {======================================================
+** STRING BUILDER
+** =======================================================
+*/
+
+#define LUA_STRBUILDER		"STRBUILDER*"
+
+/* text is kept in a heap block, so nothing is interned until `tostring';
+** the block is allocated through the core, so it counts for the collector
+** and the memory limit */
+typedef struct StrBuilder {
+  char *b;  /* heap block (NULL while nothing was reserved) */
+  size_t n;  /* number of characters in use */
+  size_t size;  /* size of `b' */
+} StrBuilder;
+
+#define tobuilder(L)	((StrBuilder *)luaL_checkudata(L, 1, LUA_STRBUILDER))
+
+
+static char *sb_reserve (lua_State *L, StrBuilder *sb, size_t l) {
+  if (sb->size - sb->n < l) {  /* not enough space? */
+    size_t newsize = sb->size * 2;
+    if (newsize - sb->n < l)
+      newsize = sb->n + l;
+    if (newsize < sb->n || newsize - sb->n < l)
+      luaL_error(L, "string builder too large");
+    sb->b = (char *)luaM_realloc_(L, sb->b, sb->size, newsize);
+    sb->size = newsize;
+    luaC_checkGC(L);
+  }
+  return sb->b + sb->n;
+}
+
+
+static StrBuilder *sb_test (lua_State *L, int idx) {
+  StrBuilder *sb = (StrBuilder *)lua_touserdata(L, idx);
+  if (sb != NULL && lua_getmetatable(L, idx)) {
+    luaL_getmetatable(L, LUA_STRBUILDER);
+    if (!lua_rawequal(L, -1, -2))
+      sb = NULL;
+    lua_pop(L, 2);
+    return sb;
+  }
+  return NULL;
+}
+
+
+/* append the string, number or builder at `idx'; 0 for other values */
+static int sb_addvalue (lua_State *L, StrBuilder *sb, int idx) {
+  switch (lua_type(L, idx)) {
+    case LUA_TNUMBER: {
+      char *b = sb_reserve(L, sb, LUAI_MAXNUMBER2STR);
+      sb->n += lua_number2str(b, lua_tonumber(L, idx));
+      return 1;
+    }
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, idx, &l);
+      memcpy(sb_reserve(L, sb, l), s, l);
+      sb->n += l;
+      return 1;
+    }
+    case LUA_TUSERDATA: {
+      StrBuilder *other = sb_test(L, idx);
+      size_t l;
+      if (other == NULL) return 0;
+      l = other->n;
+      sb_reserve(L, sb, l);  /* may move `other->b' if other == sb */
+      if (l > 0) memcpy(sb->b + sb->n, other->b, l);
+      sb->n += l;
+      return 1;
+    }
+    default: return 0;
+  }
+}
+
+
+static int sb_new (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  StrBuilder *sb;
+  luaL_argcheck(L, size >= 0, 1, "invalid size");
+  sb = (StrBuilder *)lua_newuserdata(L, sizeof(StrBuilder));
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_getmetatable(L, LUA_STRBUILDER);
+  lua_setmetatable(L, -2);
+  if (size > 0)
+    sb_reserve(L, sb, (size_t)size);
+  return 1;
+}
+
+
+static int sb_append (lua_State *L) {
+  StrBuilder *sb = tobuilder(L);
+  int top = lua_gettop(L);
+  int i;
+  for (i = 2; i <= top; i++) {
+    if (!sb_addvalue(L, sb, i))
+      luaL_typerror(L, i, "string");
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/* sb:append_array(t [, sep [, i [, j]]]), the same as table.concat */
+static int sb_appendarray (lua_State *L) {
+  StrBuilder *sb = tobuilder(L);
+  size_t lsep;
+  int i, last;
+  const char *sep = luaL_optlstring(L, 3, "", &lsep);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  i = luaL_optint(L, 4, 1);
+  last = luaL_opt(L, luaL_checkint, 5, luaL_getn(L, 2));
+  for (; i <= last; i++) {
+    lua_rawgeti(L, 2, i);
+    if (!sb_addvalue(L, sb, -1))
+      luaL_error(L, "invalid value (%s) at index %d in table for "
+                    LUA_QL("append_array"), luaL_typename(L, -1), i);
+    lua_pop(L, 1);
+    if (i < last && lsep > 0) {
+      memcpy(sb_reserve(L, sb, lsep), sep, lsep);
+      sb->n += lsep;
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int sb_tostring (lua_State *L) {
+  StrBuilder *sb = tobuilder(L);
+  lua_pushlstring(L, sb->n > 0 ? sb->b : "", sb->n);
+  return 1;
+}
+
+
+/* the block is kept, so a builder reused for every line stops allocating */
+static int sb_reset (lua_State *L) {
+  StrBuilder *sb = tobuilder(L);
+  sb->n = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int sb_len (lua_State *L) {
+  lua_pushinteger(L, tobuilder(L)->n);
+  return 1;
+}
+
+
+static int sb_gc (lua_State *L) {
+  StrBuilder *sb = tobuilder(L);
+  if (sb->b != NULL) {
+    luaM_freemem(L, sb->b, sb->size);
+    sb->b = NULL;
+    sb->n = sb->size = 0;
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
 #define MIN_OPT_LEVEL 1
 #include "lrodefs.h"
+const LUA_REG_TYPE sblib[] = {
+  {LSTRKEY("append"), LFUNCVAL(sb_append)},
+  {LSTRKEY("append_array"), LFUNCVAL(sb_appendarray)},
+  {LSTRKEY("reset"), LFUNCVAL(sb_reset)},
+  {LSTRKEY("tostring"), LFUNCVAL(sb_tostring)},
+  {LSTRKEY("__gc"), LFUNCVAL(sb_gc)},
+  {LSTRKEY("__len"), LFUNCVAL(sb_len)},
+  {LSTRKEY("__tostring"), LFUNCVAL(sb_tostring)},
+#if LUA_OPTIMIZE_MEMORY > 0
+  {LSTRKEY("__index"), LROVAL(sblib)},
+#endif
+  {LNILKEY, LNILVAL}
+};
+
 const LUA_REG_TYPE strlib[] = {
+  {LSTRKEY("builder"), LFUNCVAL(sb_new)},
   {LSTRKEY("byte"), LFUNCVAL(str_byte)},
   {LSTRKEY("char"), LFUNCVAL(str_char)},
   {LSTRKEY("dump"), LFUNCVAL(str_dump)},
@@ -870,10 +1054,23 @@ static void createmetatable (lua_State *L) {
 }
 #endif
 
+static void createbuildermeta (lua_State *L) {
+#if LUA_OPTIMIZE_MEMORY == 0
+  luaL_newmetatable(L, LUA_STRBUILDER);  /* create metatable for builders */
+  lua_pushvalue(L, -1);  /* push metatable */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  luaL_register(L, NULL, sblib);  /* builder methods */
+#else
+  luaL_rometatable(L, LUA_STRBUILDER, (void*)sblib);
+#endif
+  lua_pop(L, 1);  /* pop metatable */
+}
+
 /*
 ** Open string library
 */
 LUALIB_API int luaopen_string (lua_State *L) {
+  createbuildermeta(L);
 #if LUA_OPTIMIZE_MEMORY == 0
   luaL_register(L, LUA_STRLIBNAME, strlib);
 #if defined(LUA_COMPAT_GFIND)
@@ -32,6 +32,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "ltable.h"
 #include "lrotable.h"
 
@@ -49,7 +50,7 @@
 
 #define hashpow2(t,n)      (gnode(t, lmod((n), sizenode(t))))
   
-#define hashstr(t,str)  hashpow2(t, (str)->tsv.hash)
+#define hashstr(t,str)  hashpow2(t, luaS_hash(str))
 #define hashboolean(t,p)        hashpow2(t, p)
 
 
@@ -508,6 +509,28 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
 }
 
 
+/*
+** remove every entry of a table but keep its array and hash storage, so
+** that refilling it doesn't allocate
+*/
+void luaH_clear (Table *t) {
+  int i;
+  for (i=0; i<t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (t->node != dummynode) {
+    int size = sizenode(t);
+    for (i=0; i<size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = NULL;
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* every node is free again */
+  }
+  t->flags = cast_byte(~0);  /* no metamethods left in it */
+}
+
+
 void luaH_free (lua_State *L, Table *t) {
   if (t->node != dummynode)
     luaM_freearray(L, t->node, sizenode(t), Node);
@@ -588,8 +611,10 @@ const TValue *luaH_getnum_ro (void *t, int key) {
 */
 const TValue *luaH_getstr (Table *t, TString *key) {
   Node *n = hashstr(t, key);
+  int islong = luaS_islong(key);
   do {  /* check whether `key' is somewhere in the chain */
-    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
+    if (ttisstring(gkey(n)) && (rawtsvalue(gkey(n)) == key ||
+        (islong && luaS_eqlngstr(key, rawtsvalue(gkey(n))))))
       return gval(n);  /* that's it */
     else n = gnext(n);
   } while (n);
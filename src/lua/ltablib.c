@@ -5,7 +5,9 @@
 */
 
 
+#include <limits.h>
 #include <stddef.h>
+#include <string.h>
 
 #define ltablib_c
 #define LUA_LIB
@@ -133,6 +135,76 @@ static int tremove (lua_State *L) {
 }
 
 
+/*
+** table.new(narr, nrec): an empty table with room for 'narr' array items
+** and 'nrec' other fields, so filling it doesn't rehash
+*/
+static int tnew (lua_State *L) {
+  int narr = luaL_optint(L, 1, 0);
+  int nrec = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narr >= 0, 1, "negative size");
+  luaL_argcheck(L, nrec >= 0, 2, "negative size");
+  lua_createtable(L, narr, nrec);
+  return 1;
+}
+
+
+/* table.clear(t): removes every field of 't' but keeps its storage */
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
+/*
+** table.move(a1, f, e, t [, a2]): a2[t..t+e-f] = a1[f..e], with raw
+** accesses like the rest of this library; returns a2 (defaults to a1)
+*/
+static int tmove (lua_State *L) {
+  int f = luaL_checkint(L, 2);
+  int e = luaL_checkint(L, 3);
+  int t = luaL_checkint(L, 4);
+  int tt = !lua_isnoneornil(L, 5) ? 5 : 1;  /* destination table */
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, tt, LUA_TTABLE);
+  if (e >= f) {  /* otherwise, nothing to move */
+    int n, i;
+    luaL_argcheck(L, f > 0 || e < INT_MAX + f, 3, "too many elements to move");
+    n = e - f + 1;  /* number of elements to move */
+    luaL_argcheck(L, t <= INT_MAX - n + 1, 4, "destination wrap around");
+    if (t > e || t <= f || (tt != 1 && !lua_rawequal(L, 1, tt))) {
+      for (i = 0; i < n; i++) {
+        lua_rawgeti(L, 1, f + i);
+        lua_rawseti(L, tt, t + i);
+      }
+    }
+    else {  /* overlapping move to the right: copy backwards */
+      for (i = n - 1; i >= 0; i--) {
+        lua_rawgeti(L, 1, f + i);
+        lua_rawseti(L, tt, t + i);
+      }
+    }
+  }
+  lua_pushvalue(L, tt);
+  return 1;
+}
+
+
+/* table.pack(...): the arguments in a presized array, with the count in 'n' */
+static int tpack (lua_State *L) {
+  int i;
+  int n = lua_gettop(L);  /* number of elements to pack */
+  lua_createtable(L, n, 1);
+  lua_insert(L, 1);  /* put it at index 1 */
+  for (i = n; i >= 1; i--)  /* assign elements from the top */
+    lua_rawseti(L, 1, i);
+  lua_pushinteger(L, n);
+  lua_setfield(L, 1, "n");
+  return 1;
+}
+
+
 static void addfield (lua_State *L, luaL_Buffer *b, int i) {
   lua_rawgeti(L, 1, i);
   if (!lua_isstring(L, -1))
@@ -165,9 +237,9 @@ static int tconcat (lua_State *L) {
 
 /*
 ** {======================================================
-** Quicksort
-** (based on `Algorithms in MODULA-3', Robert Sedgewick;
-**  Addison-Wesley, 1993.)
+** Introsort: quicksort (based on `Algorithms in MODULA-3', Robert
+** Sedgewick; Addison-Wesley, 1993.) that switches to heapsort when the
+** recursion gets too deep, so the worst case stays O(n log n)
 */
 
 
@@ -176,7 +248,28 @@ static void set2 (lua_State *L, int i, int j) {
   lua_rawseti(L, 1, j);
 }
 
+/* push the sort key of the element at 'idx' (key mode of table.sort) */
+static void sort_pushkey (lua_State *L, int idx) {
+  int t;
+  if (!lua_istable(L, idx))
+    luaL_error(L, "invalid value (%s) in table for " LUA_QL("sort"),
+                  luaL_typename(L, idx));
+  lua_pushvalue(L, 2);
+  lua_rawget(L, idx < 0 ? idx-1 : idx);
+  t = lua_type(L, -1);
+  if (t != LUA_TNUMBER && t != LUA_TSTRING)
+    luaL_error(L, "invalid sort key (%s)", luaL_typename(L, -1));
+}
+
 static int sort_comp (lua_State *L, int a, int b) {
+  if (lua_type(L, 2) == LUA_TSTRING || lua_type(L, 2) == LUA_TNUMBER) {
+    int res;  /* key mode: compare the keys of the elements */
+    sort_pushkey(L, a);
+    sort_pushkey(L, b < 0 ? b-1 : b);
+    res = lua_lessthan(L, -2, -1);
+    lua_pop(L, 2);
+    return res;
+  }
   if (!lua_isnil(L, 2)) {  /* function? */
     int res;
     lua_pushvalue(L, 2);
@@ -191,9 +284,48 @@ static int sort_comp (lua_State *L, int a, int b) {
     return lua_lessthan(L, a, b);
 }
 
-static void auxsort (lua_State *L, int l, int u) {
+/* sift down heap node 'i' of the 'n' node heap stored in a[lo..lo+n-1] */
+static void siftdown (lua_State *L, int lo, int i, int n) {
+  int c;
+  while ((c = 2*i) <= n) {
+    if (c < n) {  /* pick the larger child */
+      lua_rawgeti(L, 1, lo+c);
+      lua_rawgeti(L, 1, lo+c-1);
+      if (sort_comp(L, -1, -2))  /* a[c] < a[c+1]? */
+        c++;
+      lua_pop(L, 2);
+    }
+    lua_rawgeti(L, 1, lo+i-1);
+    lua_rawgeti(L, 1, lo+c-1);
+    if (!sort_comp(L, -2, -1)) {  /* a[i] >= a[c]? */
+      lua_pop(L, 2);
+      break;
+    }
+    set2(L, lo+i-1, lo+c-1);  /* swap a[i] - a[c] */
+    i = c;
+  }
+}
+
+static void auxheapsort (lua_State *L, int l, int u) {
+  int n = u-l+1;
+  int i;
+  for (i = n/2; i >= 1; i--)
+    siftdown(L, l, i, n);
+  for (i = n; i > 1; i--) {
+    lua_rawgeti(L, 1, l);
+    lua_rawgeti(L, 1, l+i-1);
+    set2(L, l, l+i-1);  /* move the largest element after the heap */
+    siftdown(L, l, 1, i-1);
+  }
+}
+
+static void auxsort (lua_State *L, int l, int u, int depth) {
   while (l < u) {  /* for tail recursion */
     int i, j;
+    if (depth-- == 0) {  /* too many bad pivots? */
+      auxheapsort(L, l, u);
+      return;
+    }
     /* sort elements a[l], a[(l+u)/2] and a[u] */
     lua_rawgeti(L, 1, l);
     lua_rawgeti(L, 1, u);
@@ -250,17 +382,216 @@ static void auxsort (lua_State *L, int l, int u) {
     else {
       j=i+1; i=u; u=j-2;
     }
-    auxsort(L, j, i);  /* call recursively the smaller one */
+    auxsort(L, j, i, depth);  /* call recursively the smaller one */
   }  /* repeat the routine for the larger one */
 }
 
+/* recursion depth allowed before switching to heapsort: 2*log2(n) */
+static int sort_depth (int n) {
+  int depth = 0;
+  while (n > 1) {
+    n >>= 1;
+    depth += 2;
+  }
+  return depth;
+}
+
+
+/*
+** Native sort. When all the sort keys are numbers, or all are strings,
+** they are copied into a C array, sorted there with the same introsort
+** and no calls back into Lua, and the elements are then permuted in place.
+** The keys are the elements themselves, or their field 'key' in the key
+** mode of table.sort.
+*/
+
+typedef struct sortkey {
+  union {
+    lua_Number n;
+    const char *s;  /* strings stay alive in the table while sorting */
+  } k;
+  size_t len;
+  int idx;  /* index of the element in the table */
+} sortkey;
+
+typedef int (*sortkey_lt) (const sortkey *a, const sortkey *b);
+
+static int numkey_lt (const sortkey *a, const sortkey *b) {
+  return a->k.n < b->k.n;
+}
+
+/* same order as the `<' operator, see l_strcmp in lvm.c */
+static int strkey_lt (const sortkey *a, const sortkey *b) {
+  const char *l = a->k.s;
+  size_t ll = a->len;
+  const char *r = b->k.s;
+  size_t lr = b->len;
+  for (;;) {
+    int temp = strcoll(l, r);
+    if (temp != 0) return temp < 0;
+    else {  /* strings are equal up to a `\0' */
+      size_t len = strlen(l);  /* index of first `\0' in both strings */
+      if (len == lr)  /* r is finished? */
+        return 0;
+      else if (len == ll)  /* l is finished? */
+        return 1;
+      len++;
+      l += len; ll -= len; r += len; lr -= len;
+    }
+  }
+}
+
+#define swapkeys(a,i,j)	{ sortkey t_ = a[i]; a[i] = a[j]; a[j] = t_; }
+
+static void keys_siftdown (sortkey *a, int i, int n, sortkey_lt lt) {
+  int c;
+  while ((c = 2*i+1) < n) {
+    if (c+1 < n && lt(&a[c], &a[c+1]))
+      c++;
+    if (!lt(&a[i], &a[c]))
+      break;
+    swapkeys(a, i, c);
+    i = c;
+  }
+}
+
+static void keys_sort (sortkey *a, int l, int u, int depth, sortkey_lt lt) {
+  while (u-l > 8) {
+    sortkey p;
+    int i, j;
+    if (depth-- == 0) {  /* too many bad pivots: heapsort a[l..u] */
+      int n = u-l+1;
+      for (i = n/2-1; i >= 0; i--)
+        keys_siftdown(a+l, i, n, lt);
+      for (i = n-1; i > 0; i--) {
+        swapkeys(a, l, l+i);
+        keys_siftdown(a+l, 0, i, lt);
+      }
+      return;
+    }
+    /* median of a[l], a[(l+u)/2] and a[u] as pivot */
+    i = (l+u)/2;
+    if (lt(&a[u], &a[l])) swapkeys(a, l, u);
+    if (lt(&a[i], &a[l])) swapkeys(a, i, l)
+    else if (lt(&a[u], &a[i])) swapkeys(a, i, u);
+    p = a[i];
+    /* Hoare partition: a[l..j] <= P <= a[j+1..u], with l <= j < u */
+    i = l-1; j = u+1;
+    for (;;) {
+      do i++; while (lt(&a[i], &p));
+      do j--; while (lt(&p, &a[j]));
+      if (i >= j) break;
+      swapkeys(a, i, j);
+    }
+    if (j-l < u-j) {  /* recurse into the smaller half */
+      keys_sort(a, l, j, depth, lt);
+      l = j+1;
+    }
+    else {
+      keys_sort(a, j+1, u, depth, lt);
+      u = j;
+    }
+  }
+  for (; l < u; l++) {  /* insertion sort for the last few elements */
+    sortkey k = a[l+1];
+    int i = l;
+    while (i >= 0 && lt(&k, &a[i])) {
+      a[i+1] = a[i];
+      i--;
+    }
+    a[i+1] = k;
+  }
+}
+
+/* does a scratch block of 'size' bytes fit under the memory limit? */
+static int keysort_fits (lua_State *L, size_t size) {
+  int limit = lua_gc(L, LUA_GCGETMEMLIMIT, 0);
+  return limit <= 0 || lua_gc(L, LUA_GCCOUNT, 0) + (int)(size / 1024) + 1 < limit;
+}
+
+/*
+** Sort t[1..n] natively. Returns 0 (with the table untouched) if the keys
+** can't be compared natively, or if the table is larger than
+** LUAI_MAXKEYSORT or its keys would not fit under the memory limit; in
+** the key mode (key at stack index 2) bad keys are errors instead.
+*/
+static int keysort (lua_State *L, int n, int bykey) {
+  sortkey *keys;
+  int type = LUA_TNONE;
+  int i;
+  if (n < 2) return 1;
+  if (n > LUAI_MAXKEYSORT || !keysort_fits(L, n * sizeof(sortkey)))
+    return 0;
+  /* the block is counted by the collector and freed by it on errors */
+  keys = (sortkey *)lua_newuserdata(L, n * sizeof(sortkey));
+  for (i = 0; i < n; i++) {
+    int t;
+    lua_rawgeti(L, 1, i+1);
+    if (bykey) {
+      if (!lua_istable(L, -1))
+        luaL_error(L, "invalid value (%s) at index %d in table for "
+                      LUA_QL("sort"), luaL_typename(L, -1), i+1);
+      lua_pushvalue(L, 2);
+      lua_rawget(L, -2);
+      lua_remove(L, -2);  /* keep only the key */
+    }
+    t = lua_type(L, -1);
+    if (type == LUA_TNONE && (t == LUA_TNUMBER || t == LUA_TSTRING))
+      type = t;
+    if (t != type) {
+      if (!bykey) {
+        lua_pop(L, 2);  /* key and block */
+        return 0;
+      }
+      luaL_error(L, "invalid sort key (%s) at index %d", luaL_typename(L, -1), i+1);
+    }
+    if (t == LUA_TNUMBER)
+      keys[i].k.n = lua_tonumber(L, -1);
+    else
+      keys[i].k.s = lua_tolstring(L, -1, &keys[i].len);
+    keys[i].idx = i+1;
+    lua_pop(L, 1);
+  }
+  keys_sort(keys, 0, n-1, sort_depth(n), type == LUA_TNUMBER ? numkey_lt : strkey_lt);
+  /* permute the elements: t[k+1] = t[keys[k].idx], following the cycles */
+  for (i = 0; i < n; i++) {
+    int pos = i;
+    if (keys[i].idx == 0 || keys[i].idx == i+1) continue;
+    lua_rawgeti(L, 1, i+1);  /* first element to be overwritten */
+    while (keys[pos].idx != i+1) {
+      int src = keys[pos].idx;
+      lua_rawgeti(L, 1, src);
+      lua_rawseti(L, 1, pos+1);
+      keys[pos].idx = 0;
+      pos = src-1;
+    }
+    lua_rawseti(L, 1, pos+1);
+    keys[pos].idx = 0;
+  }
+  lua_pop(L, 1);  /* block */
+  return 1;
+}
+
+/*
+** table.sort(t [, comp]) or table.sort(t, key): the second form orders
+** the tables in 't' by their field 'key' (a string or a number), which
+** must be all numbers or all strings
+*/
 static int sort (lua_State *L) {
   int n = aux_getn(L, 1);
   luaL_checkstack(L, 40, "");  /* assume array is smaller than 2^40 */
+  if (lua_type(L, 2) == LUA_TSTRING || lua_type(L, 2) == LUA_TNUMBER) {
+    lua_settop(L, 2);
+    if (!keysort(L, n, 1))
+      auxsort(L, 1, n, sort_depth(n));
+    return 0;
+  }
   if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
     luaL_checktype(L, 2, LUA_TFUNCTION);
   lua_settop(L, 2);  /* make sure there is two arguments */
-  auxsort(L, 1, n);
+  if (lua_isnil(L, 2) && keysort(L, n, 0))
+    return 0;
+  auxsort(L, 1, n, sort_depth(n));
   return 0;
 }
 
@@ -270,12 +601,16 @@ static int sort (lua_State *L) {
 #define MIN_OPT_LEVEL 1
 #include "lrodefs.h"
 const LUA_REG_TYPE tab_funcs[] = {
+  {LSTRKEY("clear"), LFUNCVAL(tclear)},
   {LSTRKEY("concat"), LFUNCVAL(tconcat)},
   {LSTRKEY("foreach"), LFUNCVAL(foreach)},
   {LSTRKEY("foreachi"), LFUNCVAL(foreachi)},
   {LSTRKEY("getn"), LFUNCVAL(getn)},
   {LSTRKEY("maxn"), LFUNCVAL(maxn)},
   {LSTRKEY("insert"), LFUNCVAL(tinsert)},
+  {LSTRKEY("move"), LFUNCVAL(tmove)},
+  {LSTRKEY("new"), LFUNCVAL(tnew)},
+  {LSTRKEY("pack"), LFUNCVAL(tpack)},
   {LSTRKEY("remove"), LFUNCVAL(tremove)},
   {LSTRKEY("setn"), LFUNCVAL(setn)},
   {LSTRKEY("sort"), LFUNCVAL(sort)},
@@ -29,6 +29,8 @@
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int optimizing=0;		/* optimize bytecodes? */
+static int reporting=0;			/* report optimizer gains? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -58,7 +60,9 @@ static void usage(const char* message)
  "  -        process stdin\n"
  "  -l       list\n"
  "  -o name  output to file " LUA_QL("name") " (default is \"%s\")\n"
+ "  -O       optimize bytecodes\n"
  "  -p       parse only\n"
+ "  -r       report instruction count and size before and after " LUA_QL("-O") "\n"
  "  -s       strip debug information\n"
  "  -v       show version information\n"
  "  -cci bits       cross-compile with given integer size\n"
@@ -96,8 +100,12 @@ static int doargs(int argc, char* argv[])
    if (output==NULL || *output==0) usage(LUA_QL("-o") " needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
+  else if (IS("-r"))			/* report optimizer gains */
+   reporting=1;
   else if (IS("-s"))			/* strip debug information */
    stripping=1;
   else if (IS("-v"))			/* show version */
@@ -147,7 +155,7 @@ static int doargs(int argc, char* argv[])
 
 #define toproto(L,i) (clvalue(L->top+(i))->l.p)
 
-static const Proto* combine(lua_State* L, int n)
+static Proto* combine(lua_State* L, int n)
 {
  if (n==1)
   return toproto(L,-1);
@@ -181,6 +189,54 @@ static int writer(lua_State* L, const void* p, size_t size, void* u)
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+static int counter(lua_State* L, const void* p, size_t size, void* u)
+{
+ UNUSED(L); UNUSED(p);
+ *(size_t*)u+=size;
+ return 0;
+}
+
+static int countcode(const Proto* f)
+{
+ int i,n=f->sizecode;
+ for (i=0; i<f->sizep; i++) n+=countcode(f->p[i]);
+ return n;
+}
+
+static size_t imagesize(lua_State* L, const Proto* f)
+{
+ size_t size=0;
+ lua_lock(L);
+ luaU_dump_crosscompile(L,f,counter,&size,stripping,target);
+ lua_unlock(L);
+ return size;
+}
+
+static double percent(double before, double after)
+{
+ return before==0 ? 0 : 100*(after-before)/before;
+}
+
+static void optimize(lua_State* L, Proto* f)
+{
+ int code=0;
+ size_t size=0;
+ if (reporting)
+ {
+  code=countcode(f);
+  size=imagesize(L,f);
+ }
+ if (!luaU_optimize(L,f,stripping,&target)) fatal("optimizer generated invalid code");
+ if (reporting)
+ {
+  int ncode=countcode(f);
+  size_t nsize=imagesize(L,f);
+  fprintf(stderr,"%s: %s: %d -> %d instructions (%+.1f%%), %lu -> %lu bytes (%+.1f%%)\n",
+   progname,output==NULL ? "stdout" : output,code,ncode,percent(code,ncode),
+   (unsigned long)size,(unsigned long)nsize,percent(size,nsize));
+ }
+}
+
 struct Smain {
  int argc;
  char** argv;
@@ -191,7 +247,7 @@ static int pmain(lua_State* L)
  struct Smain* s = (struct Smain*)lua_touserdata(L, 1);
  int argc=s->argc;
  char** argv=s->argv;
- const Proto* f;
+ Proto* f;
  int i;
  if (!lua_checkstack(L,argc)) fatal("too many input files");
  for (i=0; i<argc; i++)
@@ -200,6 +256,7 @@ static int pmain(lua_State* L)
   if (luaL_loadfile(L,filename)!=0) fatal(lua_tostring(L,-1));
  }
  f=combine(L,argc);
+ if (optimizing) optimize(L,f);
  if (listing) luaU_print(f,listing>1);
  if (dumping)
  {
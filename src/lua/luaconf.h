@@ -523,6 +523,40 @@
 #define LUAI_MAXCCALLS		200
 
 
+/*
+@@ LUAI_THREADPOOL is the maximum number of bytes held by dead coroutines
+@* kept for reuse by coroutine.create (0 disables the pool).
+** CHANGE it if your program creates many short-lived coroutines. A dead
+** coroutine with a basic size stack takes about 1K on 32 bit targets; its
+** stack is shrunk back to that size when it is reused. Full collections
+** (and so the emergency GC) empty the pool.
+*/
+#define LUAI_THREADPOOL		4096
+
+
+/*
+@@ LUAI_MAXKEYSORT is the largest table that table.sort sorts natively.
+** The native sort copies the keys into a scratch block (12 to 24 bytes
+** per element); larger tables, or tables whose block would not fit under
+** the memory limit, are sorted in place. CHANGE it to trade RAM for speed.
+*/
+#if defined(ELUA_PLATFORM)
+#define LUAI_MAXKEYSORT		256
+#else
+#define LUAI_MAXKEYSORT		INT_MAX
+#endif
+
+
+/*
+@@ LUAI_MAXSHORTLEN is the maximum length of a string kept in the string
+@* table. Longer strings (packets, file chunks) are not interned; they are
+@* hashed only if used as a table key and compared by contents.
+** CHANGE it if your program keeps many copies of the same long string:
+** those are no longer shared.
+*/
+#define LUAI_MAXSHORTLEN	40
+
+
 /*
 @@ LUAI_MAXVARS is the maximum number of local variables per function
 @* (must be smaller than 250).
@@ -539,8 +573,21 @@
 
 /*
 @@ LUAL_BUFFERSIZE is the buffer size used by the lauxlib buffer system.
-*/
+** CHANGE it (or define it when building) to trade C stack for speed. This
+** much is reserved on the C stack by every function that builds a string;
+** longer results continue in a heap block, so a small value is fine for
+** targets with little stack. Keep it above 128 (the largest item built by
+** string.format) or every call to string.format will use the heap.
+** eLua images default to 256; host builds (luarpc, the cross compiler and
+** the plain Lua makefile) keep BUFSIZ.
+*/
+#ifndef LUAL_BUFFERSIZE
+#if defined(ELUA_PLATFORM)
+#define LUAL_BUFFERSIZE		256
+#else
 #define LUAL_BUFFERSIZE		BUFSIZ
+#endif
+#endif
 
 /* }================================================================== */
 
@@ -2,11 +2,21 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 
 #ifdef WIN32_BUILD
 #include <malloc.h>
+#include <windows.h>
 #else
 #include <alloca.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 #endif
 
 #include "lua.h"
@@ -32,6 +42,115 @@ void transport_open( Transport *tpt, const char *path );
 void transport_init (Transport *tpt)
 {
   tpt->fd = INVALID_TRANSPORT;
+  tpt->sock = 0;
+}
+
+#ifndef WIN32_BUILD
+
+// Stream sockets can be used instead of serial ports, which makes it easy to
+// talk to many local peers (simulated nodes, the multiplexer's tcp/unix
+// services) at the same time
+#define TRANSPORT_TCP_PREFIX        "tcp:"
+#define TRANSPORT_UNIX_PREFIX       "unix:"
+#define TRANSPORT_TCP_DEFAULT_HOST  "127.0.0.1"
+#define TRANSPORT_LISTEN_BACKLOG    4
+#define TRANSPORT_SOCKET_TIMEOUT    10
+
+static void transport_socket_error( int fd, int errnum )
+{
+  struct exception e;
+
+  if( fd != -1 )
+    close( fd );
+  e.errnum = errnum;
+  e.type = fatal;
+  Throw( e );
+}
+
+// Open 'tcp:[host:]port' or 'unix:path' as a client or a listener.
+// Returns 0 if 'path' doesn't name a socket.
+static int transport_open_socket( Transport *tpt, const char *path, int listener )
+{
+  struct addrinfo hints, *res = NULL;
+  struct sockaddr_un sun;
+  struct sockaddr *addr;
+  socklen_t addrlen;
+  struct timeval tv;
+  char host[ 256 ];
+  const char *c;
+  int fd, on = 1, err;
+
+  if( !strncmp( path, TRANSPORT_TCP_PREFIX, strlen( TRANSPORT_TCP_PREFIX ) ) )
+  {
+    path += strlen( TRANSPORT_TCP_PREFIX );
+    if( ( c = strrchr( path, ':' ) ) != NULL )
+      snprintf( host, sizeof( host ), "%.*s", ( int )( c - path ), path );
+    else
+    {
+      strcpy( host, TRANSPORT_TCP_DEFAULT_HOST );
+      c = path - 1;
+    }
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listener ? AI_PASSIVE : 0;
+    if( getaddrinfo( host, c + 1, &hints, &res ) != 0 )
+      transport_socket_error( -1, EADDRNOTAVAIL );
+    fd = socket( res->ai_family, res->ai_socktype, res->ai_protocol );
+    addr = res->ai_addr;
+    addrlen = res->ai_addrlen;
+  }
+  else if( !strncmp( path, TRANSPORT_UNIX_PREFIX, strlen( TRANSPORT_UNIX_PREFIX ) ) )
+  {
+    path += strlen( TRANSPORT_UNIX_PREFIX );
+    if( strlen( path ) >= sizeof( sun.sun_path ) )
+      transport_socket_error( -1, ENAMETOOLONG );
+    memset( &sun, 0, sizeof( sun ) );
+    sun.sun_family = AF_UNIX;
+    strcpy( sun.sun_path, path );
+    if( listener )
+      unlink( path );
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    addr = ( struct sockaddr * )&sun;
+    addrlen = sizeof( sun );
+  }
+  else
+    return 0;
+
+  if( fd == -1 )
+    err = -1;
+  else if( listener )
+  {
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+    if( ( err = bind( fd, addr, addrlen ) ) == 0 )
+      err = listen( fd, TRANSPORT_LISTEN_BACKLOG );
+  }
+  else if( ( err = connect( fd, addr, addrlen ) ) == 0 )
+  {
+    // same read timeout as the serial ports
+    tv.tv_sec = TRANSPORT_SOCKET_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+  }
+  if( res )
+    freeaddrinfo( res );
+  if( err == -1 )
+    transport_socket_error( fd, transport_errno );
+  tpt->fd = fd;
+  tpt->sock = listener;
+  return 1;
+}
+
+#endif // #ifndef WIN32_BUILD
+
+static void transport_open_path( Transport *tpt, const char *path, int listener )
+{
+#ifndef WIN32_BUILD
+  if( transport_open_socket( tpt, path, listener ) )
+    return;
+#endif
+  transport_open( tpt, path );
 }
 
 void transport_open( Transport *tpt, const char *path )
@@ -58,7 +177,7 @@ void transport_open_listener(lua_State *L, ServerHandle *handle)
   if (!lua_isstring (L,1))
     luaL_error(L,"first argument must be serial serial port");
 
-  transport_open( &handle->ltpt, lua_tostring (L,1) );
+  transport_open_path( &handle->ltpt, lua_tostring (L,1), 1 );
     
   while( transport_readable( &handle->ltpt ) == 0 ); // wait for incoming data
 }
@@ -70,7 +189,7 @@ int transport_open_connection(lua_State *L, Handle *handle)
   if (!lua_isstring (L,1))
     luaL_error(L,"first argument must be serial serial port");
 
-  transport_open( &handle->tpt, lua_tostring (L,1) );
+  transport_open_path( &handle->tpt, lua_tostring (L,1), 0 );
   
   return 1;
 }
@@ -82,6 +201,25 @@ void transport_accept (Transport *tpt, Transport *atpt)
   TRANSPORT_VERIFY_OPEN;
   while( transport_readable( tpt ) == 0 ); // wait for incoming data
   
+#ifndef WIN32_BUILD
+  if( tpt->sock )
+  {
+    struct timeval tv;
+    int on = 1;
+
+    if( ( atpt->fd = accept( tpt->fd, NULL, NULL ) ) == -1 )
+    {
+      e.errnum = transport_errno;
+      e.type = nonfatal;
+      Throw( e );
+    }
+    tv.tv_sec = TRANSPORT_SOCKET_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt( atpt->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    setsockopt( atpt->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+    return;
+  }
+#endif
   atpt->fd = tpt->fd;
 }
 
@@ -99,8 +237,8 @@ void transport_read_buffer (Transport *tpt, u8 *buffer, int length)
 
     n = ser_read( tpt->fd, buffer, length );
     
-    // error handling
-    if( n == 0 )
+    // error handling (sockets report their receive timeout as EAGAIN)
+    if( n == 0 || ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) )
     {
       e.errnum = ERR_NODATA;
       e.type = nonfatal;
@@ -119,6 +257,44 @@ void transport_read_buffer (Transport *tpt, u8 *buffer, int length)
   }
 }
 
+int transport_read_available( Transport *tpt, u8 *buffer, int length )
+{
+  int n = 0;
+  struct exception e;
+  TRANSPORT_VERIFY_OPEN;
+
+#ifdef WIN32_BUILD
+  // reads wait for the whole buffer, so take only what's already there
+  while( n < length && transport_readable( tpt ) )
+  {
+    if( ser_read( tpt->fd, buffer + n, 1 ) != 1 )
+      break;
+    n ++;
+  }
+#else
+  if( transport_select( &tpt, 1, 0 ) < 0 )
+    return 0;
+  n = ser_read( tpt->fd, buffer, length );
+
+  // readable without data means the peer went away
+  if( n == 0 )
+  {
+    e.errnum = ERR_NODATA;
+    e.type = nonfatal;
+    Throw( e );
+  }
+  if( n < 0 )
+  {
+    if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+      return 0;
+    e.errnum = transport_errno;
+    e.type = fatal;
+    Throw( e );
+  }
+#endif
+  return n;
+}
+
 void transport_write_buffer( Transport *tpt, const u8 *buffer, int length )
 {
   int n;
@@ -174,4 +350,72 @@ void transport_close (Transport *tpt)
   }
 }
 
+#ifdef WIN32_BUILD
+
+u32 transport_clock( void )
+{
+  return ( u32 )GetTickCount();
+}
+
+// Serial ports can't be waited on together, poll them instead
+int transport_select( Transport **tpts, int n, u32 timeout )
+{
+  u32 start = transport_clock();
+  int i;
+
+  for( ;; )
+  {
+    for( i = 0; i < n; i ++ )
+      if( tpts[ i ]->fd != INVALID_TRANSPORT && transport_readable( tpts[ i ] ) )
+        return i;
+    if( transport_clock() - start >= timeout )
+      return -1;
+    Sleep( 1 );
+  }
+}
+
+#else // #ifdef WIN32_BUILD
+
+u32 transport_clock( void )
+{
+  struct timeval tv;
+
+  gettimeofday( &tv, NULL );
+  return ( u32 )( tv.tv_sec * 1000 + tv.tv_usec / 1000 );
+}
+
+int transport_select( Transport **tpts, int n, u32 timeout )
+{
+  struct exception e;
+  fd_set rdfs;
+  struct timeval tv;
+  int i, maxfd = -1, ret;
+
+  FD_ZERO( &rdfs );
+  for( i = 0; i < n; i ++ )
+    if( tpts[ i ]->fd != INVALID_TRANSPORT )
+    {
+      FD_SET( tpts[ i ]->fd, &rdfs );
+      if( tpts[ i ]->fd > maxfd )
+        maxfd = tpts[ i ]->fd;
+    }
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = ( timeout % 1000 ) * 1000;
+  if( ( ret = select( maxfd + 1, &rdfs, NULL, NULL, &tv ) ) < 0 )
+  {
+    if( errno == EINTR )
+      return -1;
+    e.errnum = transport_errno;
+    e.type = fatal;
+    Throw( e );
+  }
+  if( ret > 0 )
+    for( i = 0; i < n; i ++ )
+      if( tpts[ i ]->fd != INVALID_TRANSPORT && FD_ISSET( tpts[ i ]->fd, &rdfs ) )
+        return i;
+  return -1;
+}
+
+#endif // #ifdef WIN32_BUILD
+
 #endif // LUARPC_ENABLE_SERIAL
@@ -23,6 +23,7 @@ void transport_init( Transport *tpt )
 {
   tpt->fd = INVALID_TRANSPORT;
   tpt->tmr_id = 0;
+  tpt->sock = 0;
 }
 
 // Read a char from serial buffer
@@ -136,6 +137,23 @@ void transport_read_buffer( Transport *tpt, u8 *buffer, int length )
   }
 }
 
+int transport_read_available( Transport *tpt, u8 *buffer, int length )
+{
+  int n = 0;
+  int c;
+  struct exception e;
+  TRANSPORT_VERIFY_OPEN;
+
+  if( length > 0 && adispatch_buff >= 0 )
+  {
+    buffer[ n ++ ] = ( u8 )adispatch_buff;
+    adispatch_buff = -1;
+  }
+  while( n < length && ( c = platform_uart_recv( tpt->fd, tpt->tmr_id, 0 ) ) >= 0 )
+    buffer[ n ++ ] = ( u8 )c;
+  return n;
+}
+
 void transport_write_buffer( Transport *tpt, const u8 *buffer, int length )
 {
   int i;
@@ -179,4 +197,25 @@ void transport_close( Transport *tpt )
   tpt->fd = INVALID_TRANSPORT;
 }
 
+u32 transport_clock( void )
+{
+  return ( u32 )( platform_timer_read_sys() / 1000 );
+}
+
+// Poll the UARTs until one of them has data
+int transport_select( Transport **tpts, int n, u32 timeout )
+{
+  u32 start = transport_clock();
+  int i;
+
+  for( ;; )
+  {
+    for( i = 0; i < n; i ++ )
+      if( tpts[ i ]->fd != INVALID_TRANSPORT && transport_readable( tpts[ i ] ) )
+        return i;
+    if( transport_clock() - start >= timeout )
+      return -1;
+  }
+}
+
 #endif
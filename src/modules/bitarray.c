@@ -7,10 +7,14 @@
 #include "auxmods.h"
 #include "lrotable.h"
 #include <string.h>
+#ifdef ELUA_PLATFORM_STORM
+#include "libstormarray.h"
+#endif
 
 #define META_NAME                 "eLua.bitarray"
 #define bitarray_check( L )      ( bitarray_t* )luaL_checkudata( L, 1, META_NAME )
 #define ROUND_SIZE(s)            ( ( ( s ) >> 3 ) + ( ( s ) & 7 ? 1 : 0 ) )
+#define WORD_ALIGNED(p)          ( ( ( size_t )( p ) & 3 ) == 0 )
 
 // Unpack modes
 enum
@@ -24,9 +28,26 @@ typedef struct
 {
   u32 capacity;
   u8 elsize;
+  u8 reserved[ 3 ];           // keeps 'values' word aligned for the bulk operations
   u8 values[ 1 ];
 } bitarray_t;
 
+// The bits of a bitarray or (on Storm) a storm.array, seen as a bit string
+typedef struct
+{
+  u8 *values;
+  u32 nbits;
+} bitarray_bits_t;
+
+// Logic operations
+enum
+{
+  BITARRAY_OP_AND = 0,
+  BITARRAY_OP_OR,
+  BITARRAY_OP_XOR,
+  BITARRAY_OP_NOT
+};
+
 // Index shift values/masks
 static const u8 bitarray_index_shift[] = { 0, 3, 2, 0, 1 };
 static const u8 bitarray_index_mask[] = { 0, 0x01, 0x03, 0, 0x0F };
@@ -301,6 +322,323 @@ static int bitarray_totable( lua_State *L )
   return 1;  
 }
 
+// ****************************************************************************
+// Bulk operations
+// These work on the raw bits of their operands: bit 'i' (1-based) is bit
+// 7 - ( i - 1 ) % 8 of byte ( i - 1 ) / 8, which is element 'i' of an array
+// with 1 bit elements. On Storm a storm.array can be used anywhere a bitarray
+// can; its bytes are read and written in place.
+
+// Helper: get the bits of the bitarray (or storm.array) at 'narg'
+static void bitarray_checkbits( lua_State *L, int narg, bitarray_bits_t *pb )
+{
+  bitarray_t *pa;
+#ifdef ELUA_PLATFORM_STORM
+  storm_array_t *parr;
+
+  if( ( parr = storm_array_test( L, narg ) ) != NULL )
+  {
+    pb->values = ARR_START( parr );
+    pb->nbits = ( u32 )parr->len << 3;
+    return;
+  }
+#endif
+  pa = ( bitarray_t* )luaL_checkudata( L, narg, META_NAME );
+  pb->values = pa->values;
+  pb->nbits = pa->capacity * pa->elsize;
+}
+
+// Helper: get the optional bit range [i, j] starting at 'narg' as 0-based
+// [*pfirst, *plast]. Returns 0 if the range is empty.
+static int bitarray_checkrange( lua_State *L, int narg, const bitarray_bits_t *pb, u32 *pfirst, u32 *plast )
+{
+  lua_Integer i = luaL_optinteger( L, narg, 1 );
+  lua_Integer j = luaL_optinteger( L, narg + 1, pb->nbits );
+
+  if( i > j )
+    return 0;
+  if( ( i <= 0 ) || ( j > ( lua_Integer )pb->nbits ) )
+    return luaL_error( L, "invalid index." );
+  *pfirst = ( u32 )i - 1;
+  *plast = ( u32 )j - 1;
+  return 1;
+}
+
+// Helper: clear the bits of the last byte that are past the end of the array
+static void bitarray_clearpad( bitarray_bits_t *pb )
+{
+  if( pb->nbits & 7 )
+    pb->values[ pb->nbits >> 3 ] &= ( u8 )( 0xFF << ( 8 - ( pb->nbits & 7 ) ) );
+}
+
+// Helper: number of bits set in a word
+static u32 bitarray_popcount32( u32 v )
+{
+  v = v - ( ( v >> 1 ) & 0x55555555 );
+  v = ( v & 0x33333333 ) + ( ( v >> 2 ) & 0x33333333 );
+  return ( ( ( v + ( v >> 4 ) ) & 0x0F0F0F0F ) * 0x01010101 ) >> 24;
+}
+
+// Helper: number of bits set in 'len' bytes
+static u32 bitarray_popcount_bytes( const u8 *p, u32 len )
+{
+  u32 count = 0;
+
+  for( ; len && !WORD_ALIGNED( p ); len --, p ++ )
+    count += bitarray_popcount32( *p );
+  for( ; len >= 4; len -= 4, p += 4 )
+    count += bitarray_popcount32( *( const u32* )p );
+  for( ; len; len --, p ++ )
+    count += bitarray_popcount32( *p );
+  return count;
+}
+
+// Lua: dest = bitarray.band( dest, a, b ), dest = bitarray.bor( dest, a, b ),
+//      dest = bitarray.bxor( dest, a, b ), dest = bitarray.bnot( dest, a )
+// All operands must have the same number of bits; 'dest' may be 'a' or 'b'.
+#define BITARRAY_LOGIC_LOOP( op )\
+  for( i = 0; i < nwords; i ++ )\
+    pd[ i ] = pa[ i ] op pb[ i ];\
+  for( i = nwords << 2; i < nbytes; i ++ )\
+    d.values[ i ] = a.values[ i ] op b.values[ i ]
+
+static int bitarray_logic( lua_State *L, int op )
+{
+  bitarray_bits_t d, a, b;
+  u32 *pd, *pa, *pb;
+  u32 i, nbytes, nwords = 0;
+
+  bitarray_checkbits( L, 1, &d );
+  bitarray_checkbits( L, 2, &a );
+  if( op == BITARRAY_OP_NOT )
+    b = a;
+  else
+    bitarray_checkbits( L, 3, &b );
+  if( ( d.nbits != a.nbits ) || ( d.nbits != b.nbits ) )
+    return luaL_error( L, "array sizes differ." );
+  nbytes = ROUND_SIZE( d.nbits );
+  if( WORD_ALIGNED( d.values ) && WORD_ALIGNED( a.values ) && WORD_ALIGNED( b.values ) )
+    nwords = nbytes >> 2;
+  pd = ( u32* )d.values;
+  pa = ( u32* )a.values;
+  pb = ( u32* )b.values;
+  switch( op )
+  {
+    case BITARRAY_OP_AND:
+      BITARRAY_LOGIC_LOOP( & );
+      break;
+
+    case BITARRAY_OP_OR:
+      BITARRAY_LOGIC_LOOP( | );
+      break;
+
+    case BITARRAY_OP_XOR:
+      BITARRAY_LOGIC_LOOP( ^ );
+      break;
+
+    case BITARRAY_OP_NOT:
+      for( i = 0; i < nwords; i ++ )
+        pd[ i ] = ~pa[ i ];
+      for( i = nwords << 2; i < nbytes; i ++ )
+        d.values[ i ] = ~a.values[ i ];
+      break;
+  }
+  bitarray_clearpad( &d );
+  lua_pushvalue( L, 1 );
+  return 1;
+}
+
+static int bitarray_band( lua_State *L )
+{
+  return bitarray_logic( L, BITARRAY_OP_AND );
+}
+
+static int bitarray_bor( lua_State *L )
+{
+  return bitarray_logic( L, BITARRAY_OP_OR );
+}
+
+static int bitarray_bxor( lua_State *L )
+{
+  return bitarray_logic( L, BITARRAY_OP_XOR );
+}
+
+static int bitarray_bnot( lua_State *L )
+{
+  return bitarray_logic( L, BITARRAY_OP_NOT );
+}
+
+// Lua: count = bitarray.popcount( array, [i], [j] )
+static int bitarray_popcount( lua_State *L )
+{
+  bitarray_bits_t b;
+  u32 first, last, fbyte, lbyte, count = 0;
+  u8 fmask, lmask;
+
+  bitarray_checkbits( L, 1, &b );
+  if( bitarray_checkrange( L, 2, &b, &first, &last ) )
+  {
+    fbyte = first >> 3;
+    lbyte = last >> 3;
+    fmask = 0xFF >> ( first & 7 );
+    lmask = 0xFF << ( 7 - ( last & 7 ) );
+    if( fbyte == lbyte )
+      count = bitarray_popcount32( b.values[ fbyte ] & fmask & lmask );
+    else
+      count = bitarray_popcount32( b.values[ fbyte ] & fmask ) +
+              bitarray_popcount_bytes( b.values + fbyte + 1, lbyte - fbyte - 1 ) +
+              bitarray_popcount32( b.values[ lbyte ] & lmask );
+  }
+  lua_pushinteger( L, count );
+  return 1;
+}
+
+// Helper: index of the first bit at or after 'start' that is set ('flip' is
+// 0) or clear ('flip' is 0xFF), all 0-based. Returns pb->nbits if none.
+static u32 bitarray_find( const bitarray_bits_t *pb, u32 start, u8 flip )
+{
+  const u8 *p = pb->values;
+  u32 idx, nbytes = ROUND_SIZE( pb->nbits );
+  u32 skip = flip ? 0xFFFFFFFF : 0;
+  u8 v;
+
+  if( start >= pb->nbits )
+    return pb->nbits;
+  idx = start >> 3;
+  v = ( p[ idx ] ^ flip ) & ( 0xFF >> ( start & 7 ) );
+  while( !v )
+  {
+    if( ++ idx == nbytes )
+      return pb->nbits;
+    if( WORD_ALIGNED( p + idx ) )
+      while( ( idx + 4 <= nbytes ) && ( *( const u32* )( p + idx ) == skip ) )
+        idx += 4;
+    if( idx == nbytes )
+      return pb->nbits;
+    v = p[ idx ] ^ flip;
+  }
+  for( idx <<= 3; !( v & 0x80 ); v <<= 1 )
+    idx ++;
+  return idx < pb->nbits ? idx : pb->nbits;
+}
+
+// Helper for ffs/ffc
+static int bitarray_findfirst( lua_State *L, u8 flip )
+{
+  bitarray_bits_t b;
+  lua_Integer start;
+  u32 idx;
+
+  bitarray_checkbits( L, 1, &b );
+  start = luaL_optinteger( L, 2, 1 );
+  if( start <= 0 )
+    return luaL_error( L, "invalid index." );
+  if( start > ( lua_Integer )b.nbits )
+    return 0;
+  idx = bitarray_find( &b, ( u32 )start - 1, flip );
+  if( idx == b.nbits )
+    return 0;
+  lua_pushinteger( L, idx + 1 );
+  return 1;
+}
+
+// Lua: idx = bitarray.ffs( array, [start] ), first set bit or nil
+static int bitarray_ffs( lua_State *L )
+{
+  return bitarray_findfirst( L, 0 );
+}
+
+// Lua: idx = bitarray.ffc( array, [start] ), first clear bit or nil
+static int bitarray_ffc( lua_State *L )
+{
+  return bitarray_findfirst( L, 0xFF );
+}
+
+// Helper for setrange/clearrange
+static int bitarray_fillrange( lua_State *L, int set )
+{
+  bitarray_bits_t b;
+  u32 first, last, fbyte, lbyte;
+  u8 fmask, lmask;
+
+  bitarray_checkbits( L, 1, &b );
+  if( bitarray_checkrange( L, 2, &b, &first, &last ) )
+  {
+    fbyte = first >> 3;
+    lbyte = last >> 3;
+    fmask = 0xFF >> ( first & 7 );
+    lmask = 0xFF << ( 7 - ( last & 7 ) );
+    if( fbyte == lbyte )
+      fmask &= lmask;
+    else
+    {
+      memset( b.values + fbyte + 1, set ? 0xFF : 0, lbyte - fbyte - 1 );
+      b.values[ lbyte ] = set ? b.values[ lbyte ] | lmask : b.values[ lbyte ] & ~lmask;
+    }
+    b.values[ fbyte ] = set ? b.values[ fbyte ] | fmask : b.values[ fbyte ] & ~fmask;
+  }
+  lua_pushvalue( L, 1 );
+  return 1;
+}
+
+// Lua: array = bitarray.setrange( array, [i], [j] )
+static int bitarray_setrange( lua_State *L )
+{
+  return bitarray_fillrange( L, 1 );
+}
+
+// Lua: array = bitarray.clearrange( array, [i], [j] )
+static int bitarray_clearrange( lua_State *L )
+{
+  return bitarray_fillrange( L, 0 );
+}
+
+// Lua: array = bitarray.shift( array, n )
+// Moves every bit 'n' positions towards the end of the array (towards the
+// start if 'n' is negative), filling with zeros.
+static int bitarray_shift( lua_State *L )
+{
+  bitarray_bits_t b;
+  lua_Integer n;
+  u32 k, dist, bytes, bits, nbytes;
+  u8 *p;
+
+  bitarray_checkbits( L, 1, &b );
+  n = luaL_checkinteger( L, 2 );
+  p = b.values;
+  nbytes = ROUND_SIZE( b.nbits );
+  dist = ( u32 )( n < 0 ? -n : n );
+  bitarray_clearpad( &b );
+  if( dist >= b.nbits )
+    memset( p, 0, nbytes );
+  else if( dist > 0 )
+  {
+    bytes = dist >> 3;
+    bits = dist & 7;
+    if( n > 0 )
+    {
+      if( bits == 0 )
+        memmove( p + bytes, p, nbytes - bytes );
+      else
+        for( k = nbytes; k -- > bytes; )
+          p[ k ] = ( p[ k - bytes ] >> bits ) | ( k > bytes ? ( u8 )( p[ k - bytes - 1 ] << ( 8 - bits ) ) : 0 );
+      memset( p, 0, bytes );
+      bitarray_clearpad( &b );
+    }
+    else
+    {
+      if( bits == 0 )
+        memmove( p, p + bytes, nbytes - bytes );
+      else
+        for( k = 0; k + bytes < nbytes; k ++ )
+          p[ k ] = ( u8 )( p[ k + bytes ] << bits ) | ( k + bytes + 1 < nbytes ? p[ k + bytes + 1 ] >> ( 8 - bits ) : 0 );
+      memset( p + nbytes - bytes, 0, bytes );
+    }
+  }
+  lua_pushvalue( L, 1 );
+  return 1;
+}
+
 // Module function map
 #define MIN_OPT_LEVEL 2
 #include "lrodefs.h"
@@ -310,6 +648,16 @@ const LUA_REG_TYPE bitarray_map[] =
   { LSTRKEY( "pairs" ), LFUNCVAL( bitarray_pairs ) },
   { LSTRKEY( "tostring" ), LFUNCVAL( bitarray_tostring ) },
   { LSTRKEY( "totable" ), LFUNCVAL( bitarray_totable ) },
+  { LSTRKEY( "band" ), LFUNCVAL( bitarray_band ) },
+  { LSTRKEY( "bor" ), LFUNCVAL( bitarray_bor ) },
+  { LSTRKEY( "bxor" ), LFUNCVAL( bitarray_bxor ) },
+  { LSTRKEY( "bnot" ), LFUNCVAL( bitarray_bnot ) },
+  { LSTRKEY( "popcount" ), LFUNCVAL( bitarray_popcount ) },
+  { LSTRKEY( "ffs" ), LFUNCVAL( bitarray_ffs ) },
+  { LSTRKEY( "ffc" ), LFUNCVAL( bitarray_ffc ) },
+  { LSTRKEY( "setrange" ), LFUNCVAL( bitarray_setrange ) },
+  { LSTRKEY( "clearrange" ), LFUNCVAL( bitarray_clearrange ) },
+  { LSTRKEY( "shift" ), LFUNCVAL( bitarray_shift ) },
   { LNILKEY, LNILVAL } 
 };
 
@@ -12,6 +12,10 @@
 #include "shell.h"
 #include <string.h>
 #include <stdlib.h>
+#ifdef BUILD_RFS
+#include "elua_rfs.h"
+#include "client.h"
+#endif
 
 #if defined( USE_GIT_REVISION )
 #include "git_version.h"
@@ -79,6 +83,66 @@ static int elua_shell( lua_State *L )
 }
 #endif
 
+#ifdef BUILD_RFS
+// Push nil and the reason why the RFS operation on 'path' failed
+static int elua_rfs_error( lua_State *L, const char *path, int res )
+{
+  lua_pushnil( L );
+  if( res == RFSC_UNSUPPORTED )
+    lua_pushliteral( L, "the RFS server doesn't support whole file operations" );
+  else
+    lua_pushfstring( L, "%s: RFS operation failed", path );
+  return 2;
+}
+
+// Lua: size, mtime, isdir = elua.rfs_stat( path )
+static int elua_rfs_stat( lua_State *L )
+{
+  const char *path = luaL_checkstring( L, 1 );
+  u32 size, mtime;
+  int isdir, res;
+
+  if( ( res = remotefs_stat( path, &size, &mtime, &isdir ) ) != 0 )
+    return elua_rfs_error( L, path, res );
+  lua_pushnumber( L, size );
+  lua_pushnumber( L, mtime );
+  lua_pushboolean( L, isdir );
+  return 3;
+}
+
+// Lua: data = elua.rfs_readfile( path )
+static int elua_rfs_readfile( lua_State *L )
+{
+  const char *path = luaL_checkstring( L, 1 );
+  u32 size, mtime;
+  int isdir, res;
+  s32 len;
+  void *buf;
+
+  if( ( res = remotefs_stat( path, &size, &mtime, &isdir ) ) != 0 || isdir )
+    return elua_rfs_error( L, path, res );
+  buf = lua_newuserdata( L, size ? size : 1 );
+  if( ( len = remotefs_readfile( path, buf, size ) ) < 0 )
+    return elua_rfs_error( L, path, ( int )len );
+  lua_pushlstring( L, ( const char* )buf, len );
+  return 1;
+}
+
+// Lua: written = elua.rfs_writefile( path, data )
+static int elua_rfs_writefile( lua_State *L )
+{
+  const char *path = luaL_checkstring( L, 1 );
+  size_t size;
+  const char *data = luaL_checklstring( L, 2, &size );
+  s32 len;
+
+  if( ( len = remotefs_writefile( path, data, ( u32 )size ) ) < 0 )
+    return elua_rfs_error( L, path, ( int )len );
+  lua_pushinteger( L, len );
+  return 1;
+}
+#endif // #ifdef BUILD_RFS
+
 // Module function map
 #define MIN_OPT_LEVEL 2
 #include "lrodefs.h"
@@ -90,6 +154,11 @@ const LUA_REG_TYPE elua_map[] =
 #ifdef BUILD_SHELL
   { LSTRKEY( "shell" ), LFUNCVAL( elua_shell ) },
 #endif
+#ifdef BUILD_RFS
+  { LSTRKEY( "rfs_stat" ), LFUNCVAL( elua_rfs_stat ) },
+  { LSTRKEY( "rfs_readfile" ), LFUNCVAL( elua_rfs_readfile ) },
+  { LSTRKEY( "rfs_writefile" ), LFUNCVAL( elua_rfs_writefile ) },
+#endif
 #if LUA_OPTIMIZE_MEMORY > 0
   { LSTRKEY( "EGC_NOT_ACTIVE" ), LNUMVAL( EGC_NOT_ACTIVE ) },
   { LSTRKEY( "EGC_ON_ALLOC_FAILURE" ), LNUMVAL( EGC_ON_ALLOC_FAILURE ) },
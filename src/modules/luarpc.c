@@ -41,6 +41,7 @@ void *alloca(size_t);
 #endif
 
 #include "luarpc_rpc.h"
+#include "eluarpc.h"
 
 
 #if defined( BUILD_RPC )
@@ -106,7 +107,9 @@ enum {
   RPC_TABLE_END,
   RPC_FUNCTION,
   RPC_FUNCTION_END,
-  RPC_REMOTE
+  RPC_REMOTE,
+  RPC_STRING_LZ,
+  RPC_INTEGER
 };
 
 // RPC Commands
@@ -115,7 +118,8 @@ enum
   RPC_CMD_CALL = 1,
   RPC_CMD_GET,
   RPC_CMD_CON,
-  RPC_CMD_NEWINDEX
+  RPC_CMD_NEWINDEX,
+  RPC_CMD_CAPS
 };
 
 // RPC Status Codes
@@ -128,6 +132,39 @@ enum
 
 enum { RPC_PROTOCOL_VERSION = 3 };
 
+// Compression
+// A client that wants compressed strings sets RPC_CAP_LZ in the last byte of
+// its header (the "integer only" flag) and a server that supports it returns
+// the bit in its answer. Servers that predate it don't understand the flag,
+// so compression must only be enabled when talking to a server that does.
+// Strings (including dumped functions) of at least RPC_LZ_MIN_STRING bytes
+// are then sent as RPC_STRING_LZ if that makes them smaller.
+#define RPC_CAP_LZ          0x80
+#define RPC_LZ_MIN_STRING   64
+
+static int rpc_lz_enabled;
+
+// Protocol v2
+// After the connection header a client that supports it sends RPC_CMD_CAPS.
+// A v2 server answers RPC_READY and its capabilities, older servers answer
+// RPC_UNSUPPORTED_CMD and the connection stays on v1. In v2:
+//  - commands don't wait for RPC_READY, so several of them can be sent in a
+//    single write (see rpc.batch)
+//  - lengths and counts are sent as varints
+//  - a function path is sent only once: the server answers with a small
+//    handle that replaces the path in the next calls
+//  - integers 0..127 and strings shorter than 32 bytes are encoded in their
+//    type byte, other 32-bit integers as zigzag varints and the remaining
+//    type bytes are offset by RPC2_TAG_BASE
+#define RPC_CAP_V2          0x01
+#define RPC2_FIXINT_MAX     0x7F
+#define RPC2_FIXSTR         0x80
+#define RPC2_FIXSTR_MASK    0xE0
+#define RPC2_FIXSTR_MAXLEN  0x1F
+#define RPC2_TAG_BASE       0xA0
+
+static int rpc_v2_enabled = 1;
+
 
 // return a string representation of an error number
 
@@ -149,17 +186,70 @@ static const char * errorString( int n )
 // **************************************************************************
 // transport layer generics
 
+// write the buffered data to the transport
+static void transport_flush( Transport *tpt )
+{
+  u16 len = tpt->wlen;
+
+  if( len > 0 )
+  {
+    tpt->wlen = 0;
+    transport_write_buffer( tpt, tpt->wbuf, len );
+  }
+}
+
+
+// buffer data for the transport, the buffer is flushed when it's full and
+// before reading, so a whole request or reply usually takes a single write
+static void transport_put( Transport *tpt, const u8 *buffer, int length )
+{
+  if( tpt->wlen + length > RPC_WRITE_BUF_SIZE )
+  {
+    transport_flush( tpt );
+    if( length >= RPC_WRITE_BUF_SIZE )
+    {
+      transport_write_buffer( tpt, buffer, length );
+      return;
+    }
+  }
+  memcpy( tpt->wbuf + tpt->wlen, buffer, length );
+  tpt->wlen += length;
+}
+
+
+// read from the transport (after sending what's still buffered). bytes
+// already received by rpc.adispatch are used first
+static void transport_get( Transport *tpt, u8 *buffer, int length )
+{
+  int n;
+
+  if( tpt->rleft > 0 )
+  {
+    n = length < tpt->rleft ? length : tpt->rleft;
+    memcpy( buffer, tpt->rsrc, n );
+    tpt->rsrc += n;
+    tpt->rleft -= n;
+    buffer += n;
+    length -= n;
+    if( length == 0 )
+      return;
+  }
+  transport_flush( tpt );
+  transport_read_buffer( tpt, buffer, length );
+}
+
+
 // read arbitrary length from the transport into a string buffer.
 static void transport_read_string( Transport *tpt, const char *buffer, int length )
 {
-  transport_read_buffer( tpt, ( u8 * )buffer, length );
+  transport_get( tpt, ( u8 * )buffer, length );
 }
 
 
 // write arbitrary length string buffer to the transport
 static void transport_write_string( Transport *tpt, const char *buffer, int length )
 {
-  transport_write_buffer( tpt, ( u8 * )buffer, length );
+  transport_put( tpt, ( u8 * )buffer, length );
 }
 
 
@@ -169,7 +259,7 @@ static u8 transport_read_u8( Transport *tpt )
   u8 b;
   struct exception e;
   TRANSPORT_VERIFY_OPEN;
-  transport_read_buffer( tpt, &b, 1 );
+  transport_get( tpt, &b, 1 );
   return b;
 }
 
@@ -179,7 +269,7 @@ static void transport_write_u8( Transport *tpt, u8 x )
 {
   struct exception e;
   TRANSPORT_VERIFY_OPEN;
-  transport_write_buffer( tpt, &x, 1 );
+  transport_put( tpt, &x, 1 );
 }
 
 static void swap_bytes( uint8_t *number, size_t numbersize )
@@ -204,7 +294,7 @@ static u32 transport_read_u32( Transport *tpt )
   union u32_bytes ub;
   struct exception e;
   TRANSPORT_VERIFY_OPEN;
-  transport_read_buffer ( tpt, ub.b, 4 );
+  transport_get( tpt, ub.b, 4 );
   if( tpt->net_little != tpt->loc_little )
     swap_bytes( ( uint8_t * )ub.b, 4 );
   return ub.i;
@@ -220,7 +310,64 @@ static void transport_write_u32( Transport *tpt, u32 x )
   ub.i = ( uint32_t )x;
   if( tpt->net_little != tpt->loc_little )
     swap_bytes( ( uint8_t * )ub.b, 4 );
-  transport_write_buffer( tpt, ub.b, 4 );
+  transport_put( tpt, ub.b, 4 );
+}
+
+
+// write a varint (7 bits per byte, least significant first) to the transport
+static void transport_write_varint( Transport *tpt, u32 x )
+{
+  u8 b[ 5 ];
+  int n = 0;
+
+  while( x >= 0x80 )
+  {
+    b[ n ++ ] = ( u8 )( x | 0x80 );
+    x >>= 7;
+  }
+  b[ n ++ ] = ( u8 )x;
+  transport_put( tpt, b, n );
+}
+
+
+// read a varint from the transport
+static u32 transport_read_varint( Transport *tpt )
+{
+  struct exception e;
+  u32 x = 0;
+  int shift = 0;
+  u8 b;
+
+  do
+  {
+    if( shift > 28 )
+    {
+      e.errnum = ERR_PROTOCOL;
+      e.type = fatal;
+      Throw( e );
+    }
+    b = transport_read_u8( tpt );
+    x |= ( u32 )( b & 0x7F ) << shift;
+    shift += 7;
+  } while( b & 0x80 );
+  return x;
+}
+
+
+// write a length or a count (a varint in v2, a u32 otherwise)
+static void transport_write_len( Transport *tpt, u32 x )
+{
+  if( tpt->net_v2 )
+    transport_write_varint( tpt, x );
+  else
+    transport_write_u32( tpt, x );
+}
+
+
+// read a length or a count
+static u32 transport_read_len( Transport *tpt )
+{
+  return tpt->net_v2 ? transport_read_varint( tpt ) : transport_read_u32( tpt );
 }
 
 // read a lua number from the transport
@@ -230,7 +377,7 @@ static lua_Number transport_read_number( Transport *tpt )
   u8 b[ tpt->lnum_bytes ];
   struct exception e;
   TRANSPORT_VERIFY_OPEN;
-  transport_read_buffer ( tpt, b, tpt->lnum_bytes );
+  transport_get( tpt, b, tpt->lnum_bytes );
 
   if( tpt->net_little != tpt->loc_little )
     swap_bytes( ( uint8_t * )b, tpt->lnum_bytes );
@@ -277,25 +424,25 @@ static void transport_write_number( Transport *tpt, lua_Number x )
     {
       case 1: {
         int8_t y = ( int8_t )x;
-        transport_write_buffer( tpt, ( u8 * )&y, 1 );
+        transport_put( tpt, ( u8 * )&y, 1 );
       } break;
       case 2: {
         int16_t y = ( int16_t )x;
         if( tpt->net_little != tpt->loc_little )
           swap_bytes( ( uint8_t * )&y, 2 );
-        transport_write_buffer( tpt, ( u8 * )&y, 2 );
+        transport_put( tpt, ( u8 * )&y, 2 );
       } break;
       case 4: {
         int32_t y = ( int32_t )x;
         if( tpt->net_little != tpt->loc_little )
           swap_bytes( ( uint8_t * )&y, 4 );
-        transport_write_buffer( tpt,( u8 * )&y, 4 );
+        transport_put( tpt,( u8 * )&y, 4 );
       } break;
       case 8: {
         int64_t y = ( int64_t )x;
         if( tpt->net_little != tpt->loc_little )
           swap_bytes( ( uint8_t * )&y, 8 );
-        transport_write_buffer( tpt, ( u8 * )&y, 8 );
+        transport_put( tpt, ( u8 * )&y, 8 );
       } break;
       default: lua_assert(0);
     }
@@ -304,7 +451,7 @@ static void transport_write_number( Transport *tpt, lua_Number x )
   {
     if( tpt->net_little != tpt->loc_little )
        swap_bytes( ( uint8_t * )&x, 8 );
-    transport_write_buffer( tpt, ( u8 * )&x, 8 );
+    transport_put( tpt, ( u8 * )&x, 8 );
   }
 }
 
@@ -437,6 +584,32 @@ static void write_function( Transport *tpt, lua_State *L, int var_index )
 
 static void helper_remote_index( Helper *helper );
 
+// write a type byte (offset by RPC2_TAG_BASE in v2)
+static void transport_write_tag( Transport *tpt, u8 type )
+{
+  transport_write_u8( tpt, tpt->net_v2 ? RPC2_TAG_BASE + type : type );
+}
+
+// write a number, in v2 32-bit integers are sent as fixints or varints
+static void write_number( Transport *tpt, lua_Number x )
+{
+  s32 i;
+
+  if( tpt->net_v2 && x >= ( lua_Number )-2147483647 - 1 && x <= ( lua_Number )2147483647 && ( lua_Number )( i = ( s32 )x ) == x )
+  {
+    if( i >= 0 && i <= RPC2_FIXINT_MAX )
+      transport_write_u8( tpt, ( u8 )i );
+    else
+    {
+      transport_write_tag( tpt, RPC_INTEGER );
+      transport_write_varint( tpt, ( ( u32 )i << 1 ) ^ ( i < 0 ? 0xFFFFFFFFUL : 0 ) );
+    }
+    return;
+  }
+  transport_write_tag( tpt, RPC_NUMBER );
+  transport_write_number( tpt, x );
+}
+
 // write a variable at the given index in the stack. the index must be absolute
 // (i.e. positive).
 
@@ -447,47 +620,65 @@ static void write_variable( Transport *tpt, lua_State *L, int var_index )
   switch( lua_type( L, var_index ) )
   {
     case LUA_TNUMBER:
-      transport_write_u8( tpt, RPC_NUMBER );
-      transport_write_number( tpt, lua_tonumber( L, var_index ) );
+      write_number( tpt, lua_tonumber( L, var_index ) );
       break;
 
     case LUA_TSTRING:
     {
       const char *s;
       u32 len;
-      transport_write_u8( tpt, RPC_STRING );
       s = lua_tostring( L, var_index );
       len = ( u32 )lua_strlen( L, var_index );
-      transport_write_u32( tpt, len );
+      if( tpt->net_lz && len >= RPC_LZ_MIN_STRING )
+      {
+        u8 *z = ( u8 * )alloca( len );
+        u32 zlen = eluarpc_lz_compress( ( const u8 * )s, len, z, len - 1 );
+
+        if( zlen > 0 )
+        {
+          transport_write_tag( tpt, RPC_STRING_LZ );
+          transport_write_len( tpt, len );
+          transport_write_len( tpt, zlen );
+          transport_write_string( tpt, ( const char * )z, zlen );
+          break;
+        }
+      }
+      if( tpt->net_v2 && len <= RPC2_FIXSTR_MAXLEN )
+        transport_write_u8( tpt, RPC2_FIXSTR | ( u8 )len );
+      else
+      {
+        transport_write_tag( tpt, RPC_STRING );
+        transport_write_len( tpt, len );
+      }
       transport_write_string( tpt, s, len );
       break;
     }
 
     case LUA_TTABLE:
-      transport_write_u8( tpt, RPC_TABLE );
+      transport_write_tag( tpt, RPC_TABLE );
       write_table( tpt, L, var_index );
-      transport_write_u8( tpt, RPC_TABLE_END );
+      transport_write_tag( tpt, RPC_TABLE_END );
       break;
 
     case LUA_TNIL:
-      transport_write_u8( tpt, RPC_NIL );
+      transport_write_tag( tpt, RPC_NIL );
       break;
 
     case LUA_TBOOLEAN:
-      transport_write_u8( tpt,RPC_BOOLEAN );
+      transport_write_tag( tpt, RPC_BOOLEAN );
       transport_write_u8( tpt, ( u8 )lua_toboolean( L, var_index ) );
       break;
 
     case LUA_TFUNCTION:
-      transport_write_u8( tpt, RPC_FUNCTION );
+      transport_write_tag( tpt, RPC_FUNCTION );
       write_function( tpt, L, var_index );
-      transport_write_u8( tpt, RPC_FUNCTION_END );
+      transport_write_tag( tpt, RPC_FUNCTION_END );
       break;
 
     case LUA_TUSERDATA:
       if( lua_isuserdata( L, var_index ) && ismetatable_type( L, var_index, "rpc.helper" ) )
       {
-        transport_write_u8( tpt, RPC_REMOTE );
+        transport_write_tag( tpt, RPC_REMOTE );
         helper_remote_index( ( Helper * )lua_touserdata( L, var_index ) );
       } else
         luaL_error( L, "userdata transmission unsupported" );
@@ -545,7 +736,7 @@ static void read_index( Transport *tpt, lua_State *L )
   char *funcname;
   char *token = NULL;
 
-  len = transport_read_u32( tpt ); // variable name length
+  len = transport_read_len( tpt ); // variable name length
   funcname = ( char * )alloca( len + 1 );
   transport_read_string( tpt, funcname, len );
   funcname[ len ] = 0;
@@ -570,6 +761,24 @@ static int read_variable( Transport *tpt, lua_State *L )
   struct exception e;
   u8 type = transport_read_u8( tpt );
 
+  if( tpt->net_v2 )
+  {
+    if( type <= RPC2_FIXINT_MAX )
+    {
+      lua_pushinteger( L, type );
+      return 1;
+    }
+    if( ( type & RPC2_FIXSTR_MASK ) == RPC2_FIXSTR )
+    {
+      char s[ RPC2_FIXSTR_MAXLEN + 1 ];
+      u32 len = type & RPC2_FIXSTR_MAXLEN;
+      transport_read_string( tpt, s, len );
+      lua_pushlstring( L, s, len );
+      return 1;
+    }
+    type -= RPC2_TAG_BASE;
+  }
+
   switch( type )
   {
     case RPC_NIL:
@@ -584,9 +793,16 @@ static int read_variable( Transport *tpt, lua_State *L )
       lua_pushnumber( L, transport_read_number( tpt ) );
       break;
 
+    case RPC_INTEGER:
+    {
+      u32 x = transport_read_varint( tpt );
+      lua_pushnumber( L, ( lua_Number )( s32 )( ( x >> 1 ) ^ ( 0 - ( x & 1 ) ) ) );
+      break;
+    }
+
     case RPC_STRING:
     {
-      u32 len = transport_read_u32( tpt );
+      u32 len = transport_read_len( tpt );
       char *s = ( char * )alloca( len + 1 );
       transport_read_string( tpt, s, len );
       s[ len ] = 0;
@@ -594,6 +810,24 @@ static int read_variable( Transport *tpt, lua_State *L )
       break;
     }
 
+    case RPC_STRING_LZ:
+    {
+      u32 len = transport_read_len( tpt );
+      u32 zlen = transport_read_len( tpt );
+      char *s = ( char * )alloca( len + 1 );
+      u8 *z = ( u8 * )alloca( zlen );
+      transport_read_string( tpt, ( const char * )z, zlen );
+      if( eluarpc_lz_expand( z, zlen, ( u8 * )s, len ) != ( int )len )
+      {
+        e.errnum = ERR_PROTOCOL;
+        e.type = fatal;
+        Throw( e );
+      }
+      s[ len ] = 0;
+      lua_pushlstring( L, s, len );
+      break;
+    }
+
     case RPC_TABLE:
       read_table( tpt, L );
       break;
@@ -633,6 +867,7 @@ static void client_negotiate( Transport *tpt )
   int x = 1;
 
   // default client configuration
+  tpt->net_v2 = 0;
   tpt->loc_little = ( char )*( char * )&x;
   tpt->lnum_bytes = ( char )sizeof( lua_Number );
   tpt->loc_intnum = ( char )( ( ( lua_Number )0.5 ) == 0 );
@@ -645,7 +880,7 @@ static void client_negotiate( Transport *tpt )
   header[4] = ( char )RPC_PROTOCOL_VERSION;
   header[5] = tpt->loc_little;
   header[6] = tpt->lnum_bytes;
-  header[7] = tpt->loc_intnum;
+  header[7] = tpt->loc_intnum | ( rpc_lz_enabled ? RPC_CAP_LZ : 0 );
   transport_write_string( tpt, header, sizeof( header ) );
 
 
@@ -665,7 +900,8 @@ static void client_negotiate( Transport *tpt )
   // write configuration from response
   tpt->net_little = header[5];
   tpt->lnum_bytes = header[6];
-  tpt->net_intnum = header[7];
+  tpt->net_intnum = header[7] & ~RPC_CAP_LZ;
+  tpt->net_lz = rpc_lz_enabled && ( header[7] & RPC_CAP_LZ );
 }
 
 static void server_negotiate( Transport *tpt )
@@ -673,8 +909,10 @@ static void server_negotiate( Transport *tpt )
   struct exception e;
   char header[ 8 ];
   int x = 1;
+  char caps;
 
   // default sever configuration
+  tpt->net_v2 = 0;
   tpt->net_little = tpt->loc_little = ( char )*( char * )&x;
   tpt->lnum_bytes = ( char )sizeof( lua_Number );
   tpt->net_intnum = tpt->loc_intnum = ( char )( ( ( lua_Number )0.5 ) == 0 );
@@ -692,6 +930,11 @@ static void server_negotiate( Transport *tpt )
     Throw( e );
   }
 
+  // capabilities requested by the client
+  caps = header[ 7 ] & RPC_CAP_LZ;
+  header[ 7 ] &= ~RPC_CAP_LZ;
+  tpt->net_lz = caps != 0;
+
   // check if endianness differs, if so use big endian order
   if( header[ 5 ] != tpt->loc_little )
     header[ 5 ] = tpt->net_little = 0;
@@ -707,10 +950,27 @@ static void server_negotiate( Transport *tpt )
     header[ 7 ] = tpt->net_intnum = 1;
 
   // send reconciled configuration to client
+  header[ 7 ] |= caps;
   transport_write_string( tpt, header, sizeof( header ) );
 }
 
 
+// ask the server to switch to protocol v2
+static void client_probe_v2( lua_State *L, Handle *handle )
+{
+  Transport *tpt = &handle->tpt;
+
+  transport_write_u8( tpt, RPC_CMD_CAPS );
+  if( transport_read_u8( tpt ) != RPC_READY ) // older server, stay on v1
+    return;
+  if( transport_read_u8( tpt ) & RPC_CAP_V2 )
+  {
+    lua_newtable( L );
+    handle->names_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+    tpt->net_v2 = 1;
+  }
+}
+
 static int generic_catch_handler(lua_State *L, Handle *handle, struct exception e )
 {
   deal_with_error( L, handle, errorString( e.errnum ) );
@@ -762,8 +1022,13 @@ Handle *handle_create( lua_State *L )
   luaL_getmetatable( L, "rpc.handle" );
   lua_setmetatable( L, -2 );
   h->error_handler = LUA_NOREF;
-  h->async = 0;
-  h->read_reply_count = 0;
+  h->names_ref = LUA_NOREF;
+  h->queue_ref = LUA_NOREF;
+  h->qhead = h->qtail = 0;
+  h->tpt.wlen = 0;
+  h->tpt.rleft = 0;
+  h->tpt.net_v2 = 0;
+  h->tpt.sock = 0;
   return h;
 }
 
@@ -827,40 +1092,41 @@ static int handle_newindex( lua_State *L )
   return 0;
 }
 
-// replays series of indexes to remote side as a string
-static void helper_remote_index( Helper *helper )
+// maximum length of the path of a helper
+#define HELPER_PATH_SIZE( helper ) ( ( ( helper )->nparents + 1 ) * ( NUM_FUNCNAME_CHARS + 1 ) )
+
+// build the dotted path of a helper ("a.b.c") in 'path', return its length
+static int helper_path( Helper *helper, char *path )
 {
-  int i, len;
+  int i, len = 0;
   Helper **hstack;
-  Transport *tpt = &helper->handle->tpt;
-
-  // get length of name & make stack of helpers
-  len = ( u32 )strlen( helper->funcname );
-  if( helper->nparents > 0 ) // If helper has parents, build string to remote index
-  {
-    hstack = ( Helper ** )alloca( sizeof( Helper * ) * helper->nparents );
-    hstack[ helper->nparents - 1 ] = helper->parent;
-    len += strlen( hstack[ helper->nparents - 1 ]->funcname ) + 1;
-
-    for( i = helper->nparents - 1 ; i > 0 ; i -- )
-    {
-      hstack[ i - 1 ] = hstack[ i ]->parent;
-      len += strlen( hstack[ i - 1 ]->funcname ) + 1;
-    }
 
-    transport_write_u32( tpt, len );
+  // make stack of helpers
+  hstack = ( Helper ** )alloca( sizeof( Helper * ) * ( helper->nparents + 1 ) );
+  hstack[ helper->nparents ] = helper;
+  for( i = helper->nparents ; i > 0 ; i -- )
+    hstack[ i - 1 ] = hstack[ i ]->parent;
 
-    // replay helper key names
-    for( i = 0 ; i < helper->nparents ; i ++ )
-    {
-      transport_write_string( tpt, hstack[ i ]->funcname, ( int )strlen( hstack[ i ]->funcname ) );
-      transport_write_string( tpt, ".", 1 );
-    }
+  // replay helper key names
+  for( i = 0 ; i <= helper->nparents ; i ++ )
+  {
+    if( i > 0 )
+      path[ len ++ ] = '.';
+    strcpy( path + len, hstack[ i ]->funcname );
+    len += ( int )strlen( hstack[ i ]->funcname );
   }
-  else // If helper has no parents, just use length of global
-    transport_write_u32( tpt, len );
+  return len;
+}
 
-  transport_write_string( tpt, helper->funcname, ( int )strlen( helper->funcname ) );
+// replays series of indexes to remote side as a string
+static void helper_remote_index( Helper *helper )
+{
+  Transport *tpt = &helper->handle->tpt;
+  char *path = ( char * )alloca( HELPER_PATH_SIZE( helper ) );
+  int len = helper_path( helper, path );
+
+  transport_write_len( tpt, len );
+  transport_write_string( tpt, path, len );
 }
 
 static void helper_wait_ready( Transport *tpt, u8 cmd )
@@ -869,6 +1135,8 @@ static void helper_wait_ready( Transport *tpt, u8 cmd )
   u8 cmdresp;
 
   transport_write_u8( tpt, cmd );
+  if( tpt->net_v2 ) // v2 requests are pipelined, there's no handshake
+    return;
   cmdresp = transport_read_u8( tpt );
   if( cmdresp != RPC_READY )
   {
@@ -879,12 +1147,87 @@ static void helper_wait_ready( Transport *tpt, u8 cmd )
 
 }
 
+// write a function call request (the arguments are on the stack starting at
+// 'argbase'). returns 1 if the server was asked for a handle for 'path'
+static int client_write_call( lua_State *L, Handle *handle, const char *path, size_t len, int argbase, int nargs )
+{
+  Transport *tpt = &handle->tpt;
+  u32 id = 0;
+  int i;
+
+  helper_wait_ready( tpt, RPC_CMD_CALL );
+
+  // write function handle (or name)
+  if( tpt->net_v2 )
+  {
+    lua_rawgeti( L, LUA_REGISTRYINDEX, handle->names_ref );
+    lua_pushlstring( L, path, len );
+    lua_rawget( L, -2 );
+    id = ( u32 )lua_tonumber( L, -1 );
+    lua_pop( L, 2 );
+    transport_write_varint( tpt, id );
+  }
+  if( id == 0 )
+  {
+    transport_write_len( tpt, ( u32 )len );
+    transport_write_string( tpt, path, ( int )len );
+  }
+
+  // write number of arguments and each argument
+  transport_write_len( tpt, nargs );
+  for( i = 0; i < nargs; i ++ )
+    write_variable( tpt, L, argbase + i );
+  return tpt->net_v2 && id == 0;
+}
+
+// read the reply to a function call. returns the number of return values
+// pushed on the stack, or -1 after pushing the error message
+static int client_read_reply( lua_State *L, Handle *handle, const char *path, size_t len, int newref )
+{
+  Transport *tpt = &handle->tpt;
+  u32 i, nret, id;
+  u8 ret_code;
+
+  // read return code (and the handle assigned to the function)
+  ret_code = transport_read_u8( tpt );
+  if( newref && ( id = transport_read_varint( tpt ) ) != 0 )
+  {
+    lua_rawgeti( L, LUA_REGISTRYINDEX, handle->names_ref );
+    lua_pushlstring( L, path, len );
+    lua_pushinteger( L, id );
+    lua_rawset( L, -3 );
+    lua_pop( L, 1 );
+  }
+
+  if ( ret_code == 0 )
+  {
+    // read return arguments
+    nret = transport_read_len( tpt );
+    for ( i = 0; i < nret; i ++ )
+      read_variable( tpt, L );
+    return ( int )nret;
+  }
+  else
+  {
+    // read error
+    transport_read_len( tpt ); // read code (not being used here)
+    u32 elen = transport_read_len( tpt );
+    char *err_string = ( char * )alloca( elen + 1 );
+    transport_read_string( tpt, err_string, elen );
+    lua_pushlstring( L, err_string, elen );
+    return -1;
+  }
+}
+
+static void client_async_drain( lua_State *L, Handle *handle );
+
 static int helper_get( lua_State *L, Helper *helper )
 {
   struct exception e;
   int freturn = 0;
   Transport *tpt = &helper->handle->tpt;
 
+  client_async_drain( L, helper->handle );
   Try
   {
     helper_wait_ready( tpt, RPC_CMD_GET );
@@ -902,51 +1245,15 @@ static int helper_get( lua_State *L, Helper *helper )
 }
 
 
-// static int helper_async( lua_State *L )
-// {
-//     /* first read out any pending return values for old async calls */
-//     for (; h->handle->read_reply_count > 0; h->handle->read_reply_count--) {
-//       ret_code = transport_read_u8 (tpt);   /* return code */
-//       if( ret_code == 0 )
-//       {
-//         /* read return arguments, ignore everything we read */
-//         nret = transport_read_u32( tpt );
-//
-//         for (i=0; i < ( ( int ) nret ); i++)
-//           read_variable (tpt,L);
-//
-//         lua_pop (L,nret);
-//       }
-//       else
-//       {
-//         /* read error and handle it */
-//         u32 code = transport_read_u32( tpt );
-//         u32 len = transport_read_u32( tpt );
-//         char *err_string = ( char * )alloca( len + 1 );
-//         transport_read_string( tpt, err_string, len );
-//         err_string[ len ] = 0;
-//
-//         deal_with_error( L, h->handle, err_string );
-//         freturn = 0;
-//       }
-//     }
-// }
-
-
-
-
 static int helper_call (lua_State *L)
 {
   struct exception e;
   int freturn = 0;
   Helper *h;
-  Transport *tpt;
 
   h = ( Helper * )luaL_checkudata(L, 1, "rpc.helper");
   luaL_argcheck(L, h, 1, "helper expected");
 
-  tpt = &h->handle->tpt;
-
   // capture special calls, otherwise execute normal remote call
   if( strcmp("get", h->funcname ) == 0 )
   {
@@ -955,53 +1262,16 @@ static int helper_call (lua_State *L)
   }
   else
   {
+    client_async_drain( L, h->handle );
     Try
     {
-      int i,n;
-      u32 nret,ret_code;
-
-      // write function name
-      helper_wait_ready( tpt, RPC_CMD_CALL );
-      helper_remote_index( h );
+      char *path = ( char * )alloca( HELPER_PATH_SIZE( h ) );
+      int len = helper_path( h, path );
+      int newref = client_write_call( L, h->handle, path, len, 2, lua_gettop( L ) - 1 );
 
-      // write number of arguments
-      n = lua_gettop( L );
-      transport_write_u32( tpt, n - 1 );
-
-      // write each argument
-      for( i = 2; i <= n; i ++ )
-        write_variable( tpt, L, i );
-
-      /* if we're in async mode, we're done */
-      /*if ( h->handle->async )
-      {
-        h->handle->read_reply_count++;
-        freturn = 0;
-      }*/
-
-      // read return code
-      ret_code = transport_read_u8( tpt );
-
-      if ( ret_code == 0 )
-      {
-        // read return arguments
-        nret = transport_read_u32( tpt );
-
-        for ( i = 0; i < ( ( int ) nret ); i ++ )
-          read_variable( tpt, L );
-
-        freturn = ( int )nret;
-      }
-      else
+      if( ( freturn = client_read_reply( L, h->handle, path, len, newref ) ) < 0 )
       {
-        // read error and handle it
-        transport_read_u32( tpt ); // read code (not being used here)
-        u32 len = transport_read_u32( tpt );
-        char *err_string = ( char * )alloca( len + 1 );
-        transport_read_string( tpt, err_string, len );
-        err_string[ len ] = 0;
-
-        deal_with_error( L, h->handle, err_string );
+        deal_with_error( L, h->handle, lua_tostring( L, -1 ) );
         freturn = 0;
       }
     }
@@ -1029,6 +1299,7 @@ static int helper_newindex( lua_State *L )
 
   tpt = &h->handle->tpt;
 
+  client_async_drain( L, h->handle );
   Try
   {
     // index destination on remote side
@@ -1042,8 +1313,8 @@ static int helper_newindex( lua_State *L )
     if( ret_code != 0 )
     {
       // read error and handle it
-      transport_read_u32( tpt ); // Read code (not using here)
-      u32 len = transport_read_u32( tpt );
+      transport_read_len( tpt ); // Read code (not using here)
+      u32 len = transport_read_len( tpt );
       char *err_string = ( char * )alloca( len + 1 );
       transport_read_string( tpt, err_string, len );
       err_string[ len ] = 0;
@@ -1116,9 +1387,16 @@ static ServerHandle *server_handle_create( lua_State *L )
   lua_setmetatable( L, -2 );
 
   h->link_errs = 0;
+  h->names_ref = LUA_NOREF;
+  h->nnames = 0;
 
   transport_init( &h->ltpt );
   transport_init( &h->atpt );
+  h->rlen = 0;
+  h->acked = h->negotiated = 0;
+  h->ltpt.wlen = h->atpt.wlen = 0;
+  h->ltpt.rleft = h->atpt.rleft = 0;
+  h->ltpt.net_v2 = h->atpt.net_v2 = 0;
   return h;
 }
 
@@ -1136,132 +1414,760 @@ static void server_handle_destroy( ServerHandle *h )
 // **************************************************************************
 // remote function calling (client side)
 
-// rpc_connect (ip_address, port)
-//      returns a handle to the new connection, or nil if there was an error.
-//      if there is an RPC error function defined, it will be called on error.
+// read the reply to call 'i' of rpc.batch and store it in the result table
+// at the top of the stack
+static void client_batch_reply( lua_State *L, Handle *handle, int i, int *newref )
+{
+  int top = lua_gettop( L ), res, k;
+  size_t len;
+  const char *path;
+
+  lua_rawgeti( L, i + 2, 1 );
+  path = lua_tolstring( L, -1, &len );
+  res = client_read_reply( L, handle, path, len, newref[ i ] );
+  lua_createtable( L, res < 0 ? 2 : res + 1, 0 );
+  lua_pushboolean( L, res >= 0 );
+  lua_rawseti( L, -2, 1 );
+  for( k = 1; k <= ( res < 0 ? 1 : res ); k ++ )
+  {
+    lua_pushvalue( L, top + 1 + k );
+    lua_rawseti( L, -2, k + 1 );
+  }
+  lua_rawseti( L, top, i + 1 );
+  lua_settop( L, top );
+}
+
+// **************************************************************************
+// asynchronous calls (client side)
+//
+//  rpc.async sends a call without waiting for its reply and returns a future.
+//  protocol v2 doesn't acknowledge commands, so any number of calls can be in
+//  flight on a connection. the replies come back in the order of the calls and
+//  are matched with the futures queued on the handle. a future whose deadline
+//  passed stays in the queue until its reply arrives and is discarded.
 
+// handles with calls in flight (handle userdata -> true)
+static int async_handles = LUA_NOREF;
 
-static int rpc_connect( lua_State *L )
+static Future *future_create( lua_State *L, Handle *handle )
 {
-  struct exception e;
-  Handle *handle = 0;
+  Future *f = ( Future * )lua_newuserdata( L, sizeof( Future ) );
+  luaL_getmetatable( L, "rpc.future" );
+  lua_setmetatable( L, -2 );
+  f->handle = handle;
+  f->ref = LUA_NOREF;
+  f->state = FUTURE_PENDING;
+  f->has_deadline = f->newref = 0;
+  return f;
+}
 
-  Try
-  {
-    handle = handle_create ( L );
-    transport_open_connection( L, handle );
+// store the outcome of a call in future 'f': the 'nres' values at 'base' are
+// a boolean followed by the results or by the error message. then run the
+// callback of the future with the same values
+static void future_complete( lua_State *L, Future *f, int base, int nres )
+{
+  int i;
 
-    transport_write_u8( &handle->tpt, RPC_CMD_CON );
-    client_negotiate( &handle->tpt );
+  f->state = lua_toboolean( L, base ) ? FUTURE_DONE : FUTURE_FAILED;
+  lua_rawgeti( L, LUA_REGISTRYINDEX, f->ref );
+  for( i = 0; i < nres; i ++ )
+  {
+    lua_pushvalue( L, base + i );
+    lua_rawseti( L, -2, i + 1 );
   }
-  Catch( e )
+  lua_pushinteger( L, nres );
+  lua_setfield( L, -2, "n" );
+  lua_getfield( L, -1, "callback" );
+  lua_remove( L, -2 );
+  if( lua_isnil( L, -1 ) )
+    lua_pop( L, 1 );
+  else
   {
-    deal_with_error( L, 0, errorString( e.errnum ) );
-    lua_pushnil( L );
+    for( i = 0; i < nres; i ++ )
+      lua_pushvalue( L, base + i );
+    lua_call( L, nres, 0 );
   }
-  return 1;
 }
 
+static void future_fail( lua_State *L, Future *f, const char *msg )
+{
+  int base = lua_gettop( L ) + 1;
 
-// rpc_close( handle )
-//     this closes the transport, but does not free the handle object. that's
-//     because the handle will still be in the user's name space and might be
-//     referred to again. we'll let garbage collection free the object.
-//     it's a lua runtime error to refer to a transport after it has been closed.
-
+  lua_pushboolean( L, 0 );
+  lua_pushstring( L, msg );
+  future_complete( L, f, base, 2 );
+  lua_settop( L, base - 1 );
+}
 
-static int rpc_close( lua_State *L )
+// push the values stored in a completed future
+static int future_push_results( lua_State *L, Future *f )
 {
-  check_num_args( L, 1 );
+  int i, n;
 
-  if( lua_isuserdata( L, 1 ) )
+  lua_rawgeti( L, LUA_REGISTRYINDEX, f->ref );
+  lua_getfield( L, -1, "n" );
+  n = lua_tointeger( L, -1 );
+  lua_pop( L, 1 );
+  lua_checkstack( L, n );
+  for( i = 1; i <= n; i ++ )
+    lua_rawgeti( L, -i, i );
+  lua_remove( L, -n - 1 );
+  return n;
+}
+
+// add the future at 'idx' to the queue of 'handle'
+static void client_async_queue( lua_State *L, Handle *handle, int idx )
+{
+  if( handle->queue_ref == LUA_NOREF )
   {
-    if( ismetatable_type( L, 1, "rpc.handle" ) )
-    {
-      Handle *handle = ( Handle * )lua_touserdata( L, 1 );
-      transport_close( &handle->tpt );
-      return 0;
-    }
-    if( ismetatable_type( L, 1, "rpc.server_handle" ) )
-    {
-      ServerHandle *handle = ( ServerHandle * )lua_touserdata( L, 1 );
-      server_handle_shutdown( handle );
-      return 0;
-    }
+    lua_newtable( L );
+    handle->queue_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+    handle->qhead = handle->qtail = 0;
   }
+  lua_rawgeti( L, LUA_REGISTRYINDEX, handle->queue_ref );
+  lua_pushvalue( L, idx );
+  lua_rawseti( L, -2, handle->qtail ++ );
+  lua_pop( L, 1 );
 
-  return luaL_error(L,"arg must be handle");
+  // remember the handle (the future keeps the handle userdata)
+  if( async_handles == LUA_NOREF )
+  {
+    lua_newtable( L );
+    async_handles = luaL_ref( L, LUA_REGISTRYINDEX );
+  }
+  lua_rawgeti( L, LUA_REGISTRYINDEX, async_handles );
+  lua_rawgeti( L, LUA_REGISTRYINDEX, ( ( Future * )lua_touserdata( L, idx ) )->ref );
+  lua_getfield( L, -1, "handle" );
+  lua_pushboolean( L, 1 );
+  lua_rawset( L, -4 );
+  lua_pop( L, 2 );
 }
 
+// forget the queue of 'handle' once it's empty
+static void client_async_release( lua_State *L, Handle *handle, int udidx )
+{
+  luaL_unref( L, LUA_REGISTRYINDEX, handle->queue_ref );
+  handle->queue_ref = LUA_NOREF;
+  handle->qhead = handle->qtail = 0;
+  lua_rawgeti( L, LUA_REGISTRYINDEX, async_handles );
+  lua_pushvalue( L, udidx );
+  lua_pushnil( L );
+  lua_rawset( L, -3 );
+  lua_pop( L, 1 );
+}
 
-// rpc_async (handle,)
-//     this sets a handle's asynchronous calling mode (0/nil=off, other=on).
-//     (this is for the client only).
-//     @@@ Before re-enabling, this should be brought up to date with multi-command architecture
-
-// static int rpc_async (lua_State *L)
-// {
-//   Handle *handle;
-//   check_num_args( L, 2 );
-//
-//   if ( !lua_isuserdata( L, 1 ) || !ismetatable_type( L, 1, "rpc.handle" ) )
-//     my_lua_error( L, "first arg must be client handle" );
-//
-//   handle = ( Handle * )lua_touserdata( L, 1 );
-//
-//   if ( lua_isnil( L, 2 ) || ( lua_isnumber( L, 2 ) && lua_tonumber( L, 2 ) == 0) )
-//     handle->async = 0;
-//   else
-//     handle->async = 1;
-//
-//   return 0;
-// }
-
-//****************************************************************************
-// lua remote function server
-//   read function call data and execute the function. this function empties the
-//   stack on entry and exit. This sets a custom error handler to catch errors
-//   around the function call.
-
-static void read_cmd_call( Transport *tpt, lua_State *L )
+// fail all the calls in flight on 'handle' (the handle userdata is at
+// 'udidx') and close its connection
+static void client_async_abort( lua_State *L, Handle *handle, int udidx, const char *msg )
 {
-  int i, stackpos, good_function, nargs;
-  u32 len;
-  char *funcname;
-  char *token = NULL;
+  int top = lua_gettop( L ), q, qtail = handle->qtail;
 
-  // read function name
-  len = transport_read_u32( tpt ); /* function name string length */
-  funcname = ( char * )alloca( len + 1 );
-  transport_read_string( tpt, funcname, len );
-  funcname[ len ] = 0;
+  transport_close( &handle->tpt );
+  if( handle->queue_ref == LUA_NOREF )
+    return;
+  lua_rawgeti( L, LUA_REGISTRYINDEX, handle->queue_ref );
+  client_async_release( L, handle, udidx );
+  for( q = handle->qhead; q < qtail; q ++ )
+  {
+    lua_rawgeti( L, top + 1, q );
+    if( ( ( Future * )lua_touserdata( L, -1 ) )->state == FUTURE_PENDING )
+      future_fail( L, ( Future * )lua_touserdata( L, -1 ), msg );
+    lua_pop( L, 1 );
+  }
+  lua_settop( L, top );
+}
 
-  // get function
-  // @@@ perhaps handle more like variables instead of using a long string?
-  // @@@ also strtok is not thread safe
-  token = strtok( funcname, "." );
-  lua_getglobal( L, token );
-  if( LUA_ISCALLABLE( L, -1 ) || LUA_ISATABLE( L, -1 ) ) // only continue if non-nil
+// read the reply to the oldest call in flight on 'handle'
+static void client_async_reply( lua_State *L, Handle *handle, int udidx )
+{
+  struct exception e;
+  int top = lua_gettop( L ), res = 0, failed = 0;
+  Future *f;
+  size_t len;
+  const char *path;
+
+  lua_rawgeti( L, LUA_REGISTRYINDEX, handle->queue_ref );
+  lua_rawgeti( L, top + 1, handle->qhead );
+  lua_pushnil( L );
+  lua_rawseti( L, top + 1, handle->qhead ++ );
+  f = ( Future * )lua_touserdata( L, top + 2 );
+  lua_rawgeti( L, LUA_REGISTRYINDEX, f->ref );
+  lua_getfield( L, top + 3, "path" );
+  path = lua_tolstring( L, top + 4, &len );
+  lua_pushboolean( L, 1 );
+  Try
   {
-    token = strtok( NULL, "." );
+    res = client_read_reply( L, handle, path, len, f->newref );
+  }
+  Catch( e )
+  {
+    failed = 1;
+  }
+  if( failed )
+  {
+    lua_settop( L, top );
+    client_async_abort( L, handle, udidx, errorString( e.errnum ) );
+    return;
+  }
+  if( handle->qhead == handle->qtail )
+    client_async_release( L, handle, udidx );
+  // the callbacks run outside the Try block, they may raise Lua errors
+  if( f->state == FUTURE_PENDING )
+  {
+    lua_pushboolean( L, res >= 0 );
+    lua_replace( L, top + 5 );
+    future_complete( L, f, top + 5, res < 0 ? 2 : res + 1 );
+  }
+  lua_settop( L, top );
+}
+
+// read the replies to all the calls in flight on 'handle', so that the reply
+// to a synchronous exchange isn't taken for one of them. their callbacks run
+// before the synchronous call is sent.
+static void client_async_drain( lua_State *L, Handle *handle )
+{
+  int top = lua_gettop( L );
+
+  while( handle->queue_ref != LUA_NOREF )
+  {
+    // the handle userdata is kept in the future's table
+    lua_rawgeti( L, LUA_REGISTRYINDEX, handle->queue_ref );
+    lua_rawgeti( L, top + 1, handle->qhead );
+    lua_rawgeti( L, LUA_REGISTRYINDEX, ( ( Future * )lua_touserdata( L, top + 2 ) )->ref );
+    lua_getfield( L, top + 3, "handle" );
+    client_async_reply( L, handle, top + 4 );
+    lua_settop( L, top );
+  }
+}
+
+// wait up to 'timeout' ms for the replies to the calls in flight; after the
+// first reply (or expired deadline) only the replies already received are
+// handled. returns the number of calls still waiting for a reply.
+static int client_async_poll( lua_State *L, u32 timeout )
+{
+  int top = lua_gettop( L ), n, i, q, ready, pending = 0;
+  s32 left;
+  u32 start = transport_clock(), now, wait;
+  Handle **handles;
+  Transport **tpts;
+  Future *f;
 
-    // loop over remainder of string, leaving token with last value if
-    // indexing fails
-    while( token != NULL && ( LUA_ISCALLABLE( L, -1 ) || LUA_ISATABLE( L, -1 ) ) )
+  if( async_handles == LUA_NOREF )
+    return 0;
+  for( ;; )
+  {
+    // gather the handles (kept on the stack while callbacks run)
+    lua_settop( L, top );
+    lua_rawgeti( L, LUA_REGISTRYINDEX, async_handles );
+    lua_newtable( L );
+    n = 0;
+    lua_pushnil( L );
+    while( lua_next( L, top + 1 ) )
     {
-      lua_getfield( L, -1, token );
-      if ( LUA_ISCALLABLE( L, -1 ) || LUA_ISATABLE( L, -1 ) )
+      lua_pop( L, 1 );
+      lua_pushvalue( L, -1 );
+      lua_rawseti( L, top + 2, ++ n );
+    }
+    lua_checkstack( L, n + LUA_MINSTACK );
+    for( i = 1; i <= n; i ++ )
+      lua_rawgeti( L, top + 2, i );
+    handles = ( Handle ** )lua_newuserdata( L, sizeof( Handle * ) * ( n + 1 ) );
+    tpts = ( Transport ** )lua_newuserdata( L, sizeof( Transport * ) * ( n + 1 ) );
+
+    // fail the calls whose deadline passed
+    now = transport_clock();
+    wait = now - start >= timeout ? 0 : timeout - ( now - start );
+    pending = ready = 0;
+    for( i = 0; i < n; i ++ )
+    {
+      handles[ i ] = ( Handle * )lua_touserdata( L, top + 3 + i );
+      tpts[ i ] = &handles[ i ]->tpt;
+      if( !transport_is_open( tpts[ i ] ) )
+      {
+        client_async_abort( L, handles[ i ], top + 3 + i, errorString( ERR_CLOSED ) );
+        ready = 1;
+        continue;
+      }
+      lua_rawgeti( L, LUA_REGISTRYINDEX, handles[ i ]->queue_ref );
+      for( q = handles[ i ]->qhead; q < handles[ i ]->qtail; q ++ )
       {
-        lua_remove( L, -2 );
-        token = strtok( NULL, "." );
+        lua_rawgeti( L, -1, q );
+        f = ( Future * )lua_touserdata( L, -1 );
+        lua_pop( L, 1 );
+        if( f->state != FUTURE_PENDING )
+          continue;
+        if( f->has_deadline && ( left = ( s32 )( f->deadline - now ) ) <= 0 )
+        {
+          future_fail( L, f, "timeout" );
+          ready = 1;
+          continue;
+        }
+        if( f->has_deadline && ( u32 )left < wait )
+          wait = ( u32 )left;
+        pending ++;
       }
+      lua_pop( L, 1 );
+    }
+    if( pending == 0 )
+      break;
+    if( ready )
+      start = now, timeout = wait = 0;
+
+    // handle one reply
+    if( ( i = transport_select( tpts, n, wait ) ) >= 0 )
+    {
+      client_async_reply( L, handles[ i ], top + 3 + i );
+      start = transport_clock();
+      timeout = 0;
+    }
+    else if( transport_clock() - start >= timeout )
+      break;
+  }
+  lua_settop( L, top );
+  return pending;
+}
+
+// rpc_async( handle, { path, args..., timeout = ms } [, callback ] )
+//     sends a call without waiting for its reply and returns a future. the
+//     reply is read by future:wait, future:ready, rpc.wait or rpc.poll, which
+//     also run the callback with the values future:wait returns. the call
+//     fails with "timeout" if no reply arrived after 'timeout' milliseconds.
+//     on a protocol v1 connection the call completes before returning.
+static int rpc_async( lua_State *L )
+{
+  struct exception e;
+  Handle *handle;
+  Future *f;
+  int fidx, top, i, nargs, failed = 0;
+  volatile int res = 0;
+  size_t len;
+  const char *path;
+
+  handle = ( Handle * )luaL_checkudata( L, 1, "rpc.handle" );
+  luaL_checktype( L, 2, LUA_TTABLE );
+  lua_rawgeti( L, 2, 1 );
+  luaL_argcheck( L, lua_type( L, -1 ) == LUA_TSTRING, 2, "function name expected" );
+  lua_pop( L, 1 );
+  if( !lua_isnoneornil( L, 3 ) )
+    luaL_checktype( L, 3, LUA_TFUNCTION );
+  lua_settop( L, 3 );
+
+  f = future_create( L, handle );
+  fidx = lua_gettop( L );
+  lua_createtable( L, 0, 4 );
+  lua_rawgeti( L, 2, 1 );
+  lua_setfield( L, -2, "path" );
+  lua_pushvalue( L, 1 );
+  lua_setfield( L, -2, "handle" );
+  lua_pushvalue( L, 3 );
+  lua_setfield( L, -2, "callback" );
+  f->ref = luaL_ref( L, LUA_REGISTRYINDEX );
+  lua_getfield( L, 2, "timeout" );
+  if( lua_isnumber( L, -1 ) )
+  {
+    f->has_deadline = 1;
+    f->deadline = transport_clock() + ( u32 )lua_tointeger( L, -1 );
+  }
+  lua_pop( L, 1 );
+
+  // send the call
+  nargs = lua_objlen( L, 2 ) - 1;
+  lua_checkstack( L, nargs + 1 );
+  for( i = 1; i <= nargs + 1; i ++ )
+    lua_rawgeti( L, 2, i );
+  path = lua_tolstring( L, fidx + 1, &len );
+  top = lua_gettop( L );
+  Try
+  {
+    f->newref = client_write_call( L, handle, path, len, fidx + 2, nargs );
+    if( handle->tpt.net_v2 )
+      transport_flush( &handle->tpt );
+    else
+    {
+      lua_pushboolean( L, 1 );
+      res = client_read_reply( L, handle, path, len, f->newref );
+    }
+  }
+  Catch( e )
+  {
+    failed = 1;
+  }
+  if( failed )
+  {
+    lua_settop( L, fidx );
+    client_async_abort( L, handle, 1, errorString( e.errnum ) );
+    if( f->state == FUTURE_PENDING )
+      future_fail( L, f, errorString( e.errnum ) );
+  }
+  else if( handle->tpt.net_v2 )
+    client_async_queue( L, handle, fidx );
+  else
+  {
+    lua_pushboolean( L, res >= 0 );
+    lua_replace( L, top + 1 );
+    future_complete( L, f, top + 1, res < 0 ? 2 : res + 1 );
+  }
+  lua_settop( L, fidx );
+  return 1;
+}
+
+// rpc_poll( [ timeout ] )
+//     waits up to 'timeout' milliseconds (default 0) for replies to the
+//     asynchronous calls and handles all of them that arrived. returns the
+//     number of calls still waiting for a reply.
+static int rpc_poll( lua_State *L )
+{
+  lua_pushinteger( L, client_async_poll( L, ( u32 )luaL_optinteger( L, 1, 0 ) ) );
+  return 1;
+}
+
+// rpc_wait( { futures... } [, timeout ] )
+//     waits until all the futures completed or 'timeout' milliseconds passed
+//     (no timeout by default). returns true if all of them completed.
+static int rpc_wait( lua_State *L )
+{
+  int i, n, done = 0, hastimeout = !lua_isnoneornil( L, 2 );
+  u32 start = transport_clock(), timeout = ( u32 )luaL_optinteger( L, 2, 0 ), elapsed;
+
+  luaL_checktype( L, 1, LUA_TTABLE );
+  n = lua_objlen( L, 1 );
+  for( ;; )
+  {
+    for( i = 1; i <= n; i ++ )
+    {
+      lua_rawgeti( L, 1, i );
+      if( ( ( Future * )luaL_checkudata( L, -1, "rpc.future" ) )->state == FUTURE_PENDING )
+        break;
+      lua_pop( L, 1 );
+    }
+    if( ( done = i > n ) != 0 )
+      break;
+    lua_pop( L, 1 );
+    elapsed = transport_clock() - start;
+    if( hastimeout && elapsed >= timeout )
+      break;
+    if( client_async_poll( L, hastimeout ? timeout - elapsed : RPC_ASYNC_POLL_TIME ) == 0 )
+      break;
+  }
+  if( !done ) // the last poll might have completed them
+    for( done = 1, i = 1; i <= n && done; i ++ )
+    {
+      lua_rawgeti( L, 1, i );
+      done = ( ( Future * )lua_touserdata( L, -1 ) )->state != FUTURE_PENDING;
+      lua_pop( L, 1 );
+    }
+  lua_pushboolean( L, done );
+  return 1;
+}
+
+// future:wait( [ timeout ] )
+//     waits for the call to complete (or for 'timeout' milliseconds). returns
+//     true followed by the results, false and the error message, or nil if
+//     the call is still in flight.
+static int future_wait( lua_State *L )
+{
+  Future *f = ( Future * )luaL_checkudata( L, 1, "rpc.future" );
+  int hastimeout = !lua_isnoneornil( L, 2 );
+  u32 start = transport_clock(), timeout = ( u32 )luaL_optinteger( L, 2, 0 ), elapsed;
+
+  while( f->state == FUTURE_PENDING )
+  {
+    elapsed = transport_clock() - start;
+    if( hastimeout && elapsed >= timeout )
+      return 0;
+    if( client_async_poll( L, hastimeout ? timeout - elapsed : RPC_ASYNC_POLL_TIME ) == 0 && f->state == FUTURE_PENDING )
+      return 0;
+  }
+  return future_push_results( L, f );
+}
+
+// future:ready()
+//     handles the replies already received, returns true if the call completed
+static int future_ready( lua_State *L )
+{
+  Future *f = ( Future * )luaL_checkudata( L, 1, "rpc.future" );
+
+  if( f->state == FUTURE_PENDING )
+    client_async_poll( L, 0 );
+  lua_pushboolean( L, f->state != FUTURE_PENDING );
+  return 1;
+}
+
+static int future_gc( lua_State *L )
+{
+  Future *f = ( Future * )luaL_checkudata( L, 1, "rpc.future" );
+
+  luaL_unref( L, LUA_REGISTRYINDEX, f->ref );
+  f->ref = LUA_NOREF;
+  return 0;
+}
+
+// rpc_connect (ip_address, port)
+//      returns a handle to the new connection, or nil if there was an error.
+//      if there is an RPC error function defined, it will be called on error.
+
+
+static int rpc_connect( lua_State *L )
+{
+  struct exception e;
+  Handle *handle = 0;
+
+  Try
+  {
+    handle = handle_create ( L );
+    transport_open_connection( L, handle );
+
+    transport_write_u8( &handle->tpt, RPC_CMD_CON );
+    client_negotiate( &handle->tpt );
+    if( rpc_v2_enabled )
+      client_probe_v2( L, handle );
+  }
+  Catch( e )
+  {
+    deal_with_error( L, 0, errorString( e.errnum ) );
+    lua_pushnil( L );
+  }
+  return 1;
+}
+
+
+// rpc_close( handle )
+//     this closes the transport, but does not free the handle object. that's
+//     because the handle will still be in the user's name space and might be
+//     referred to again. we'll let garbage collection free the object.
+//     it's a lua runtime error to refer to a transport after it has been closed.
+
+
+static int rpc_close( lua_State *L )
+{
+  check_num_args( L, 1 );
+
+  if( lua_isuserdata( L, 1 ) )
+  {
+    if( ismetatable_type( L, 1, "rpc.handle" ) )
+    {
+      Handle *handle = ( Handle * )lua_touserdata( L, 1 );
+      client_async_abort( L, handle, 1, errorString( ERR_CLOSED ) );
+      return 0;
+    }
+    if( ismetatable_type( L, 1, "rpc.server_handle" ) )
+    {
+      ServerHandle *handle = ( ServerHandle * )lua_touserdata( L, 1 );
+      server_handle_shutdown( handle );
+      return 0;
+    }
+  }
+
+  return luaL_error(L,"arg must be handle");
+}
+
+
+// rpc_batch( handle, { path, args... }, ... )
+//     calls several remote functions. with protocol v2 all the calls are sent
+//     in a single write before reading any reply. returns a table with one
+//     entry per call: { true, results... } or { false, error message }.
+static int rpc_batch( lua_State *L )
+{
+  struct exception e;
+  Handle *handle;
+  int i, ncalls, top, res;
+  int *newref;
+  size_t len;
+  const char *path;
+
+  handle = ( Handle * )luaL_checkudata( L, 1, "rpc.handle" );
+  ncalls = lua_gettop( L ) - 1;
+  for( i = 2; i <= ncalls + 1; i ++ )
+  {
+    luaL_checktype( L, i, LUA_TTABLE );
+    lua_rawgeti( L, i, 1 );
+    luaL_argcheck( L, lua_type( L, -1 ) == LUA_TSTRING, i, "function name expected" );
+    lua_pop( L, 1 );
+  }
+  newref = ( int * )alloca( sizeof( int ) * ( ncalls + 1 ) );
+  client_async_drain( L, handle );
+  lua_createtable( L, ncalls, 0 );
+  Try
+  {
+    for( i = 0; i < ncalls; i ++ )
+    {
+      // push the arguments of the call and send it
+      top = lua_gettop( L );
+      lua_checkstack( L, lua_objlen( L, i + 2 ) );
+      for( res = 1; res <= ( int )lua_objlen( L, i + 2 ); res ++ )
+        lua_rawgeti( L, i + 2, res );
+      path = lua_tolstring( L, top + 1, &len );
+      newref[ i ] = client_write_call( L, handle, path, len, top + 2, lua_gettop( L ) - top - 1 );
+      lua_settop( L, top );
+
+      // v1 calls wait for each reply
+      if( !handle->tpt.net_v2 )
+        client_batch_reply( L, handle, i, newref );
     }
+    if( handle->tpt.net_v2 )
+      for( i = 0; i < ncalls; i ++ )
+        client_batch_reply( L, handle, i, newref );
+  }
+  Catch( e )
+  {
+    return generic_catch_handler( L, handle, e );
   }
+  return 1;
+}
+
+// rpc_fastpath( [ enabled ] )
+//     enables or disables protocol v2 for the connections opened after this
+//     call (it's only used if the server supports it). returns the current
+//     setting.
+static int rpc_fastpath( lua_State *L )
+{
+  if( lua_gettop( L ) > 0 )
+    rpc_v2_enabled = lua_toboolean( L, 1 );
+  lua_pushboolean( L, rpc_v2_enabled );
+  return 1;
+}
+
+//****************************************************************************
+// lua remote function server
+//   read function call data and execute the function. this function empties the
+//   stack on entry and exit. This sets a custom error handler to catch errors
+//   around the function call.
+
+// split a dotted path ("a.b.c") and push a table with its keys
+static void push_path( lua_State *L, const char *path, size_t len )
+{
+  const char *p = path, *end = path + len, *dot;
+  int n = 0;
+
+  lua_newtable( L );
+  while( p <= end )
+  {
+    if( ( dot = ( const char * )memchr( p, '.', end - p ) ) == NULL )
+      dot = end;
+    lua_pushlstring( L, p, dot - p );
+    lua_rawseti( L, -2, ++ n );
+    p = dot + 1;
+  }
+}
+
+// look up the path whose keys are in the table at the top of the stack and
+// push the value found. returns the key where the lookup stopped, or NULL if
+// the whole path resolved to a function or a table
+static const char *server_resolve( lua_State *L )
+{
+  int keys = lua_gettop( L );
+  int i, n = ( int )lua_objlen( L, keys );
+  const char *key;
+
+  lua_rawgeti( L, keys, 1 );
+  key = lua_tostring( L, -1 );
+  lua_gettable( L, LUA_GLOBALSINDEX );
+  for( i = 2; ; i ++ )
+  {
+    if( !LUA_ISCALLABLE( L, -1 ) && !LUA_ISATABLE( L, -1 ) )
+      return key;
+    if( i > n )
+      return NULL;
+    lua_rawgeti( L, keys, i );
+    key = lua_tostring( L, -1 );
+    lua_gettable( L, -2 );
+    lua_remove( L, -2 );
+  }
+}
+
+// start a new table of function handles (protocol v2)
+static void server_reset_names( lua_State *L, ServerHandle *handle )
+{
+  luaL_unref( L, LUA_REGISTRYINDEX, handle->names_ref );
+  lua_newtable( L );
+  handle->names_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+  handle->nnames = 0;
+}
+
+// push the keys of a function path and return its handle (a new one if the
+// path wasn't seen before, 0 if there's no room left for new handles)
+static u32 server_register_path( lua_State *L, ServerHandle *handle, const char *path, size_t len )
+{
+  u32 id = 0;
+
+  lua_rawgeti( L, LUA_REGISTRYINDEX, handle->names_ref );
+  lua_pushlstring( L, path, len );
+  lua_rawget( L, -2 );
+  if( lua_isnumber( L, -1 ) )
+  {
+    id = ( u32 )lua_tonumber( L, -1 );
+    lua_pop( L, 1 );
+    lua_rawgeti( L, -1, id );
+  }
+  else
+  {
+    lua_pop( L, 1 );
+    push_path( L, path, len );
+    if( handle->nnames < RPC_MAX_NAMES )
+    {
+      id = ++ handle->nnames;
+      lua_pushvalue( L, -1 );
+      lua_rawseti( L, -3, id );
+      lua_pushlstring( L, path, len );
+      lua_pushinteger( L, id );
+      lua_rawset( L, -4 );
+    }
+  }
+  lua_remove( L, -2 );
+  return id;
+}
+
+// write the status of a call (followed by the new function handle if the
+// client sent a path in v2)
+static void server_write_status( Transport *tpt, u8 status, int named, u32 id )
+{
+  transport_write_u8( tpt, status );
+  if( tpt->net_v2 && named )
+    transport_write_varint( tpt, id );
+}
+
+static void read_cmd_call( ServerHandle *handle, lua_State *L )
+{
+  struct exception e;
+  Transport *tpt = &handle->atpt;
+  int i, stackpos, good_function, nargs, named;
+  u32 len, id = 0;
+  char *funcname;
+  const char *token;
+
+  // read function handle or name and push the keys of its path
+  if( tpt->net_v2 )
+    id = transport_read_varint( tpt );
+  if( ( named = id == 0 ) != 0 )
+  {
+    len = transport_read_len( tpt ); /* function name string length */
+    funcname = ( char * )alloca( len );
+    transport_read_string( tpt, funcname, len );
+    if( tpt->net_v2 )
+      id = server_register_path( L, handle, funcname, len );
+    else
+      push_path( L, funcname, len );
+  }
+  else
+  {
+    lua_rawgeti( L, LUA_REGISTRYINDEX, handle->names_ref );
+    lua_rawgeti( L, -1, id );
+    lua_remove( L, -2 );
+    if( !lua_istable( L, -1 ) )
+    {
+      e.errnum = ERR_PROTOCOL;
+      e.type = fatal;
+      Throw( e );
+    }
+  }
+
+  // get function
+  token = server_resolve( L );
   stackpos = lua_gettop( L ) - 1;
   good_function = LUA_ISCALLABLE( L, -1 );
 
   // read number of arguments
-  nargs = transport_read_u32( tpt );
+  nargs = transport_read_len( tpt );
 
   // read in each argument, leave it on the stack
   for ( i = 0; i < nargs; i ++ )
@@ -1279,37 +2185,37 @@ static void read_cmd_call( Transport *tpt, lua_State *L )
       size_t elen;
       const char *errmsg;
       errmsg = lua_tolstring( L, -1, &elen );
-      transport_write_u8( tpt, 1 );
-      transport_write_u32( tpt, error_code );
-      transport_write_u32( tpt, ( u32 )elen );
+      server_write_status( tpt, 1, named, id );
+      transport_write_len( tpt, error_code );
+      transport_write_len( tpt, ( u32 )elen );
       transport_write_string( tpt, errmsg, ( int )elen );
     }
     else
     {
       // pass the return values back to the caller
-      transport_write_u8( tpt, 0 );
+      server_write_status( tpt, 0, named, id );
       nret = lua_gettop( L ) - stackpos;
-      transport_write_u32( tpt, nret );
+      transport_write_len( tpt, nret );
       for ( i = 0; i < nret; i ++ )
         write_variable( tpt, L, stackpos + 1 + i );
     }
   }
   else
   {
-    // bad index or function call
+    // bad index or function call (the value found is below the arguments)
     const char *msg;
-    if ( lua_isnil( L, -1 ) )
+    if ( lua_isnil( L, stackpos + 1 ) )
       msg = "undefined: ";
-    else if ( LUA_ISATABLE( L, -1 ) )
+    else if ( LUA_ISATABLE( L, stackpos + 1 ) )
       msg = "can't call table";
     else
       msg = "not table/func: ";
     if( token == NULL ) // should occur if "function" was actually a table
-      token = (char *)"";
+      token = "";
     int errlen = ( int )strlen( msg ) + strlen( token );
-    transport_write_u8( tpt, 1 );
-    transport_write_u32( tpt, LUA_ERRRUN );
-    transport_write_u32( tpt, errlen );
+    server_write_status( tpt, 1, named, id );
+    transport_write_len( tpt, LUA_ERRRUN );
+    transport_write_len( tpt, errlen );
     transport_write_string( tpt, msg, ( int )strlen( msg ) );
     transport_write_string( tpt, token, strlen( token ) );
   }
@@ -1325,7 +2231,7 @@ static void read_cmd_get( Transport *tpt, lua_State *L )
   char *token = NULL;
 
   // read function name
-  len = transport_read_u32( tpt ); // function name string length
+  len = transport_read_len( tpt ); // function name string length
   funcname = ( char * )alloca( len + 1 );
   transport_read_string( tpt, funcname, len );
   funcname[ len ] = 0;
@@ -1358,7 +2264,7 @@ static void read_cmd_newindex( Transport *tpt, lua_State *L )
   char *token = NULL;
 
   // read function name
-  len = transport_read_u32( tpt ); // function name string length
+  len = transport_read_len( tpt ); // function name string length
   funcname = ( char * )alloca( len + 1 );
   transport_read_string( tpt, funcname, len );
   funcname[ len ] = 0;
@@ -1406,6 +2312,163 @@ static void read_cmd_newindex( Transport *tpt, lua_State *L )
 }
 
 
+// **************************************************************************
+// non-blocking server
+//
+//  rpc.adispatch collects the bytes of a command in the server handle's
+//  buffer as they arrive and runs the command only once it's complete, so a
+//  slow client can't stall the caller (a timer or event loop callback). the
+//  scanner below walks the buffered bytes with the same grammar as
+//  read_variable and read_cmd_*, without touching the Lua state. commands
+//  that don't fit in the buffer are finished with blocking reads.
+
+// scan results
+enum { SCAN_MORE, SCAN_VALUE, SCAN_END };
+
+typedef struct
+{
+  const u8 *p, *end;
+  Transport *tpt;
+} Scanner;
+
+static int scan_skip( Scanner *s, u32 n )
+{
+  if( ( u32 )( s->end - s->p ) < n )
+    return 0;
+  s->p += n;
+  return 1;
+}
+
+static int scan_varint( Scanner *s, u32 *x )
+{
+  int shift = 0;
+
+  *x = 0;
+  do
+  {
+    if( s->p == s->end || shift > 28 )
+      return 0;
+    *x |= ( u32 )( *s->p & 0x7F ) << shift;
+    shift += 7;
+  } while( *s->p ++ & 0x80 );
+  return 1;
+}
+
+static int scan_len( Scanner *s, u32 *x )
+{
+  union u32_bytes ub;
+
+  if( s->tpt->net_v2 )
+    return scan_varint( s, x );
+  if( s->end - s->p < 4 )
+    return 0;
+  memcpy( ub.b, s->p, 4 );
+  if( s->tpt->net_little != s->tpt->loc_little )
+    swap_bytes( ( uint8_t * )ub.b, 4 );
+  *x = ub.i;
+  s->p += 4;
+  return 1;
+}
+
+// skip a length followed by that many bytes
+static int scan_string( Scanner *s )
+{
+  u32 len;
+
+  return scan_len( s, &len ) && scan_skip( s, len );
+}
+
+static int scan_variable( Scanner *s )
+{
+  u32 x;
+  int res;
+  u8 type;
+
+  if( s->p == s->end )
+    return SCAN_MORE;
+  type = *s->p ++;
+  if( s->tpt->net_v2 )
+  {
+    if( type <= RPC2_FIXINT_MAX )
+      return SCAN_VALUE;
+    if( ( type & RPC2_FIXSTR_MASK ) == RPC2_FIXSTR )
+      return scan_skip( s, type & RPC2_FIXSTR_MAXLEN ) ? SCAN_VALUE : SCAN_MORE;
+    type -= RPC2_TAG_BASE;
+  }
+  switch( type )
+  {
+    case RPC_BOOLEAN:
+      return scan_skip( s, 1 ) ? SCAN_VALUE : SCAN_MORE;
+
+    case RPC_NUMBER:
+      return scan_skip( s, s->tpt->lnum_bytes ) ? SCAN_VALUE : SCAN_MORE;
+
+    case RPC_INTEGER:
+      return scan_varint( s, &x ) ? SCAN_VALUE : SCAN_MORE;
+
+    case RPC_STRING:
+    case RPC_REMOTE:
+      return scan_string( s ) ? SCAN_VALUE : SCAN_MORE;
+
+    case RPC_STRING_LZ:
+      return scan_len( s, &x ) && scan_string( s ) ? SCAN_VALUE : SCAN_MORE;
+
+    case RPC_TABLE:
+    case RPC_FUNCTION:
+      while( ( res = scan_variable( s ) ) == SCAN_VALUE );
+      return res == SCAN_END ? SCAN_VALUE : SCAN_MORE;
+
+    case RPC_TABLE_END:
+    case RPC_FUNCTION_END:
+      return SCAN_END;
+
+    default: // nil, or garbage that read_variable will reject
+      return SCAN_VALUE;
+  }
+}
+
+// returns the length of the command at the start of the buffer, or 0 if it
+// wasn't completely received yet
+static int server_scan_command( ServerHandle *handle )
+{
+  Scanner s;
+  u32 id = 0, nargs;
+
+  s.p = handle->rbuf + 1;
+  s.end = handle->rbuf + handle->rlen;
+  s.tpt = &handle->atpt;
+  switch( handle->rbuf[ 0 ] )
+  {
+    case RPC_CMD_CALL:
+      if( s.tpt->net_v2 && !scan_varint( &s, &id ) )
+        return 0;
+      if( id == 0 && !scan_string( &s ) )
+        return 0;
+      if( !scan_len( &s, &nargs ) )
+        return 0;
+      while( nargs -- > 0 )
+        if( scan_variable( &s ) != SCAN_VALUE )
+          return 0;
+      break;
+
+    case RPC_CMD_GET:
+      if( !scan_string( &s ) )
+        return 0;
+      break;
+
+    case RPC_CMD_NEWINDEX:
+      if( !scan_string( &s ) || scan_variable( &s ) != SCAN_VALUE || scan_variable( &s ) != SCAN_VALUE )
+        return 0;
+      break;
+
+    case RPC_CMD_CON:
+      if( !scan_skip( &s, 8 ) )
+        return 0;
+      break;
+  }
+  return ( int )( s.p - handle->rbuf );
+}
+
 static ServerHandle *rpc_listen_helper( lua_State *L )
 {
   struct exception e;
@@ -1459,7 +2522,7 @@ static int rpc_peek( lua_State *L )
   // if accepting transport is open, see if there is any data to read
   if ( transport_is_open( &handle->atpt ) )
   {
-    if ( transport_readable( &handle->atpt ) )
+    if ( handle->rlen > 0 || transport_readable( &handle->atpt ) )
       lua_pushnumber( L, 1 );
     else
       lua_pushnil( L );
@@ -1483,6 +2546,15 @@ static int rpc_peek( lua_State *L )
 }
 
 
+// acknowledge a command (v2 commands are pipelined, so there's nothing to do,
+// rpc.adispatch may have acknowledged it already)
+static void server_ready( ServerHandle *handle )
+{
+  if( !handle->atpt.net_v2 && !handle->acked )
+    transport_write_u8( &handle->atpt, RPC_READY );
+  handle->acked = 0;
+}
+
 static void rpc_dispatch_helper( lua_State *L, ServerHandle *handle )
 {
   struct exception e;
@@ -1497,20 +2569,27 @@ static void rpc_dispatch_helper( lua_State *L, ServerHandle *handle )
         switch ( transport_read_u8( &handle->atpt ) )
         {
           case RPC_CMD_CALL:  // call function
-            transport_write_u8( &handle->atpt, RPC_READY );
-            read_cmd_call( &handle->atpt, L );
+            server_ready( handle );
+            read_cmd_call( handle, L );
             break;
           case RPC_CMD_GET: // get server-side variable for client
-            transport_write_u8( &handle->atpt, RPC_READY );
+            server_ready( handle );
             read_cmd_get( &handle->atpt, L );
             break;
           case RPC_CMD_CON: //  allow client to renegotiate active connection
             server_negotiate( &handle->atpt );
+            handle->negotiated = 1;
             break;
           case RPC_CMD_NEWINDEX: // assign new variable on server
-            transport_write_u8( &handle->atpt, RPC_READY );
+            server_ready( handle );
             read_cmd_newindex( &handle->atpt, L );
             break;
+          case RPC_CMD_CAPS: // client speaks protocol v2
+            transport_write_u8( &handle->atpt, RPC_READY );
+            transport_write_u8( &handle->atpt, RPC_CAP_V2 );
+            server_reset_names( L, handle );
+            handle->atpt.net_v2 = 1;
+            break;
           default: // complain and throw exception if unknown command
             transport_write_u8(&handle->atpt, RPC_UNSUPPORTED_CMD );
             e.type = nonfatal;
@@ -1540,6 +2619,7 @@ static void rpc_dispatch_helper( lua_State *L, ServerHandle *handle )
             Throw( e );
         }
       }
+      transport_flush( &handle->atpt );
     }
     else
     {
@@ -1551,6 +2631,7 @@ static void rpc_dispatch_helper( lua_State *L, ServerHandle *handle )
       {
         case RPC_CMD_CON:
           server_negotiate( &handle->atpt );
+          handle->negotiated = 1;
           break;
         default: // connection must be established to issue any other commands
           e.type = nonfatal;
@@ -1590,18 +2671,93 @@ static int rpc_dispatch( lua_State *L )
 
   handle = ( ServerHandle * )lua_touserdata( L, 1 );
 
+  // start with what rpc.adispatch already received
+  handle->atpt.rsrc = handle->rbuf;
+  handle->atpt.rleft = handle->rlen;
   rpc_dispatch_helper( L, handle );
+  handle->rlen = handle->atpt.rleft;
+  memmove( handle->rbuf, handle->atpt.rsrc, handle->rlen );
+  handle->atpt.rleft = 0;
   return 0;
 }
 
+// receive what's available and run the commands completely received.
+// returns the number of commands run
 static int rpc_adispatch_helper( lua_State *L, ServerHandle * handle )
 {
-  // Check if we have waiting data that we can dispatch on,
-  // don't block if we don't have any data
-  if( transport_readable( &handle->atpt ) || transport_readable( &handle->ltpt ) )
-      rpc_dispatch_helper( L, handle );
+  struct exception e;
+  Transport *tpt = &handle->atpt, *ltpt = &handle->ltpt;
+  int len = 0, failed = 0, ncmds = 0;
 
-  return 0;
+  Try
+  {
+    if( !transport_is_open( tpt ) && transport_is_open( ltpt ) && transport_select( &ltpt, 1, 0 ) == 0 )
+    {
+      transport_accept( ltpt, tpt );
+      handle->rlen = 0;
+      handle->acked = handle->negotiated = 0;
+    }
+    if( transport_is_open( tpt ) && handle->rlen < RPC_READ_BUF_SIZE )
+      handle->rlen += transport_read_available( tpt, handle->rbuf + handle->rlen, RPC_READ_BUF_SIZE - handle->rlen );
+  }
+  Catch( e )
+  {
+    failed = 1;
+    handle->rlen = 0;
+    if( e.type == fatal )
+    {
+      server_handle_shutdown( handle );
+      deal_with_error( L, 0, errorString( e.errnum ) );
+    }
+    else
+      transport_close( tpt );
+  }
+  if( failed )
+    return 0;
+
+  while( handle->rlen > 0 && transport_is_open( tpt ) )
+  {
+    // connection must be established to issue any other commands
+    if( !handle->negotiated && handle->rbuf[ 0 ] != RPC_CMD_CON )
+    {
+      handle->rlen = 0;
+      transport_close( tpt );
+      break;
+    }
+    if( ( len = server_scan_command( handle ) ) == 0 )
+    {
+      if( handle->rlen < RPC_READ_BUF_SIZE )
+      {
+        // v1 clients send the rest of the command after the acknowledge
+        if( !tpt->net_v2 && !handle->acked && handle->negotiated &&
+            ( handle->rbuf[ 0 ] == RPC_CMD_CALL || handle->rbuf[ 0 ] == RPC_CMD_GET || handle->rbuf[ 0 ] == RPC_CMD_NEWINDEX ) )
+        {
+          Try
+          {
+            transport_write_u8( tpt, RPC_READY );
+            transport_flush( tpt );
+            handle->acked = 1;
+          }
+          Catch( e )
+          {
+            transport_close( tpt );
+          }
+        }
+        break;
+      }
+      len = handle->rlen; // too big for the buffer, block for the rest
+    }
+
+    // run the command from the buffer
+    tpt->rsrc = handle->rbuf;
+    tpt->rleft = len;
+    rpc_dispatch_helper( L, handle );
+    tpt->rleft = 0;
+    ncmds ++;
+    handle->rlen -= len;
+    memmove( handle->rbuf, handle->rbuf + len, handle->rlen );
+  }
+  return ncmds;
 }
 
 static int rpc_adispatch( lua_State *L )
@@ -1613,9 +2769,8 @@ static int rpc_adispatch( lua_State *L )
   luaL_argcheck(L, handle, 1, "server handle expected");
 
   handle = ( ServerHandle * )lua_touserdata( L, 1 );
-  rpc_adispatch_helper( L, handle );
-
-  return 0;
+  lua_pushinteger( L, rpc_adispatch_helper( L, handle ) );
+  return 1;
 }
 
 // rpc_server( transport_identifier )
@@ -1670,6 +2825,55 @@ static int rpc_on_error( lua_State *L )
   return 0;
 }
 
+// **************************************************************************
+// compression
+
+// rpc.compress( [ enabled ] )
+//     asks for compressed strings on the connections opened after this call
+//     (the server must support it). returns the current setting.
+static int rpc_compress( lua_State *L )
+{
+  if( lua_gettop( L ) > 0 )
+    rpc_lz_enabled = lua_toboolean( L, 1 );
+  lua_pushboolean( L, rpc_lz_enabled );
+  return 1;
+}
+
+// rpc.lzpack( s )
+//     returns the compressed form of string s (nil if it doesn't get smaller)
+static int rpc_lzpack( lua_State *L )
+{
+  size_t len;
+  const char *s = luaL_checklstring( L, 1, &len );
+  char *z;
+  u32 zlen;
+
+  if( len < 2 )
+    return 0;
+  z = ( char * )alloca( len - 1 );
+  if( ( zlen = eluarpc_lz_compress( ( const u8 * )s, len, ( u8 * )z, len - 1 ) ) == 0 )
+    return 0;
+  lua_pushlstring( L, z, zlen );
+  return 1;
+}
+
+// rpc.lzunpack( z, len )
+//     expands the compressed string z to its original length len
+static int rpc_lzunpack( lua_State *L )
+{
+  size_t zlen;
+  const char *z = luaL_checklstring( L, 1, &zlen );
+  int len = luaL_checkinteger( L, 2 );
+  char *s;
+
+  luaL_argcheck( L, len >= 0, 2, "invalid length" );
+  s = ( char * )alloca( len + 1 );
+  if( eluarpc_lz_expand( ( const u8 * )z, zlen, ( u8 * )s, len ) != len )
+    return luaL_error( L, "invalid compressed data" );
+  lua_pushlstring( L, s, len );
+  return 1;
+}
+
 // **************************************************************************
 // register RPC functions
 
@@ -1699,6 +2903,17 @@ const LUA_REG_TYPE rpc_server_handle[] =
   { LNILKEY, LNILVAL }
 };
 
+const LUA_REG_TYPE rpc_future[] =
+{
+  { LSTRKEY( "wait" ), LFUNCVAL( future_wait ) },
+  { LSTRKEY( "ready" ), LFUNCVAL( future_ready ) },
+  { LSTRKEY( "__gc" ), LFUNCVAL( future_gc ) },
+#if LUA_OPTIMIZE_MEMORY > 0
+  { LSTRKEY( "__index" ), LROVAL( rpc_future ) },
+#endif
+  { LNILKEY, LNILVAL }
+};
+
 const LUA_REG_TYPE rpc_map[] =
 {
   {  LSTRKEY( "connect" ), LFUNCVAL( rpc_connect ) },
@@ -1709,7 +2924,14 @@ const LUA_REG_TYPE rpc_map[] =
   {  LSTRKEY( "peek" ), LFUNCVAL( rpc_peek ) },
   {  LSTRKEY( "dispatch" ), LFUNCVAL( rpc_dispatch ) },
   {  LSTRKEY( "adispatch" ), LFUNCVAL( rpc_adispatch ) },
-//  {  LSTRKEY( "rpc_async" ), LFUNCVAL( rpc_async ) },
+  {  LSTRKEY( "compress" ), LFUNCVAL( rpc_compress ) },
+  {  LSTRKEY( "lzpack" ), LFUNCVAL( rpc_lzpack ) },
+  {  LSTRKEY( "lzunpack" ), LFUNCVAL( rpc_lzunpack ) },
+  {  LSTRKEY( "batch" ), LFUNCVAL( rpc_batch ) },
+  {  LSTRKEY( "fastpath" ), LFUNCVAL( rpc_fastpath ) },
+  {  LSTRKEY( "async" ), LFUNCVAL( rpc_async ) },
+  {  LSTRKEY( "poll" ), LFUNCVAL( rpc_poll ) },
+  {  LSTRKEY( "wait" ), LFUNCVAL( rpc_wait ) },
 #if LUA_OPTIMIZE_MEMORY > 0
 // {  LSTRKEY("mode"), LSTRVAL( LUARPC_MODE ) },
 #endif // #if LUA_OPTIMIZE_MEMORY > 0
@@ -1723,6 +2945,7 @@ LUALIB_API int luaopen_rpc(lua_State *L)
   luaL_rometatable(L, "rpc.helper", (void*)rpc_helper);
   luaL_rometatable(L, "rpc.handle", (void*)rpc_handle);
   luaL_rometatable(L, "rpc.server_handle", (void*)rpc_server_handle);
+  luaL_rometatable(L, "rpc.future", (void*)rpc_future);
 #else
   luaL_register( L, "rpc", rpc_map );
   lua_pushstring( L, LUARPC_MODE );
@@ -1735,6 +2958,11 @@ LUALIB_API int luaopen_rpc(lua_State *L)
   luaL_register( L, NULL, rpc_handle );
 
   luaL_newmetatable( L, "rpc.server_handle" );
+
+  luaL_newmetatable( L, "rpc.future" );
+  luaL_register( L, NULL, rpc_future );
+  lua_pushvalue( L, -1 );
+  lua_setfield( L, -2, "__index" );
 #endif
   return 1;
 }
@@ -1762,6 +2990,14 @@ static const luaL_reg rpc_server_handle[] =
   { NULL, NULL }
 };
 
+static const luaL_reg rpc_future[] =
+{
+  { "wait", future_wait },
+  { "ready", future_ready },
+  { "__gc", future_gc },
+  { NULL, NULL }
+};
+
 static const luaL_reg rpc_map[] =
 {
   { "connect", rpc_connect },
@@ -1772,7 +3008,14 @@ static const luaL_reg rpc_map[] =
   { "peek", rpc_peek },
   { "dispatch", rpc_dispatch },
   { "adispatch", rpc_adispatch },
-//  { "rpc_async", rpc_async },
+  { "compress", rpc_compress },
+  { "lzpack", rpc_lzpack },
+  { "lzunpack", rpc_lzunpack },
+  { "batch", rpc_batch },
+  { "fastpath", rpc_fastpath },
+  { "async", rpc_async },
+  { "poll", rpc_poll },
+  { "wait", rpc_wait },
   { NULL, NULL }
 };
 
@@ -1791,6 +3034,11 @@ LUALIB_API int luaopen_rpc(lua_State *L)
 
   luaL_newmetatable( L, "rpc.server_handle" );
 
+  luaL_newmetatable( L, "rpc.future" );
+  luaL_register( L, NULL, rpc_future );
+  lua_pushvalue( L, -1 );
+  lua_setfield( L, -2, "__index" );
+
   return 1;
 }
 
@@ -128,8 +128,8 @@ void mp_buf_append(mp_buf *buf, const unsigned char *s, size_t len) {
     if (buf->free < len) {
         size_t newlen = buf->len+len;
 
-        buf->b = (unsigned char*)mp_realloc(buf->L, buf->b, buf->len, newlen*2);
-        buf->free = newlen;
+        buf->b = (unsigned char*)mp_realloc(buf->L, buf->b, buf->len+buf->free, newlen*2);
+        buf->free = newlen*2 - buf->len;
     }
     memcpy(buf->b+buf->len,s,len);
     buf->len += len;
@@ -137,7 +137,7 @@ void mp_buf_append(mp_buf *buf, const unsigned char *s, size_t len) {
 }
 
 void mp_buf_free(mp_buf *buf) {
-    mp_realloc(buf->L, buf->b, buf->len, 0); /* realloc to 0 = free */
+    mp_realloc(buf->L, buf->b, buf->len+buf->free, 0); /* realloc to 0 = free */
     mp_realloc(buf->L, buf, sizeof(*buf), 0);
 }
 
@@ -610,19 +610,12 @@ int libmsgpack_mp_pack(lua_State *L) {
         lua_pushvalue(L, i);
 
         mp_encode_lua_type(L,buf,0);
-
-        lua_pushlstring(L,(char*)buf->b,buf->len);
-
-        /* Reuse the buffer for the next operation by
-         * setting its free count to the total buffer size
-         * and the current position to zero. */
-        buf->free += buf->len;
-        buf->len = 0;
     }
-    mp_buf_free(buf);
 
-    /* Concatenate all nargs buffers together */
-    lua_concat(L, nargs);
+    /* The arguments are encoded back to back, so the stream is interned
+     * once instead of once per argument and again when concatenated. */
+    lua_pushlstring(L,(char*)buf->b,buf->len);
+    mp_buf_free(buf);
     return 1;
 }
 
@@ -20,6 +20,10 @@
 #ifndef LUA_NUMBER_INTEGRAL
 #error need integral
 #endif
+
+// The kernel ABI entry points. Host builds of the tests in test/ define
+// STORM_HOST_STANDIN and link test/storm-standin.c, which models them.
+#ifndef STORM_HOST_STANDIN
 int32_t __attribute__((naked)) k_syscall_ex_ri32_u32_u32(uint32_t id, uint32_t arg0, uint32_t arg1)
 {
     __syscall_body(ABI_ID_SYSCALL_EX);
@@ -96,6 +100,27 @@ int32_t __attribute__((naked)) k_syscall_ex_ri32_uint32_vptr_uint32_vptr_vptr(ui
 {
     __syscall_body(ABI_ID_SYSCALL_EX);
 }
+#else
+int32_t k_syscall_ex_ri32_u32_u32(uint32_t id, uint32_t arg0, uint32_t arg1);
+int32_t k_syscall_ex_ri32_u32(uint32_t id, uint32_t arg0);
+int32_t k_syscall_ex_ru32_u32(uint32_t id, uint32_t arg0);
+int32_t k_syscall_ex_ri32_u32_u32_cb_vptr(uint32_t id, uint32_t arg0, uint32_t arg1, void* cb, void *r);
+uint32_t k_syscall_ex_ru32(uint32_t id);
+int32_t k_syscall_ex_ri32(uint32_t id);
+int32_t k_syscall_ex_ri32_u32_vptr_u32_cptr_cb_vptr(uint32_t id, uint32_t arg0, void *arg1, uint32_t arg2, char* arg3, cb_t cb, void *r);
+int32_t k_syscall_ex_ri32_u32_cb_vptr(uint32_t id, uint32_t arg0, void *cb, void *r);
+int32_t k_syscall_ex_ri32_cptr_u32_cptr_u32(uint32_t id, uint32_t arg0, const char* arg1, uint32_t arg2, const char* arg3, uint32_t arg4);
+int32_t k_syscall_ex_ri32_u32_u32_u32_buf_u32_vptr_vptr(uint32_t id, uint32_t arg0, uint32_t arg1, uint8_t* arg2, uint32_t arg3, void* cb, void* r);
+int32_t k_syscall_ex_ri32_cb_vptr_cb_vptr_cptr_u32(uint32_t id, void* arg0, void* arg1, void* arg2, void* arg3, const char* arg4, uint32_t arg5);
+int32_t k_syscall_ex_ri32_u32_u32_cptr(uint32_t id, uint32_t char_handle, uint32_t len, const char* buffer);
+void* k_syscall_ex_rvoid(uint32_t id);
+int32_t k_syscall_ex_rcptr_u32_cptr_u32(uint32_t id, const char* arg0, uint32_t arg1, const char* arg2, uint32_t arg3);
+int32_t k_syscall_ex_rcptr_u32_u32(uint32_t id, const char* arg0, uint32_t arg1, uint32_t buffer);
+int32_t k_syscall_ex_ri32_cptr_u32_cptr_cptr(uint32_t id, const char* d, uint32_t a, const char *b, char* c);
+int32_t k_syscall_ex_ri32_cptr(uint32_t id, char *b);
+int32_t k_syscall_ex_ri32_vptr_vptr_uint32_vptr_vptr(uint32_t id, void* a, void* b, uint32_t c, void *d, void *e);
+int32_t k_syscall_ex_ri32_uint32_vptr_uint32_vptr_vptr(uint32_t id, uint32_t a, void* b, uint32_t c, void *d, void *e);
+#endif
 //Some driver specific syscalls
 //--------- GPIO
 #define simplegpio_set_mode(dir,pinspec) k_syscall_ex_ri32_u32_u32(0x101,(dir),(pinspec))
@@ -288,6 +313,229 @@ int libstorm_os_getipaddrstring( lua_State *L )
     return 1;
 }
 
+// Payload-side routing table cache. The kernel table is fetched once into
+// route_snapshot and reused until the payload changes it through addroute or
+// delroute (or calls storm.os.flushroutes after the kernel changed it).
+// Lookups are longest-prefix matches against the snapshot, memoised by the
+// textual address, so per-packet forwarding makes no syscall and no allocation.
+#define ROUTE_ENTRY_LEN 35
+#define ROUTE_MAX_ENTRIES 20
+#define ROUTE_KEY_CACHE 4
+#define ROUTE_ADDR_STRLEN 40
+
+typedef struct
+{
+    char addr [ROUTE_ADDR_STRLEN];
+    uint8_t addrlen;
+    uint8_t prefixlen;
+    int8_t idx;     // index into route_snapshot, -1 for no route
+} route_key_cache_t;
+
+static uint8_t route_snapshot [ROUTE_ENTRY_LEN*ROUTE_MAX_ENTRIES];
+static int route_count;
+static uint8_t route_valid;
+static route_key_cache_t route_keys [ROUTE_KEY_CACHE];
+static uint8_t route_key_next;
+
+static void route_invalidate(void)
+{
+    int i;
+    route_valid = 0;
+    for (i = 0; i < ROUTE_KEY_CACHE; i++)
+    {
+        route_keys[i].addrlen = 0;
+    }
+}
+
+static void route_refresh(void)
+{
+    if (route_valid) return;
+    route_count = 0;
+    routingtable_gettable((uint32_t)&route_count, (uint32_t) route_snapshot);
+    if (route_count > ROUTE_MAX_ENTRIES) route_count = ROUTE_MAX_ENTRIES;
+    route_valid = 1;
+}
+
+static int route_hexval(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parse a textual IPv6 address (with optional ::) into 16 bytes
+static int route_parse_addr(const char *s, size_t len, uint8_t *out)
+{
+    uint16_t words [8];
+    int nwords = 0, gap = -1;
+    size_t i = 0;
+    int v, digits, w;
+    if (len >= 2 && s[0] == ':' && s[1] == ':')
+    {
+        gap = 0;
+        i = 2;
+    }
+    while (i < len)
+    {
+        v = 0;
+        digits = 0;
+        while (i < len && (w = route_hexval(s[i])) >= 0 && digits < 4)
+        {
+            v = (v << 4) | w;
+            digits++;
+            i++;
+        }
+        if (digits == 0 || nwords == 8) return -1;
+        words[nwords++] = v;
+        if (i == len) break;
+        if (s[i] != ':') return -1;
+        i++;
+        if (i < len && s[i] == ':')
+        {
+            if (gap >= 0) return -1;
+            gap = nwords;
+            i++;
+        }
+    }
+    if (gap < 0 && nwords != 8) return -1;
+    memset(out, 0, 16);
+    if (gap < 0) gap = nwords;
+    for (i = 0; i < gap; i++)
+    {
+        out[2*i] = words[i] >> 8;
+        out[2*i+1] = words[i] & 0xFF;
+    }
+    for (i = gap; i < nwords; i++)
+    {
+        w = 8 - (nwords - i);
+        out[2*w] = words[i] >> 8;
+        out[2*w+1] = words[i] & 0xFF;
+    }
+    return 0;
+}
+
+static int route_prefix_match(const uint8_t *a, const uint8_t *b, int bits)
+{
+    int bytes = bits >> 3;
+    uint8_t mask;
+    if (memcmp(a, b, bytes) != 0) return 0;
+    if ((bits & 7) == 0) return 1;
+    mask = 0xFF << (8 - (bits & 7));
+    return ((a[bytes] ^ b[bytes]) & mask) == 0;
+}
+
+// Longest-prefix match of the first prefixlen bits of addr
+static int route_match(const uint8_t *addr, int prefixlen)
+{
+    int i, best = -1, bestlen = -1;
+    const uint8_t *e;
+    for (i = 0; i < route_count; i++)
+    {
+        e = route_snapshot + i*ROUTE_ENTRY_LEN;
+        if (e[17] > prefixlen || (int)e[17] <= bestlen) continue;
+        if (route_prefix_match(addr, e + 1, e[17]))
+        {
+            best = i;
+            bestlen = e[17];
+        }
+    }
+    return best;
+}
+
+static int route_lookup_cached(lua_State *L, const char *addrstr, size_t len, int prefixlen)
+{
+    route_key_cache_t *k;
+    uint8_t addr [16];
+    int i;
+    route_refresh();
+    if (len < ROUTE_ADDR_STRLEN)
+    {
+        for (i = 0; i < ROUTE_KEY_CACHE; i++)
+        {
+            k = &route_keys[i];
+            if (k->addrlen == len && k->prefixlen == prefixlen && memcmp(k->addr, addrstr, len) == 0)
+                return k->idx;
+        }
+    }
+    if (route_parse_addr(addrstr, len, addr) != 0)
+        return luaL_error(L, "bad address");
+    i = route_match(addr, prefixlen);
+    if (len < ROUTE_ADDR_STRLEN)
+    {
+        k = &route_keys[route_key_next];
+        route_key_next = (route_key_next + 1) % ROUTE_KEY_CACHE;
+        memcpy(k->addr, addrstr, len);
+        k->addrlen = len;
+        k->prefixlen = prefixlen;
+        k->idx = i;
+    }
+    return i;
+}
+
+//lua: storm.os.routefor(addrstr, [prefixlen], [array]) -> route_key, ifindex or nil
+// If array (>= 35 bytes) is given, the packed route entry is copied into it
+int libstorm_os_routefor( lua_State *L )
+{
+    size_t len;
+    const char *addrstr = luaL_checklstring(L, 1, &len);
+    int prefixlen = luaL_optinteger(L, 2, 128);
+    storm_array_t *arr = NULL;
+    const uint8_t *e;
+    int idx;
+    if (lua_gettop(L) >= 3)
+    {
+        arr = lua_touserdata(L, 3);
+        if (!arr || arr->len < ROUTE_ENTRY_LEN)
+            return luaL_error(L, "expected array of at least 35 bytes");
+    }
+    idx = route_lookup_cached(L, addrstr, len, prefixlen);
+    if (idx < 0)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    e = route_snapshot + idx*ROUTE_ENTRY_LEN;
+    if (arr)
+        memcpy(ARR_START(arr), e, ROUTE_ENTRY_LEN);
+    lua_pushnumber(L, e[0]);
+    lua_pushnumber(L, e[34]);
+    return 2;
+}
+
+//lua: storm.os.routes([array]) -> array, count
+// Packed 35 byte route entries (key, prefix[16], prefixlen, nexthop[16], ifindex).
+// A UINT8 array that is large enough is reused, otherwise a new one is created.
+int libstorm_os_routes( lua_State *L )
+{
+    storm_array_t *arr = NULL;
+    uint32_t need;
+    route_refresh();
+    need = route_count*ROUTE_ENTRY_LEN;
+    if (lua_gettop(L) >= 1 && !lua_isnil(L, 1))
+    {
+        arr = lua_touserdata(L, 1);
+        if (!arr || arr->len < need)
+            return luaL_error(L, "array too small");
+        lua_pushvalue(L, 1);
+    }
+    else
+    {
+        storm_array_nc_create(L, need, ARR_TYPE_UINT8);
+        arr = lua_touserdata(L, -1);
+    }
+    memcpy(ARR_START(arr), route_snapshot, need);
+    lua_pushnumber(L, route_count);
+    return 2;
+}
+
+//lua: storm.os.flushroutes() -> nil
+int libstorm_os_flushroutes( lua_State *L )
+{
+    route_invalidate();
+    return 0;
+}
+
 int libstorm_os_addroute( lua_State *L )
 {
     const char* prefix;
@@ -317,6 +565,7 @@ int libstorm_os_addroute( lua_State *L )
     }
     ifindex = luaL_checknumber(L, 4);
     rv = routingtable_addroute(prefix, prefixlen, nexthop, ifindex);
+    route_invalidate();
     lua_pushnumber(L, rv);
     return 1;
 }
@@ -329,6 +578,7 @@ int libstorm_os_delroute( lua_State *L )
     if (lua_gettop(L) != 1) return luaL_error(L, errparam);
     route_key = luaL_checknumber(L, 1);
     rv = routingtable_delroute(route_key);
+    route_invalidate();
     lua_pushnumber(L, rv);
     return 1;
 }
@@ -604,25 +854,427 @@ int libstorm_io_set_pull( lua_State *L )
     return 0;
 }
 
-static void libstorm_tmr_free_context( lua_State *L, void* ctx)
+// ****************************************************************************
+// Native callback dispatch
+//
+// Every kernel callback that enters Lua goes through cb_dispatch(). The caller
+// pushes the function and its arguments onto _cb_L; the dispatcher accounts the
+// invocation against its source, applies the source's overload policy and runs
+// it. The caller also names the registration the invocation belongs to (its
+// timer, socket, watch or characteristic), so that COALESCE keeps the latest
+// invocation of each registration rather than one per source. Context structs for callbacks come from a fixed pool so that the dispatch
+// path does not touch the heap.
+
+enum {
+    CB_SRC_TIMER = 0,
+    CB_SRC_NET,
+    CB_SRC_IO,
+    CB_SRC_STDIN,
+    CB_SRC_I2C,
+    CB_SRC_SPI,
+    CB_SRC_FLASH,
+    CB_SRC_BL,
+    CB_SRC_COUNT
+};
+
+enum {
+    CB_POLICY_RUN = 0,      // always run (default)
+    CB_POLICY_DROP = 1,     // discard invocations over the limit
+    CB_POLICY_COALESCE = 2, // keep only the latest invocation per registration
+    CB_POLICY_QUEUE = 3     // defer invocations over the limit, in order
+};
+
+#define CB_POOL_SIZE 24
+#define CB_SLOT_WORDS 10
+#define CB_QUEUE_LEN 16
+#define CB_COALESCE_LEN 16
+#define CB_DEFER_MAXARGS 5
+
+typedef struct
+{
+    uint32_t invocations;
+    uint32_t errors;
+    uint32_t max_ticks;
+    uint32_t dropped;
+    uint32_t coalesced;
+    uint32_t queued;
+    uint32_t window_start;
+    uint32_t window_ticks;
+    uint16_t window_count;
+    uint16_t limit;         // invocations per window, 0 = unlimited
+    uint8_t policy;
+} cb_source_t;
+
+typedef struct
+{
+    const void *key;    // registration, NULL for one-off invocations
+    uint8_t src;
+    uint8_t nargs;
+    int refs [CB_DEFER_MAXARGS + 1]; // function, then arguments
+} cb_deferred_t;
+
+typedef union cb_slot
+{
+    union cb_slot *next;
+    uint32_t w [CB_SLOT_WORDS];
+} cb_slot_t;
+
+static const char * const cb_source_names [CB_SRC_COUNT] =
+{
+    "timer", "net", "io", "stdin", "i2c", "spi", "flash", "bl"
+};
+
+static cb_source_t cb_sources [CB_SRC_COUNT];
+static cb_deferred_t cb_coalesced [CB_COALESCE_LEN];
+static cb_deferred_t cb_queue [CB_QUEUE_LEN];
+static uint8_t cb_queue_head;
+static uint8_t cb_queue_count;
+static cb_slot_t cb_pool [CB_POOL_SIZE];
+static cb_slot_t *cb_free_list;
+static uint8_t cb_pool_ready;
+static uint32_t cb_busy_ticks;
+
+// Get a callback context. Contexts that do not fit a pool slot, or that arrive
+// when the pool is exhausted, fall back to the heap.
+static void* cb_alloc(size_t size)
+{
+    cb_slot_t *s;
+    int i;
+    if (!cb_pool_ready)
+    {
+        for (i = 0; i < CB_POOL_SIZE; i++)
+        {
+            cb_pool[i].next = cb_free_list;
+            cb_free_list = &cb_pool[i];
+        }
+        cb_pool_ready = 1;
+    }
+    if (size > sizeof(cb_slot_t) || cb_free_list == NULL)
+        return malloc(size);
+    s = cb_free_list;
+    cb_free_list = s->next;
+    return s;
+}
+
+static void cb_release(void *ctx)
+{
+    cb_slot_t *s = ctx;
+    if (s >= &cb_pool[0] && s < &cb_pool[CB_POOL_SIZE])
+    {
+        s->next = cb_free_list;
+        cb_free_list = s;
+    }
+    else
+    {
+        free(ctx);
+    }
+}
+
+// Returns nonzero if src has used up its invocation budget for the current window
+static int cb_overloaded(cb_source_t *s, uint32_t now)
+{
+    if (s->limit == 0)
+        return 0;
+    if ((uint32_t)(now - s->window_start) >= s->window_ticks)
+    {
+        s->window_start = now;
+        s->window_count = 0;
+    }
+    return s->window_count >= s->limit;
+}
+
+static void cb_defer_clear(lua_State *L, cb_deferred_t *d)
+{
+    int i;
+    for (i = 0; i <= d->nargs; i++)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, d->refs[i]);
+    }
+    d->nargs = 0;
+    d->refs[0] = 0;
+}
+
+// Pops function + nargs from the stack into d
+static void cb_defer_save(lua_State *L, cb_deferred_t *d, int src, const void *key, int nargs)
+{
+    int i;
+    d->key = key;
+    d->src = src;
+    d->nargs = nargs;
+    for (i = nargs; i >= 0; i--)
+    {
+        d->refs[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+}
+
+static void cb_run(lua_State *L, int src, int nargs)
+{
+    cb_source_t *s = &cb_sources[src];
+    uint32_t start, elapsed;
+    int rv;
+    const char* msg;
+    start = timer_getnow();
+    s->invocations++;
+    s->window_count++;
+    if ((rv = lua_pcall(L, nargs, 0, 0)) != 0)
+    {
+        s->errors++;
+        printf("[ERROR] could not run %s callback (%d)\n", cb_source_names[src], rv);
+        msg = lua_tostring(L, -1);
+        printf("[ERROR] msg: %s\n", msg);
+        lua_pop(L, 1);
+    }
+    elapsed = timer_getnow() - start;
+    cb_busy_ticks += elapsed;
+    if (elapsed > s->max_ticks)
+        s->max_ticks = elapsed;
+}
+
+// The coalesce slot of registration key, else a free slot, else NULL
+static cb_deferred_t* cb_coalesce_slot(int src, const void *key)
+{
+    cb_deferred_t *d, *free = NULL;
+    int i;
+    for (i = 0; i < CB_COALESCE_LEN; i++)
+    {
+        d = &cb_coalesced[i];
+        if (d->refs[0] == 0)
+        {
+            if (free == NULL)
+                free = d;
+        }
+        else if (key != NULL && d->key == key && d->src == src)
+        {
+            return d;
+        }
+    }
+    return free;
+}
+
+// A registration that is going away must not be matched by a new one that
+// reuses its context; its pending invocation still runs
+static void cb_forget(const void *key)
+{
+    int i;
+    for (i = 0; i < CB_COALESCE_LEN; i++)
+    {
+        if (cb_coalesced[i].key == key)
+            cb_coalesced[i].key = NULL;
+    }
+}
+
+static void cb_dispatch(lua_State *L, int src, const void *key, int nargs)
+{
+    cb_source_t *s = &cb_sources[src];
+    cb_deferred_t *d;
+    if (!cb_overloaded(s, timer_getnow()))
+    {
+        cb_run(L, src, nargs);
+        return;
+    }
+    if (nargs > CB_DEFER_MAXARGS || s->policy == CB_POLICY_DROP)
+    {
+        s->dropped++;
+        lua_pop(L, nargs + 1);
+        return;
+    }
+    switch (s->policy)
+    {
+        case CB_POLICY_COALESCE:
+            d = cb_coalesce_slot(src, key);
+            if (d == NULL)
+            {
+                s->dropped++;
+                lua_pop(L, nargs + 1);
+                break;
+            }
+            if (d->refs[0] != 0)
+            {
+                cb_defer_clear(L, d);
+                s->coalesced++;
+            }
+            cb_defer_save(L, d, src, key, nargs);
+            break;
+        case CB_POLICY_QUEUE:
+            if (cb_queue_count == CB_QUEUE_LEN)
+            {
+                s->dropped++;
+                lua_pop(L, nargs + 1);
+                break;
+            }
+            d = &cb_queue[(cb_queue_head + cb_queue_count) % CB_QUEUE_LEN];
+            cb_defer_save(L, d, src, key, nargs);
+            cb_queue_count++;
+            s->queued++;
+            break;
+        default:
+            cb_run(L, src, nargs);
+    }
+}
+
+static void cb_run_deferred(lua_State *L, cb_deferred_t *d)
+{
+    int i;
+    for (i = 0; i <= d->nargs; i++)
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, d->refs[i]);
+    }
+    i = d->nargs;
+    cb_defer_clear(L, d);
+    cb_run(L, d->src, i);
+}
+
+// Run deferred invocations whose source has budget again.
+// Returns the number of invocations still deferred.
+static int cb_drain(lua_State *L)
+{
+    uint32_t now = timer_getnow();
+    int pending = 0;
+    int i;
+    cb_deferred_t *d;
+    while (cb_queue_count)
+    {
+        d = &cb_queue[cb_queue_head];
+        if (cb_overloaded(&cb_sources[d->src], now))
+            break;
+        cb_queue_head = (cb_queue_head + 1) % CB_QUEUE_LEN;
+        cb_queue_count--;
+        cb_run_deferred(L, d);
+    }
+    pending += cb_queue_count;
+    for (i = 0; i < CB_COALESCE_LEN; i++)
+    {
+        d = &cb_coalesced[i];
+        if (d->refs[0] == 0)
+            continue;
+        if (cb_overloaded(&cb_sources[d->src], now))
+            pending++;
+        else
+            cb_run_deferred(L, d);
+    }
+    return pending;
+}
+
+static int cb_source_lookup(lua_State *L, int idx)
+{
+    const char *name = luaL_checkstring(L, idx);
+    int i;
+    for (i = 0; i < CB_SRC_COUNT; i++)
+    {
+        if (strcmp(name, cb_source_names[i]) == 0)
+            return i;
+    }
+    return luaL_error(L, "unknown callback source");
+}
+
+static void cb_push_stats(lua_State *L, int src)
+{
+    cb_source_t *s = &cb_sources[src];
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, s->invocations);
+    lua_setfield(L, -2, "invocations");
+    lua_pushnumber(L, s->errors);
+    lua_setfield(L, -2, "errors");
+    lua_pushnumber(L, s->max_ticks);
+    lua_setfield(L, -2, "maxtime");
+    lua_pushnumber(L, s->dropped);
+    lua_setfield(L, -2, "dropped");
+    lua_pushnumber(L, s->coalesced);
+    lua_setfield(L, -2, "coalesced");
+    lua_pushnumber(L, s->queued);
+    lua_setfield(L, -2, "queued");
+}
+
+//lua: storm.os.cbstats([source]) -> {invocations, errors, maxtime, dropped, coalesced, queued}
+// without a source, returns a table of those keyed by source name
+int libstorm_os_cbstats(lua_State *L)
+{
+    int i;
+    if (lua_gettop(L) >= 1)
+    {
+        cb_push_stats(L, cb_source_lookup(L, 1));
+        return 1;
+    }
+    lua_createtable(L, 0, CB_SRC_COUNT);
+    for (i = 0; i < CB_SRC_COUNT; i++)
+    {
+        cb_push_stats(L, i);
+        lua_setfield(L, -2, cb_source_names[i]);
+    }
+    return 1;
+}
+
+//lua: storm.os.clearcbstats() -> nil
+int libstorm_os_clear_cbstats(lua_State *L)
+{
+    int i;
+    cb_source_t *s;
+    for (i = 0; i < CB_SRC_COUNT; i++)
+    {
+        s = &cb_sources[i];
+        s->invocations = s->errors = s->max_ticks = 0;
+        s->dropped = s->coalesced = s->queued = 0;
+    }
+    return 0;
+}
+
+//lua: storm.os.cbpolicy(source, policy, limit, window_ticks) -> nil
+// at most limit invocations of source run per window; the rest are handled by policy
+int libstorm_os_cbpolicy(lua_State *L)
+{
+    cb_source_t *s = &cb_sources[cb_source_lookup(L, 1)];
+    int policy = luaL_checkinteger(L, 2);
+    if (policy < CB_POLICY_RUN || policy > CB_POLICY_QUEUE)
+        return luaL_error(L, "invalid policy");
+    s->policy = policy;
+    s->limit = luaL_optinteger(L, 3, 0);
+    s->window_ticks = luaL_optinteger(L, 4, SECOND_TICKS);
+    s->window_count = 0;
+    s->window_start = timer_getnow();
+    return 0;
+}
+
+// Timer contexts are kept on a list so that the idle logic knows when the
+// next Lua timer is due
+typedef struct storm_tmr
+{
+    struct storm_tmr *next;
+    uint32_t interval;  // 0 for one shot timers
+    uint32_t expiry;
+    int32_t id;
+    uint32_t nargs;
+    int refs [1];       // function, then arguments
+} storm_tmr_t;
+
+static storm_tmr_t *tmr_active;
+
+static void libstorm_tmr_free_context( lua_State *L, storm_tmr_t *t)
 {
     uint32_t i;
-    uint32_t *context = ctx;
-    for (i=0;i<context[0];i++)
+    storm_tmr_t **p;
+    for (p = &tmr_active; *p; p = &(*p)->next)
+    {
+        if (*p == t)
+        {
+            *p = t->next;
+            break;
+        }
+    }
+    for (i=0;i<=t->nargs;i++)
     {
-        luaL_unref(L, LUA_REGISTRYINDEX, context[i+2]); //parameters;
+        luaL_unref(L, LUA_REGISTRYINDEX, t->refs[i]); //function and parameters
     }
-    luaL_unref(L, LUA_REGISTRYINDEX, context[1]); //function
-    free(context);
+    cb_forget(t);
+    cb_release(t);
 }
 int libstorm_os_cancel( lua_State *L )
 {
-    const uint32_t *context;
+    storm_tmr_t *t;
     if (lua_gettop( L ) != 1)
         return luaL_error( L, "cancel takes a single timer pointer");
-    context = lua_touserdata(L, 1);
-    timer_cancel(context[context[0]+2]);
-    libstorm_tmr_free_context(L, (void*) context);
+    t = lua_touserdata(L, 1);
+    timer_cancel(t->id);
+    libstorm_tmr_free_context(L, t);
     lua_pop(L, 1);
     return 0;
 }
@@ -650,42 +1302,27 @@ int libstorm_os_now( lua_State *L )
     return 1;
 }
 
-static void libstorm_tmr_periodic_callback(void* ctx)
+static void libstorm_tmr_push(storm_tmr_t *t)
 {
-    uint32_t *context = ctx;
     uint32_t i;
-    const char* msg;
-    int rv;
-    lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, context[1]);
-    for (i=0;i<context[0];i++)
-    {
-        lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, context[i+2]);
-    }
-    if ((rv = lua_pcall(_cb_L, context[0], 0, 0)) != 0)
+    for (i=0;i<=t->nargs;i++)
     {
-        printf("[ERROR] could not run tmr.periodic callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
+        lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, t->refs[i]);
     }
 }
+static void libstorm_tmr_periodic_callback(void* ctx)
+{
+    storm_tmr_t *t = ctx;
+    t->expiry += t->interval;
+    libstorm_tmr_push(t);
+    cb_dispatch(_cb_L, CB_SRC_TIMER, t, t->nargs);
+}
 static void libstorm_tmr_oneshot_callback(void* ctx)
 {
-    uint32_t *context = ctx;
-    uint32_t i;
-    int rv;
-    const char* msg;
-    lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, context[1]);
-    for (i=0;i<context[0];i++)
-    {
-        lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, context[i+2]);
-    }
-    if ((rv = lua_pcall(_cb_L, context[0], 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run tmr.oneshot callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
-    libstorm_tmr_free_context(_cb_L, context);
+    storm_tmr_t *t = ctx;
+    libstorm_tmr_push(t);
+    cb_dispatch(_cb_L, CB_SRC_TIMER, NULL, t->nargs);
+    libstorm_tmr_free_context(_cb_L, t);
 }
 
 static int libstorm_tmr_impl( lua_State *L, uint32_t periodic)
@@ -694,35 +1331,43 @@ static int libstorm_tmr_impl( lua_State *L, uint32_t periodic)
     int rv;
     int i;
     int tos;
-    uint32_t *context;
+    storm_tmr_t *t;
     tos = lua_gettop( L );
     if (tos < 2)
         return luaL_error( L, "need interval and function");
-    context = (uint32_t*) malloc(4*(tos+1));
-    if (!context)
-        return luaL_error( L, "out of memory");
     ticks = ( u32 )luaL_checkinteger( L, 1 );
-    context[0] = tos-2;
+    t = (storm_tmr_t*) cb_alloc(sizeof(storm_tmr_t) + sizeof(int)*(tos-2));
+    if (!t)
+        return luaL_error( L, "out of memory");
+    t->nargs = tos-2;
 
     for ( i = tos; i >= 2; i --)
     {
-        context[i-1] = luaL_ref(L, LUA_REGISTRYINDEX);
+        t->refs[i-2] = luaL_ref(L, LUA_REGISTRYINDEX);
     }
+    t->interval = periodic ? ticks : 0;
+    t->expiry = timer_getnow() + ticks;
     if (periodic)
     {
-        rv = timer_set(ticks, 1, libstorm_tmr_periodic_callback, context);
+        rv = timer_set(ticks, 1, libstorm_tmr_periodic_callback, t);
     }
     else
     {
-        rv = timer_set(ticks, 0, libstorm_tmr_oneshot_callback, context);
+        rv = timer_set(ticks, 0, libstorm_tmr_oneshot_callback, t);
     }
     if (rv < 0)
     {
-        free(context); context = NULL;
+        for ( i = 0; i <= t->nargs; i ++)
+        {
+            luaL_unref(L, LUA_REGISTRYINDEX, t->refs[i]);
+        }
+        cb_release(t); t = NULL;
         return luaL_error( L, "kernel error");
     }
-    context[tos] = rv;
-    lua_pushlightuserdata ( L, context);
+    t->id = rv;
+    t->next = tmr_active;
+    tmr_active = t;
+    lua_pushlightuserdata ( L, t);
     return 1;
 }
 
@@ -738,17 +1383,168 @@ int libstorm_os_invoke_later(lua_State *L)
     return libstorm_tmr_impl(L, 0);
 }
 
+// Idle handling. Before the payload blocks in k_wait_callback it works out how
+// long it will be idle (the earliest pending Lua timer or budget refill for
+// deferred callbacks) and, if that window is long enough and the
+// collector is close to or past its next step, spends part of it on
+// incremental GC so that collection does not land in the middle of active
+// work. The kernel already sleeps until its earliest event, which includes
+// these timers; deferred callbacks get a one-shot kernel timer for their refill
+// so that they wake it too. Time blocked in the kernel minus time spent in
+// callbacks it ran is accounted as sleep.
+#define IDLE_MIN_TICKS (2*MILLISECOND_TICKS)    // don't bother with GC below this
+#define IDLE_GC_HEADROOM 1024                   // bytes before the next GC step is due
+#define IDLE_NO_DEADLINE 0xFFFFFFFF
+
+static uint32_t pwr_sleep_ticks;
+static uint32_t pwr_awake_ticks;
+static uint32_t pwr_gc_steps;
+static uint32_t pwr_last_mark;
+static uint8_t pwr_started;
+static uint8_t cb_refill_armed;
+
+// Ticks until src gets budget again
+static uint32_t cb_refill_ticks(int src, uint32_t now)
+{
+    cb_source_t *s = &cb_sources[src];
+    uint32_t d = (uint32_t)(now - s->window_start);
+    return d >= s->window_ticks ? 0 : s->window_ticks - d;
+}
+
+// Ticks until a source with deferred invocations gets budget again,
+// IDLE_NO_DEADLINE if nothing is deferred
+static uint32_t cb_next_refill(uint32_t now)
+{
+    uint32_t best = IDLE_NO_DEADLINE;
+    uint32_t d;
+    int i;
+    if (cb_queue_count)
+        best = cb_refill_ticks(cb_queue[cb_queue_head].src, now);
+    for (i = 0; i < CB_COALESCE_LEN; i++)
+    {
+        if (cb_coalesced[i].refs[0] == 0)
+            continue;
+        d = cb_refill_ticks(cb_coalesced[i].src, now);
+        if (d < best)
+            best = d;
+    }
+    return best;
+}
+
+// The refill timer only has to wake k_wait_callback; cb_drain does the work
+static void cb_refill_callback(void* ctx)
+{
+    cb_refill_armed = 0;
+}
+
+// Ticks until the earliest pending Lua timer, IDLE_NO_DEADLINE if there is none
+static uint32_t idle_next_deadline(uint32_t now)
+{
+    storm_tmr_t *t;
+    uint32_t best = cb_next_refill(now);
+    int32_t d;
+    for (t = tmr_active; t; t = t->next)
+    {
+        d = (int32_t)(t->expiry - now);
+        if (d <= 0)
+            return 0;
+        if ((uint32_t)d < best)
+            best = d;
+    }
+    return best;
+}
+
+// Run incremental GC steps while they fit in half of the idle window
+static void idle_gc(lua_State *L, uint32_t now, uint32_t idle)
+{
+    uint32_t budget = idle >> 1;
+    if (idle < IDLE_MIN_TICKS)
+        return;
+    if (lua_gc(L, LUA_GCDEBT, 0) < -IDLE_GC_HEADROOM)
+        return;
+    while ((uint32_t)(timer_getnow() - now) < budget)
+    {
+        pwr_gc_steps++;
+        if (lua_gc(L, LUA_GCSTEP, 0))
+            break; // cycle finished
+    }
+}
+
+static void bl_notify_pump(void);
+
 int libstorm_os_run_callback(lua_State *L)
 {
     _cb_L = L;
+    cb_drain(L);
+    bl_notify_pump();
     k_run_callback();
     return 0;
 }
 
 int libstorm_os_wait_callback(lua_State *L)
 {
+    uint32_t now, idle, start, busy, refill;
     _cb_L = L;
+    bl_notify_pump();
+    // Deferred callbacks still waiting for budget must not block behind the
+    // kernel, but polling for the refill would keep the CPU awake
+    if (cb_drain(L) && !cb_refill_armed)
+    {
+        refill = cb_next_refill(timer_getnow());
+        if (timer_set(refill ? refill : 1, 0, cb_refill_callback, NULL) >= 0)
+        {
+            cb_refill_armed = 1;
+        }
+        else
+        {
+            k_run_callback();
+            return 0;
+        }
+    }
+    now = timer_getnow();
+    if (!pwr_started)
+    {
+        pwr_last_mark = now;
+        pwr_started = 1;
+    }
+    idle = idle_next_deadline(now);
+    idle_gc(L, now, idle);
+    start = timer_getnow();
+    pwr_awake_ticks += start - pwr_last_mark;
+    busy = cb_busy_ticks;
     k_wait_callback();
+    pwr_last_mark = timer_getnow();
+    busy = cb_busy_ticks - busy;
+    pwr_sleep_ticks += (pwr_last_mark - start) - busy;
+    pwr_awake_ticks += busy;
+    return 0;
+}
+
+//lua: storm.os.nextdeadline() -> ticks until the next Lua timer, or nil
+int libstorm_os_nextdeadline(lua_State *L)
+{
+    uint32_t d = idle_next_deadline(timer_getnow());
+    if (d == IDLE_NO_DEADLINE)
+        lua_pushnil(L);
+    else
+        lua_pushnumber(L, d);
+    return 1;
+}
+
+//lua: storm.os.powerstats() -> sleep_ticks, awake_ticks, idle_gc_steps
+int libstorm_os_powerstats(lua_State *L)
+{
+    lua_pushnumber(L, pwr_sleep_ticks);
+    lua_pushnumber(L, pwr_awake_ticks);
+    lua_pushnumber(L, pwr_gc_steps);
+    return 3;
+}
+
+//lua: storm.os.clearpowerstats() -> nil
+int libstorm_os_clear_powerstats(lua_State *L)
+{
+    pwr_sleep_ticks = pwr_awake_ticks = pwr_gc_steps = 0;
+    pwr_started = 0;
     return 0;
 }
 
@@ -779,8 +1575,6 @@ typedef struct
 static void libstorm_net_recv_cb(void* sock_ptr, udp_recv_params_t *params, char* addr)
 {
     storm_socket_t *sock = sock_ptr;
-    int rv;
-    const char* msg;
     if (sock->recv_cb_ref == 0) return;
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, sock->recv_cb_ref);
     lua_pushlstring(_cb_L, (char*)params->buffer, params->buflen);
@@ -788,12 +1582,7 @@ static void libstorm_net_recv_cb(void* sock_ptr, udp_recv_params_t *params, char
     lua_pushnumber(_cb_L, params->port);
     lua_pushnumber(_cb_L, params->lqi);
     lua_pushnumber(_cb_L, params->rssi);
-    if ((rv = lua_pcall(_cb_L, 5, 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run net.recv callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
+    cb_dispatch(_cb_L, CB_SRC_NET, sock, 5);
 }
 
 // Lua: storm.net.udpsocket(port, recv_callback)
@@ -813,7 +1602,7 @@ int libstorm_net_udpsocket(lua_State *L)
     {
         return luaL_error( L, "ran out of sock FD's");
     }
-    sock = (storm_socket_t*) malloc(sizeof(storm_socket_t));
+    sock = (storm_socket_t*) cb_alloc(sizeof(storm_socket_t));
     if (!sock)
     {
         return luaL_error( L, "out of memory");
@@ -824,7 +1613,7 @@ int libstorm_net_udpsocket(lua_State *L)
     rv = udp_bind(socknum, port);
     if (rv != 0)
     {
-        free(sock);
+        cb_release(sock);
         return luaL_error( L, "could not bind socket");
     }
     sock->recv_cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
@@ -846,7 +1635,8 @@ int libstorm_net_close(lua_State *L)
     luaL_unref(L, LUA_REGISTRYINDEX, sock->recv_cb_ref);
     //tell kernel to free socket
     udp_close(sock->sockid);
-    free(sock);
+    cb_forget(sock);
+    cb_release(sock);
     return 0;
 }
 // Lua: storm.net.sendto(socket_handle, buffer, addrstr, port)
@@ -1014,32 +1804,18 @@ typedef struct
 static void libstorm_io_watch_single_cb(void* watch_ptr)
 {
     io_watch_t *watch = watch_ptr;
-    int rv;
-    const char* msg;
     if (watch->cbref == 0) return;
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, watch->cbref);
-    if ((rv = lua_pcall(_cb_L, 0, 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run io.watch1 callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
+    cb_dispatch(_cb_L, CB_SRC_IO, NULL, 0);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, watch->cbref);
-    free(watch);
+    cb_release(watch);
 }
 static void libstorm_io_watch_all_cb(void* watch_ptr)
 {
     io_watch_t *watch = watch_ptr;
-    int rv;
-    const char* msg;
     if (watch->cbref == 0) return;
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, watch->cbref);
-    if ((rv = lua_pcall(_cb_L, 0, 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run io.watchA callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
+    cb_dispatch(_cb_L, CB_SRC_IO, watch, 0);
 }
 // Lua: storm.io.watch_single(changetype, pin, function)
 static int libstorm_io_watch_impl(lua_State *L, int repeat)
@@ -1058,7 +1834,7 @@ static int libstorm_io_watch_impl(lua_State *L, int repeat)
     if (watchtype < 0 || watchtype > 2)
         return luaL_error(L, "invalid change type");
 
-    watch = (io_watch_t*) malloc(sizeof(io_watch_t));
+    watch = (io_watch_t*) cb_alloc(sizeof(io_watch_t));
     if (!watch)
     {
         return luaL_error( L, "out of memory");
@@ -1091,23 +1867,17 @@ int libstorm_io_cancel_watch(lua_State *L)
     watch = lua_touserdata(L, 1);
     simplegpio_disable_irq(watch->pinspec);
     luaL_unref(L, LUA_REGISTRYINDEX, watch->cbref);
-    free(watch);
+    cb_forget(watch);
+    cb_release(watch);
     return 0;
 }
 
 static void libstorm_os_read_stdin_callback(void* r, int32_t v)
 {
     int cbindex = (int) r;
-    int rv;
-    const char *msg;
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, cbindex);
     lua_pushlstring(_cb_L, stdin_buffer, v);
-    if ((rv = lua_pcall(_cb_L, 1, 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run stdin callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
+    cb_dispatch(_cb_L, CB_SRC_STDIN, NULL, 1);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, cbindex);
 }
 //lua: storm.os.read_stdin(func(txt))
@@ -1138,20 +1908,13 @@ typedef struct
 static void libstorm_i2c_transact_callback(void* tr, int status)
 {
     i2c_transact_t *t = tr;
-    int rv;
-    const char* msg;
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, t->cbref);
     lua_pushnumber(_cb_L, status);
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, t->arrayref);
-    if ((rv = lua_pcall(_cb_L, 2, 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run i2c callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
+    cb_dispatch(_cb_L, CB_SRC_I2C, NULL, 2);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, t->cbref);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, t->arrayref);
-    free(t);
+    cb_release(t);
 }
 
 static int libstorm_io_i2c_x(lua_State *L, uint8_t iswrite)
@@ -1171,7 +1934,7 @@ static int libstorm_io_i2c_x(lua_State *L, uint8_t iswrite)
     if (((address & 0xFF00) < 0x100) || ((address && 0xFF00) > 0x200))
         return luaL_error( L, "invalid address");
     //check flags?
-    t = (i2c_transact_t*) malloc(sizeof(i2c_transact_t));
+    t = (i2c_transact_t*) cb_alloc(sizeof(i2c_transact_t));
     if (!t)
     {
         return luaL_error( L, "out of memory");
@@ -1180,7 +1943,7 @@ static int libstorm_io_i2c_x(lua_State *L, uint8_t iswrite)
     rv = i2c_transact(iswrite, address, flags, ARR_START(arr), t->len, (void*)libstorm_i2c_transact_callback, t);
     if (rv != 0)
     {
-        free(t);
+        cb_release(t);
         lua_pushnil(L);
         return 1;
     }
@@ -1230,33 +1993,94 @@ int libstorm_net_clear_retry_stats(lua_State *L)
 }
 static void libstorm_bl_onready_callback(void *r)
 {
-    int rv;
-    const char* msg;
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, bl_onready_cb_key);
-    if ((rv = lua_pcall(_cb_L, 0, 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run bl onready callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
+    cb_dispatch(_cb_L, CB_SRC_BL, NULL, 0);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, bl_onready_cb_key);
     bl_onready_cb_key = 0;
 }
-static void libstorm_bl_onchanged_callback(void *r, uint32_t status)
+// Notification queues. Bytes appended with notify_array are packed into
+// BL_MTU sized notifications and sent while the link is up and the kernel
+// accepts them; the rest stays queued until the next pump.
+#define BL_MTU 20
+#define BL_MAX_STREAMS 4
+#define BL_QUEUE_LEN 160
+
+typedef struct
 {
-    int rv;
-    const char* msg;
+    uint16_t handle;
+    uint16_t head;
+    uint16_t count;
+    uint16_t _;
+    uint32_t sent;
+    uint32_t dropped;
+    uint8_t buf [BL_QUEUE_LEN];
+} bl_stream_t;
 
-    lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, bl_connect_cb_key);
-    lua_pushnumber(_cb_L, status);
-    if ((rv = lua_pcall(_cb_L, 1, 0, 0)) != 0)
+typedef struct
+{
+    int cbref;
+    int arrref;
+} bl_char_t;
+
+static bl_stream_t bl_streams [BL_MAX_STREAMS];
+static uint8_t bl_nstreams;
+static uint8_t bl_connected;
+
+static bl_stream_t* bl_get_stream(int handle, int create)
+{
+    int i;
+    bl_stream_t *st;
+    for (i = 0; i < bl_nstreams; i++)
     {
-        printf("[ERROR] could not run bl onchanged callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
+        if (bl_streams[i].handle == handle)
+            return &bl_streams[i];
+    }
+    if (!create || bl_nstreams == BL_MAX_STREAMS)
+        return NULL;
+    st = &bl_streams[bl_nstreams++];
+    memset(st, 0, sizeof(bl_stream_t));
+    st->handle = handle;
+    return st;
+}
+
+// Send queued notifications from st. Partial packets only go out if flush is set.
+static void bl_stream_pump(bl_stream_t *st, int flush)
+{
+    uint8_t pkt [BL_MTU];
+    uint16_t n, i;
+    while (bl_connected && st->count && (st->count >= BL_MTU || flush))
+    {
+        n = st->count < BL_MTU ? st->count : BL_MTU;
+        for (i = 0; i < n; i++)
+        {
+            pkt[i] = st->buf[(st->head + i) % BL_QUEUE_LEN];
+        }
+        if (bl_notify(st->handle, n, (char*)pkt) != 0)
+            break; // kernel busy, retry on the next pump
+        st->head = (st->head + n) % BL_QUEUE_LEN;
+        st->count -= n;
+        st->sent += n;
+    }
+}
+
+static void bl_notify_pump(void)
+{
+    int i;
+    for (i = 0; i < bl_nstreams; i++)
+    {
+        bl_stream_pump(&bl_streams[i], 0);
     }
 }
 
+static void libstorm_bl_onchanged_callback(void *r, uint32_t status)
+{
+    bl_connected = (status != 0);
+    bl_notify_pump();
+    lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, bl_connect_cb_key);
+    lua_pushnumber(_cb_L, status);
+    cb_dispatch(_cb_L, CB_SRC_BL, &bl_connect_cb_key, 1);
+}
+
 //onready, onconnect
 int libstorm_bl_enable(lua_State *L)
 {
@@ -1288,34 +2112,61 @@ int libstorm_bl_addservice(lua_State *L)
     return 1;
 }
 
-static void bl_write_callback(uint32_t cbref, uint32_t buflen, uint8_t *buffer)
+//lua callback signature on_write(string), or on_write(array, len, size) if the
+//characteristic has a write buffer; size is the length of the write, larger
+//than len if it was truncated to the buffer
+static void bl_write_callback(void *ctx, uint32_t buflen, uint8_t *buffer)
 {
-    int rv;
-    const char* msg;
-    lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, cbref);
-    lua_pushlstring(_cb_L, (char*)buffer, buflen);
-    if ((rv = lua_pcall(_cb_L, 1, 0, 0)) != 0)
+    bl_char_t *c = ctx;
+    storm_array_t *arr;
+    uint32_t len;
+    lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, c->cbref);
+    if (c->arrref == 0)
     {
-        printf("[ERROR] could not run bl write callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
-}
-//addcharacteristic(svc_handle, uuid, on_write)
+        lua_pushlstring(_cb_L, (char*)buffer, buflen);
+        cb_dispatch(_cb_L, CB_SRC_BL, c, 1);
+        return;
+    }
+    lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, c->arrref);
+    arr = lua_touserdata(_cb_L, -1);
+    len = buflen > arr->len ? arr->len : buflen;
+    memcpy(ARR_START(arr), buffer, len);
+    lua_pushnumber(_cb_L, len);
+    lua_pushnumber(_cb_L, buflen);
+    // The buffer only holds this write, so the callback can't be deferred:
+    // a later write would overwrite it. It still counts against the budget.
+    cb_run(_cb_L, CB_SRC_BL, 3);
+}
+//addcharacteristic(svc_handle, uuid, on_write, [write_buffer_array])
 int libstorm_bl_addcharacteristic(lua_State *L)
 {
     int handle;
     int svc_handle, uuid;
-    int cbref;
-    if (lua_gettop(L) != 3)
+    bl_char_t *c;
+    if (lua_gettop(L) != 3 && lua_gettop(L) != 4)
+    {
+        return luaL_error(L, "expected (handle, uuid, on_write, [array])");
+    }
+    c = cb_alloc(sizeof(bl_char_t));
+    if (!c)
     {
-        return luaL_error(L, "expected (handle, uuid, on_write)");
+        return luaL_error( L, "out of memory");
+    }
+    c->arrref = 0;
+    if (lua_gettop(L) == 4)
+    {
+        if (!lua_touserdata(L, 4))
+        {
+            cb_release(c);
+            return luaL_error(L, "invalid array");
+        }
+        c->arrref = luaL_ref(L, LUA_REGISTRYINDEX); //write buffer
     }
-    cbref = luaL_ref(L, LUA_REGISTRYINDEX); //callback
+    c->cbref = luaL_ref(L, LUA_REGISTRYINDEX); //callback
     uuid = lua_tonumber(L, 2);
     svc_handle = lua_tonumber(L, 1);
-    
-    handle = bl_addcharacteristic(svc_handle, uuid, bl_write_callback, (void*) cbref);
+
+    handle = bl_addcharacteristic(svc_handle, uuid, bl_write_callback, c);
     lua_pushnumber(L, handle);
     return 1;
 }
@@ -1334,6 +2185,76 @@ int libstorm_bl_notify(lua_State *L)
     return 0;
 }
 
+//Lua signature storm.bl.notify_array(char_handle, array, [offset], [len]) -> queued
+//Queues the raw bytes of the array for packed notifications. Returns the number
+//of bytes accepted, which is less than len if the queue is full.
+int libstorm_bl_notify_array(lua_State *L)
+{
+    int handle = luaL_checkinteger(L, 1);
+    storm_array_t *arr = lua_touserdata(L, 2);
+    bl_stream_t *st;
+    lua_Integer ioff, ilen;
+    uint32_t off, len, i;
+    if (!arr)
+        return luaL_error(L, "invalid array");
+    ioff = luaL_optinteger(L, 3, 0);
+    if (ioff < 0 || ioff > arr->len)
+        return luaL_error(L, "out of bounds");
+    off = ioff;
+    ilen = luaL_optinteger(L, 4, arr->len - off);
+    if (ilen < 0 || (uint32_t)ilen > arr->len - off)
+        return luaL_error(L, "out of bounds");
+    len = ilen;
+    st = bl_get_stream(handle, 1);
+    if (!st)
+        return luaL_error(L, "too many notify streams");
+    if (len > BL_QUEUE_LEN - st->count)
+    {
+        st->dropped += len - (BL_QUEUE_LEN - st->count);
+        len = BL_QUEUE_LEN - st->count;
+    }
+    for (i = 0; i < len; i++)
+    {
+        st->buf[(st->head + st->count + i) % BL_QUEUE_LEN] = ARR_START(arr)[off + i];
+    }
+    st->count += len;
+    bl_stream_pump(st, 0);
+    lua_pushnumber(L, len);
+    return 1;
+}
+
+//Lua signature storm.bl.notify_flush(char_handle) -> pending
+//Sends queued bytes including a trailing partial notification
+int libstorm_bl_notify_flush(lua_State *L)
+{
+    bl_stream_t *st = bl_get_stream(luaL_checkinteger(L, 1), 0);
+    if (!st)
+    {
+        lua_pushnumber(L, 0);
+        return 1;
+    }
+    bl_stream_pump(st, 1);
+    lua_pushnumber(L, st->count);
+    return 1;
+}
+
+//Lua signature storm.bl.notify_stats(char_handle) -> pending, sent, dropped
+int libstorm_bl_notify_stats(lua_State *L)
+{
+    bl_stream_t *st = bl_get_stream(luaL_checkinteger(L, 1), 0);
+    if (!st)
+    {
+        lua_pushnumber(L, 0);
+        lua_pushnumber(L, 0);
+        lua_pushnumber(L, 0);
+        return 3;
+    }
+    lua_pushnumber(L, st->count);
+    lua_pushnumber(L, st->sent);
+    lua_pushnumber(L, st->dropped);
+    return 3;
+}
+
 int libstorm_os_reset(lua_State *L)
 {
     sysinfo_reset();
@@ -1407,6 +2328,329 @@ int libstorm_aes_setkey(lua_State *L)
     return 0;
 }
 
+// Streaming AES modes built on the aes_encrypt syscall. The kernel primitive is
+// AES-CBC, so a single block with a zero IV is the raw block cipher, and a single
+// block with IV = X computes E(X ^ B), which is one CBC-MAC step. Everything
+// else (counter mode, CCM* framing) is done here, in place on storm arrays.
+enum {
+    AES_MODE_CTR = 1,
+    AES_MODE_CCM = 2
+};
+
+#define AES_BLOCK 16
+#define AES_CCM_NONCE 13
+
+typedef struct
+{
+    uint8_t mode;
+    uint8_t miclen;
+    uint8_t ksused;     // keystream bytes consumed from ks
+    uint8_t macused;    // bytes buffered in macbuf
+    uint16_t remaining; // CCM: message bytes still expected
+    uint16_t _;
+    uint8_t ctr [AES_BLOCK];
+    uint8_t ks [AES_BLOCK];
+    uint8_t mac [AES_BLOCK];
+    uint8_t macbuf [AES_BLOCK];
+    uint8_t s0 [AES_BLOCK];
+} storm_aes_ctx_t;
+
+extern const luaR_entry libstorm_aes_ctx_map[];
+
+static const char aes_zero_iv [AES_BLOCK] = {0};
+
+static void aes_block(const uint8_t *in, uint8_t *out)
+{
+    aes_encrypt(aes_zero_iv, AES_BLOCK, (const char*)in, (char*)out);
+}
+
+static void aes_ctr_incr(uint8_t *ctr)
+{
+    int i;
+    for (i = AES_BLOCK - 1; i >= 0; i--)
+    {
+        if (++ctr[i] != 0) break;
+    }
+}
+
+static void aes_mac_flush(storm_aes_ctx_t *ctx)
+{
+    uint8_t out [AES_BLOCK];
+    if (ctx->macused == 0) return;
+    memset(ctx->macbuf + ctx->macused, 0, AES_BLOCK - ctx->macused);
+    aes_encrypt((char*)ctx->mac, AES_BLOCK, (char*)ctx->macbuf, (char*)out);
+    memcpy(ctx->mac, out, AES_BLOCK);
+    ctx->macused = 0;
+}
+
+static void aes_mac_update(storm_aes_ctx_t *ctx, const uint8_t *data, uint32_t len)
+{
+    uint32_t n;
+    while (len)
+    {
+        n = AES_BLOCK - ctx->macused;
+        if (n > len) n = len;
+        memcpy(ctx->macbuf + ctx->macused, data, n);
+        ctx->macused += n;
+        data += n;
+        len -= n;
+        if (ctx->macused == AES_BLOCK)
+            aes_mac_flush(ctx);
+    }
+}
+
+static void aes_ctr_xor(storm_aes_ctx_t *ctx, uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+    for (i = 0; i < len; i++)
+    {
+        if (ctx->ksused == AES_BLOCK)
+        {
+            aes_ctr_incr(ctx->ctr);
+            aes_block(ctx->ctr, ctx->ks);
+            ctx->ksused = 0;
+        }
+        data[i] ^= ctx->ks[ctx->ksused++];
+    }
+}
+
+// Resolve (array, [offset], [len]) at stack index idx into a byte range
+static uint8_t* aes_get_range(lua_State *L, int idx, uint32_t *len)
+{
+    storm_array_t *arr = lua_touserdata(L, idx);
+    lua_Integer ioff, in;
+    uint32_t off, n;
+    if (!arr)
+    {
+        luaL_error(L, "invalid array");
+        return NULL;
+    }
+    ioff = luaL_optinteger(L, idx + 1, 0);
+    if (ioff < 0 || ioff > arr->len)
+    {
+        luaL_error(L, "out of bounds");
+        return NULL;
+    }
+    off = ioff;
+    in = luaL_optinteger(L, idx + 2, arr->len - off);
+    if (in < 0 || (uint32_t)in > arr->len - off)
+    {
+        luaL_error(L, "out of bounds");
+        return NULL;
+    }
+    n = in;
+    *len = n;
+    return ARR_START(arr) + off;
+}
+
+static storm_aes_ctx_t* aes_get_ctx(lua_State *L, int mode)
+{
+    storm_aes_ctx_t *ctx = lua_touserdata(L, 1);
+    if (!ctx || ctx->mode != mode)
+    {
+        luaL_error(L, "invalid aes context");
+        return NULL;
+    }
+    return ctx;
+}
+
+static void aes_ctr_reset(lua_State *L, storm_aes_ctx_t *ctx, int ividx)
+{
+    const char *iv;
+    size_t len;
+    iv = luaL_checklstring(L, ividx, &len);
+    if (len != AES_BLOCK)
+    {
+        luaL_error(L, "Expected iv length 16");
+        return;
+    }
+    memset(ctx, 0, sizeof(storm_aes_ctx_t));
+    ctx->mode = AES_MODE_CTR;
+    memcpy(ctx->ctr, iv, AES_BLOCK);
+    // The first update uses the IV itself as the counter block
+    aes_block(ctx->ctr, ctx->ks);
+}
+
+// CCM* as used by 802.15.4: 13 byte nonce, 2 byte length field, MIC of
+// 0, 4, 6, 8, 10, 12, 14 or 16 bytes (0 means encryption only)
+static void aes_ccm_reset(lua_State *L, storm_aes_ctx_t *ctx, int idx)
+{
+    const char *nonce;
+    const uint8_t *aad = NULL;
+    size_t len;
+    uint32_t msglen, miclen, aadlen = 0;
+    uint8_t b [AES_BLOCK];
+    nonce = luaL_checklstring(L, idx, &len);
+    if (len != AES_CCM_NONCE)
+    {
+        luaL_error(L, "Expected nonce length 13");
+        return;
+    }
+    msglen = luaL_checkinteger(L, idx + 1);
+    miclen = luaL_checkinteger(L, idx + 2);
+    if (msglen > 0xFFFF)
+    {
+        luaL_error(L, "message too long");
+        return;
+    }
+    if (miclen > AES_BLOCK || (miclen & 1) || miclen == 2)
+    {
+        luaL_error(L, "invalid mic length");
+        return;
+    }
+    if (lua_isstring(L, idx + 3))
+    {
+        aad = (const uint8_t*) lua_tolstring(L, idx + 3, &len);
+        aadlen = len;
+    }
+    else if (lua_isuserdata(L, idx + 3))
+    {
+        storm_array_t *arr = lua_touserdata(L, idx + 3);
+        aad = ARR_START(arr);
+        aadlen = arr->len;
+    }
+    if (aadlen >= 0xFF00)
+    {
+        luaL_error(L, "aad too long");
+        return;
+    }
+
+    memset(ctx, 0, sizeof(storm_aes_ctx_t));
+    ctx->mode = AES_MODE_CCM;
+    ctx->miclen = miclen;
+    ctx->remaining = msglen;
+
+    // A_0, and S_0 = E(A_0) which masks the MIC
+    ctx->ctr[0] = 1; // L - 1
+    memcpy(ctx->ctr + 1, nonce, AES_CCM_NONCE);
+    aes_block(ctx->ctr, ctx->s0);
+    ctx->ksused = AES_BLOCK;
+
+    if (miclen == 0)
+        return;
+
+    // B_0
+    b[0] = (aadlen ? 0x40 : 0) | (((miclen - 2) / 2) << 3) | 1;
+    memcpy(b + 1, nonce, AES_CCM_NONCE);
+    b[14] = msglen >> 8;
+    b[15] = msglen & 0xFF;
+    aes_block(b, ctx->mac);
+
+    if (aadlen)
+    {
+        b[0] = aadlen >> 8;
+        b[1] = aadlen & 0xFF;
+        aes_mac_update(ctx, b, 2);
+        aes_mac_update(ctx, aad, aadlen);
+        aes_mac_flush(ctx);
+    }
+}
+
+//lua: storm.aes.ctr(iv) -> ctx
+int libstorm_aes_ctr(lua_State *L)
+{
+    storm_aes_ctx_t *ctx = lua_newuserdata(L, sizeof(storm_aes_ctx_t));
+    aes_ctr_reset(L, ctx, 1);
+    lua_pushrotable(L, (void*)libstorm_aes_ctx_map);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+//lua: storm.aes.ccm(nonce, msglen, miclen, [aad]) -> ctx
+int libstorm_aes_ccm(lua_State *L)
+{
+    storm_aes_ctx_t *ctx = lua_newuserdata(L, sizeof(storm_aes_ctx_t));
+    aes_ccm_reset(L, ctx, 1);
+    lua_pushrotable(L, (void*)libstorm_aes_ctx_map);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+//lua: ctx:reset(iv) for ctr, ctx:reset(nonce, msglen, miclen, [aad]) for ccm
+static int libstorm_aes_ctx_reset(lua_State *L)
+{
+    storm_aes_ctx_t *ctx = lua_touserdata(L, 1);
+    if (!ctx)
+        return luaL_error(L, "invalid aes context");
+    if (ctx->mode == AES_MODE_CTR)
+        aes_ctr_reset(L, ctx, 2);
+    else
+        aes_ccm_reset(L, ctx, 2);
+    return 0;
+}
+
+//lua: ctx:update(array, [offset], [len]) -> nil (ctr, in place)
+static int libstorm_aes_ctx_update(lua_State *L)
+{
+    storm_aes_ctx_t *ctx = aes_get_ctx(L, AES_MODE_CTR);
+    uint32_t len;
+    uint8_t *data = aes_get_range(L, 2, &len);
+    aes_ctr_xor(ctx, data, len);
+    return 0;
+}
+
+static int libstorm_aes_ccm_x(lua_State *L, int encrypt)
+{
+    storm_aes_ctx_t *ctx = aes_get_ctx(L, AES_MODE_CCM);
+    uint32_t len;
+    uint8_t *data = aes_get_range(L, 2, &len);
+    if (len > ctx->remaining)
+        return luaL_error(L, "more data than declared msglen");
+    ctx->remaining -= len;
+    if (encrypt && ctx->miclen)
+        aes_mac_update(ctx, data, len);
+    aes_ctr_xor(ctx, data, len);
+    if (!encrypt && ctx->miclen)
+        aes_mac_update(ctx, data, len);
+    return 0;
+}
+
+//lua: ctx:encrypt(array, [offset], [len]) -> nil (ccm, in place)
+static int libstorm_aes_ctx_encrypt(lua_State *L)
+{
+    return libstorm_aes_ccm_x(L, 1);
+}
+
+//lua: ctx:decrypt(array, [offset], [len]) -> nil (ccm, in place)
+static int libstorm_aes_ctx_decrypt(lua_State *L)
+{
+    return libstorm_aes_ccm_x(L, 0);
+}
+
+//lua: ctx:final() -> mic, or ctx:final(mic) -> bool when decrypting
+static int libstorm_aes_ctx_final(lua_State *L)
+{
+    storm_aes_ctx_t *ctx = aes_get_ctx(L, AES_MODE_CCM);
+    const char *expect;
+    size_t len;
+    uint8_t diff = 0;
+    int i;
+    if (ctx->remaining != 0)
+        return luaL_error(L, "message shorter than declared msglen");
+    aes_mac_flush(ctx);
+    for (i = 0; i < ctx->miclen; i++)
+    {
+        ctx->mac[i] ^= ctx->s0[i];
+    }
+    if (lua_gettop(L) < 2)
+    {
+        lua_pushlstring(L, (char*)ctx->mac, ctx->miclen);
+        return 1;
+    }
+    expect = luaL_checklstring(L, 2, &len);
+    if (len != ctx->miclen)
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    for (i = 0; i < ctx->miclen; i++)
+    {
+        diff |= ctx->mac[i] ^ (uint8_t)expect[i];
+    }
+    lua_pushboolean(L, diff == 0);
+    return 1;
+}
+
 //lua: storm.spi.setcs(val) -> nil
 int libstorm_spi_set_cs(lua_State *L)
 {
@@ -1433,19 +2677,12 @@ typedef struct {
 void spi_xfer_cb(void *r)
 {
     spi_xfer_t *t = r;
-    int rv;
-    const char* msg;
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, t->cb_ref);
-    if ((rv = lua_pcall(_cb_L, 0, 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run spi callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
+    cb_dispatch(_cb_L, CB_SRC_SPI, NULL, 0);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, t->cb_ref);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, t->tx_ref);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, t->rx_ref);
-    free(t);
+    cb_release(t);
 }
 //lua: storm.spi.xfer(txarr, rxarr, cb) -> nil
 int libstorm_spi_xfer(lua_State *L)
@@ -1454,7 +2691,7 @@ int libstorm_spi_xfer(lua_State *L)
     int rv;
     storm_array_t *txarr = lua_touserdata(L, 1);
     storm_array_t *rxarr = lua_touserdata(L, 2);
-    t = malloc(sizeof(spi_xfer_t));
+    t = cb_alloc(sizeof(spi_xfer_t));
     if (!t)
     {
         return luaL_error( L, "out of memory");
@@ -1465,7 +2702,7 @@ int libstorm_spi_xfer(lua_State *L)
     rv = spi_write(ARR_START(txarr), ARR_START(rxarr), txarr->len, spi_xfer_cb, t);
     if (rv != 0)
     {
-        free(t);
+        cb_release(t);
         return luaL_error( L, "bad spi tx");
     }
     return 0;
@@ -1479,18 +2716,11 @@ typedef struct {
 void flash_xfer_cb(void *r)
 {
     flash_xfer_t *t = r;
-    int rv;
-    const char* msg;
     lua_rawgeti(_cb_L, LUA_REGISTRYINDEX, t->cb_ref);
-    if ((rv = lua_pcall(_cb_L, 0, 0, 0)) != 0)
-    {
-        printf("[ERROR] could not run flash callback (%d)\n", rv);
-        msg = lua_tostring(_cb_L, -1);
-        printf("[ERROR] msg: %s\n", msg);
-    }
+    cb_dispatch(_cb_L, CB_SRC_FLASH, NULL, 0);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, t->buf_ref);
     luaL_unref(_cb_L, LUA_REGISTRYINDEX, t->cb_ref);
-    free(t);
+    cb_release(t);
 }
 
 //lua: storm.flash.write(addr, txarr, cb)
@@ -1500,7 +2730,7 @@ int libstorm_flash_write(lua_State *L)
     int rv;
     uint32_t addr = lua_tonumber(L, 1);
     storm_array_t *txarr = lua_touserdata(L, 2);
-    t = malloc(sizeof(flash_xfer_t));
+    t = cb_alloc(sizeof(flash_xfer_t));
     if (!t)
     {
         return luaL_error( L, "out of memory");
@@ -1510,7 +2740,7 @@ int libstorm_flash_write(lua_State *L)
     rv = flash_write(addr, ARR_START(txarr), txarr->len, flash_xfer_cb, t);
     if (rv != 0)
     {
-        free(t);
+        cb_release(t);
         return luaL_error( L, "bad flash tx");
     }
     return 0;
@@ -1523,7 +2753,7 @@ int libstorm_flash_read(lua_State *L)
     int rv;
     uint32_t addr = lua_tonumber(L, 1);
     storm_array_t *rxarr = lua_touserdata(L, 2);
-    t = malloc(sizeof(flash_xfer_t));
+    t = cb_alloc(sizeof(flash_xfer_t));
     if (!t)
     {
         return luaL_error( L, "out of memory");
@@ -1533,7 +2763,7 @@ int libstorm_flash_read(lua_State *L)
     rv = flash_read(addr, ARR_START(rxarr), rxarr->len, flash_xfer_cb, t);
     if (rv != 0)
     {
-        free(t);
+        cb_release(t);
         return luaL_error( L, "bad flash rx");
     }
     return 0;
@@ -1616,6 +2846,9 @@ const LUA_REG_TYPE libstorm_os_map[] =
     { LSTRKEY( "run_callback" ), LFUNCVAL ( libstorm_os_run_callback ) },
     { LSTRKEY( "wait_callback" ), LFUNCVAL ( libstorm_os_wait_callback ) },
     { LSTRKEY( "kyield" ), LFUNCVAL ( libstorm_os_kyield ) },
+    { LSTRKEY( "nextdeadline" ), LFUNCVAL ( libstorm_os_nextdeadline ) },
+    { LSTRKEY( "powerstats" ), LFUNCVAL ( libstorm_os_powerstats ) },
+    { LSTRKEY( "clearpowerstats" ), LFUNCVAL ( libstorm_os_clear_powerstats ) },
     { LSTRKEY( "stormshell"), LFUNCVAL ( libstorm_os_stormshell) },
     { LSTRKEY( "read_stdin"), LFUNCVAL ( libstorm_os_read_stdin) },
     { LSTRKEY( "imageram"), LFUNCVAL ( libstorm_os_freeram) },
@@ -1630,7 +2863,17 @@ const LUA_REG_TYPE libstorm_os_map[] =
     { LSTRKEY( "getroute" ), LFUNCVAL ( libstorm_os_getroute ) },
     { LSTRKEY( "lookuproute" ), LFUNCVAL ( libstorm_os_lookuproute ) },
     { LSTRKEY( "gettable" ), LFUNCVAL ( libstorm_os_gettable ) },
+    { LSTRKEY( "routefor" ), LFUNCVAL ( libstorm_os_routefor ) },
+    { LSTRKEY( "routes" ), LFUNCVAL ( libstorm_os_routes ) },
+    { LSTRKEY( "flushroutes" ), LFUNCVAL ( libstorm_os_flushroutes ) },
     { LSTRKEY( "setpowerlock"), LFUNCVAL ( libstorm_os_setpowerlock) },
+    { LSTRKEY( "cbstats" ), LFUNCVAL ( libstorm_os_cbstats ) },
+    { LSTRKEY( "clearcbstats" ), LFUNCVAL ( libstorm_os_clear_cbstats ) },
+    { LSTRKEY( "cbpolicy" ), LFUNCVAL ( libstorm_os_cbpolicy ) },
+    { LSTRKEY( "CB_RUN" ), LNUMVAL ( CB_POLICY_RUN ) },
+    { LSTRKEY( "CB_DROP" ), LNUMVAL ( CB_POLICY_DROP ) },
+    { LSTRKEY( "CB_COALESCE" ), LNUMVAL ( CB_POLICY_COALESCE ) },
+    { LSTRKEY( "CB_QUEUE" ), LNUMVAL ( CB_POLICY_QUEUE ) },
     { LSTRKEY( "ROUTE_IFACE_ALL" ), LNUMVAL ( 0 ) },
     { LSTRKEY( "ROUTE_IFACE_154" ), LNUMVAL ( 1 ) },
     { LSTRKEY( "ROUTE_IFACE_PPP" ), LNUMVAL ( 2 ) },
@@ -1666,6 +2909,9 @@ const LUA_REG_TYPE libstorm_bl_map[] =
     { LSTRKEY( "addservice" ),  LFUNCVAL ( libstorm_bl_addservice ) },
     { LSTRKEY( "addcharacteristic" ),  LFUNCVAL ( libstorm_bl_addcharacteristic ) },
     { LSTRKEY( "notify" ),  LFUNCVAL ( libstorm_bl_notify ) },
+    { LSTRKEY( "notify_array" ),  LFUNCVAL ( libstorm_bl_notify_array ) },
+    { LSTRKEY( "notify_flush" ),  LFUNCVAL ( libstorm_bl_notify_flush ) },
+    { LSTRKEY( "notify_stats" ),  LFUNCVAL ( libstorm_bl_notify_stats ) },
     { LNILKEY, LNILVAL }
 };
 const LUA_REG_TYPE libstorm_aes_map[] =
@@ -1673,6 +2919,18 @@ const LUA_REG_TYPE libstorm_aes_map[] =
     { LSTRKEY( "encrypt" ),  LFUNCVAL ( libstorm_aes_encrypt ) },
     { LSTRKEY( "decrypt" ),  LFUNCVAL ( libstorm_aes_decrypt ) },
     { LSTRKEY( "setkey" ),  LFUNCVAL ( libstorm_aes_setkey ) },
+    { LSTRKEY( "ctr" ),  LFUNCVAL ( libstorm_aes_ctr ) },
+    { LSTRKEY( "ccm" ),  LFUNCVAL ( libstorm_aes_ccm ) },
+    { LNILKEY, LNILVAL }
+};
+const LUA_REG_TYPE libstorm_aes_ctx_map[] =
+{
+    { LSTRKEY( "reset" ),  LFUNCVAL ( libstorm_aes_ctx_reset ) },
+    { LSTRKEY( "update" ),  LFUNCVAL ( libstorm_aes_ctx_update ) },
+    { LSTRKEY( "encrypt" ),  LFUNCVAL ( libstorm_aes_ctx_encrypt ) },
+    { LSTRKEY( "decrypt" ),  LFUNCVAL ( libstorm_aes_ctx_decrypt ) },
+    { LSTRKEY( "final" ),  LFUNCVAL ( libstorm_aes_ctx_final ) },
+    { LSTRKEY( "__index" ), LROVAL ( libstorm_aes_ctx_map ) },
     { LNILKEY, LNILVAL }
 };
 const LUA_REG_TYPE libstorm_spi_map[] =
@@ -35,5 +35,8 @@ int libstorm_bl_enable(lua_State *L);
 int libstorm_bl_addservice(lua_State *L);
 int libstorm_bl_addcharacteristic(lua_State *L);
 int libstorm_bl_notify(lua_State *L);
+int libstorm_bl_notify_array(lua_State *L);
+int libstorm_bl_notify_flush(lua_State *L);
+int libstorm_bl_notify_stats(lua_State *L);
 
 #endif
@@ -0,0 +1,39 @@
+-- storm.array bindings, expanded by utils/mkbind.lua into libstormarray_bind.h
+
+return {
+  types = {
+    array = { ctype = "storm_array_t*", check = "arr_checkarray" },
+  },
+  maps = {
+    { name = "array_meta_map", static = true,
+      funcs = {
+        get = { "arr_get", "array", "int" },
+        set = { "arr_set", "array", "int", "number" },
+        get_as = { "arr_get_as", "array", "int", "int" },
+        set_as = { "arr_set_as", "array", "int", "int", "number" },
+        get_pstring = { "arr_get_pstring", "array", "int" },
+        set_pstring = { "arr_set_pstring", "array", "int", "lstring" },
+        as_str = { "arr_as_str", "array" },
+        __len = { "arr_get_length", "array" },
+      },
+      maps = { __index = "array_meta_map" },
+    },
+    { name = "libstorm_array_map",
+      funcs = {
+        create = { "arr_create", "int", "int=ARR_TYPE_INT32" },
+        fromstr = "arr_from_str",
+      },
+      nums = {
+        INT8 = "ARR_TYPE_INT8",
+        UINT8 = "ARR_TYPE_UINT8",
+        INT16 = "ARR_TYPE_INT16",
+        UINT16 = "ARR_TYPE_UINT16",
+        INT32 = "ARR_TYPE_INT32",
+        INT16_BE = "GS_TYPE_INT16_BE",
+        UINT16_BE = "GS_TYPE_UINT16_BE",
+        INT32_BE = "GS_TYPE_INT32_BE",
+      },
+      maps = { _arrmeta = "array_meta_map" },
+    },
+  },
+}
@@ -24,38 +24,38 @@
 const uint8_t arr_sizemap [] = {0, 1, 1, 2, 2, 4};
 const uint8_t arr_shiftmap [] = {0, 0, 0, 1, 1, 2};
 
-// Module function map
-#define MIN_OPT_LEVEL 2
-#include "lrodefs.h"
-int arr_create(lua_State *L);
-int arr_set_type(lua_State *L);
-int arr_get_type(lua_State *L);
-int arr_get(lua_State *L);
-int arr_set(lua_State *L);
-int arr_get_as(lua_State *L);
-int arr_set_as(lua_State *L);
-int arr_get_length(lua_State *L);
-int arr_set_pstring(lua_State *L);
-int arr_get_pstring(lua_State *L);
-int arr_as_str(lua_State *L);
-
-static const LUA_REG_TYPE array_meta_map[] =
+// The 'array' argument type of libstormarray.bind.lua
+static storm_array_t *arr_checkarray(lua_State *L, int narg)
 {
- //   { LSTRKEY( "set_type" ), LFUNCVAL ( arr_set_type ) },
-  //  { LSTRKEY( "get_type" ), LFUNCVAL ( arr_get_type ) },
-    { LSTRKEY( "get" ), LFUNCVAL ( arr_get ) },
-    { LSTRKEY( "set" ), LFUNCVAL ( arr_set ) },
-    { LSTRKEY( "get_as" ), LFUNCVAL ( arr_get_as ) },
-    { LSTRKEY( "set_as" ), LFUNCVAL ( arr_set_as ) },
-    { LSTRKEY( "__len" ), LFUNCVAL ( arr_get_length ) },
-    { LSTRKEY( "__index" ), LROVAL ( array_meta_map ) },
-    { LSTRKEY( "get_pstring" ), LFUNCVAL ( arr_get_pstring ) },
-    { LSTRKEY( "set_pstring" ), LFUNCVAL ( arr_set_pstring ) },
-    { LSTRKEY( "as_str" ), LFUNCVAL ( arr_as_str ) },
+    storm_array_t *arr = lua_touserdata(L, narg);
+    if (!arr)
+    {
+        luaL_error(L, "invalid array");
+    }
+    return arr;
+}
 
+// Module function maps and argument unpacking, generated by build_elua.lua
+#include "libstormarray_bind.h"
 
-    { LNILKEY, LNILVAL }
-};
+/**
+ * Returns the array at narg, or NULL if that value is not a storm array
+ */
+storm_array_t *storm_array_test(lua_State *L, int narg)
+{
+    storm_array_t *arr = lua_touserdata(L, narg);
+    if (arr && lua_getmetatable(L, narg))
+    {
+        lua_pushrotable(L, (void*)array_meta_map);
+        if (!lua_rawequal(L, -1, -2))
+        {
+            arr = NULL;
+        }
+        lua_pop(L, 2);
+        return arr;
+    }
+    return NULL;
+}
 
 /**
  * This function can be called directly, without using lua_call
@@ -71,17 +71,13 @@ int storm_array_nc_create(lua_State *L, int count, int type)
     return 1;
 }
 //lua storm.array.create(count, default_element_size)
-int arr_create(lua_State *L)
+static int arr_create(lua_State *L, lua_Integer count, lua_Integer atype)
 {
-    uint32_t size = luaL_checkinteger(L, 1);
-    uint32_t type = ARR_TYPE_INT32;
-    if (lua_gettop(L) >= 2)
+    uint32_t size = count;
+    uint32_t type = atype;
+    if (type > ARR_TYPE_INT32)
     {
-        type = luaL_checkinteger(L, 2);
-        if (type > ARR_TYPE_INT32)
-        {
-            return luaL_error(L, "invalid array type");
-        }
+        return luaL_error(L, "invalid array type");
     }
     if (size*arr_sizemap[type] > ARRAY_SANE_SIZE)
     {
@@ -96,16 +92,10 @@ int arr_create(lua_State *L)
     return 1;
 }
 //lua array:get(idx)
-int arr_get(lua_State *L)
+static int arr_get(lua_State *L, storm_array_t *arr, lua_Integer index)
 {
-    int idx;
+    int idx = index;
     uint16_t count;
-    storm_array_t *arr = lua_touserdata(L, 1);
-    idx = luaL_checkinteger(L, 2);
-    if (!arr)
-    {
-        return luaL_error(L, "invalid array");
-    }
     count = arr->len >> arr_shiftmap[arr->type];
     if (idx > count || idx == 0)
     {
@@ -135,17 +125,11 @@ int arr_get(lua_State *L)
     return 1;
 }
 //lua array:set(idx, val)
-int arr_set(lua_State *L)
+static int arr_set(lua_State *L, storm_array_t *arr, lua_Integer index, lua_Number value)
 {
-    int idx;
+    int idx = index;
+    int val = value;
     uint16_t count;
-    storm_array_t *arr = lua_touserdata(L, 1);
-    idx = luaL_checkinteger(L, 2);
-    int val = luaL_checknumber(L, 3);
-    if (!arr)
-    {
-        return luaL_error(L, "invalid array");
-    }
     count = arr->len >> arr_shiftmap[arr->type];
     if (idx > count || idx == 0)
     {
@@ -176,19 +160,12 @@ int arr_set(lua_State *L)
 }
 
 //lua array:get_as(type, byte_idx)
-int arr_get_as(lua_State *L)
+static int arr_get_as(lua_State *L, storm_array_t *arr, lua_Integer atype, lua_Integer index)
 {
-    int idx;
+    int idx = index;
     uint8_t* ptr;
-    int type;
+    int type = atype;
     uint8_t rv [] __attribute__((aligned(4))) = {0,0,0,0};
-    storm_array_t *arr = lua_touserdata(L, 1);
-    idx = luaL_checkinteger(L, 3);
-    type = luaL_checkinteger(L, 2);
-    if (!arr)
-    {
-        return luaL_error(L, "invalid array");
-    }
     if (idx >= arr->len)
     {
         return luaL_error(L, "out of bounds");
@@ -240,10 +217,9 @@ int arr_get_as(lua_State *L)
 }
 
 //lua #array
-int arr_get_length(lua_State *L)
+static int arr_get_length(lua_State *L, storm_array_t *arr)
 {
     int count;
-    storm_array_t *arr = lua_touserdata(L, 1);
     count = arr->len >> arr_shiftmap[arr->type];
     lua_pushnumber(L, count);
     return 1;
@@ -269,18 +245,16 @@ int arr_from_str(lua_State *L)
 }
 
 //lua arr:as_str()
-int arr_as_str(lua_State *L)
+static int arr_as_str(lua_State *L, storm_array_t *arr)
 {
-    storm_array_t *arr = lua_touserdata(L, 1);
     lua_pushlstring(L, (char*)(ARR_START(arr)), arr->len);
     return 1;
 }
 
 //lua: array:get_pstring(byte_index)
-int arr_get_pstring(lua_State *L)
+static int arr_get_pstring(lua_State *L, storm_array_t *arr, lua_Integer index)
 {
-    storm_array_t *arr = lua_touserdata(L, 1);
-    int idx = luaL_checkinteger(L, 2);
+    int idx = index;
     if (idx > arr->len) return luaL_error(L, "out of bounds");
     int strlen = ARR_START(arr)[idx];
     if (idx + strlen >= arr->len) return luaL_error(L, "bad string");
@@ -288,13 +262,10 @@ int arr_get_pstring(lua_State *L)
     return 1;
 }
 
-//lua: array:get_pstring(byte_index, string)
-int arr_set_pstring(lua_State *L)
+//lua: array:set_pstring(byte_index, string)
+static int arr_set_pstring(lua_State *L, storm_array_t *arr, lua_Integer index, const char *str, size_t strlen)
 {
-    storm_array_t *arr = lua_touserdata(L, 1);
-    int idx = luaL_checkinteger(L, 2);
-    size_t strlen;
-    const char* str = lua_tolstring(L, 3, &strlen);
+    int idx = index;
     if (strlen > 255) strlen = 255;
     if (idx + strlen >= arr->len) return luaL_error(L, "out of bounds");
     memcpy(ARR_START(arr) + idx + 1, str, strlen);
@@ -303,22 +274,14 @@ int arr_set_pstring(lua_State *L)
 }
 
 //lua array:set_as(type, byte_idx, val)
-int arr_set_as(lua_State *L)
+static int arr_set_as(lua_State *L, storm_array_t *arr, lua_Integer atype, lua_Integer index, lua_Number value)
 {
-    int idx;
+    int idx = index;
     uint8_t* srcptr;
     uint8_t* dstptr;
-    int val;
-    int type;
-    storm_array_t *arr = lua_touserdata(L, 1);
-    type = luaL_checkinteger(L, 2);
-    idx = luaL_checkinteger(L, 3);
-    val = luaL_checknumber(L, 4);
+    int val = value;
+    int type = atype;
     srcptr = (uint8_t*) (&val);
-    if (!arr)
-    {
-        return luaL_error(L, "invalid array");
-    }
     if (idx >= arr->len)
     {
         return luaL_error(L, "out of bounds");
@@ -354,19 +317,3 @@ int arr_set_as(lua_State *L)
     return 0;
 }
 
-
-const LUA_REG_TYPE libstorm_array_map[] =
-{
-    { LSTRKEY( "create" ), LFUNCVAL ( arr_create ) },
-    { LSTRKEY( "fromstr" ), LFUNCVAL ( arr_from_str ) },
-    { LSTRKEY( "INT8" ),  LNUMVAL ( ARR_TYPE_INT8 ) },
-    { LSTRKEY( "UINT8" ), LNUMVAL ( ARR_TYPE_UINT8 ) },
-    { LSTRKEY( "INT16" ), LNUMVAL ( ARR_TYPE_INT16 ) },
-    { LSTRKEY( "UINT16" ),LNUMVAL ( ARR_TYPE_UINT16 ) },
-    { LSTRKEY( "INT32" ), LNUMVAL ( ARR_TYPE_INT32 ) },
-    { LSTRKEY( "INT16_BE" ), LNUMVAL ( GS_TYPE_INT16_BE ) },
-    { LSTRKEY( "UINT16_BE" ), LNUMVAL ( GS_TYPE_UINT16_BE ) },
-    { LSTRKEY( "INT32_BE" ), LNUMVAL ( GS_TYPE_INT32_BE ) },
-    { LSTRKEY( "_arrmeta" ), LROVAL ( array_meta_map ) },
-    { LNILKEY, LNILVAL }
-};
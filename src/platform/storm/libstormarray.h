@@ -24,19 +24,18 @@ enum {
 
 #define ARR_START(x) (((uint8_t*)((x)) + sizeof(storm_array_t)))
 
+// log2 of the element size, indexed by array type
+extern const uint8_t arr_shiftmap [];
+
 /**
  * This function can be called directly, without using lua_call
  */
 int storm_array_nc_create(lua_State *L, int count, int type);
-int arr_create(lua_State *L);
-int arr_get(lua_State *L);
-int arr_set(lua_State *L);
-int arr_get_as(lua_State *L);
-int arr_get_length(lua_State *L);
 int arr_from_str(lua_State *L);
-int arr_as_str(lua_State *L);
-int arr_get_pstring(lua_State *L);
-int arr_set_pstring(lua_State *L);
-int arr_set_as(lua_State *L);
+
+/**
+ * Returns the array at narg, or NULL if that value is not a storm array
+ */
+storm_array_t *storm_array_test(lua_State *L, int narg);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,744 @@
+// storm.fix: fixed point arithmetic for integer-only Lua builds
+// Values are signed 32 bit integers holding a number scaled by 2^q, where q
+// is the count of fractional bits (0..31). Functions take q as an optional
+// argument after their operands, defaulting to Q16.16 (storm.fix.Q16);
+// Q1.31 is storm.fix.Q31. The vector forms write into an INT32 storm array,
+// which may be one of their inputs.
+//
+// Only integer arithmetic is used: products are exact 64 bit values, every
+// rounding is to nearest with ties away from zero, and shifts of negative
+// numbers never depend on the compiler. Results are therefore bit-exact
+// between the Linux simulator and the Cortex-M4, and scalar and vector
+// forms return the same values. Overflows saturate to the int32 range,
+// as do division by zero (to the sign of the dividend) and log2 of a value
+// <= 0 (to the minimum); sqrt of a negative value is 0.
+
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+#include "platform.h"
+#include "lrotable.h"
+#include "platform_conf.h"
+#include "auxmods.h"
+#include <string.h>
+#include <stdint.h>
+#include "libstormarray.h"
+
+#if LUA_OPTIMIZE_MEMORY == 0
+#error libstorm can only be compiled with LTR on (optram=true)
+#endif
+
+#ifndef LUA_NUMBER_INTEGRAL
+#error need integral
+#endif
+
+#define FIX_Q16         16
+#define FIX_Q31         31
+#define FIX_ONE         ( 1 << FIX_Q16 )
+#define FIX_PI          205887
+
+// Angles are reduced and rotated with 40 fractional bits; CORDIC runs 8
+// iterations more than the output has fractional bits
+#define FIX_IQ          40
+#define FIX_PI_IQ       INT64_C(3454217652358)
+#define FIX_HALFPI_IQ   INT64_C(1727108826179)
+#define FIX_TWOPI_IQ    INT64_C(6908435304715)
+#define FIX_TWOPI_Q30   INT64_C(6746518852)
+#define FIX_CORDIC_K    INT64_C(667681663043)
+#define FIX_CORDIC_ITER 40
+#define FIX_CORDIC_XITER 8
+#define FIX_LN2_Q32     UINT64_C(2977044472)
+#define FIX_DIGITS_MAX  9
+
+// atan(2^-i) with FIX_IQ fractional bits
+static const int64_t fix_atan_tab [FIX_CORDIC_ITER] =
+{
+    INT64_C(863554413089), INT64_C(509785937287), INT64_C(269356888665),
+    INT64_C(136729762476), INT64_C(68630207382), INT64_C(34348560106),
+    INT64_C(17178471287), INT64_C(8589759836), INT64_C(4294945451),
+    INT64_C(2147480917), INT64_C(1073741483), INT64_C(536870869),
+    INT64_C(268435451), INT64_C(134217727), INT64_C(67108864),
+    INT64_C(33554432), INT64_C(16777216), INT64_C(8388608), INT64_C(4194304),
+    INT64_C(2097152), INT64_C(1048576), INT64_C(524288), INT64_C(262144),
+    INT64_C(131072), INT64_C(65536), INT64_C(32768), INT64_C(16384),
+    INT64_C(8192), INT64_C(4096), INT64_C(2048), INT64_C(1024), INT64_C(512),
+    INT64_C(256), INT64_C(128), INT64_C(64), INT64_C(32), INT64_C(16),
+    INT64_C(8), INT64_C(4), INT64_C(2)
+};
+
+// 2^(k/16) and 2^(k/256) in Q1.31, unsigned
+static const uint32_t fix_exp2_hi [16] =
+{
+    2147483648U, 2242560872U, 2341847524U, 2445529972U, 2553802834U,
+    2666869345U, 2784941738U, 2908241642U, 3037000500U, 3171459999U,
+    3311872529U, 3458501653U, 3611622603U, 3771522796U, 3938502376U,
+    4112874773U
+};
+static const uint32_t fix_exp2_lo [16] =
+{
+    2147483648U, 2153306067U, 2159144272U, 2164998306U, 2170868212U,
+    2176754033U, 2182655811U, 2188573592U, 2194507417U, 2200457330U,
+    2206423375U, 2212405596U, 2218404036U, 2224418739U, 2230449750U,
+    2236497113U
+};
+
+typedef int32_t (*fix_unop_t)(int32_t a, int q);
+typedef int32_t (*fix_binop_t)(int32_t a, int32_t b, int q);
+
+static int32_t fix_sat(int64_t v)
+{
+    if (v > INT32_MAX) return INT32_MAX;
+    if (v < INT32_MIN) return INT32_MIN;
+    return (int32_t)v;
+}
+
+// v / 2^n, rounded to nearest with ties away from zero (v must be > -2^63)
+static int64_t fix_round(int64_t v, int n)
+{
+    uint64_t m;
+    if (n <= 0) return v;
+    if (n > 62) return 0;
+    m = v < 0 ? -(uint64_t)v : (uint64_t)v;
+    m = (m + ((uint64_t)1 << (n - 1))) >> n;
+    return v < 0 ? -(int64_t)m : (int64_t)m;
+}
+
+// floor(v / 2^n), independent of how the compiler shifts negative values
+static int64_t fix_asr(int64_t v, int n)
+{
+    return v >= 0 ? v >> n : -(int64_t)((-(uint64_t)v - 1) >> n) - 1;
+}
+
+// Converts v from 'from' to 'to' fractional bits, saturating
+static int32_t fix_rescale(int64_t v, int from, int to)
+{
+    int64_t limit;
+    if (to <= from) return fix_sat(fix_round(v, from - to));
+    limit = INT64_C(1) << (31 - (to - from));
+    if (v >= limit) return INT32_MAX;
+    if (v < -limit) return INT32_MIN;
+    return (int32_t)(v * (INT64_C(1) << (to - from)));
+}
+
+static int fix_msb(uint64_t v)
+{
+    int n = -1;
+    while (v)
+    {
+        v >>= 1;
+        n++;
+    }
+    return n;
+}
+
+static int32_t fix_mul(int32_t a, int32_t b, int q)
+{
+    return fix_sat(fix_round((int64_t)a * b, q));
+}
+
+static int32_t fix_div(int32_t a, int32_t b, int q)
+{
+    uint64_t n, d;
+    if (b == 0) return a < 0 ? INT32_MIN : INT32_MAX;
+    n = (uint64_t)(a < 0 ? -(int64_t)a : a) << q;
+    d = b < 0 ? -(int64_t)b : b;
+    n = (n + d / 2) / d;
+    if ((a < 0) != (b < 0))
+        return n > (uint64_t)INT32_MAX + 1 ? INT32_MIN : (int32_t)-(int64_t)n;
+    return n > INT32_MAX ? INT32_MAX : (int32_t)n;
+}
+
+static int32_t fix_sqrt(int32_t a, int q)
+{
+    uint64_t n, r = 0, bit;
+    if (a <= 0) return 0;
+    // Integer square root of a * 2^q, one result bit per step
+    n = (uint64_t)a << q;
+    bit = (uint64_t)1 << (fix_msb(n) & ~1);
+    while (bit)
+    {
+        if (n >= r + bit)
+        {
+            n -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+            r >>= 1;
+        bit >>= 2;
+    }
+    // n is now the remainder; round up if sqrt is past r + 0.5
+    if (n > r) r++;
+    return r > INT32_MAX ? INT32_MAX : (int32_t)r;
+}
+
+static int32_t fix_log2(int32_t a, int q)
+{
+    int m = fix_msb(a), nf = q + 2, i;
+    uint32_t x;
+    uint64_t sq;
+    int64_t r;
+    if (a <= 0) return INT32_MIN;
+    // a = x * 2^(m - q) with x in [1, 2) as Q1.31; the fraction bits of
+    // log2(x) are found by repeated squaring
+    x = (uint32_t)a << (31 - m);
+    r = (int64_t)(m - q);
+    for (i = 0; i < nf; i++)
+    {
+        sq = (uint64_t)x * x;
+        r *= 2;
+        if (sq >> 63)
+        {
+            r += 1;
+            x = (uint32_t)(sq >> 32);
+        }
+        else
+            x = (uint32_t)(sq >> 31);
+    }
+    return fix_sat(fix_round(r, 2));
+}
+
+static int32_t fix_exp2(int32_t a, int q)
+{
+    int64_t i = fix_asr(a, q);
+    uint32_t f = (uint32_t)(((uint64_t)a - ((uint64_t)i << q)) << (32 - q));
+    uint64_t t, t2, t3, p;
+    uint32_t x;
+    int shift;
+    // 2^f = 2^(hi/16) * 2^(mid/256) * e^(r*ln2), r < 2^-8
+    t = ((uint64_t)(f & 0xFFFFFF) * FIX_LN2_Q32 + ((uint64_t)1 << 31)) >> 32;
+    t2 = (t * t) >> 32;
+    t3 = (t2 * t) >> 32;
+    p = ((uint64_t)1 << 32) + t + t2 / 2 + t3 / 6;
+    x = (uint32_t)((p + 1) >> 1);
+    x = (uint32_t)(((uint64_t)x * fix_exp2_lo[(f >> 24) & 15] + ((uint64_t)1 << 30)) >> 31);
+    x = (uint32_t)(((uint64_t)x * fix_exp2_hi[f >> 28] + ((uint64_t)1 << 30)) >> 31);
+    // Scale the Q1.31 mantissa by 2^i into q fractional bits
+    shift = i + q - 31;
+    if (shift > 0)
+        return shift > 31 ? INT32_MAX : fix_sat((int64_t)((uint64_t)x << shift));
+    return fix_sat(fix_round(x, -shift));
+}
+
+// Angle in q fractional bits to radians in [-pi, pi] with FIX_IQ bits
+static int64_t fix_angle(int32_t a, int q)
+{
+    int64_t k = 0, z;
+    // The turn count is estimated at 30 bits, where a cannot overflow; the
+    // reduction itself wraps around in 64 bits but its result is small, so
+    // it is exact. At most one turn of error is left to correct.
+    if (q < 31)
+    {
+        k = (int64_t)a * (INT64_C(1) << (30 - q)) / FIX_TWOPI_Q30;
+        z = (int64_t)((uint64_t)(int64_t)a * ((uint64_t)1 << (FIX_IQ - q)) - (uint64_t)k * FIX_TWOPI_IQ);
+    }
+    else
+        z = (int64_t)a * (INT64_C(1) << (FIX_IQ - q));
+    while (z > FIX_PI_IQ) z -= FIX_TWOPI_IQ;
+    while (z < -FIX_PI_IQ) z += FIX_TWOPI_IQ;
+    return z;
+}
+
+// CORDIC in rotation mode: sin and cos of the angle, FIX_IQ bits
+static void fix_sincos(int32_t a, int q, int64_t *ps, int64_t *pc)
+{
+    int64_t z = fix_angle(a, q), x = FIX_CORDIC_K, y = 0, t;
+    int i, neg = 0, n = q + FIX_CORDIC_XITER;
+    if (z > FIX_HALFPI_IQ)
+    {
+        z = FIX_PI_IQ - z;
+        neg = 1;
+    }
+    else if (z < -FIX_HALFPI_IQ)
+    {
+        z = -FIX_PI_IQ - z;
+        neg = 1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        t = x;
+        if (z >= 0)
+        {
+            x -= fix_asr(y, i);
+            y += fix_asr(t, i);
+            z -= fix_atan_tab[i];
+        }
+        else
+        {
+            x += fix_asr(y, i);
+            y -= fix_asr(t, i);
+            z += fix_atan_tab[i];
+        }
+    }
+    *ps = y;
+    *pc = neg ? -x : x;
+}
+
+static int32_t fix_sin(int32_t a, int q)
+{
+    int64_t s, c;
+    fix_sincos(a, q, &s, &c);
+    return fix_rescale(s, FIX_IQ, q);
+}
+
+static int32_t fix_cos(int32_t a, int q)
+{
+    int64_t s, c;
+    fix_sincos(a, q, &s, &c);
+    return fix_rescale(c, FIX_IQ, q);
+}
+
+// CORDIC in vectoring mode; y and x only need a common scale
+static int32_t fix_atan2(int32_t ya, int32_t xa, int q)
+{
+    int64_t x = xa, y = ya, z = 0, t;
+    int i, m, n = q + FIX_CORDIC_XITER;
+    if (x == 0 && y == 0) return 0;
+    // Bring the vector into the right half plane
+    if (x < 0)
+    {
+        t = x;
+        if (y >= 0)
+        {
+            x = y;
+            y = -t;
+            z = FIX_HALFPI_IQ;
+        }
+        else
+        {
+            x = -y;
+            y = t;
+            z = -FIX_HALFPI_IQ;
+        }
+    }
+    // Scale the vector up so the shifts keep enough bits
+    m = fix_msb(x | (y < 0 ? -y : y));
+    x <<= FIX_IQ - m;
+    y *= INT64_C(1) << (FIX_IQ - m);
+    for (i = 0; i < n; i++)
+    {
+        t = x;
+        if (y > 0)
+        {
+            x += fix_asr(y, i);
+            y -= fix_asr(t, i);
+            z += fix_atan_tab[i];
+        }
+        else
+        {
+            x -= fix_asr(y, i);
+            y += fix_asr(t, i);
+            z -= fix_atan_tab[i];
+        }
+    }
+    return fix_rescale(z, FIX_IQ, q);
+}
+
+// One Horner step: acc * x + c
+static int32_t fix_horner(int32_t acc, int32_t x, int32_t c, int q)
+{
+    return fix_sat(fix_round((int64_t)acc * x, q) + c);
+}
+
+// c[0] + c[1]*x + ... + c[n-1]*x^(n-1)
+static int32_t fix_poly(int32_t x, const int32_t *c, int n, int q)
+{
+    int32_t acc;
+    if (n == 0) return 0;
+    acc = c[--n];
+    while (n > 0)
+        acc = fix_horner(acc, x, c[--n], q);
+    return acc;
+}
+
+static int fix_checkq(lua_State *L, int idx)
+{
+    int q = luaL_optinteger(L, idx, FIX_Q16);
+    luaL_argcheck(L, q >= 0 && q <= FIX_Q31, idx, "fractional bits must be 0..31");
+    return q;
+}
+
+static int32_t* fix_checkarray(lua_State *L, int idx, uint32_t *count)
+{
+    storm_array_t *arr = lua_touserdata(L, idx);
+    *count = 0;
+    if (!arr)
+    {
+        luaL_error(L, "invalid array");
+        return NULL;
+    }
+    if (arr->type != ARR_TYPE_INT32)
+    {
+        luaL_error(L, "need an INT32 array");
+        return NULL;
+    }
+    *count = arr->len >> 2;
+    return (int32_t*)ARR_START(arr);
+}
+
+// dst and src arrays must have the same length
+static int32_t* fix_checkdst(lua_State *L, uint32_t *count, int32_t **src)
+{
+    uint32_t n;
+    int32_t *dst = fix_checkarray(L, 1, &n);
+    *src = fix_checkarray(L, 2, count);
+    if (n != *count)
+    {
+        luaL_error(L, "array size mismatch");
+        return NULL;
+    }
+    return dst;
+}
+
+// Coefficients for a vector are a table {c0, c1, ...} or an INT32 array; a
+// table is copied once into a scratch userdata left on the stack
+static int32_t* fix_checkcoeffs(lua_State *L, int idx, uint32_t *count)
+{
+    int32_t *c;
+    uint32_t i;
+    if (lua_type(L, idx) != LUA_TTABLE)
+        return fix_checkarray(L, idx, count);
+    *count = lua_objlen(L, idx);
+    c = lua_newuserdata(L, *count * sizeof(int32_t) + 1);
+    for (i = 0; i < *count; i++)
+    {
+        lua_rawgeti(L, idx, i + 1);
+        c[i] = (int32_t)luaL_checkinteger(L, -1);
+        lua_pop(L, 1);
+    }
+    return c;
+}
+
+static int fix_unop(lua_State *L, fix_unop_t op)
+{
+    int32_t a = (int32_t)luaL_checkinteger(L, 1);
+    lua_pushinteger(L, op(a, fix_checkq(L, 2)));
+    return 1;
+}
+
+static int fix_binop(lua_State *L, fix_binop_t op)
+{
+    int32_t a = (int32_t)luaL_checkinteger(L, 1);
+    int32_t b = (int32_t)luaL_checkinteger(L, 2);
+    lua_pushinteger(L, op(a, b, fix_checkq(L, 3)));
+    return 1;
+}
+
+static int fix_vunop(lua_State *L, fix_unop_t op)
+{
+    uint32_t n, i;
+    int32_t *src, *dst = fix_checkdst(L, &n, &src);
+    int q = fix_checkq(L, 3);
+    for (i = 0; i < n; i++)
+        dst[i] = op(src[i], q);
+    lua_settop(L, 1);
+    return 1;
+}
+
+// The second operand is an array or a number applied to every element
+static int fix_vbinop(lua_State *L, fix_binop_t op)
+{
+    uint32_t n, nb, i;
+    int32_t *a, *b, *dst = fix_checkdst(L, &n, &a);
+    int q = fix_checkq(L, 4);
+    int32_t k;
+    if (lua_type(L, 3) == LUA_TNUMBER)
+    {
+        k = (int32_t)lua_tointeger(L, 3);
+        for (i = 0; i < n; i++)
+            dst[i] = op(a[i], k, q);
+    }
+    else
+    {
+        b = fix_checkarray(L, 3, &nb);
+        if (nb != n) return luaL_error(L, "array size mismatch");
+        for (i = 0; i < n; i++)
+            dst[i] = op(a[i], b[i], q);
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+//lua storm.fix.mul(a, b, [q])
+static int libstorm_fix_mul(lua_State *L)
+{
+    return fix_binop(L, fix_mul);
+}
+
+//lua storm.fix.div(a, b, [q])
+static int libstorm_fix_div(lua_State *L)
+{
+    return fix_binop(L, fix_div);
+}
+
+//lua storm.fix.sqrt(a, [q])
+static int libstorm_fix_sqrt(lua_State *L)
+{
+    return fix_unop(L, fix_sqrt);
+}
+
+//lua storm.fix.log2(a, [q])
+static int libstorm_fix_log2(lua_State *L)
+{
+    return fix_unop(L, fix_log2);
+}
+
+//lua storm.fix.exp2(a, [q])
+static int libstorm_fix_exp2(lua_State *L)
+{
+    return fix_unop(L, fix_exp2);
+}
+
+//lua storm.fix.sin(radians, [q])
+static int libstorm_fix_sin(lua_State *L)
+{
+    return fix_unop(L, fix_sin);
+}
+
+//lua storm.fix.cos(radians, [q])
+static int libstorm_fix_cos(lua_State *L)
+{
+    return fix_unop(L, fix_cos);
+}
+
+//lua storm.fix.atan2(y, x, [q])
+static int libstorm_fix_atan2(lua_State *L)
+{
+    return fix_binop(L, fix_atan2);
+}
+
+//lua storm.fix.poly(x, coeffs, [q])
+static int libstorm_fix_poly(lua_State *L)
+{
+    uint32_t n;
+    int32_t x = (int32_t)luaL_checkinteger(L, 1), acc = 0;
+    int q = fix_checkq(L, 3);
+    // A table is read in place instead of being copied for a single value
+    if (lua_type(L, 2) == LUA_TTABLE)
+    {
+        for (n = lua_objlen(L, 2); n > 0; n--)
+        {
+            lua_rawgeti(L, 2, n);
+            acc = fix_horner(acc, x, (int32_t)luaL_checkinteger(L, -1), q);
+            lua_pop(L, 1);
+        }
+    }
+    else
+    {
+        int32_t *c = fix_checkarray(L, 2, &n);
+        acc = fix_poly(x, c, n, q);
+    }
+    lua_pushinteger(L, acc);
+    return 1;
+}
+
+//lua storm.fix.conv(a, from_q, to_q)
+static int libstorm_fix_conv(lua_State *L)
+{
+    int32_t a = (int32_t)luaL_checkinteger(L, 1);
+    int from = fix_checkq(L, 2);
+    lua_pushinteger(L, fix_rescale(a, from, fix_checkq(L, 3)));
+    return 1;
+}
+
+//lua storm.fix.fromstr("-12.375", [q]) -> fixed point value or nil
+static int libstorm_fix_fromstr(lua_State *L)
+{
+    const char *s = luaL_checkstring(L, 1);
+    int q = fix_checkq(L, 2);
+    int neg = 0, digits = 0, fdigits = 0;
+    uint64_t ip = 0, fp = 0, scale = 1;
+    if (*s == '-' || *s == '+') neg = *s++ == '-';
+    for (; *s >= '0' && *s <= '9'; s++, digits++)
+    {
+        if (ip <= INT32_MAX) ip = ip * 10 + (*s - '0');
+    }
+    if (*s == '.')
+    {
+        for (s++; *s >= '0' && *s <= '9'; s++, digits++)
+        {
+            if (fdigits++ < FIX_DIGITS_MAX)
+            {
+                fp = fp * 10 + (*s - '0');
+                scale *= 10;
+            }
+        }
+    }
+    if (digits == 0 || *s != '\0')
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    // |value| * 2^q, with the fraction rounded to nearest
+    if (ip > INT32_MAX) ip = INT32_MAX;
+    ip = (ip << q) + ((fp << q) + scale / 2) / scale;
+    if (neg)
+        lua_pushinteger(L, ip > (uint64_t)INT32_MAX + 1 ? INT32_MIN : (int32_t)-(int64_t)ip);
+    else
+        lua_pushinteger(L, ip > INT32_MAX ? INT32_MAX : (int32_t)ip);
+    return 1;
+}
+
+//lua storm.fix.tostr(a, [q], [digits]) -> decimal string
+static int libstorm_fix_tostr(lua_State *L)
+{
+    int32_t a = (int32_t)luaL_checkinteger(L, 1);
+    int q = fix_checkq(L, 2);
+    // Enough digits to tell neighbouring values apart: ceil(q * log10(2))
+    int digits = (q * 30103 + 99999) / 100000;
+    uint64_t m = a < 0 ? -(int64_t)a : a, scale = 1;
+    char buf [24];
+    int i, neg, pos = sizeof(buf);
+    if (digits > FIX_DIGITS_MAX) digits = FIX_DIGITS_MAX;
+    digits = luaL_optinteger(L, 3, digits);
+    luaL_argcheck(L, digits >= 0 && digits <= FIX_DIGITS_MAX, 3, "too many digits");
+    for (i = 0; i < digits; i++) scale *= 10;
+    m = (m * scale + ((uint64_t)1 << q >> 1)) >> q;
+    neg = a < 0 && m != 0;
+    // Digits are written backwards from the end of buf
+    for (i = 0; i < digits; i++, m /= 10)
+        buf[--pos] = '0' + m % 10;
+    if (digits > 0) buf[--pos] = '.';
+    do
+    {
+        buf[--pos] = '0' + m % 10;
+        m /= 10;
+    } while (m);
+    if (neg) buf[--pos] = '-';
+    lua_pushlstring(L, buf + pos, sizeof(buf) - pos);
+    return 1;
+}
+
+//lua storm.fix.vmul(dst, a, b, [q]) -> dst; b is an array or a number
+static int libstorm_fix_vmul(lua_State *L)
+{
+    return fix_vbinop(L, fix_mul);
+}
+
+//lua storm.fix.vdiv(dst, a, b, [q]) -> dst
+static int libstorm_fix_vdiv(lua_State *L)
+{
+    return fix_vbinop(L, fix_div);
+}
+
+//lua storm.fix.vatan2(dst, y, x, [q]) -> dst
+static int libstorm_fix_vatan2(lua_State *L)
+{
+    return fix_vbinop(L, fix_atan2);
+}
+
+//lua storm.fix.vsqrt(dst, a, [q]) -> dst
+static int libstorm_fix_vsqrt(lua_State *L)
+{
+    return fix_vunop(L, fix_sqrt);
+}
+
+//lua storm.fix.vlog2(dst, a, [q]) -> dst
+static int libstorm_fix_vlog2(lua_State *L)
+{
+    return fix_vunop(L, fix_log2);
+}
+
+//lua storm.fix.vexp2(dst, a, [q]) -> dst
+static int libstorm_fix_vexp2(lua_State *L)
+{
+    return fix_vunop(L, fix_exp2);
+}
+
+//lua storm.fix.vsin(dst, a, [q]) -> dst
+static int libstorm_fix_vsin(lua_State *L)
+{
+    return fix_vunop(L, fix_sin);
+}
+
+//lua storm.fix.vcos(dst, a, [q]) -> dst
+static int libstorm_fix_vcos(lua_State *L)
+{
+    return fix_vunop(L, fix_cos);
+}
+
+//lua storm.fix.vpoly(dst, a, coeffs, [q]) -> dst
+static int libstorm_fix_vpoly(lua_State *L)
+{
+    uint32_t n, nc, i;
+    int32_t *src, *dst = fix_checkdst(L, &n, &src);
+    int q = fix_checkq(L, 4);
+    int32_t *c = fix_checkcoeffs(L, 3, &nc);
+    for (i = 0; i < n; i++)
+        dst[i] = fix_poly(src[i], c, nc, q);
+    lua_settop(L, 1);
+    return 1;
+}
+
+//lua storm.fix.vconv(dst, src, from_q, to_q) -> dst
+// src may be any storm array type, so raw sensor readings (INT16, UINT16...)
+// can be scaled into an INT32 working array in one call
+static int libstorm_fix_vconv(lua_State *L)
+{
+    uint32_t n, i;
+    int32_t *dst = fix_checkarray(L, 1, &n);
+    storm_array_t *src = lua_touserdata(L, 2);
+    int from = fix_checkq(L, 3), to = fix_checkq(L, 4);
+    int32_t v;
+    uint8_t *p;
+    if (!src)
+    {
+        return luaL_error(L, "invalid array");
+    }
+    if (src->type < ARR_TYPE_INT8 || src->type > ARR_TYPE_INT32)
+    {
+        return luaL_error(L, "bad array type");
+    }
+    if ((uint32_t)(src->len >> arr_shiftmap[src->type]) != n)
+    {
+        return luaL_error(L, "array size mismatch");
+    }
+    p = ARR_START(src);
+    for (i = 0; i < n; i++)
+    {
+        switch (src->type)
+        {
+            case ARR_TYPE_INT8: v = ((int8_t*)p)[i]; break;
+            case ARR_TYPE_UINT8: v = p[i]; break;
+            case ARR_TYPE_INT16: v = ((int16_t*)p)[i]; break;
+            case ARR_TYPE_UINT16: v = ((uint16_t*)p)[i]; break;
+            default: v = ((int32_t*)p)[i]; break;
+        }
+        dst[i] = fix_rescale(v, from, to);
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+// Module function map
+#define MIN_OPT_LEVEL 2
+#include "lrodefs.h"
+const LUA_REG_TYPE libstorm_fix_map[] =
+{
+    { LSTRKEY( "mul" ), LFUNCVAL ( libstorm_fix_mul ) },
+    { LSTRKEY( "div" ), LFUNCVAL ( libstorm_fix_div ) },
+    { LSTRKEY( "sqrt" ), LFUNCVAL ( libstorm_fix_sqrt ) },
+    { LSTRKEY( "log2" ), LFUNCVAL ( libstorm_fix_log2 ) },
+    { LSTRKEY( "exp2" ), LFUNCVAL ( libstorm_fix_exp2 ) },
+    { LSTRKEY( "sin" ), LFUNCVAL ( libstorm_fix_sin ) },
+    { LSTRKEY( "cos" ), LFUNCVAL ( libstorm_fix_cos ) },
+    { LSTRKEY( "atan2" ), LFUNCVAL ( libstorm_fix_atan2 ) },
+    { LSTRKEY( "poly" ), LFUNCVAL ( libstorm_fix_poly ) },
+    { LSTRKEY( "conv" ), LFUNCVAL ( libstorm_fix_conv ) },
+    { LSTRKEY( "fromstr" ), LFUNCVAL ( libstorm_fix_fromstr ) },
+    { LSTRKEY( "tostr" ), LFUNCVAL ( libstorm_fix_tostr ) },
+    { LSTRKEY( "vmul" ), LFUNCVAL ( libstorm_fix_vmul ) },
+    { LSTRKEY( "vdiv" ), LFUNCVAL ( libstorm_fix_vdiv ) },
+    { LSTRKEY( "vsqrt" ), LFUNCVAL ( libstorm_fix_vsqrt ) },
+    { LSTRKEY( "vlog2" ), LFUNCVAL ( libstorm_fix_vlog2 ) },
+    { LSTRKEY( "vexp2" ), LFUNCVAL ( libstorm_fix_vexp2 ) },
+    { LSTRKEY( "vsin" ), LFUNCVAL ( libstorm_fix_vsin ) },
+    { LSTRKEY( "vcos" ), LFUNCVAL ( libstorm_fix_vcos ) },
+    { LSTRKEY( "vatan2" ), LFUNCVAL ( libstorm_fix_vatan2 ) },
+    { LSTRKEY( "vpoly" ), LFUNCVAL ( libstorm_fix_vpoly ) },
+    { LSTRKEY( "vconv" ), LFUNCVAL ( libstorm_fix_vconv ) },
+    { LSTRKEY( "Q16" ), LNUMVAL ( FIX_Q16 ) },
+    { LSTRKEY( "Q31" ), LNUMVAL ( FIX_Q31 ) },
+    { LSTRKEY( "ONE" ), LNUMVAL ( FIX_ONE ) },
+    { LSTRKEY( "PI" ), LNUMVAL ( FIX_PI ) },
+    { LNILKEY, LNILVAL }
+};
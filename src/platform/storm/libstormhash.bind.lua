@@ -0,0 +1,17 @@
+-- storm.hash bindings, expanded by utils/mkbind.lua into libstormhash_bind.h
+
+return {
+  types = {
+    bytes = { ctype = "hash_bytes", check = "hash_checkbytes" },
+  },
+  maps = {
+    { name = "libstorm_hash_map",
+      funcs = {
+        crc16 = { "hash_crc16", "bytes", "number=0xFFFF", "int=1", "int=-1" },
+        crc32 = { "hash_crc32", "bytes", "number=0", "int=1", "int=-1" },
+        fletcher16 = { "hash_fletcher16", "bytes", "number=0", "int=1", "int=-1" },
+        fnv1a = { "hash_fnv1a", "bytes", "number=HASH_FNV_OFFSET", "int=1", "int=-1" },
+      },
+    },
+  },
+}
@@ -27,37 +27,54 @@ static u8 *rfsc_buffer;
 static p_rfsc_send rfsc_send;
 static p_rfsc_recv rfsc_recv;
 static timer_data_type rfsc_timeout;
+static unsigned rfsc_window = 1;
+static int rfsc_caps_known;
+static u32 rfsc_caps;
+static u32 rfsc_server_window = 1;
+static u8 *rfsc_zbuffer;
+static u32 rfsc_bufsize;
 
 // ****************************************************************************
 // Client helpers
 
-static int rfsch_send_request_read_response()
+// Empty the receive buffer before starting a new exchange
+static void rfsch_flush()
 {
-  u16 temp16;
-  u32 readbytes;
-
 #ifndef ELUA_CPU_LINUX
-  // Empty receive buffer
   while( rfsc_recv( rfsc_buffer, 1, 0 ) == 1 );
 #endif
+}
 
-  // Send request
-  if( eluarpc_get_packet_size( rfsc_buffer, &temp16 ) == ELUARPC_ERR )
+static int rfsch_send_request()
+{
+  u16 temp16;
+  const u8 *p = rfsc_buffer;
+
+  // Compress the request if the server accepts it and it gets smaller
+  if( rfsc_zbuffer && eluarpc_peer_compress() && eluarpc_compress_packet( rfsc_buffer, rfsc_zbuffer, rfsc_bufsize ) == ELUARPC_OK )
+    p = rfsc_zbuffer;
+  if( eluarpc_get_packet_size( p, &temp16 ) == ELUARPC_ERR )
   {
     RFSDEBUG( "[RFS] get packet size error\n" );
     return CLIENT_ERR;
   }
-  if( rfsc_send( rfsc_buffer, temp16 ) != temp16 )
+  if( rfsc_send( p, temp16 ) != temp16 )
   {
     RFSDEBUG( "[RFS] rfsc_send error\n" );
     return CLIENT_ERR;
   }
-  
-  // Get response
+  return CLIENT_OK;
+}
+
+static int rfsch_read_response()
+{
+  u16 temp16;
+  u32 readbytes;
+
   // First the length, then the rest of the data
   if( ( readbytes = rfsc_recv( rfsc_buffer, ELUARPC_START_OFFSET, rfsc_timeout ) ) != ELUARPC_START_OFFSET )
   {
-    RFSDEBUG( "[RFS] rfsc_recv (1) error: expected %u, got %u\n", ( unsigned )( temp16 - ELUARPC_START_OFFSET ), ( unsigned )readbytes );
+    RFSDEBUG( "[RFS] rfsc_recv (1) error: expected %u, got %u\n", ( unsigned )ELUARPC_START_OFFSET, ( unsigned )readbytes );
     return CLIENT_ERR;
   }
   if( eluarpc_get_packet_size( rfsc_buffer, &temp16 ) == ELUARPC_ERR )
@@ -70,9 +87,202 @@ static int rfsch_send_request_read_response()
     RFSDEBUG( "[RFS] rfsc_recv (2) error: expected %u, got %u\n", ( unsigned )( temp16 - ELUARPC_START_OFFSET ), ( unsigned )readbytes );
     return CLIENT_ERR;
   }
+  if( rfsc_zbuffer && eluarpc_is_compressed( rfsc_buffer ) )
+  {
+    memcpy( rfsc_zbuffer, rfsc_buffer, temp16 );
+    if( eluarpc_expand_packet( rfsc_zbuffer, rfsc_buffer, rfsc_bufsize ) == ELUARPC_ERR )
+    {
+      RFSDEBUG( "[RFS] unable to expand response\n" );
+      return CLIENT_ERR;
+    }
+  }
   return CLIENT_OK;
 }
 
+static int rfsch_send_request_read_response()
+{
+  rfsch_flush();
+  if( rfsch_send_request() == CLIENT_ERR )
+    return CLIENT_ERR;
+  return rfsch_read_response();
+}
+
+// Packets announce compression only to servers that reported RFS_CAP_LZ
+// (older servers reject them)
+static void rfsch_set_compress()
+{
+  eluarpc_set_compress( rfsc_zbuffer && ( rfsc_caps & RFS_CAP_LZ ) ? ELUARPC_LZ_ON : ELUARPC_LZ_OFF );
+}
+
+// Ask the server for its capabilities, once it answers. Servers that predate
+// RFS_OP_CAPS answer something that is not a "caps" response (or nothing at
+// all, in which case they are asked again by the next open/opendir) and get
+// only the original stop-and-wait protocol.
+static void rfsch_get_caps()
+{
+  if( rfsc_caps_known )
+    return;
+  remotefs_caps_write_request( rfsc_buffer );
+  if( rfsch_send_request_read_response() == CLIENT_ERR )
+    return;
+  rfsc_caps_known = 1;
+  if( remotefs_caps_read_response( rfsc_buffer, &rfsc_caps, &rfsc_server_window ) == ELUARPC_ERR )
+    rfsc_caps = 0;
+  if( ( rfsc_caps & RFS_CAP_TAGS ) == 0 || rfsc_server_window == 0 )
+    rfsc_server_window = 1;
+  rfsch_set_compress();
+  RFSDEBUG( "[RFS] server caps %X, window %u\n", ( unsigned )rfsc_caps, ( unsigned )rfsc_server_window );
+}
+
+// Number of requests kept in flight: what the application asked for, limited
+// by what the server can take
+static unsigned rfsch_window()
+{
+  return rfsc_window < rfsc_server_window ? rfsc_window : ( unsigned )rfsc_server_window;
+}
+
+// Result of a response to a windowed transfer request (whole file operations
+// fail for a negative result)
+static int rfsch_window_read_result( int op, const u8 **presbuf, u32 *pres )
+{
+  s32 sres;
+
+  switch( op )
+  {
+    case RFS_OP_WRITE:
+      return remotefs_write_read_response( rfsc_buffer, pres );
+    case RFS_OP_READFILE:
+      if( remotefs_readfile_read_response( rfsc_buffer, &sres, presbuf, pres ) == ELUARPC_ERR || sres < 0 )
+        return ELUARPC_ERR;
+      return ELUARPC_OK;
+    case RFS_OP_WRITEFILE:
+      if( remotefs_writefile_read_response( rfsc_buffer, &sres ) == ELUARPC_ERR || sres < 0 )
+        return ELUARPC_ERR;
+      *pres = ( u32 )sres;
+      return ELUARPC_OK;
+    default:
+      return remotefs_read_read_response( rfsc_buffer, presbuf, pres );
+  }
+}
+
+// Windowed transfers
+// Up to 'window' tagged requests for consecutive chunks of the transfer are
+// kept in flight. The server executes the requests of a client in the order
+// it receives them, so chunk 'n' always maps to bytes [n * chunk, (n + 1) *
+// chunk) of the transfer; the tag of a response (the low 8 bits of its chunk
+// number) tells which chunk it belongs to, so responses can be consumed in
+// any order. 'op' is RFS_OP_READ/RFS_OP_WRITE (on 'fd') or
+// RFS_OP_READFILE/RFS_OP_WRITEFILE (on 'path', starting at offset 0).
+// The chunks sent after a short transfer or a failed response still move the
+// position of 'fd', so it is moved back to the end of the bytes reported.
+static s32 rfsch_window_transfer( int op, int fd, const char *path, u8 *p, u32 count, u32 chunk, unsigned window )
+{
+  u32 nchunks = ( count + chunk - 1 ) / chunk;
+  u32 base = 0, sent = 0, stop = nchunks, stoplen = 0;
+  u32 completed = 0;  // completed chunks, bit 'i' is chunk 'base + i'
+  u32 received = 0;   // responses read
+  u32 moved = 0;      // bytes transferred by the server for these responses
+  u32 want, res, idx;
+  const u8 *resbuf;
+  s32 total;
+  int err = 0, lost = 0;
+
+  if( window > RFSC_MAX_WINDOW )
+    window = RFSC_MAX_WINDOW;
+  rfsch_flush();
+  while( 1 )
+  {
+    // Keep the window full
+    while( sent < stop && sent - base < window )
+    {
+      want = sent == nchunks - 1 ? count - sent * chunk : chunk;
+      eluarpc_set_tag( sent & 0xFF );
+      switch( op )
+      {
+        case RFS_OP_WRITE:
+          remotefs_write_write_request( rfsc_buffer, fd, p + sent * chunk, want );
+          break;
+        case RFS_OP_READFILE:
+          remotefs_readfile_write_request( rfsc_buffer, path, sent * chunk, want );
+          break;
+        case RFS_OP_WRITEFILE:
+          remotefs_writefile_write_request( rfsc_buffer, path, sent * chunk, sent == 0 ? RFS_WRITEFILE_FLAG_TRUNC : 0, p + sent * chunk, want );
+          break;
+        default:
+          remotefs_read_write_request( rfsc_buffer, fd, want );
+          break;
+      }
+      if( rfsch_send_request() == CLIENT_ERR )
+      {
+        err = 1;
+        break;
+      }
+      sent ++;
+    }
+    if( err || base == sent )
+      break;
+
+    // Wait for any of the outstanding responses
+    if( rfsch_read_response() == CLIENT_ERR )
+    {
+      err = 1;
+      break;
+    }
+    received ++;
+    if( rfsch_window_read_result( op, &resbuf, &res ) == ELUARPC_ERR )
+    {
+      err = lost = 1;
+      break;
+    }
+    moved += res;
+    idx = base + ( u8 )( eluarpc_get_tag() - base );
+    want = idx == nchunks - 1 ? count - idx * chunk : chunk;
+    if( eluarpc_get_tag() == ELUARPC_NO_TAG || idx >= sent || ( completed & ( 1UL << ( idx - base ) ) ) || res > want )
+    {
+      RFSDEBUG( "[RFS] unexpected response for chunk %u\n", ( unsigned )idx );
+      err = 1;
+      break;
+    }
+    if( ( op == RFS_OP_READ || op == RFS_OP_READFILE ) && res > 0 )
+      memcpy( p + idx * chunk, resbuf, res );
+    if( res < want && idx < stop )
+    {
+      stop = idx;
+      stoplen = res;
+    }
+    completed |= 1UL << ( idx - base );
+    while( completed & 1 )
+    {
+      completed >>= 1;
+      base ++;
+    }
+  }
+  // Consume the responses still outstanding, so that the next exchange
+  // doesn't read one of them
+  while( err && received < sent && rfsch_read_response() == CLIENT_OK )
+  {
+    received ++;
+    if( rfsch_window_read_result( op, &resbuf, &res ) == ELUARPC_ERR )
+      lost = 1;
+    else
+      moved += res;
+  }
+  eluarpc_set_tag( ELUARPC_NO_TAG );
+  // After an error only the chunks before the first missing response count
+  // (whole file operations fail if nothing was transferred)
+  if( err && base <= stop )
+    total = base == 0 && ( op == RFS_OP_READFILE || op == RFS_OP_WRITEFILE ) ? -1 : ( s32 )( base * chunk );
+  else
+    total = stop < nchunks ? ( s32 )( stop * chunk + stoplen ) : ( s32 )count;
+  if( ( op == RFS_OP_READ || op == RFS_OP_WRITE ) && !lost && received == sent && moved > ( u32 )total )
+  {
+    RFSDEBUG( "[RFS] moving back %u bytes\n", ( unsigned )( moved - total ) );
+    if( rfsc_lseek( fd, -( s32 )( moved - total ), SEEK_CUR ) == -1 )
+      return -1;
+  }
+  return total;
+}
+
 // ****************************************************************************
 // Client public interface
 
@@ -89,10 +299,35 @@ void rfsc_set_timeout( timer_data_type timeout )
   rfsc_timeout = timeout;
 }
 
+// Enable compression with a scratch buffer as large as the packet buffer
+// (NULL disables it). It is only used with servers that report RFS_CAP_LZ.
+void rfsc_set_compress( u8 *pzbuf, u32 bufsize )
+{
+  rfsc_zbuffer = pzbuf;
+  rfsc_bufsize = bufsize;
+  rfsch_set_compress();
+}
+
+// Set the maximum number of requests kept in flight for large transfers. The
+// server reports how many it can take, so the window only opens once it
+// answered RFS_OP_CAPS (1 keeps the original stop-and-wait exchange).
+void rfsc_set_window( unsigned window )
+{
+  rfsc_window = window == 0 ? 1 : window;
+}
+
+// Capabilities of the server (RFS_CAP_* flags, 0 until it answered)
+u32 rfsc_get_caps()
+{
+  return rfsc_caps;
+}
+
 int rfsc_open( const char* pathname, int flags, int mode )
 {
   int fd;
 
+  rfsch_get_caps();
+
   // Make the request
   remotefs_open_write_request( rfsc_buffer, pathname, os_open_sys_flags_to_rfs_flags( flags ), mode );
 
@@ -139,6 +374,52 @@ s32 rfsc_read( int fd, void *buf, u32 count )
   return ( s32 )count;
 }
 
+// Transfer 'count' bytes in 'chunk' sized requests, keeping the configured
+// number of requests in flight. Returns the number of bytes transferred.
+s32 rfsc_read_chunked( int fd, void *buf, u32 count, u32 chunk )
+{
+  s32 total = 0, res;
+  u32 toread;
+  u8 *p = ( u8* )buf;
+
+  if( rfsch_window() > 1 && count > chunk )
+    return rfsch_window_transfer( RFS_OP_READ, fd, NULL, p, count, chunk, rfsch_window() );
+  while( count )
+  {
+    toread = count > chunk ? chunk : count;
+    if( ( res = rfsc_read( fd, p, toread ) ) == -1 )
+      break;
+    total += res;
+    if( res < toread )
+      break;
+    count -= toread;
+    p += toread;
+  }
+  return total;
+}
+
+s32 rfsc_write_chunked( int fd, const void *buf, u32 count, u32 chunk )
+{
+  s32 total = 0, res;
+  u32 towrite;
+  const u8 *p = ( const u8* )buf;
+
+  if( rfsch_window() > 1 && count > chunk )
+    return rfsch_window_transfer( RFS_OP_WRITE, fd, NULL, ( u8* )p, count, chunk, rfsch_window() );
+  while( count )
+  {
+    towrite = count > chunk ? chunk : count;
+    if( ( res = rfsc_write( fd, p, towrite ) ) == -1 )
+      break;
+    total += res;
+    if( res < towrite )
+      break;
+    count -= towrite;
+    p += towrite;
+  }
+  return total;
+}
+
 s32 rfsc_lseek( int fd, s32 offset, int whence )
 {
   s32 res;
@@ -177,6 +458,8 @@ u32 rfsc_opendir( const char* name )
 {
   u32 res;
 
+  rfsch_get_caps();
+
   // Make the request
   remotefs_opendir_write_request( rfsc_buffer, name );
   if( rfsch_send_request_read_response() == CLIENT_ERR )
@@ -218,4 +501,88 @@ int rfsc_closedir( u32 d )
   return res;
 }  
 
+// Returns 0 for OK, -1 for error, RFSC_UNSUPPORTED if the server doesn't
+// know whole file operations
+int rfsc_stat( const char *pathname, u32 *psize, u32 *pmtime, u8 *pflags )
+{
+  int res;
+  u8 op;
+
+  rfsch_get_caps();
+  if( ( rfsc_caps & RFS_CAP_FILES ) == 0 )
+    return RFSC_UNSUPPORTED;
+
+  // Make the request
+  remotefs_stat_write_request( rfsc_buffer, pathname );
+  if( rfsch_send_request_read_response() == CLIENT_ERR )
+    return -1;
+
+  // Interpret the response
+  if( remotefs_stat_read_response( rfsc_buffer, &res, psize, pmtime, pflags ) == ELUARPC_ERR )
+    return remotefs_unsupported_read_response( rfsc_buffer, &op ) == ELUARPC_OK ? RFSC_UNSUPPORTED : -1;
+  return res;
+}
+
+// Get the next entries of directory 'd' in 'buf' (at most 'bufsize' bytes)
+// Returns the number of entries (0 at the end of the directory, -1 for
+// error, RFSC_UNSUPPORTED if the server doesn't know batched listings); use
+// eluarpc_get_entry to decode them (a = size, b = time)
+int rfsc_readdir_batch( u32 d, u8 *buf, u32 bufsize, u32 *plen )
+{
+  int count;
+  const u8 *pentries;
+  u8 op;
+
+  // Make the request
+  remotefs_readdirb_write_request( rfsc_buffer, d, bufsize );
+  if( rfsch_send_request_read_response() == CLIENT_ERR )
+    return -1;
+
+  // Interpret the response
+  if( remotefs_readdirb_read_response( rfsc_buffer, &count, &pentries, plen ) == ELUARPC_ERR )
+    return remotefs_unsupported_read_response( rfsc_buffer, &op ) == ELUARPC_OK ? RFSC_UNSUPPORTED : -1;
+  if( *plen > bufsize )
+    return -1;
+  if( *plen )
+    memcpy( buf, pentries, *plen );
+  return count;
+}
+
+// Fetch (at most 'count' bytes of) a whole file by name in 'chunk' sized
+// pieces, without open/close round trips. Returns the number of bytes read
+// (-1 for error, RFSC_UNSUPPORTED as rfsc_stat).
+s32 rfsc_readfile( const char *pathname, void *buf, u32 count, u32 chunk )
+{
+  rfsch_get_caps();
+  if( ( rfsc_caps & RFS_CAP_FILES ) == 0 )
+    return RFSC_UNSUPPORTED;
+  if( count == 0 )
+    return 0;
+  return rfsch_window_transfer( RFS_OP_READFILE, -1, pathname, ( u8* )buf, count, chunk, rfsch_window() );
+}
+
+// Store a whole file by name (created or truncated) in pieces of at most
+// 'chunk' bytes, including the file name. Returns the number of bytes written
+// (-1 for error, RFSC_UNSUPPORTED as rfsc_stat).
+s32 rfsc_writefile( const char *pathname, const void *buf, u32 count, u32 chunk )
+{
+  u32 extra = RFS_WRITEFILE_EXTRA( strlen( pathname ) ) - ELUARPC_WRITE_REQUEST_EXTRA;
+  s32 res;
+
+  rfsch_get_caps();
+  if( ( rfsc_caps & RFS_CAP_FILES ) == 0 )
+    return RFSC_UNSUPPORTED;
+  if( chunk <= extra )
+    return -1;
+  if( count == 0 )
+  {
+    // Nothing to stream, just create/truncate the file
+    remotefs_writefile_write_request( rfsc_buffer, pathname, 0, RFS_WRITEFILE_FLAG_TRUNC, NULL, 0 );
+    if( rfsch_send_request_read_response() == CLIENT_ERR || remotefs_writefile_read_response( rfsc_buffer, &res ) == ELUARPC_ERR )
+      return -1;
+    return res;
+  }
+  return rfsch_window_transfer( RFS_OP_WRITEFILE, -1, pathname, ( u8* )buf, count, chunk - extra, rfsch_window() );
+}
+
 #endif // #ifdef BUILD_RFS
@@ -14,6 +14,8 @@
 #include "hostif.h"
 #endif
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 
 #include "elua_rfs.h"
 
@@ -28,6 +30,14 @@
 #define RFS_TIMER_ID          PLATFORM_TIMER_SYS_ID
 #endif
 
+// Maximum number of READ/WRITE requests kept in flight for large transfers
+// (1 selects the original stop-and-wait protocol). The client also limits it
+// to what the server reports, so servers without tagged requests always get
+// one request at a time.
+#ifndef RFS_WINDOW
+#define RFS_WINDOW            4
+#endif
+
 // Our RFS buffer
 // Compute the usable buffer size starting from RFS_BUFFER_SIZE (which is the
 // size of the serial buffer). A complete packet must fit in RFS_BUFFER_SIZE
@@ -35,69 +45,277 @@
 #define RFS_REAL_BUFFER_SIZE      ( ( 1 << RFS_BUFFER_SIZE ) - ELUARPC_WRITE_REQUEST_EXTRA )
 static u8 rfs_buffer[ 1 << RFS_BUFFER_SIZE ];
 
+// Compressed packets (opt-in, as it needs a second buffer for packing and
+// unpacking). They are only used if the server reports RFS_CAP_LZ, other
+// servers get plain packets.
+#ifndef RFS_COMPRESS
+#define RFS_COMPRESS          0
+#endif
+
+#if RFS_COMPRESS
+static u8 rfs_zbuffer[ 1 << RFS_BUFFER_SIZE ];
+#endif
+
 #ifdef ELUA_SIMULATOR
 static int rfs_read_fd, rfs_write_fd;
 #endif
 
-static int rfs_open_r( struct _reent *r, const char *path, int flags, int mode, void *pdata )
+// Block cache configuration (RFS_CACHE_SLOTS 0 disables the cache)
+#ifndef RFS_CACHE_SLOTS
+#define RFS_CACHE_SLOTS       2
+#endif
+
+#ifndef RFS_CACHE_BLOCK_SIZE
+#define RFS_CACHE_BLOCK_SIZE  RFS_REAL_BUFFER_SIZE
+#endif
+
+#ifndef RFS_CACHE_TTL
+#define RFS_CACHE_TTL         1000000
+#endif
+
+// Directory entries are fetched in batches of at most RFS_DIR_BATCH_SIZE bytes
+// (0 reverts to one request per entry)
+#ifndef RFS_DIR_BATCH_SIZE
+#define RFS_DIR_BATCH_SIZE    128
+#endif
+
+// Number of directories that can be listed in batches at the same time
+#ifndef RFS_DIR_BATCH_SLOTS
+#define RFS_DIR_BATCH_SLOTS   2
+#endif
+
+// ****************************************************************************
+// Block cache
+// Each cached file descriptor owns one block of RFS_CACHE_BLOCK_SIZE bytes
+// that holds either read-ahead data or pending (write-behind) data. The
+// application file position is tracked locally in 'pos'; the position of
+// the server side descriptor is implied by the block state:
+//   RFS_CACHE_EMPTY: pos
+//   RFS_CACHE_READ:  start + len (the block was read from 'start')
+//   RFS_CACHE_WRITE: start (the block was not sent yet)
+// Read-ahead data is trusted for RFS_CACHE_TTL microseconds, so files
+// changed on the host are picked up again. Pending writes are sent when the
+// block fills, on any read or lseek on the same descriptor and on close.
+
+#if RFS_CACHE_SLOTS > 0
+
+enum
+{
+  RFS_CACHE_EMPTY,
+  RFS_CACHE_READ,
+  RFS_CACHE_WRITE
+};
+
+typedef struct
+{
+  int fd;
+  u8 state;
+  s32 pos;
+  s32 start;
+  u32 len;
+  timer_data_type stamp;
+  u8 buf[ RFS_CACHE_BLOCK_SIZE ];
+} RFS_CACHE_SLOT;
+
+static RFS_CACHE_SLOT rfs_cache[ RFS_CACHE_SLOTS ];
+
+static RFS_CACHE_SLOT* rfs_cache_find( int fd )
 {
-  return rfsc_open( path, flags, mode );
+  unsigned i;
+
+  for( i = 0; i < RFS_CACHE_SLOTS; i ++ )
+    if( rfs_cache[ i ].fd == fd )
+      return rfs_cache + i;
+  return NULL;
 }
 
-static int rfs_close_r( struct _reent *r, int fd, void *pdata )
+static int rfs_cache_is_valid( RFS_CACHE_SLOT *pslot )
 {
-  return rfsc_close( fd );
+  return pslot->state == RFS_CACHE_READ && platform_timer_get_diff_crt( RFS_TIMER_ID, pslot->stamp ) < RFS_CACHE_TTL;
 }
 
-static _ssize_t rfs_write_r( struct _reent *r, int fd, const void* ptr, size_t len, void *pdata )
-{ 
-  s32 total = 0, res;
-  u32 towrite;
-  const u8 *p = ( const u8* )ptr;
+// Send the pending data or drop the read-ahead data, leaving the server
+// descriptor at 'pos'. Returns 0 for OK, -1 for error.
+static int rfs_cache_flush( RFS_CACHE_SLOT *pslot )
+{
+  s32 res = 0;
 
-  // Write in RFS_REAL_BUFFER_SIZE increments
-//  printf( "Got WRITE request for %d bytes\n", len );
-  while( len )
+  if( pslot->state == RFS_CACHE_WRITE )
   {
-    towrite = len > RFS_REAL_BUFFER_SIZE ? RFS_REAL_BUFFER_SIZE : len;
-    if( ( res = rfsc_write( fd, p, towrite ) ) == -1 )
-      break;
-    total += res;
-//    printf( "Wrote %d bytes\n", res );
-    if( res < towrite )
-      break;
-    len -= towrite;
-    p += towrite; 
+    res = rfsc_write_chunked( pslot->fd, pslot->buf, pslot->len, RFS_REAL_BUFFER_SIZE );
+    if( res != pslot->len )
+    {
+      pslot->pos = pslot->start + ( res > 0 ? res : 0 );
+      res = -1;
+    }
+    else
+      res = 0;
   }
-  return ( _ssize_t )total;
+  else if( pslot->state == RFS_CACHE_READ && pslot->pos != pslot->start + ( s32 )pslot->len )
+    res = rfsc_lseek( pslot->fd, pslot->pos, SEEK_SET ) == -1 ? -1 : 0;
+  pslot->state = RFS_CACHE_EMPTY;
+  return ( int )res;
 }
 
-static _ssize_t rfs_read_r( struct _reent *r, int fd, void* ptr, size_t len, void *pdata )
+static s32 rfs_cache_read( RFS_CACHE_SLOT *pslot, u8 *p, u32 len )
 {
   s32 total = 0, res;
-  u32 toread;
-  u8 *p = ( u8* )ptr;
+  u32 avail;
 
-  // Read in RFS_REAL_BUFFER_SIZE increments
-//  printf( "Got READ request for %d bytes\n", len );
+  if( pslot->state == RFS_CACHE_WRITE && rfs_cache_flush( pslot ) == -1 )
+    return -1;
   while( len )
   {
-    toread = len > RFS_REAL_BUFFER_SIZE ? RFS_REAL_BUFFER_SIZE : len;
-    if( ( res = rfsc_read( fd, p, toread ) ) == -1 )
+    if( rfs_cache_is_valid( pslot ) && pslot->pos >= pslot->start && pslot->pos < pslot->start + ( s32 )pslot->len )
+    {
+      avail = pslot->start + pslot->len - pslot->pos;
+      avail = avail > len ? len : avail;
+      memcpy( p, pslot->buf + ( pslot->pos - pslot->start ), avail );
+      pslot->pos += avail;
+      p += avail;
+      len -= avail;
+      total += avail;
+      continue;
+    }
+    // Cache miss: sequential reads continue from the end of the block
+    if( rfs_cache_flush( pslot ) == -1 )
+      break;
+    if( len >= RFS_CACHE_BLOCK_SIZE )
+    {
+      res = rfsc_read_chunked( pslot->fd, p, len, RFS_REAL_BUFFER_SIZE );
+      pslot->pos += res;
+      total += res;
       break;
-    total += res; 
-//    printf( "Read %d bytes\n", res );
-    if( res < toread )
+    }
+    if( ( res = rfsc_read_chunked( pslot->fd, pslot->buf, RFS_CACHE_BLOCK_SIZE, RFS_REAL_BUFFER_SIZE ) ) <= 0 )
       break;
-    len -= toread;
-    p += toread;
+    pslot->state = RFS_CACHE_READ;
+    pslot->start = pslot->pos;
+    pslot->len = ( u32 )res;
+    pslot->stamp = platform_timer_read( RFS_TIMER_ID );
+  }
+  return total;
+}
+
+static s32 rfs_cache_write( RFS_CACHE_SLOT *pslot, const u8 *p, u32 len )
+{
+  s32 res;
+
+  // Pending data is coalesced only with writes that extend it
+  if( pslot->state == RFS_CACHE_READ ||
+      ( pslot->state == RFS_CACHE_WRITE && ( pslot->pos != pslot->start + ( s32 )pslot->len || pslot->len + len > RFS_CACHE_BLOCK_SIZE ) ) )
+    if( rfs_cache_flush( pslot ) == -1 )
+      return -1;
+  if( pslot->state == RFS_CACHE_EMPTY )
+  {
+    if( len >= RFS_CACHE_BLOCK_SIZE )
+    {
+      res = rfsc_write_chunked( pslot->fd, p, len, RFS_REAL_BUFFER_SIZE );
+      pslot->pos += res;
+      return res;
+    }
+    pslot->state = RFS_CACHE_WRITE;
+    pslot->start = pslot->pos;
+    pslot->len = 0;
+  }
+  memcpy( pslot->buf + pslot->len, p, len );
+  pslot->len += len;
+  pslot->pos += len;
+  return ( s32 )len;
+}
+
+static s32 rfs_cache_lseek( RFS_CACHE_SLOT *pslot, s32 off, int whence )
+{
+  s32 target = whence == SEEK_SET ? off : pslot->pos + off;
+  s32 res;
+
+  // Seeks inside the read-ahead block don't need the server
+  if( whence != SEEK_END && rfs_cache_is_valid( pslot ) && target >= pslot->start && target <= pslot->start + ( s32 )pslot->len )
+  {
+    pslot->pos = target;
+    return target;
+  }
+  if( rfs_cache_flush( pslot ) == -1 )
+    return -1;
+  if( whence == SEEK_CUR )
+    res = rfsc_lseek( pslot->fd, target, SEEK_SET );
+  else
+    res = rfsc_lseek( pslot->fd, off, whence );
+  if( res != -1 )
+    pslot->pos = res;
+  return res;
+}
+
+#endif // #if RFS_CACHE_SLOTS > 0
+
+static int rfs_open_r( struct _reent *r, const char *path, int flags, int mode, void *pdata )
+{
+  int fd = rfsc_open( path, flags, mode );
+#if RFS_CACHE_SLOTS > 0
+  RFS_CACHE_SLOT *pslot;
+
+  // Appending writes go wherever the server file ends, so they are not cached
+  if( fd >= 0 && ( flags & O_APPEND ) == 0 && ( pslot = rfs_cache_find( -1 ) ) != NULL )
+  {
+    pslot->fd = fd;
+    pslot->state = RFS_CACHE_EMPTY;
+    pslot->pos = 0;
+  }
+#endif
+  return fd;
+}
+
+static int rfs_close_r( struct _reent *r, int fd, void *pdata )
+{
+  int res = 0;
+#if RFS_CACHE_SLOTS > 0
+  RFS_CACHE_SLOT *pslot = rfs_cache_find( fd );
+
+  if( pslot )
+  {
+    if( pslot->state == RFS_CACHE_WRITE )
+      res = rfs_cache_flush( pslot );
+    pslot->fd = -1;
   }
-  return ( _ssize_t )total;
+#endif
+  if( rfsc_close( fd ) == -1 )
+    res = -1;
+  return res;
+}
+
+static _ssize_t rfs_write_r( struct _reent *r, int fd, const void* ptr, size_t len, void *pdata )
+{ 
+#if RFS_CACHE_SLOTS > 0
+  RFS_CACHE_SLOT *pslot = rfs_cache_find( fd );
+
+  if( pslot )
+    return ( _ssize_t )rfs_cache_write( pslot, ( const u8* )ptr, len );
+#endif
+  // Write in RFS_REAL_BUFFER_SIZE increments
+  return ( _ssize_t )rfsc_write_chunked( fd, ptr, len, RFS_REAL_BUFFER_SIZE );
+}
+
+static _ssize_t rfs_read_r( struct _reent *r, int fd, void* ptr, size_t len, void *pdata )
+{
+#if RFS_CACHE_SLOTS > 0
+  RFS_CACHE_SLOT *pslot = rfs_cache_find( fd );
+
+  if( pslot )
+    return ( _ssize_t )rfs_cache_read( pslot, ( u8* )ptr, len );
+#endif
+  // Read in RFS_REAL_BUFFER_SIZE increments
+  return ( _ssize_t )rfsc_read_chunked( fd, ptr, len, RFS_REAL_BUFFER_SIZE );
 }
 
 // lseek
 static off_t rfs_lseek_r( struct _reent *r, int fd, off_t off, int whence, void *pdata )
 {
+#if RFS_CACHE_SLOTS > 0
+  RFS_CACHE_SLOT *pslot = rfs_cache_find( fd );
+
+  if( pslot )
+    return ( off_t )rfs_cache_lseek( pslot, ( s32 )off, whence );
+#endif
   return ( off_t )rfsc_lseek( fd, ( s32 )off, whence );
 }
 
@@ -107,13 +325,102 @@ static void* rfs_opendir_r( struct _reent *r, const char* name, void *pdata )
   return ( void* )rfsc_opendir( name );
 }
 
+#if RFS_DIR_BATCH_SIZE > 0
+// Batches of entries of the directories that are being listed, one per
+// directory handle, so interleaved listings don't lose entries. Directories
+// listed while all the slots are busy use single entry requests.
+typedef struct
+{
+  u32 d;
+  const u8 *next, *end;
+  u8 buf[ RFS_DIR_BATCH_SIZE < RFS_REAL_BUFFER_SIZE ? RFS_DIR_BATCH_SIZE : RFS_REAL_BUFFER_SIZE ];
+} RFS_DIR_BATCH;
+
+static RFS_DIR_BATCH rfs_dir_batch[ RFS_DIR_BATCH_SLOTS ];
+static int rfs_dir_use_batch = 1;
+
+// Find the batch of directory 'd' (or 0 for a free slot)
+static RFS_DIR_BATCH* rfsh_dir_batch_find( u32 d )
+{
+  unsigned i;
+
+  for( i = 0; i < RFS_DIR_BATCH_SLOTS; i ++ )
+    if( rfs_dir_batch[ i ].d == d )
+      return rfs_dir_batch + i;
+  return NULL;
+}
+
+// Get the batch of directory 'd', claiming a free slot for a new listing
+static RFS_DIR_BATCH* rfsh_dir_batch_get( u32 d )
+{
+  RFS_DIR_BATCH *pb = rfsh_dir_batch_find( d );
+
+  if( pb == NULL && ( pb = rfsh_dir_batch_find( 0 ) ) != NULL )
+  {
+    pb->d = d;
+    pb->next = pb->end = NULL;
+  }
+  return pb;
+}
+
+// Get the next directory entry from the batch, fetching a new batch as
+// needed. Returns 1 for an entry, 0 at the end of the directory, -1 for
+// error and RFSC_UNSUPPORTED if the server does not support batched listings.
+// The slot is released when the listing ends.
+static int rfsh_readdir_batch( RFS_DIR_BATCH *pb, struct dm_dirent *pent )
+{
+  u32 len;
+  int count;
+
+  if( pb->next == pb->end )
+  {
+    if( ( count = rfsc_readdir_batch( pb->d, pb->buf, sizeof( pb->buf ), &len ) ) <= 0 )
+    {
+      pb->d = 0;
+      return count;
+    }
+    pb->next = pb->buf;
+    pb->end = pb->buf + len;
+  }
+  if( ( pb->next = eluarpc_get_entry( pb->next, pb->end, &pent->fname, &pent->fsize, &pent->ftime ) ) == NULL )
+  {
+    pb->d = 0;
+    return 0;
+  }
+  return 1;
+}
+#endif // #if RFS_DIR_BATCH_SIZE > 0
+
 // readdir
 static struct dm_dirent* rfs_readdir_r( struct _reent *r, void *d, void *pdata )
 {
   static struct dm_dirent ent;
+#if RFS_DIR_BATCH_SIZE > 0
+  RFS_DIR_BATCH *pb;
+#endif
 
-  rfsc_readdir( ( u32 )d, &ent.fname, &ent.fsize, &ent.ftime );
   ent.flags = 0;
+#if RFS_DIR_BATCH_SIZE > 0
+  if( rfs_dir_use_batch && ( rfsc_get_caps() & RFS_CAP_READDIRB ) && ( pb = rfsh_dir_batch_get( ( u32 )d ) ) != NULL )
+  {
+    switch( rfsh_readdir_batch( pb, &ent ) )
+    {
+      case 1:
+        return &ent;
+      case 0:
+        return NULL;
+      case RFSC_UNSUPPORTED:
+        // The server said it doesn't know readdirb, use single entry
+        // requests from now on
+        rfs_dir_use_batch = 0;
+        break;
+      default:
+        r->_errno = EIO;
+        return NULL;
+    }
+  }
+#endif
+  rfsc_readdir( ( u32 )d, &ent.fname, &ent.fsize, &ent.ftime );
   if( ent.fname == NULL )
     return NULL;
   return &ent;
@@ -122,9 +429,44 @@ static struct dm_dirent* rfs_readdir_r( struct _reent *r, void *d, void *pdata )
 // closedir
 static int rfs_closedir_r( struct _reent *r, void *d, void *pdata )
 {
+#if RFS_DIR_BATCH_SIZE > 0
+  RFS_DIR_BATCH *pb = rfsh_dir_batch_find( ( u32 )d );
+
+  if( pb )
+    pb->d = 0;
+#endif
   return rfsc_closedir( ( u32 )d );
 }
 
+// ****************************************************************************
+// Whole file operations
+// Files are fetched and stored by name in RFS_REAL_BUFFER_SIZE pieces,
+// without open/close round trips. They return RFSC_UNSUPPORTED if the server
+// doesn't report RFS_CAP_FILES.
+
+// Returns 0 for OK
+int remotefs_stat( const char *path, u32 *psize, u32 *pmtime, int *pisdir )
+{
+  u8 flags;
+  int res;
+
+  if( ( res = rfsc_stat( path, psize, pmtime, &flags ) ) == 0 )
+    *pisdir = ( flags & RFS_STAT_FLAG_DIR ) != 0;
+  return res;
+}
+
+// Returns the number of bytes read
+s32 remotefs_readfile( const char *path, void *buf, u32 count )
+{
+  return rfsc_readfile( path, buf, count, RFS_REAL_BUFFER_SIZE );
+}
+
+// Creates or truncates the file, returns the number of bytes written
+s32 remotefs_writefile( const char *path, const void *buf, u32 count )
+{
+  return rfsc_writefile( path, buf, count, RFS_REAL_BUFFER_SIZE );
+}
+
 // ****************************************************************************
 // Remote FS serial transport functions
 
@@ -211,6 +553,18 @@ int remotefs_init()
   } 
 #endif
   rfsc_setup( rfs_buffer, rfs_send, rfs_recv, RFS_TIMEOUT );
+  rfsc_set_window( RFS_WINDOW );
+#if RFS_COMPRESS
+  rfsc_set_compress( rfs_zbuffer, sizeof( rfs_zbuffer ) );
+#endif
+#if RFS_CACHE_SLOTS > 0
+  {
+    unsigned i;
+
+    for( i = 0; i < RFS_CACHE_SLOTS; i ++ )
+      rfs_cache[ i ].fd = -1;
+  }
+#endif
   return dm_register( "/rfs", NULL, &rfs_device );
 }
 
@@ -201,3 +201,136 @@ int remotefs_closedir_read_request( const u8 *p, u32 *pd )
 }
 
 
+
+// ****************************************************************************
+// Operation: stat
+// stat: int stat( const char *pathname, u32 *psize, u32 *pmtime, u8 *pflags )
+
+void remotefs_stat_write_response( u8 *p, int result, u32 size, u32 mtime, u8 flags )
+{
+  eluarpc_gen_write( p, "rillc", RFS_OP_STAT, result, size, mtime, flags );
+}
+
+int remotefs_stat_read_response( const u8 *p, int *presult, u32 *psize, u32 *pmtime, u8 *pflags )
+{
+  return eluarpc_gen_read( p, "rillc", RFS_OP_STAT, presult, psize, pmtime, pflags );
+}
+
+void remotefs_stat_write_request( u8 *p, const char *pathname )
+{
+  eluarpc_gen_write( p, "op", RFS_OP_STAT, pathname, strlen( pathname ) + 1 );
+}
+
+int remotefs_stat_read_request( const u8 *p, const char **ppathname )
+{
+  return eluarpc_gen_read( p, "op", RFS_OP_STAT, ppathname, NULL );
+}
+
+// ****************************************************************************
+// Operation: readdirb
+// readdirb: int readdirb( u32 d, u32 maxbytes )
+
+void remotefs_readdirb_write_response( u8 *p, int count, const void *entries, u32 len )
+{
+  eluarpc_gen_write( p, "rip", RFS_OP_READDIRB, count, entries, len );
+}
+
+int remotefs_readdirb_read_response( const u8 *p, int *pcount, const u8 **pentries, u32 *plen )
+{
+  return eluarpc_gen_read( p, "rip", RFS_OP_READDIRB, pcount, pentries, plen );
+}
+
+void remotefs_readdirb_write_request( u8 *p, u32 d, u32 maxbytes )
+{
+  eluarpc_gen_write( p, "oll", RFS_OP_READDIRB, d, maxbytes );
+}
+
+int remotefs_readdirb_read_request( const u8 *p, u32 *pd, u32 *pmaxbytes )
+{
+  return eluarpc_gen_read( p, "oll", RFS_OP_READDIRB, pd, pmaxbytes );
+}
+
+// ****************************************************************************
+// Operation: readfile
+// readfile: s32 readfile( const char *pathname, u32 offset, void *buf, u32 count )
+
+void remotefs_readfile_write_response( u8 *p, s32 filesize, u32 readbytes )
+{
+  eluarpc_gen_write( p, "rLp", RFS_OP_READFILE, filesize, NULL, readbytes );
+}
+
+int remotefs_readfile_read_response( const u8 *p, s32 *pfilesize, const u8 **ppdata, u32 *preadbytes )
+{
+  return eluarpc_gen_read( p, "rLp", RFS_OP_READFILE, pfilesize, ppdata, preadbytes );
+}
+
+void remotefs_readfile_write_request( u8 *p, const char *pathname, u32 offset, u32 count )
+{
+  eluarpc_gen_write( p, "opll", RFS_OP_READFILE, pathname, strlen( pathname ) + 1, offset, count );
+}
+
+int remotefs_readfile_read_request( const u8 *p, const char **ppathname, u32 *poffset, u32 *pcount )
+{
+  return eluarpc_gen_read( p, "opll", RFS_OP_READFILE, ppathname, NULL, poffset, pcount );
+}
+
+// ****************************************************************************
+// Operation: writefile
+// writefile: s32 writefile( const char *pathname, u32 offset, u8 flags, const void *buf, u32 count )
+
+void remotefs_writefile_write_response( u8 *p, s32 result )
+{
+  eluarpc_gen_write( p, "rL", RFS_OP_WRITEFILE, result );
+}
+
+int remotefs_writefile_read_response( const u8 *p, s32 *presult )
+{
+  return eluarpc_gen_read( p, "rL", RFS_OP_WRITEFILE, presult );
+}
+
+void remotefs_writefile_write_request( u8 *p, const char *pathname, u32 offset, u8 flags, const void *buf, u32 count )
+{
+  eluarpc_gen_write( p, "oplcp", RFS_OP_WRITEFILE, pathname, strlen( pathname ) + 1, offset, flags, buf, count );
+}
+
+int remotefs_writefile_read_request( const u8 *p, const char **ppathname, u32 *poffset, u8 *pflags, const void **pbuf, u32 *pcount )
+{
+  return eluarpc_gen_read( p, "oplcp", RFS_OP_WRITEFILE, ppathname, NULL, poffset, pflags, pbuf, pcount );
+}
+
+// ****************************************************************************
+// Operation: caps
+// caps: u32 caps( u32 *pwindow )
+
+void remotefs_caps_write_response( u8 *p, u32 caps, u32 window )
+{
+  eluarpc_gen_write( p, "rll", RFS_OP_CAPS, caps, window );
+}
+
+int remotefs_caps_read_response( const u8 *p, u32 *pcaps, u32 *pwindow )
+{
+  return eluarpc_gen_read( p, "rll", RFS_OP_CAPS, pcaps, pwindow );
+}
+
+void remotefs_caps_write_request( u8 *p )
+{
+  eluarpc_gen_write( p, "o", RFS_OP_CAPS );
+}
+
+int remotefs_caps_read_request( const u8 *p )
+{
+  return eluarpc_gen_read( p, "o", RFS_OP_CAPS );
+}
+
+// ****************************************************************************
+// Response to unknown operations
+
+void remotefs_unsupported_write_response( u8 *p, u8 op )
+{
+  eluarpc_gen_write( p, "rc", RFS_OP_UNSUPPORTED, op );
+}
+
+int remotefs_unsupported_read_response( const u8 *p, u8 *pop )
+{
+  return eluarpc_gen_read( p, "rc", RFS_OP_UNSUPPORTED, pop );
+}
@@ -0,0 +1,70 @@
+-- Bulk bitarray operations benchmark
+-- Run on the simulator or on a board:
+--   test/bench-bitarray.lua [bits]
+-- Each workload runs on 1 bit arrays twice: as a Lua loop over the elements
+-- (as code did before the bulk operations) and as a single bulk call. It
+-- reports bits per second for each.
+
+local N = tonumber( ( ... ) ) or 1024
+local MINMS = 1000  -- milliseconds spent on each measurement
+
+-- Millisecond clock; os.clock only has whole seconds in integral builds
+local function now()
+  if storm and storm.os and storm.os.now then
+    return storm.os.now() / storm.os.MILLISECOND
+  end
+  return os.clock() * 1000
+end
+
+-- Calls f() until MINMS elapsed, returns bits per second
+local function rate( f )
+  local n, t0 = 0, now()
+  repeat
+    f()
+    n = n + 1
+  until now() - t0 >= MINMS
+  return n * N / ( now() - t0 ) * 1000
+end
+
+local a, b, d = bitarray.new( N, 1 ), bitarray.new( N, 1 ), bitarray.new( N, 1 )
+for i = 1, N do
+  a[ i ] = i % 3 == 0 and 1 or 0
+  b[ i ] = i % 5 == 0 and 1 or 0
+end
+local sparse = bitarray.new( N, 1 )
+sparse[ N ] = 1
+
+local WORKLOADS = {
+  { "and",
+    function()
+      for i = 1, N do d[ i ] = ( a[ i ] == 1 and b[ i ] == 1 ) and 1 or 0 end
+    end,
+    function() bitarray.band( d, a, b ) end },
+  { "popcount",
+    function()
+      local c = 0
+      for i = 1, N do c = c + a[ i ] end
+    end,
+    function() bitarray.popcount( a ) end },
+  { "ffs (sparse)",
+    function()
+      for i = 1, N do if sparse[ i ] == 1 then break end end
+    end,
+    function() bitarray.ffs( sparse ) end },
+  { "set range",
+    function()
+      for i = 1, N do d[ i ] = 1 end
+    end,
+    function() bitarray.setrange( d, 1, N ) end },
+  { "shift by 3",
+    function()
+      for i = N, 4, -1 do d[ i ] = d[ i - 3 ] end
+      for i = 1, 3 do d[ i ] = 0 end
+    end,
+    function() bitarray.shift( d, 3 ) end },
+}
+
+print( string.format( "%-14s %12s %12s", "workload", "lua/s", "bulk/s" ) )
+for _, w in ipairs( WORKLOADS ) do
+  print( string.format( "%-14s %12d %12d", w[ 1 ], rate( w[ 2 ] ), rate( w[ 3 ] ) ) )
+end
@@ -0,0 +1,68 @@
+-- Coroutine spawn/finish benchmark
+-- Run on the simulator, or with a host luarpc binary built with the
+-- coroutine library (-DMODULE_LUA_CO_LINE):
+--   luarpc test/bench-coro.lua [tasks]
+-- A round robin scheduler keeps a fixed number of cooperative tasks alive;
+-- each task yields a few times and finishes, and is replaced by a new one.
+-- For every workload it reports the spawn/finish throughput and the peak
+-- heap seen by the collector, in whole KB.
+
+local TASKS = tonumber( ( ... ) ) or 20000
+
+-- Grows the task stack by 'depth' Lua frames before yielding
+local function nest( depth, yields )
+  if depth > 0 then
+    return nest( depth - 1, yields ) + 1
+  end
+  for i = 1, yields do
+    coroutine.yield( i )
+  end
+  return 0
+end
+
+local function failing( depth, yields )
+  nest( depth, yields )
+  error( "task failed" )
+end
+
+-- Runs 'TASKS' tasks, 'live' of them at a time
+local function bench( name, body, live, depth, yields )
+  collectgarbage( "collect" )
+  local base = gcinfo()
+  local peak, spawned, finished = base, 0, 0
+  local tasks = {}
+  local t0 = os.clock()
+  while finished < TASKS do
+    for slot = 1, live do
+      local co = tasks[ slot ]
+      if co == nil and spawned < TASKS then
+        co = coroutine.create( body )
+        spawned = spawned + 1
+        tasks[ slot ] = co
+        local mem = gcinfo()
+        if mem > peak then peak = mem end
+      end
+      if co then
+        coroutine.resume( co, depth, yields )
+        if coroutine.status( co ) == "dead" then
+          tasks[ slot ] = nil
+          finished = finished + 1
+        end
+      end
+    end
+  end
+  local t = os.clock() - t0
+  print( string.format( "%-24s %5d %5d %9.0f %8d %8d", name, live, depth,
+    TASKS / t, peak - base, peak ) )
+end
+
+print( string.format( "%-24s %5s %5s %9s %8s %8s", "workload", "live", "depth", "tasks/s", "peak KB", "heap KB" ) )
+bench( "short tasks", nest, 1, 0, 1 )
+bench( "short tasks", nest, 16, 0, 3 )
+bench( "short tasks", nest, 128, 0, 3 )
+bench( "deep tasks", nest, 16, 40, 3 )
+bench( "failing tasks", failing, 16, 0, 3 )
+bench( "mixed", function( depth, yields )
+  if math.random( 4 ) == 1 then return nest( 40, yields ) end
+  return nest( 0, yields )
+end, 64, 0, 3 )
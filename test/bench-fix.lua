@@ -0,0 +1,89 @@
+-- Fixed point benchmark for storm.fix
+-- Run on the Linux simulator or on a Storm:
+--   test/bench-fix.lua [elements]
+-- Each workload processes an INT32 array of raw readings three ways: a Lua
+-- loop doing the scaled integer math by hand (as calibration code did before
+-- storm.fix), a Lua loop calling the scalar storm.fix function, and a single
+-- call to the vector form. It reports elements per second for each.
+
+local fix, array = storm.fix, storm.array
+local N = tonumber( ( ... ) ) or 500
+local MINMS = 1000  -- milliseconds spent on each measurement
+
+-- Millisecond clock; os.clock only has whole seconds in integral builds
+local function now()
+  if storm.os and storm.os.now then
+    return storm.os.now() / storm.os.MILLISECOND
+  end
+  return os.clock() * 1000
+end
+
+-- Calls f() until MINMS elapsed, returns elements per second
+local function rate( f )
+  local n, t0 = 0, now()
+  repeat
+    f()
+    n = n + 1
+  until now() - t0 >= MINMS
+  return n * N / ( now() - t0 ) * 1000
+end
+
+local src, dst = array.create( N, array.INT32 ), array.create( N, array.INT32 )
+for i = 1, N do src:set( i, ( i * 37 ) % 4096 ) end
+
+-- Second order calibration of a 12 bit reading, Q16.16 coefficients
+local C0, C1, C2 = fix.fromstr( "-40.5" ), fix.fromstr( "0.0625" ), fix.fromstr( "0.00153" )
+local COEFFS = { C0, C1, C2 }
+
+-- Integer square root by Newton's method
+local function isqrt( v )
+  if v <= 0 then return 0 end
+  local x = v
+  local y = ( x + 1 ) / 2
+  while y < x do
+    x = y
+    y = ( x + v / x ) / 2
+  end
+  return x
+end
+
+local WORKLOADS = {
+  { "calibration poly",
+    function()
+      for i = 1, N do
+        local x = src:get( i )
+        dst:set( i, C0 + C1 * x + ( C2 * x ) * x )
+      end
+    end,
+    function()
+      for i = 1, N do dst:set( i, fix.poly( src:get( i ) * fix.ONE, COEFFS ) ) end
+    end,
+    function()
+      fix.vconv( dst, src, 0, fix.Q16 )
+      fix.vpoly( dst, dst, COEFFS )
+    end },
+  { "sqrt",
+    function()
+      for i = 1, N do dst:set( i, isqrt( src:get( i ) ) ) end
+    end,
+    function()
+      for i = 1, N do dst:set( i, fix.sqrt( src:get( i ), 0 ) ) end
+    end,
+    function() fix.vsqrt( dst, src, 0 ) end },
+  { "sin", nil,
+    function()
+      for i = 1, N do dst:set( i, fix.sin( src:get( i ), 12 ) ) end
+    end,
+    function() fix.vsin( dst, src, 12 ) end },
+  { "log2", nil,
+    function()
+      for i = 1, N do dst:set( i, fix.log2( src:get( i ), 0 ) ) end
+    end,
+    function() fix.vlog2( dst, src, 0 ) end },
+}
+
+print( string.format( "%-18s %10s %10s %10s", "workload", "lua/s", "scalar/s", "vector/s" ) )
+for _, w in ipairs( WORKLOADS ) do
+  local lua = w[ 2 ] and string.format( "%10d", rate( w[ 2 ] ) ) or string.format( "%10s", "-" )
+  print( string.format( "%-18s %s %10d %10d", w[ 1 ], lua, rate( w[ 3 ] ), rate( w[ 4 ] ) ) )
+end
@@ -0,0 +1,75 @@
+-- Checksum benchmark for storm.hash
+-- Run on the Linux simulator or on a Storm:
+--   test/bench-hash.lua [bytes]
+-- Checksums a packet sized string with a byte-at-a-time Lua implementation
+-- using the bit module, as payload code did before storm.hash, and with the
+-- native function. Reports nanoseconds per packet for each.
+
+local hash = storm.hash
+local N = tonumber( ( ... ) ) or 127
+local MINMS = 1000  -- milliseconds spent on each measurement
+
+-- Millisecond clock; os.clock only has whole seconds in integral builds
+local function now()
+  if storm.os and storm.os.now then
+    return storm.os.now() / storm.os.MILLISECOND
+  end
+  return os.clock() * 1000
+end
+
+-- Calls f() in batches until MINMS elapsed, returns nanoseconds per call
+local function cost( f, batch )
+  local n, t0 = 0, now()
+  repeat
+    for _ = 1, batch do f() end
+    n = n + batch
+  until now() - t0 >= MINMS
+  return math.floor( ( now() - t0 ) * 1000000 / n )
+end
+
+local chars = { }
+for i = 1, N do chars[ i ] = string.char( ( i * 37 ) % 256 ) end
+local PACKET = table.concat( chars )
+
+local band, bxor, lshift = bit.band, bit.bxor, bit.lshift
+
+local function lua_crc16( s )
+  local crc = 0xFFFF
+  for i = 1, #s do
+    crc = bxor( crc, lshift( s:byte( i ), 8 ) )
+    for _ = 1, 8 do
+      if band( crc, 0x8000 ) ~= 0 then
+        crc = band( bxor( lshift( crc, 1 ), 0x1021 ), 0xFFFF )
+      else
+        crc = band( lshift( crc, 1 ), 0xFFFF )
+      end
+    end
+  end
+  return crc
+end
+
+local function lua_fletcher16( s )
+  local s1, s2 = 0, 0
+  for i = 1, #s do
+    s1 = ( s1 + s:byte( i ) ) % 255
+    s2 = ( s2 + s1 ) % 255
+  end
+  return s2 * 256 + s1
+end
+
+assert( lua_crc16( PACKET ) == hash.crc16( PACKET ) )
+assert( lua_fletcher16( PACKET ) == hash.fletcher16( PACKET ) )
+
+print( string.format( "%d byte packet", N ) )
+print( string.format( "%-12s %12s %12s", "checksum", "lua ns", "native ns" ) )
+local WORKLOADS = {
+  { "crc16", lua_crc16 },
+  { "crc32" },
+  { "fletcher16", lua_fletcher16 },
+  { "fnv1a" },
+}
+for _, w in ipairs( WORKLOADS ) do
+  local native = hash[ w[ 1 ] ]
+  local lua = w[ 2 ] and string.format( "%12d", cost( function() w[ 2 ]( PACKET ) end, 1 ) ) or string.format( "%12s", "-" )
+  print( string.format( "%-12s %s %12d", w[ 1 ], lua, cost( function() native( PACKET ) end, 100 ) ) )
+end
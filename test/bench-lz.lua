@@ -0,0 +1,62 @@
+-- Compression benchmark for the RFS/luarpc wire format
+-- Run with the host luarpc binary:
+--   luarpc test/bench-lz.lua [file1.lua file2.lua ...]
+-- For every Lua source it reports the compression ratio and throughput of the
+-- source and of its bytecode, both as a single stream (luarpc strings) and
+-- split in packets (RFS, 512 byte buffers).
+
+local files = { ... }
+if #files == 0 then
+  files = { "build_elua.lua", "build_data.lua", "config/config.lua", "utils/utils.lua", "test/test-rpc.lua" }
+end
+
+local PACKET = 512 - 31  -- data in a WRITE request with a 512 byte buffer
+local MINTIME = 0.2      -- seconds spent on each measurement
+
+-- Calls f( data ) until MINTIME elapsed, returns MB/s
+local function throughput( f, data )
+  local n, t0 = 0, os.clock()
+  repeat
+    f( data )
+    n = n + 1
+  until os.clock() - t0 >= MINTIME
+  return #data * n / ( os.clock() - t0 ) / 1048576
+end
+
+-- Compressed size of 'data', sent as one string or in packets
+local function packed_size( data, packet )
+  local size = 0
+  for i = 1, #data, packet do
+    local chunk = data:sub( i, i + packet - 1 )
+    local z = rpc.lzpack( chunk )
+    size = size + ( z and #z or #chunk )
+  end
+  return size
+end
+
+local function bench( name, data )
+  local z = rpc.lzpack( data ) or data
+  assert( z == data or rpc.lzunpack( z, #data ) == data, name .. ": round trip failed" )
+  local comp = throughput( rpc.lzpack, data )
+  local decomp = throughput( function() rpc.lzunpack( z, #data ) end, data )
+  print( string.format( "%-32s %7d %6.1f%% %6.1f%% %8.1f %8.1f", name, #data,
+    100 * #z / #data, 100 * packed_size( data, PACKET ) / #data, comp, decomp ) )
+  return #data, #z
+end
+
+print( string.format( "%-32s %7s %7s %7s %8s %8s", "input", "bytes", "stream", "packet", "comp", "decomp" ) )
+print( string.format( "%-32s %7s %7s %7s %8s %8s", "", "", "", "", "MB/s", "MB/s" ) )
+local total, ztotal = 0, 0
+for _, fname in ipairs( files ) do
+  local f = assert( io.open( fname, "rb" ) )
+  local src = f:read( "*a" )
+  f:close()
+  local n, zn = bench( fname, src )
+  total, ztotal = total + n, ztotal + zn
+  local fn = loadstring( src, fname )
+  if fn then
+    n, zn = bench( fname .. " (bytecode)", string.dump( fn ) )
+    total, ztotal = total + n, ztotal + zn
+  end
+end
+print( string.format( "total: %d -> %d bytes (%.1f%%)", total, ztotal, 100 * ztotal / total ) )
@@ -0,0 +1,40 @@
+-- table.sort benchmark
+-- Run on the simulator, on a board, or with a host luarpc binary:
+--   luarpc test/bench-sort.lua [elements]
+-- Sorts the same data with a Lua comparison function, with no comparison
+-- function and with the key mode, and reports elements sorted per second.
+
+local N = tonumber( ( ... ) ) or 2000
+local MINTIME = 1  -- seconds spent on each measurement
+
+math.randomseed( 1 )
+local nums, strs, recs = {}, {}, {}
+for i = 1, N do
+  nums[ i ] = math.random( 100000 )
+  strs[ i ] = string.format( "node%05d", math.random( 100000 ) )
+  recs[ i ] = { rssi = math.random( 100 ), addr = strs[ i ] }
+end
+
+-- Sorts a fresh copy of 'data' until MINTIME elapsed, returns elements per second
+local function rate( data, ... )
+  local copy, n, t0 = {}, 0, os.clock()
+  repeat
+    for i = 1, N do copy[ i ] = data[ i ] end
+    table.sort( copy, ... )
+    n = n + 1
+  until os.clock() - t0 >= MINTIME
+  return n * N / ( os.clock() - t0 )
+end
+
+local function bench( name, ... )
+  print( string.format( "%-28s %10.0f", name, rate( ... ) ) )
+end
+
+print( string.format( "%-28s %10s", "workload", "elements/s" ) )
+bench( "numbers, comparator", nums, function( a, b ) return a < b end )
+bench( "numbers", nums )
+bench( "strings, comparator", strs, function( a, b ) return a < b end )
+bench( "strings", strs )
+bench( "records, comparator", recs, function( a, b ) return a.rssi < b.rssi end )
+bench( "records, key field", recs, "rssi" )
+bench( "records, string key", recs, "addr" )
@@ -0,0 +1,468 @@
+// Host stand-in for the Storm kernel, used to run the storm.bl and storm.os
+// tests off-target. It implements the kernel ABI that libstorm.c calls with a
+// virtual clock, one-shot and periodic timers and a local BLE stack that
+// records notifications and lets the test inject connection changes and
+// characteristic writes. Syscalls it does not model fail.
+//
+// Build it for the host together with the Lua core (integral numbers, LTR,
+// LUA_CROSS_COMPILER so that the host stdint types are used, and a
+// platform_conf.h whose LUA_PLATFORM_LIBS_ROM lists only the Lua libraries),
+// libstorm.c and libstormarray.c, with ELUA_PLATFORM_STORM and
+// STORM_HOST_STANDIN defined. The rotable range check needs stext and etext
+// to span .rodata, and libstorm.c needs _ebss; with GNU ld that is
+//   -Detext=standin_etext (for lrotable.c only)
+//   -Wl,--defsym=stext=__executable_start -Wl,--defsym=standin_etext=_end
+//   -Wl,--defsym=_ebss=_end
+// Then run a test with it:
+//   ./standin test/test-bl.lua
+//
+// The script gets the storm.os, storm.bl and storm.array modules and a
+// 'standin' module that drives the stand-in:
+//   standin.connect(status)          queue a BLE connection change
+//   standin.write(handle, string)    queue a write to a characteristic
+//   standin.busy(n)                  refuse the next n notifications
+//   standin.packets()                notifications sent so far, as a table
+//                                    of {handle, payload}; clears the record
+//   standin.advance(ticks)           move the virtual clock forward
+
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+#include "lrotable.h"
+#include <interface.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STANDIN_MAX_TIMERS 16
+#define STANDIN_MAX_EVENTS 32
+#define STANDIN_MAX_CHARS 16
+#define STANDIN_MAX_PACKETS 256
+#define STANDIN_MTU 20
+
+typedef void (*standin_write_cb_t) (void *r, uint32_t len, uint8_t *buf);
+
+typedef struct
+{
+    uint32_t deadline;
+    uint32_t interval;
+    cb_t cb;
+    void *r;
+    uint8_t active;
+} standin_timer_t;
+
+enum
+{
+    STANDIN_EV_READY,
+    STANDIN_EV_CHANGED,
+    STANDIN_EV_WRITE
+};
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t len;
+    uint16_t handle;
+    uint32_t status;
+    uint8_t buf [STANDIN_MTU];
+} standin_event_t;
+
+typedef struct
+{
+    standin_write_cb_t cb;
+    void *r;
+} standin_char_t;
+
+typedef struct
+{
+    uint16_t handle;
+    uint8_t len;
+    char buf [STANDIN_MTU];
+} standin_packet_t;
+
+static uint32_t standin_now;
+static standin_timer_t standin_timers [STANDIN_MAX_TIMERS];
+static standin_event_t standin_events [STANDIN_MAX_EVENTS];
+static uint32_t standin_nevents;
+static standin_char_t standin_chars [STANDIN_MAX_CHARS];
+static uint32_t standin_nchars;
+static uint32_t standin_nservices;
+static standin_packet_t standin_packets [STANDIN_MAX_PACKETS];
+static uint32_t standin_npackets;
+static uint32_t standin_busy;
+static cb_t standin_onready;
+static void *standin_onready_r;
+static cb_u32_t standin_onchanged;
+static void *standin_onchanged_r;
+
+//------------------------------
+// Callback queue
+//------------------------------
+
+static int standin_push_event(standin_event_t *ev)
+{
+    if (standin_nevents == STANDIN_MAX_EVENTS)
+        return -1;
+    standin_events[standin_nevents++] = *ev;
+    return 0;
+}
+
+// Runs the oldest queued event, else the earliest expired timer.
+// Returns 1 if a callback ran.
+static int standin_run_one(void)
+{
+    standin_event_t ev;
+    standin_timer_t *t, *best = NULL;
+    int i;
+    if (standin_nevents)
+    {
+        ev = standin_events[0];
+        memmove(&standin_events[0], &standin_events[1], (--standin_nevents) * sizeof(standin_event_t));
+        switch (ev.type)
+        {
+            case STANDIN_EV_READY:
+                standin_onready(standin_onready_r);
+                break;
+            case STANDIN_EV_CHANGED:
+                standin_onchanged(standin_onchanged_r, ev.status);
+                break;
+            case STANDIN_EV_WRITE:
+                standin_chars[ev.handle].cb(standin_chars[ev.handle].r, ev.len, ev.buf);
+                break;
+        }
+        return 1;
+    }
+    for (i = 0; i < STANDIN_MAX_TIMERS; i++)
+    {
+        t = &standin_timers[i];
+        if (t->active && (int32_t)(t->deadline - standin_now) <= 0 &&
+            (!best || (int32_t)(t->deadline - best->deadline) < 0))
+            best = t;
+    }
+    if (!best)
+        return 0;
+    if (best->interval)
+        best->deadline += best->interval;
+    else
+        best->active = 0;
+    best->cb(best->r);
+    return 1;
+}
+
+uint8_t k_run_callback()
+{
+    return standin_run_one();
+}
+
+// Runs everything that is due. If nothing is, the virtual clock jumps to the
+// earliest timer, like the kernel sleeping until its next event.
+void k_wait_callback()
+{
+    standin_timer_t *t, *best = NULL;
+    int i;
+    if (standin_run_one())
+    {
+        while (standin_run_one())
+            ;
+        return;
+    }
+    for (i = 0; i < STANDIN_MAX_TIMERS; i++)
+    {
+        t = &standin_timers[i];
+        if (t->active && (!best || (int32_t)(t->deadline - best->deadline) < 0))
+            best = t;
+    }
+    if (!best)
+        return;
+    standin_now = best->deadline;
+    while (standin_run_one())
+        ;
+}
+
+void k_yield()
+{
+}
+
+int32_t k_write(uint32_t fd, uint8_t const *src, uint32_t size)
+{
+    return fwrite(src, 1, size, fd == 2 ? stderr : stdout);
+}
+
+int32_t k_read(uint32_t fd, uint8_t *dst, uint32_t size)
+{
+    return -1;
+}
+
+int32_t k_read_async(uint32_t fd, uint8_t *dst, uint32_t size, cb_i32_t cb, void* r)
+{
+    return -1;
+}
+
+//------------------------------
+// Extended syscalls
+//------------------------------
+
+int32_t k_syscall_ex_ri32_u32_u32_cb_vptr(uint32_t id, uint32_t arg0, uint32_t arg1, void* cb, void *r)
+{
+    int i;
+    switch (id)
+    {
+        case 0x201: // timer_set(ticks, periodic, cb, r)
+            for (i = 0; i < STANDIN_MAX_TIMERS; i++)
+            {
+                if (!standin_timers[i].active)
+                {
+                    standin_timers[i].deadline = standin_now + arg0;
+                    standin_timers[i].interval = arg1 ? arg0 : 0;
+                    standin_timers[i].cb = (cb_t)cb;
+                    standin_timers[i].r = r;
+                    standin_timers[i].active = 1;
+                    return i;
+                }
+            }
+            return -1;
+        case 0x603: // bl_addcharacteristic(svc_handle, uuid, on_write, r)
+            if (standin_nchars == STANDIN_MAX_CHARS)
+                return -1;
+            standin_chars[standin_nchars].cb = (standin_write_cb_t)cb;
+            standin_chars[standin_nchars].r = r;
+            return standin_nchars++;
+    }
+    return -1;
+}
+
+int32_t k_syscall_ex_ri32_u32(uint32_t id, uint32_t arg0)
+{
+    switch (id)
+    {
+        case 0x205: // timer_cancel(id)
+            if (arg0 >= STANDIN_MAX_TIMERS)
+                return -1;
+            standin_timers[arg0].active = 0;
+            return 0;
+        case 0x602: // bl_addservice(uuid)
+            return standin_nservices++;
+    }
+    return -1;
+}
+
+uint32_t k_syscall_ex_ru32(uint32_t id)
+{
+    switch (id)
+    {
+        case 0x202: // timer_getnow()
+            return standin_now;
+        case 0x203: // timer_getnow_s16()
+            return standin_now >> 16;
+    }
+    return 0;
+}
+
+int32_t k_syscall_ex_ri32_cb_vptr_cb_vptr_cptr_u32(uint32_t id, void* arg0, void* arg1, void* arg2, void* arg3, const char* arg4, uint32_t arg5)
+{
+    standin_event_t ev;
+    if (id != 0x601) // bl_enable(on_ready, r, on_changed, r, adv, advlen)
+        return -1;
+    standin_onready = (cb_t)arg0;
+    standin_onready_r = arg1;
+    standin_onchanged = (cb_u32_t)arg2;
+    standin_onchanged_r = arg3;
+    ev.type = STANDIN_EV_READY;
+    return standin_push_event(&ev);
+}
+
+int32_t k_syscall_ex_ri32_u32_u32_cptr(uint32_t id, uint32_t char_handle, uint32_t len, const char* buffer)
+{
+    standin_packet_t *p;
+    if (id != 0x604 || len > STANDIN_MTU) // bl_notify(handle, len, buf)
+        return -1;
+    if (standin_busy)
+    {
+        standin_busy--;
+        return -1;
+    }
+    if (standin_npackets == STANDIN_MAX_PACKETS)
+        return -1;
+    p = &standin_packets[standin_npackets++];
+    p->handle = char_handle;
+    p->len = len;
+    memcpy(p->buf, buffer, len);
+    return 0;
+}
+
+int32_t k_syscall_ex_ri32_u32_u32(uint32_t id, uint32_t arg0, uint32_t arg1)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ru32_u32(uint32_t id, uint32_t arg0)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ri32(uint32_t id)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ri32_u32_vptr_u32_cptr_cb_vptr(uint32_t id, uint32_t arg0, void *arg1, uint32_t arg2, char* arg3, cb_t cb, void *r)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ri32_u32_cb_vptr(uint32_t id, uint32_t arg0, void *cb, void *r)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ri32_cptr_u32_cptr_u32(uint32_t id, uint32_t arg0, const char* arg1, uint32_t arg2, const char* arg3, uint32_t arg4)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ri32_u32_u32_u32_buf_u32_vptr_vptr(uint32_t id, uint32_t arg0, uint32_t arg1, uint8_t* arg2, uint32_t arg3, void* cb, void* r)
+{
+    return -1;
+}
+void* k_syscall_ex_rvoid(uint32_t id)
+{
+    return NULL;
+}
+int32_t k_syscall_ex_rcptr_u32_cptr_u32(uint32_t id, const char* arg0, uint32_t arg1, const char* arg2, uint32_t arg3)
+{
+    return 0;
+}
+int32_t k_syscall_ex_rcptr_u32_u32(uint32_t id, const char* arg0, uint32_t arg1, uint32_t buffer)
+{
+    return 0;
+}
+int32_t k_syscall_ex_ri32_cptr_u32_cptr_cptr(uint32_t id, const char* d, uint32_t a, const char *b, char* c)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ri32_cptr(uint32_t id, char *b)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ri32_vptr_vptr_uint32_vptr_vptr(uint32_t id, void* a, void* b, uint32_t c, void *d, void *e)
+{
+    return -1;
+}
+int32_t k_syscall_ex_ri32_uint32_vptr_uint32_vptr_vptr(uint32_t id, uint32_t a, void* b, uint32_t c, void *d, void *e)
+{
+    return -1;
+}
+
+//------------------------------
+// Lua control module
+//------------------------------
+
+// Lua: standin.connect(status)
+static int standin_connect(lua_State *L)
+{
+    standin_event_t ev;
+    ev.type = STANDIN_EV_CHANGED;
+    ev.status = luaL_checkinteger(L, 1);
+    if (!standin_onchanged || standin_push_event(&ev) < 0)
+        return luaL_error(L, "cannot queue connection change");
+    return 0;
+}
+
+// Lua: standin.write(handle, string)
+static int standin_write(lua_State *L)
+{
+    standin_event_t ev;
+    size_t len;
+    const char *s;
+    ev.type = STANDIN_EV_WRITE;
+    ev.handle = luaL_checkinteger(L, 1);
+    s = luaL_checklstring(L, 2, &len);
+    if (ev.handle >= standin_nchars || len > STANDIN_MTU)
+        return luaL_error(L, "invalid write");
+    ev.len = len;
+    memcpy(ev.buf, s, len);
+    if (standin_push_event(&ev) < 0)
+        return luaL_error(L, "cannot queue write");
+    return 0;
+}
+
+// Lua: standin.busy(n)
+static int standin_setbusy(lua_State *L)
+{
+    standin_busy = luaL_checkinteger(L, 1);
+    return 0;
+}
+
+// Lua: standin.packets() -> { {handle, payload}, ... }
+static int standin_getpackets(lua_State *L)
+{
+    uint32_t i;
+    lua_createtable(L, standin_npackets, 0);
+    for (i = 0; i < standin_npackets; i++)
+    {
+        lua_createtable(L, 2, 0);
+        lua_pushinteger(L, standin_packets[i].handle);
+        lua_rawseti(L, -2, 1);
+        lua_pushlstring(L, standin_packets[i].buf, standin_packets[i].len);
+        lua_rawseti(L, -2, 2);
+        lua_rawseti(L, -2, i + 1);
+    }
+    standin_npackets = 0;
+    return 1;
+}
+
+// Lua: standin.advance(ticks)
+static int standin_advance(lua_State *L)
+{
+    standin_now += luaL_checkinteger(L, 1);
+    return 0;
+}
+
+#define MIN_OPT_LEVEL 2
+#include "lrodefs.h"
+static const LUA_REG_TYPE standin_map[] =
+{
+    { LSTRKEY( "connect" ), LFUNCVAL ( standin_connect ) },
+    { LSTRKEY( "write" ), LFUNCVAL ( standin_write ) },
+    { LSTRKEY( "busy" ), LFUNCVAL ( standin_setbusy ) },
+    { LSTRKEY( "packets" ), LFUNCVAL ( standin_getpackets ) },
+    { LSTRKEY( "advance" ), LFUNCVAL ( standin_advance ) },
+    { LNILKEY, LNILVAL }
+};
+
+extern const luaR_entry libstorm_os_map[];
+extern const luaR_entry libstorm_bl_map[];
+extern const luaR_entry libstorm_array_map[];
+
+int main(int argc, char **argv)
+{
+    lua_State *L;
+    int i;
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s script.lua [args]\n", argv[0]);
+        return 1;
+    }
+    L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_newtable(L);
+    lua_pushrotable(L, (void*)libstorm_os_map);
+    lua_setfield(L, -2, "os");
+    lua_pushrotable(L, (void*)libstorm_bl_map);
+    lua_setfield(L, -2, "bl");
+    lua_pushrotable(L, (void*)libstorm_array_map);
+    lua_setfield(L, -2, "array");
+    lua_setglobal(L, "storm");
+    lua_pushrotable(L, (void*)standin_map);
+    lua_setglobal(L, "standin");
+    if (luaL_loadfile(L, argv[1]))
+    {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        return 1;
+    }
+    for (i = 2; i < argc; i++)
+    {
+        lua_pushstring(L, argv[i]);
+    }
+    if (lua_pcall(L, argc - 2, 0, 0))
+    {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        return 1;
+    }
+    lua_close(L);
+    return 0;
+}
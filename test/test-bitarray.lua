@@ -0,0 +1,139 @@
+-- Tests for the bulk operations of the bitarray module
+-- Run on the simulator or on a board:
+--   test/test-bitarray.lua
+-- Every operation is checked against a plain Lua model of the bits, on 1 bit
+-- arrays of all sizes that cross the byte and word boundaries.
+
+local failed, checked = 0, 0
+
+local function check( ok, msg )
+  checked = checked + 1
+  if not ok then
+    failed = failed + 1
+    print( "FAIL: " .. msg )
+  end
+end
+
+local function random_bits( n, density )
+  local a, m = bitarray.new( n, 1 ), { }
+  for i = 1, n do
+    m[ i ] = math.random( 100 ) <= density and 1 or 0
+    a[ i ] = m[ i ]
+  end
+  return a, m
+end
+
+local function same( a, m, n )
+  for i = 1, n do
+    if a[ i ] ~= m[ i ] then return false end
+  end
+  return true
+end
+
+local function model_find( m, n, start, v )
+  for i = start, n do
+    if m[ i ] == v then return i end
+  end
+end
+
+local function model_count( m, i, j )
+  local c = 0
+  for k = i, j do c = c + m[ k ] end
+  return c
+end
+
+math.randomseed( 5 )
+for n = 1, 80 do
+  for _, density in ipairs{ 0, 3, 50, 97, 100 } do
+    local tag = " n=" .. n .. " d=" .. density
+    local a, ma = random_bits( n, density )
+    local b, mb = random_bits( n, 50 )
+    local d = bitarray.new( n, 1 )
+    local m = { }
+
+    check( bitarray.band( d, a, b ) == d, "band: returns the destination" .. tag )
+    for i = 1, n do m[ i ] = ( ma[ i ] == 1 and mb[ i ] == 1 ) and 1 or 0 end
+    check( same( d, m, n ), "band" .. tag )
+    bitarray.bor( d, a, b )
+    for i = 1, n do m[ i ] = ( ma[ i ] == 1 or mb[ i ] == 1 ) and 1 or 0 end
+    check( same( d, m, n ), "bor" .. tag )
+    bitarray.bxor( d, a, b )
+    for i = 1, n do m[ i ] = ma[ i ] ~= mb[ i ] and 1 or 0 end
+    check( same( d, m, n ), "bxor" .. tag )
+    bitarray.bnot( d, a )
+    for i = 1, n do m[ i ] = 1 - ma[ i ] end
+    check( same( d, m, n ), "bnot" .. tag )
+    check( bitarray.popcount( d ) == n - model_count( ma, 1, n ), "bnot: padding stays clear" .. tag )
+
+    check( bitarray.popcount( a ) == model_count( ma, 1, n ), "popcount" .. tag )
+    local i = math.random( n )
+    local j = math.random( i, n )
+    check( bitarray.popcount( a, i, j ) == model_count( ma, i, j ), "popcount range" .. tag )
+    check( bitarray.popcount( a, j + 1, j ) == 0, "popcount: empty range" .. tag )
+
+    for start = 1, n, 7 do
+      check( bitarray.ffs( a, start ) == model_find( ma, n, start, 1 ), "ffs " .. start .. tag )
+      check( bitarray.ffc( a, start ) == model_find( ma, n, start, 0 ), "ffc " .. start .. tag )
+    end
+    check( bitarray.ffs( a, n + 1 ) == nil, "ffs: past the end" .. tag )
+
+    local c, mc = random_bits( n, density )
+    bitarray.setrange( c, i, j )
+    for k = i, j do mc[ k ] = 1 end
+    check( same( c, mc, n ), "setrange" .. tag )
+    i = math.random( n )
+    j = math.random( i, n )
+    bitarray.clearrange( c, i, j )
+    for k = i, j do mc[ k ] = 0 end
+    check( same( c, mc, n ), "clearrange" .. tag )
+
+    for _, s in ipairs{ 1, 3, 8, 13, 32, n - 1, n, -1, -5, -8, -17, -n, 0 } do
+      local e, me = random_bits( n, density )
+      bitarray.shift( e, s )
+      for k = 1, n do m[ k ] = me[ k - s ] or 0 end
+      check( same( e, m, n ) and bitarray.popcount( e ) == model_count( m, 1, n ), "shift " .. s .. tag )
+    end
+  end
+end
+
+-- Elements wider than one bit are handled as their raw bits
+local a = bitarray.new( 4, 8, 0xFF )
+check( bitarray.popcount( a ) == 32, "popcount: bytes" )
+bitarray.shift( a, 4 )
+check( a[ 1 ] == 0x0F and a[ 4 ] == 0xFF, "shift: bytes" )
+a = bitarray.new( 10, 1, 0xFF )
+check( bitarray.popcount( a ) == 10 and bitarray.ffc( a ) == nil, "fill: padding is not counted" )
+bitarray.shift( a, -3 )
+check( bitarray.popcount( a ) == 7 and bitarray.ffc( a ) == 8, "shift: padding is not shifted in" )
+a = bitarray.new( 16, 4 )
+a[ 2 ] = 9
+check( bitarray.ffs( a ) == 5 and bitarray.popcount( a ) == 2, "ffs: nibbles" )
+
+-- Errors
+check( not pcall( bitarray.band, bitarray.new( 8, 1 ), bitarray.new( 8, 1 ), bitarray.new( 9, 1 ) ), "band: size mismatch" )
+check( not pcall( bitarray.popcount, bitarray.new( 8, 1 ), 0 ), "popcount: index 0" )
+check( not pcall( bitarray.popcount, bitarray.new( 8, 1 ), 1, 9 ), "popcount: index past the end" )
+check( not pcall( bitarray.setrange, { } ), "setrange: not an array" )
+
+-- storm.array interoperability: the bytes are used in place
+if storm and storm.array then
+  local arr = storm.array.create( 8, storm.array.UINT8 )
+  arr:set( 1, 0x80 )
+  arr:set( 8, 0x01 )
+  check( bitarray.popcount( arr ) == 2, "storm: popcount" )
+  check( bitarray.ffs( arr ) == 1 and bitarray.ffs( arr, 2 ) == 64, "storm: ffs" )
+  local mask = bitarray.new( 64, 1 )
+  bitarray.setrange( mask, 1, 60 )
+  check( bitarray.band( arr, arr, mask ) == arr and arr:get( 1 ) == 0x80 and arr:get( 8 ) == 0, "storm: band in place" )
+  bitarray.shift( arr, 9 )
+  check( arr:get( 1 ) == 0 and arr:get( 2 ) == 0x40, "storm: shift" )
+  bitarray.bor( mask, mask, arr )
+  check( bitarray.popcount( mask ) == 60, "storm: mixed operands" )
+  local words = storm.array.create( 2, storm.array.INT32 )
+  check( not pcall( bitarray.band, storm.array.create( 3, storm.array.INT32 ), words, arr ), "storm: size mismatch" )
+  bitarray.setrange( words, 1, 64 )
+  check( words:get( 1 ) == -1 and bitarray.ffc( words ) == nil, "storm: setrange" )
+end
+
+print( string.format( "bitarray: %d checks, %d failed", checked, failed ) )
+assert( failed == 0, "bitarray tests failed" )
@@ -0,0 +1,167 @@
+-- Tests for the storm.bl notify queues and write buffers, and for deferred
+-- and coalesced callbacks in storm.os.wait_callback
+-- Run off-target with the kernel stand-in (see test/storm-standin.c):
+--   standin test/test-bl.lua
+
+local failed, checked = 0, 0
+
+local function check( ok, msg )
+  checked = checked + 1
+  if not ok then
+    failed = failed + 1
+    print( "FAIL: " .. msg )
+  end
+end
+
+local array, bl, os = storm.array, storm.bl, storm.os
+
+local function bytes( first, n )
+  local a = array.create( n, array.UINT8 )
+  for i = 1, n do a:set( i, ( first + i - 1 ) % 256 ) end
+  return a
+end
+
+local function expect( from, n )
+  local t = { }
+  for i = 0, n - 1 do t[ #t + 1 ] = string.char( ( from + i ) % 256 ) end
+  return table.concat( t )
+end
+
+local function payloads( packets )
+  local t = { }
+  for i, p in ipairs( packets ) do t[ i ] = p[ 2 ] end
+  return t
+end
+
+-- Bring the stack up
+local ready, link = false, nil
+bl.enable( "adv", function( status ) link = status end, function() ready = true end )
+os.run_callback()
+check( ready, "enable: on_ready runs" )
+
+local svc = bl.addservice( 0x1234 )
+local writes = { }
+local ch = bl.addcharacteristic( svc, 0x5678, function( s ) writes[ #writes + 1 ] = s end )
+
+-- Nothing is sent while the link is down
+check( bl.notify_array( ch, bytes( 0, 45 ) ) == 45, "notify_array: accepts the bytes" )
+check( #standin.packets() == 0, "notify_array: nothing sent while disconnected" )
+standin.connect( 1 )
+os.run_callback()
+check( link == 1, "connect: callback runs" )
+local p = payloads( standin.packets() )
+check( #p == 2 and p[ 1 ] == expect( 0, 20 ) and p[ 2 ] == expect( 20, 20 ), "connect: full packets go out" )
+local pending, sent, dropped = bl.notify_stats( ch )
+check( pending == 5 and sent == 40 and dropped == 0, "notify_stats after connect" )
+check( bl.notify_flush( ch ) == 0, "notify_flush: empties the queue" )
+p = payloads( standin.packets() )
+check( #p == 1 and p[ 1 ] == expect( 40, 5 ), "notify_flush: partial packet" )
+
+-- Offsets and lengths select a part of the array
+local a = bytes( 100, 50 )
+bl.notify_array( ch, a, 10, 20 )
+p = payloads( standin.packets() )
+check( #p == 1 and p[ 1 ] == expect( 110, 20 ), "notify_array: offset and length" )
+
+-- A busy kernel keeps the bytes queued until the next pump
+standin.busy( 1 )
+bl.notify_array( ch, a, 0, 20 )
+check( #standin.packets() == 0 and bl.notify_stats( ch ) == 20, "busy: bytes stay queued" )
+os.run_callback()
+p = payloads( standin.packets() )
+check( #p == 1 and p[ 1 ] == expect( 100, 20 ), "busy: sent on the next pump" )
+
+-- The queue is bounded; what does not fit is counted as dropped
+standin.connect( 0 )
+os.run_callback()
+local big = bytes( 0, 200 )
+local accepted = bl.notify_array( ch, big )
+pending, sent, dropped = bl.notify_stats( ch )
+check( accepted < 200 and pending == accepted and dropped == 200 - accepted, "overflow: dropped bytes are counted" )
+standin.connect( 1 )
+os.run_callback()
+bl.notify_flush( ch )
+p = table.concat( payloads( standin.packets() ) )
+check( p == expect( 0, accepted ), "overflow: queued bytes are sent in order" )
+
+-- Ranges outside the array are rejected
+check( not pcall( bl.notify_array, ch, a, 1, -1 ), "bounds: negative length" )
+check( not pcall( bl.notify_array, ch, a, -1 ), "bounds: negative offset" )
+check( not pcall( bl.notify_array, ch, a, 51 ), "bounds: offset past the end" )
+check( not pcall( bl.notify_array, ch, a, 10, 41 ), "bounds: length past the end" )
+check( not pcall( bl.notify_array, ch, a, 1, 0x7FFFFFFF ), "bounds: huge length" )
+check( bl.notify_array( ch, a, 50 ) == 0, "bounds: empty range at the end" )
+
+-- Writes land in the characteristic's buffer, or arrive as strings
+standin.write( ch, "plain" )
+os.run_callback()
+check( writes[ 1 ] == "plain", "write: string callback" )
+local buf = array.create( 8, array.UINT8 )
+local got = { }
+local function contents( arr, len )
+  local t = { }
+  for i = 1, len do t[ i ] = string.char( arr:get( i ) ) end
+  return table.concat( t )
+end
+local wch = bl.addcharacteristic( svc, 0x9abc, function( arr, len, size )
+  got[ #got + 1 ] = { arr, len, size, contents( arr, len ) }
+end, buf )
+standin.write( wch, "abc" )
+os.run_callback()
+check( #got == 1 and got[ 1 ][ 1 ] == buf and got[ 1 ][ 2 ] == 3 and got[ 1 ][ 3 ] == 3 and got[ 1 ][ 4 ] == "abc", "write: buffer" )
+standin.write( wch, "0123456789" )
+os.run_callback()
+check( got[ 2 ][ 1 ] == buf and got[ 2 ][ 2 ] == 8 and got[ 2 ][ 4 ] == "01234567", "write: truncated to the buffer" )
+check( got[ 2 ][ 3 ] == 10, "write: the callback gets the full size" )
+
+-- Buffered writes are never deferred: each callback sees its own bytes
+os.cbpolicy( "bl", os.CB_QUEUE, 1, 100 * os.MILLISECOND )
+got = { }
+standin.write( wch, "zero" )  -- uses up the budget
+standin.write( wch, "first" )
+standin.write( wch, "second" )
+for i = 1, 3 do os.wait_callback() end
+check( #got == 3 and got[ 2 ][ 4 ] == "first" and got[ 3 ][ 4 ] == "second", "write: buffered writes see their own bytes" )
+check( os.cbstats( "bl" ).queued == 0, "write: buffered writes are not queued" )
+os.cbpolicy( "bl", os.CB_RUN )
+
+-- Deferred callbacks: wait_callback sleeps until the budget refills instead
+-- of returning at once, so the virtual clock moves a window per invocation
+local window = 100 * os.MILLISECOND
+local n = 0
+local wq = bl.addcharacteristic( svc, 0xdef0, function() n = n + 1 end )
+os.cbpolicy( "bl", os.CB_QUEUE, 1, window )
+for i = 1, 3 do standin.write( wq, "x" ) end
+local t0, calls = os.now( os.SHIFT_0 ), 0
+while n < 3 and calls < 20 do
+  os.wait_callback()
+  calls = calls + 1
+end
+local elapsed = os.now( os.SHIFT_0 ) - t0
+check( n == 3, "defer: all callbacks ran" )
+check( calls <= 6, "defer: wait_callback blocks until the refill (" .. calls .. " calls)" )
+check( elapsed >= 2 * window, "defer: one invocation per window" )
+os.cbpolicy( "bl", os.CB_RUN )
+
+-- COALESCE keeps one pending invocation per timer: a timer firing while
+-- another one is deferred must not replace it
+local na, nb = 0, 0
+os.clearcbstats()
+os.cbpolicy( "timer", os.CB_COALESCE, 1, 10 * window )
+local ta = os.invokePeriodically( 10 * os.MILLISECOND, function() na = na + 1 end )
+local tb = os.invokePeriodically( 15 * os.MILLISECOND, function() nb = nb + 1 end )
+for i = 1, 3 do os.wait_callback() end  -- a runs, b is deferred, a is deferred
+check( na == 1 and nb == 0, "coalesce: over the limit the timers are deferred" )
+os.cancel( ta )
+os.cancel( tb )
+calls = 0
+while ( na < 2 or nb < 1 ) and calls < 10 do
+  os.wait_callback()
+  calls = calls + 1
+end
+check( na == 2 and nb == 1, "coalesce: each timer keeps its own invocation" )
+check( os.cbstats( "timer" ).coalesced == 0, "coalesce: nothing was replaced" )
+os.cbpolicy( "timer", os.CB_RUN )
+
+print( string.format( "bl: %d checks, %d failed", checked, failed ) )
+assert( failed == 0, "bl tests failed" )
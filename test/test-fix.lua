@@ -0,0 +1,170 @@
+-- Conformance tests for storm.fix
+-- Run on the Linux simulator or on a Storm:
+--   test/test-fix.lua
+-- Checks the results against correctly rounded references, checks that the
+-- scalar and vector forms agree, and hashes the results over a fixed sweep
+-- of inputs. The hash must be the same on every platform: it is what makes
+-- the results bit-exact between the simulator and the Cortex-M4.
+
+local fix, array = storm.fix, storm.array
+
+-- Reference results, correctly rounded; 'tol' is the accepted error in LSBs
+-- { function, q, tol, arguments..., expected }
+local CASES = {
+  { "mul", 16, 0, 205887, 131072, 411774 }, -- 3.14159265 * 2
+  { "mul", 16, 0, -98304, 147456, -221184 }, -- -1.5 * 2.25
+  { "mul", 16, 0, 1, 32768, 1 }, -- 0.0000152587890625 * 0.5
+  { "mul", 16, 0, -1, 32768, -1 }, -- -0.0000152587890625 * 0.5
+  { "mul", 16, 0, 1966080000, 1966080000, 2147483647 }, -- 30000 * 30000
+  { "div", 16, 0, 65536, 196608, 21845 }, -- 1 / 3
+  { "div", 16, 0, -65536, 196608, -21845 }, -- -1 / 3
+  { "div", 16, 0, 327680, 0, 2147483647 }, -- 5 / 0
+  { "div", 16, 0, -327680, 0, -2147483648 }, -- -5 / 0
+  { "div", 16, 0, 2147418112, 32768, 2147483647 }, -- 32767 / 0.5
+  { "sqrt", 16, 0, 131072, 92682 }, -- sqrt(2)
+  { "sqrt", 16, 0, 16384, 32768 }, -- sqrt(0.25)
+  { "sqrt", 16, 0, 655360000, 6553600 }, -- sqrt(10000)
+  { "sqrt", 16, 0, -65536, 0 }, -- sqrt(-1)
+  { "log2", 16, 1, 655360, 217706 }, -- log2(10)
+  { "log2", 16, 1, 32768, -65536 }, -- log2(0.5)
+  { "log2", 16, 1, 65536, 0 }, -- log2(1)
+  { "log2", 16, 1, 196608, 103872 }, -- log2(3)
+  { "log2", 16, 1, 66, -652451 }, -- log2(0.001)
+  { "exp2", 16, 1, 32768, 92682 }, -- exp2(0.5)
+  { "exp2", 16, 1, -65536, 32768 }, -- exp2(-1)
+  { "exp2", 16, 1, 671744, 79806339 }, -- exp2(10.25)
+  { "exp2", 16, 1, 1015808, 2147483647 }, -- exp2(15.5)
+  { "exp2", 16, 1, -1310720, 0 }, -- exp2(-20)
+  { "sin", 16, 1, 65536, 55147 }, -- sin(1)
+  { "sin", 16, 1, -131072, -59592 }, -- sin(-2)
+  { "sin", 16, 1, 205887, 0 }, -- sin(3.14159265)
+  { "sin", 16, 1, 6553600, -33185 }, -- sin(100)
+  { "sin", 16, 1, -65536000, -54190 }, -- sin(-1000)
+  { "cos", 16, 1, 65536, 35409 }, -- cos(1)
+  { "cos", 16, 1, -131072, -27273 }, -- cos(-2)
+  { "cos", 16, 1, 205887, -65536 }, -- cos(3.14159265)
+  { "cos", 16, 1, 6553600, 56513 }, -- cos(100)
+  { "cos", 16, 1, -65536000, 36856 }, -- cos(-1000)
+  { "atan2", 16, 1, 65536, 65536, 51472 }, -- atan2(1, 1)
+  { "atan2", 16, 1, 65536, -65536, 154416 }, -- atan2(1, -1)
+  { "atan2", 16, 1, -65536, -65536, -154416 }, -- atan2(-1, -1)
+  { "atan2", 16, 1, 0, -65536, 205887 }, -- atan2(0, -1)
+  { "atan2", 16, 1, 196608, 262144, 42172 }, -- atan2(3, 4)
+  { "mul", 31, 0, 1073741824, -1073741824, -536870912 }, -- 0.5 * -0.5
+  { "mul", 31, 0, -2147483648, -2147483648, 2147483647 }, -- -1 * -1
+  { "mul", 31, 0, 1518500250, 1518500250, 1073741824 }, -- 0.7071067811865476 * 0.7071067811865476
+  { "div", 31, 0, 536870912, 1073741824, 1073741824 }, -- 0.25 / 0.5
+  { "div", 31, 0, -214748365, 644245094, -715827884 }, -- -0.1 / 0.3
+  { "sqrt", 31, 0, 536870912, 1073741824 }, -- sqrt(0.25)
+  { "log2", 31, 2, 1610612736, -891286243 }, -- log2(0.75)
+  { "exp2", 31, 2, -1073741824, 1518500250 }, -- exp2(-0.5)
+  { "sin", 31, 1, 1073741824, 1029558505 }, -- sin(0.5)
+  { "cos", 31, 1, 1073741824, 1884594201 }, -- cos(0.5)
+  { "atan2", 31, 1, 536870912, 1073741824, 995675659 }, -- atan2(0.25, 0.5)
+}
+
+-- Hash of the sweep below; update only when results change on purpose
+local DIGEST = "e4667df3"
+
+local failed, checked = 0, 0
+
+local function check( ok, msg )
+  checked = checked + 1
+  if not ok then
+    failed = failed + 1
+    print( "FAIL: " .. msg )
+  end
+end
+
+for _, c in ipairs( CASES ) do
+  local name, q, tol = c[ 1 ], c[ 2 ], c[ 3 ]
+  local args = { unpack( c, 4, #c - 1 ) }
+  args[ #args + 1 ] = q
+  local got, exp = fix[ name ]( unpack( args ) ), c[ #c ]
+  check( math.abs( got - exp ) <= tol, string.format( "%s(%s) = %d, expected %d", name, table.concat( args, ", " ), got, exp ) )
+end
+
+-- Saturation and domain rules
+check( fix.exp2( 40 * fix.ONE ) == 2147483647, "exp2 overflow saturates" )
+check( fix.log2( 0 ) == -2147483648, "log2(0) saturates" )
+check( fix.conv( fix.PI, 16, 31 ) == 2147483647, "conv saturates" )
+check( fix.conv( 1073741824, 31, 16 ) == 32768, "conv Q31 to Q16" )
+
+-- Decimal conversions
+check( fix.fromstr( "-12.375" ) == -811008, "fromstr" )
+check( fix.fromstr( "0.5", fix.Q31 ) == 1073741824, "fromstr Q31" )
+check( fix.fromstr( "1.2.3" ) == nil and fix.fromstr( "" ) == nil, "fromstr rejects bad input" )
+check( fix.tostr( -811008 ) == "-12.37500", "tostr" )
+check( fix.tostr( fix.PI, 16, 2 ) == "3.14", "tostr digits" )
+check( fix.tostr( -1, 16, 2 ) == "0.00", "tostr rounds to an unsigned zero" )
+for i = -50, 50 do
+  local v = i * 42949667
+  check( fix.fromstr( fix.tostr( v, 16, 9 ) ) == v, "tostr/fromstr round trip " .. v )
+end
+
+-- Polynomials: 1 - 2x + 3x^2, table and array coefficients
+local coeffs = { fix.ONE, -2 * fix.ONE, 3 * fix.ONE }
+local carr = array.create( 3, array.INT32 )
+for i = 1, 3 do carr:set( i, coeffs[ i ] ) end
+check( fix.poly( fix.ONE / 2, coeffs ) == 49152, "poly" )
+check( fix.poly( fix.ONE / 2, carr ) == 49152, "poly with an array" )
+
+-- Inputs spread over the whole int32 range and around zero
+local sweep = {}
+for i = -1000, 1000 do
+  sweep[ #sweep + 1 ] = i * 2147483
+  sweep[ #sweep + 1 ] = i * 61
+end
+
+-- Vector forms must give the scalar results, also in place
+local N = 256
+local a, b, d = array.create( N, array.INT32 ), array.create( N, array.INT32 ), array.create( N, array.INT32 )
+local UNARY = { "sqrt", "log2", "exp2", "sin", "cos" }
+local BINARY = { "mul", "div", "atan2" }
+for _, q in ipairs( { fix.Q16, fix.Q31 } ) do
+  for base = 0, #sweep - N, N do
+    for i = 1, N do
+      a:set( i, sweep[ base + i ] )
+      b:set( i, sweep[ #sweep - base - i + 1 ] )
+    end
+    for _, name in ipairs( UNARY ) do
+      fix[ "v" .. name ]( d, a, q )
+      for i = 1, N do
+        check( d:get( i ) == fix[ name ]( a:get( i ), q ), "v" .. name .. " differs at " .. a:get( i ) )
+      end
+    end
+    for _, name in ipairs( BINARY ) do
+      fix[ "v" .. name ]( d, a, b, q )
+      for i = 1, N do
+        check( d:get( i ) == fix[ name ]( a:get( i ), b:get( i ), q ), "v" .. name .. " differs at " .. a:get( i ) )
+      end
+    end
+    fix.vmul( d, a, fix.ONE / 3, q )
+    check( d:get( N ) == fix.mul( a:get( N ), fix.ONE / 3, q ), "vmul by a number" )
+    fix.vpoly( d, a, coeffs, q )
+    check( d:get( 1 ) == fix.poly( a:get( 1 ), coeffs, q ), "vpoly" )
+    fix.vsin( a, a, q )
+    check( a:get( 1 ) == fix.sin( sweep[ base + 1 ], q ), "vsin in place" )
+  end
+end
+
+-- Bit-exactness: two running sums modulo 65521 of every result
+local s1, s2 = 1, 0
+local function hash( v )
+  s1 = ( s1 + v % 65521 ) % 65521
+  s2 = ( s2 + s1 ) % 65521
+end
+for _, q in ipairs( { 0, 8, fix.Q16, 24, fix.Q31 } ) do
+  for i = 1, #sweep do
+    local x, y = sweep[ i ], sweep[ #sweep - i + 1 ]
+    for _, name in ipairs( UNARY ) do hash( fix[ name ]( x, q ) ) end
+    for _, name in ipairs( BINARY ) do hash( fix[ name ]( x, y, q ) ) end
+    hash( fix.poly( x, coeffs, q ) )
+    hash( fix.conv( x, q, 16 ) )
+  end
+end
+local digest = string.format( "%04x%04x", s2, s1 )
+check( digest == DIGEST, "digest " .. digest .. ", expected " .. DIGEST )
+
+print( string.format( "storm.fix: %d checks, %d failed", checked, failed ) )
+assert( failed == 0, "storm.fix conformance failed" )
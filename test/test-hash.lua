@@ -0,0 +1,79 @@
+-- Tests for storm.hash
+-- Run on the Linux simulator or on a Storm:
+--   test/test-hash.lua
+-- The reference values come from zlib (crc32) and straightforward bitwise
+-- implementations of the other algorithms.
+
+local hash, array = storm.hash, storm.array
+
+local failed, checked = 0, 0
+
+local function check( ok, msg )
+  checked = checked + 1
+  if not ok then
+    failed = failed + 1
+    print( "FAIL: " .. msg )
+  end
+end
+
+-- 10000 bytes of test data
+local bytes = { }
+for i = 0, 9999 do
+  bytes[ i + 1 ] = string.char( ( ( i * 31 + 7 ) * ( math.floor( i / 256 ) + 1 ) ) % 256 )
+end
+local BIG = table.concat( bytes )
+
+-- { data, crc16, crc32, fletcher16, fnv1a }
+local VECTORS = {
+  { "123456789", 0x29B1, 0xCBF43926, 0x1EDE, 0xBB86B11C },
+  { "", 0xFFFF, 0x00000000, 0x0000, 0x811C9DC5 },
+  { "a", 0x9D77, 0xE8B7BE43, 0x6161, 0xE40C292C },
+  { "abcde", nil, nil, 0xC8F0, nil },
+  { BIG, 0x8613, 0x13982345, 0xED1D, 0xB9C95845 },
+}
+local FUNCS = { "crc16", "crc32", "fletcher16", "fnv1a" }
+
+for _, v in ipairs( VECTORS ) do
+  local data = v[ 1 ]
+  for k, name in ipairs( FUNCS ) do
+    local f, expected = hash[ name ], v[ k + 1 ]
+    if expected then
+      local label = string.format( "%s(%d bytes)", name, #data )
+      check( f( data ) == expected, label )
+      -- Incremental: split the data at a few places
+      for _, cut in ipairs{ 0, 1, 3, math.floor( #data / 2 ), #data } do
+        if cut <= #data then
+          local h = f( data:sub( 1, cut ) )
+          check( f( data:sub( cut + 1 ), h ) == expected, label .. " split at " .. cut )
+          check( f( data, f( data, nil, 1, cut ), cut + 1 ) == expected, label .. " range split at " .. cut )
+        end
+      end
+      -- Storm arrays hash their bytes
+      if #data > 0 and #data <= 4000 then
+        local arr = array.fromstr( data )
+        check( f( arr ) == expected, label .. " of an array" )
+      end
+    end
+  end
+end
+
+-- Ranges count like string.sub
+local s = "0123456789abcdef"
+for _, r in ipairs{ { 1, -1 }, { 3, 7 }, { -4, -1 }, { 5, 100 }, { 0, 2 }, { 9, 3 }, { -100, 4 } } do
+  for _, name in ipairs( FUNCS ) do
+    check( hash[ name ]( s, nil, r[ 1 ], r[ 2 ] ) == hash[ name ]( s:sub( r[ 1 ], r[ 2 ] ) ),
+      string.format( "%s range %d..%d", name, r[ 1 ], r[ 2 ] ) )
+  end
+end
+
+-- Arrays of wider types are read as their bytes in memory
+local a16 = array.create( 2, array.UINT16 )
+a16:set_as( array.INT16_BE, 0, 0x3132 )
+a16:set_as( array.INT16_BE, 2, 0x3334 )
+check( hash.crc32( a16 ) == hash.crc32( "1234" ), "crc32 of an UINT16 array" )
+
+check( not pcall( hash.crc32, 12 ), "crc32 of a number" )
+check( not pcall( hash.crc32 ), "crc32 of nothing" )
+
+print( string.format( "storm.hash: %d checks, %d failed", checked, failed ) )
+assert( failed == 0, "storm.hash tests failed" )
@@ -0,0 +1,176 @@
+-- Regression tests for the luac.cross bytecode optimizer (src/lua/lopt.c)
+-- Run on the desktop with a Lua interpreter that loads the native bytecode of
+-- luac.cross (for example the luarpc binary):
+--   luarpc test/test-lopt.lua [path to luac.cross]
+-- Every program runs from source, compiled plain, with -O and with -O -s; the
+-- outputs must be the same. The listings check what is folded on float and on
+-- integer targets.
+
+local luac = ... or "./luac.cross"
+local lua = arg[ -1 ]
+
+local failed, checked = 0, 0
+
+local function check( ok, msg )
+  checked = checked + 1
+  if not ok then
+    failed = failed + 1
+    print( "FAIL: " .. msg )
+  end
+end
+
+local src, out, log = os.tmpname(), os.tmpname(), os.tmpname()
+
+local function write( name, text )
+  local f = assert( io.open( name, "w" ) )
+  f:write( text )
+  f:close()
+end
+
+-- run a command, return its output (io.popen isn't always available)
+local function run( cmd )
+  os.execute( cmd .. " > " .. log .. " 2>&1" )
+  local f = assert( io.open( log ) )
+  local s = f:read( "*a" )
+  f:close()
+  return s
+end
+
+local PROGRAMS = {
+  { "constant locals", [[
+    local N, S, F = 10, "x", false
+    local t = { }
+    for i = 1, N do t[ #t + 1 ] = S .. i end
+    print( #t, t[ N ], F, not F, N * 2 + 1, N - 3 * N, -N )
+  ]] },
+  { "debug guards", [[
+    local DEBUG, LEVEL = false, 2
+    local function log( ... ) if DEBUG then print( "log", ... ) end end
+    local function f( x )
+      log( x )
+      if LEVEL > 1 then return x * LEVEL elseif DEBUG then return 0 end
+      return -x
+    end
+    print( f( 3 ), f( -4 ) )
+  ]] },
+  { "written locals and upvalues", [[
+    local a = 1
+    local function bump() a = a + 1 end
+    bump()
+    print( a )
+    local b = 5
+    if a > 1 then b = 6 end
+    print( b )
+    local c = 2
+    for i = 1, 3 do c = c * 2 end
+    print( c )
+    local d = 1
+    local g = function() return d end
+    d = 7
+    print( g() )
+  ]] },
+  { "arithmetic", [[
+    local a, b, z = 7, 2, 0
+    print( a / b, a % b, a ^ b, -a % b, a % -b, a + b, a - b, a * b )
+    print( a / z, -a / z, a % 3.5, 2 ^ 0.5, 10 ^ -1 )
+    print( ( z / z ) ~= ( z / z ) )
+    local big = 2 ^ 53
+    print( big + 1 == big )
+  ]] },
+  { "comparisons and tests", [[
+    local a, b, s, n = 3, 4, "abc", nil
+    print( a < b, a <= b, a == b, a ~= b, b < a, s == "abc", s < "abd" )
+    print( #s, not n, n and 1 or 2, a and b, n or s, a > b and 1 or nil )
+    local x = a < b and "lt" or "ge"
+    local y = n == nil and ( s or 1 )
+    print( x, y )
+  ]] },
+  { "control flow", [[
+    local ON = true
+    local r = { }
+    for i = 1, 5 do
+      if ON then
+        if i % 2 == 0 then r[ #r + 1 ] = i else r[ #r + 1 ] = -i end
+      else
+        r[ #r + 1 ] = 0
+      end
+    end
+    local i = 0
+    while true do
+      i = i + 1
+      if i > 3 then break end
+    end
+    repeat i = i - 1 until not ON or i == 0
+    print( table.concat( r, "," ), i )
+  ]] },
+  { "dead stores", [[
+    local function f( x )
+      local y = 1
+      y = x
+      local z = y
+      z = z + 1
+      local unused = x * 2
+      return z
+    end
+    print( f( 5 ), f( -1 ) )
+  ]] },
+  { "varargs, calls and tables", [[
+    local K = 3
+    local function pack( ... ) return select( "#", ... ), ... end
+    print( pack( K, nil, K ) )
+    local t = { K, K + 1, K + 2, [ K ] = "k", n = K; 10, 20 }
+    print( #t, t[ 3 ], t.n, t[ 5 ] )
+    local big = { }
+    for i = 1, 60 do big[ i ] = i end
+    local u = { unpack( big ) }
+    print( #u, u[ 60 ] )
+  ]] },
+}
+
+for _, p in ipairs( PROGRAMS ) do
+  local name = p[ 1 ]
+  write( src, p[ 2 ] )
+  local expected = run( lua .. " " .. src )
+  check( expected ~= "" and not expected:find( "error" ), name .. ": runs from source" )
+  for _, opts in ipairs{ "", "-O", "-O -s" } do
+    local msg = run( string.format( "%s %s -o %s %s", luac, opts, out, src ) )
+    check( msg == "", name .. ": compiles with '" .. opts .. "' " .. msg )
+    check( run( lua .. " " .. out ) == expected, name .. ": same output with '" .. opts .. "'" )
+  end
+end
+
+-- Count the instructions of each opcode in the listing of 'text'
+local function listing( text, opts )
+  write( src, text )
+  local ops = { }
+  for op in run( string.format( "%s -O -p -l %s %s", luac, opts, src ) ):gmatch( "\t%[%d+%]\t(%u+)" ) do
+    ops[ op ] = ( ops[ op ] or 0 ) + 1
+  end
+  return ops
+end
+
+-- Float targets fold all the arithmetic, but never to NaN or by dividing by 0
+local ARITH = "local a, b = 7, 2 print( a + b, a * b, a / b, a % b, a ^ b )"
+local ops = listing( ARITH, "" )
+check( not ( ops.ADD or ops.MUL or ops.DIV or ops.MOD or ops.POW ), "float: arithmetic is folded" )
+ops = listing( "local a, z = 1, 0 print( a / z, z / z, a % z )", "" )
+check( ops.DIV == 2 and ops.MOD == 1, "float: division by zero is not folded" )
+
+-- Integer targets leave DIV, MOD and POW to the target, and fold the rest
+-- only if the result fits
+ops = listing( ARITH, "-ccn int 32" )
+check( not ( ops.ADD or ops.MUL ), "int: ADD and MUL are folded" )
+check( ops.DIV == 1 and ops.MOD == 1 and ops.POW == 1, "int: DIV, MOD and POW are not folded" )
+ops = listing( "local a, b = -7, 2 print( a / b, a % b, b ^ 3 )", "-ccn int 32" )
+check( ops.DIV == 1 and ops.MOD == 1 and ops.POW == 1, "int: negative operands are not folded" )
+ops = listing( "local a = 32767 print( a + 1, a - 1 )", "-ccn int 16" )
+check( ops.ADD == 1 and not ops.SUB, "int: results out of range are not folded" )
+ops = listing( "local a = 2147483647 print( a * 2 )", "-ccn int 32" )
+check( ops.MUL == 1, "int: overflowing products are not folded" )
+
+os.remove( src )
+os.remove( out )
+os.remove( log )
+
+print( string.format( "lopt: %d checks, %d failed", checked, failed ) )
+assert( failed == 0, "lopt tests failed" )
@@ -0,0 +1,113 @@
+-- Tests for luarpc protocol v2, asynchronous calls and futures
+-- Run on the desktop with the luarpc interpreter:
+--   luarpc test/test-rpc-async.lua [address]
+-- The script starts a server on 'address' (default unix:/tmp/luarpc-test) by
+-- running itself with "server" as the first argument, then talks to it over
+-- a protocol v1 and a protocol v2 connection.
+
+local mode, address = ...
+if mode ~= "server" then mode, address = "client", mode end
+address = address or "unix:/tmp/luarpc-test"
+
+if mode == "server" then
+  function echo( ... ) return ... end
+  -- busy wait (the server runs one call at a time, so the calls sent after
+  -- this one stay in flight)
+  function slow( ms, ... )
+    local t = os.clock() + ms / 1000
+    while os.clock() < t do end
+    return ...
+  end
+  value = 0
+  rpc.server( address )
+  return
+end
+
+local failed, checked = 0, 0
+
+local function check( ok, msg )
+  checked = checked + 1
+  if not ok then
+    failed = failed + 1
+    print( "FAIL: " .. msg )
+  end
+end
+
+local function connect()
+  for i = 1, 50 do
+    local ok, h = pcall( rpc.connect, address )
+    if ok and h then return h end
+    os.execute( "sleep 0.1" )
+  end
+  error( "can't connect to " .. address )
+end
+
+os.remove( address:match( "^unix:(.*)" ) or "" )
+os.execute( string.format( "%s %s server %s &", arg[ -1 ], arg[ 0 ], address ) )
+
+-- Protocol v2: calls are pipelined, so a slow call is still in flight
+-- when rpc.async returns
+rpc.fastpath( true )
+local c = connect()
+local f = rpc.async( c, { "slow", 200, "a", 1 } )
+check( not f:ready(), "v2: the call is in flight" )
+local ok, s, n = f:wait()
+check( ok == true and s == "a" and n == 1, "v2: future:wait returns the results" )
+check( f:ready() and f:wait() == true, "v2: a completed future keeps its results" )
+
+-- Function handles: the same path is called again through its handle
+for i = 1, 3 do check( c.echo( i, "x" .. i ) == i, "v2: repeated call " .. i ) end
+check( select( 2, c.echo( 1, "y" ) ) == "y", "v2: all the results are returned" )
+
+-- Several futures, callbacks, errors and timeouts
+local got = { }
+local fs = { }
+for i = 1, 5 do
+  fs[ i ] = rpc.async( c, { "slow", 20, i }, function( ok, v ) got[ #got + 1 ] = v end )
+end
+check( rpc.wait( fs ), "rpc.wait: all the calls complete" )
+check( #got == 5 and got[ 1 ] == 1 and got[ 5 ] == 5, "callbacks run in call order" )
+check( rpc.poll() == 0, "rpc.poll: nothing in flight" )
+ok, s = rpc.async( c, { "nosuchfunction" } ):wait()
+check( ok == false and type( s ) == "string", "async: remote error" )
+f = rpc.async( c, { "slow", 300, "late", timeout = 50 } )
+ok, s = f:wait()
+check( ok == false and s == "timeout", "async: timeout" )
+check( c.echo( "after" ) == "after", "async: the late reply is discarded" )
+
+-- Synchronous calls read the replies to the calls still in flight first
+got = { }
+local f1 = rpc.async( c, { "slow", 100, "f1" }, function( ok, v ) got[ #got + 1 ] = v end )
+local f2 = rpc.async( c, { "echo", "f2" }, function( ok, v ) got[ #got + 1 ] = v end )
+check( c.echo( "sync" ) == "sync", "mixed: call" )
+check( f1:ready() and f2:ready() and got[ 1 ] == "f1" and got[ 2 ] == "f2", "mixed: call drains the futures" )
+check( select( 2, f2:wait() ) == "f2", "mixed: call keeps the future results" )
+f1 = rpc.async( c, { "slow", 100, "f1" } )
+c.value = 42
+check( f1:ready(), "mixed: newindex drains the futures" )
+f1 = rpc.async( c, { "echo", "f1" } )
+check( c.value:get() == 42, "mixed: get" )
+check( select( 2, f1:wait() ) == "f1", "mixed: get drains the futures" )
+f1 = rpc.async( c, { "slow", 50, "f1" } )
+local r = rpc.batch( c, { "echo", 1 }, { "echo", 2 } )
+check( r[ 1 ][ 2 ] == 1 and r[ 2 ][ 2 ] == 2, "mixed: batch" )
+check( select( 2, f1:wait() ) == "f1", "mixed: batch drains the futures" )
+
+-- Protocol v1: rpc.async completes the call before returning (the server
+-- serves one connection at a time)
+rpc.close( c )
+rpc.fastpath( false )
+local c1 = connect()
+f = rpc.async( c1, { "slow", 100, "v1" } )
+check( f:ready() and select( 2, f:wait() ) == "v1", "v1: async completes at once" )
+r = rpc.batch( c1, { "echo", 1 }, { "nosuchfunction" } )
+check( r[ 1 ][ 1 ] == true and r[ 1 ][ 2 ] == 1 and r[ 2 ][ 1 ] == false, "v1: batch" )
+check( c1.echo( "v1" ) == "v1", "v1: call" )
+rpc.fastpath( true )
+
+-- Stop the server (the call doesn't return)
+rpc.async( c1, { "os.exit" } )
+rpc.close( c1 )
+
+print( string.format( "rpc async: %d checks, %d failed", checked, failed ) )
+assert( failed == 0, "rpc async tests failed" )
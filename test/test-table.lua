@@ -0,0 +1,161 @@
+-- Tests for table.new, table.clear, table.move, table.pack and table.sort
+-- Run on the simulator, on a board, or with a host luarpc binary:
+--   luarpc test/test-table.lua
+
+local failed, checked = 0, 0
+
+local function check( ok, msg )
+  checked = checked + 1
+  if not ok then
+    failed = failed + 1
+    print( "FAIL: " .. msg )
+  end
+end
+
+local function same( t, expected, n )
+  for i = 1, n or #expected do
+    if t[ i ] ~= expected[ i ] then return false end
+  end
+  return true
+end
+
+-- table.new
+local t = table.new( 100, 10 )
+check( type( t ) == "table" and next( t ) == nil, "new: empty table" )
+for i = 1, 100 do t[ i ] = i end
+t.x = 1
+check( #t == 100 and t.x == 1, "new: filled" )
+check( next( table.new() ) == nil, "new: no sizes" )
+check( not pcall( table.new, -1 ), "new: negative size" )
+
+-- table.clear keeps the table usable, including its hash chains
+t = { 1, 2, 3, a = 1, b = 2, c = { } }
+table.clear( t )
+check( next( t ) == nil and #t == 0, "clear: empty" )
+for round = 1, 3 do
+  for i = 1, 50 do t[ "k" .. i ] = i; t[ i ] = -i end
+  local n = 0
+  for k, v in pairs( t ) do n = n + 1 end
+  check( n == 100 and t.k17 == 17 and t[ 33 ] == -33, "clear: refill " .. round )
+  table.clear( t )
+  check( next( t ) == nil, "clear: empty again " .. round )
+end
+local mt = { }
+mt.__index = function() return "meta" end
+t = setmetatable( { x = 1 }, mt )
+table.clear( t )
+check( t.x == "meta" and getmetatable( t ) == mt, "clear: keeps the metatable" )
+table.clear( mt )
+check( t.x == nil, "clear: metamethods of a cleared metatable are gone" )
+check( not pcall( table.clear, "x" ), "clear: not a table" )
+
+-- table.move
+t = { 1, 2, 3, 4, 5 }
+check( table.move( t, 2, 4, 1 ) == t and same( t, { 2, 3, 4, 4, 5 } ), "move: left overlap" )
+t = { 1, 2, 3, 4, 5 }
+table.move( t, 1, 3, 3 )
+check( same( t, { 1, 2, 1, 2, 3 } ), "move: right overlap" )
+local dst = { "a" }
+check( table.move( { 7, 8, 9 }, 1, 3, 2, dst ) == dst and same( dst, { "a", 7, 8, 9 } ), "move: other table" )
+t = { 1, 2 }
+table.move( t, 3, 2, 1 )
+check( same( t, { 1, 2 } ), "move: empty range" )
+table.move( { 1, nil, 3 }, 1, 3, 1, dst )
+check( same( dst, { 1, nil, 3, 9 }, 4 ), "move: holes are copied" )
+check( not pcall( table.move, { }, 1, 2 ), "move: missing destination" )
+
+-- table.pack
+t = table.pack( 1, nil, "x" )
+check( t.n == 3 and t[ 1 ] == 1 and t[ 2 ] == nil and t[ 3 ] == "x", "pack: values" )
+check( table.pack().n == 0, "pack: no values" )
+
+-- table.sort: native keys, comparison functions and the key mode
+local function sorted( t, lt )
+  for i = 2, #t do
+    if lt( t[ i ], t[ i - 1 ] ) then return false end
+  end
+  return true
+end
+local function lt( a, b ) return a < b end
+math.randomseed( 3 )
+for n = 0, 100 do
+  local nums, strs, recs = { }, { }, { }
+  for i = 1, n do
+    nums[ i ] = math.random( 50 )
+    strs[ i ] = "s" .. math.random( 50 ) .. "\0" .. math.random( 3 )
+    recs[ i ] = { v = nums[ i ], s = strs[ i ], i }
+  end
+  local c = { unpack( nums ) }
+  table.sort( c )
+  check( sorted( c, lt ), "sort: numbers " .. n )
+  c = { unpack( strs ) }
+  table.sort( c )
+  check( sorted( c, lt ), "sort: strings " .. n )
+  c = { unpack( nums ) }
+  table.sort( c, function( a, b ) return a > b end )
+  check( sorted( c, function( a, b ) return a > b end ), "sort: comparator " .. n )
+  c = { unpack( recs ) }
+  table.sort( c, "v" )
+  check( sorted( c, function( a, b ) return a.v < b.v end ), "sort: number key " .. n )
+  table.sort( c, "s" )
+  check( sorted( c, function( a, b ) return a.s < b.s end ), "sort: string key " .. n )
+  table.sort( c, 1 )
+  check( sorted( c, function( a, b ) return a[ 1 ] < b[ 1 ] end ), "sort: index key " .. n )
+  local seen = { }
+  for _, r in ipairs( c ) do seen[ r ] = true end
+  for _, r in ipairs( recs ) do check( seen[ r ], "sort: lost an element " .. n ) end
+end
+check( not pcall( table.sort, { 1, "a", 2 } ), "sort: mixed values" )
+check( not pcall( table.sort, { { v = 1 }, { v = "a" } }, "v" ), "sort: mixed keys" )
+check( not pcall( table.sort, { { v = 1 }, { } }, "v" ), "sort: missing key" )
+check( not pcall( table.sort, { { v = 1 }, 2 }, "v" ), "sort: not a table" )
+
+-- Near the memory limit the native sort has no room for its keys, and
+-- tables are sorted in place, in the key mode too
+do
+  local n = 2000
+  local nums, strs, recs = { }, { }, { }
+  for i = 1, n do
+    nums[ i ] = math.random( 1000 )
+    strs[ i ] = "s" .. math.random( 1000 )
+    recs[ i ] = { v = nums[ i ], s = strs[ i ] }
+  end
+  local bad = { }
+  for i = 1, n do bad[ i ] = { v = i } end
+  bad[ n ].v = "x"
+  collectgarbage( "collect" )
+  collectgarbage( "setmemlimit", gcinfo() + 4 )
+  table.sort( nums )
+  table.sort( strs )
+  table.sort( recs, "v" )
+  local okv = sorted( recs, function( a, b ) return a.v < b.v end )
+  table.sort( recs, "s" )
+  local oks = sorted( recs, function( a, b ) return a.s < b.s end )
+  local badok = pcall( table.sort, bad, "v" )
+  collectgarbage( "setmemlimit", 0 )
+  check( sorted( nums, lt ), "sort: numbers in place" )
+  check( sorted( strs, lt ), "sort: strings in place" )
+  check( okv and oks, "sort: keys in place" )
+  check( not badok, "sort: mixed keys in place" )
+end
+
+-- McIlroy's adversary drives plain quicksort quadratic; introsort must
+-- stay within a small multiple of n log2 n comparisons
+do
+  local n, gas, nsolid, candidate, count = 2000, 2001, 0, nil, 0
+  local val, t = { }, { }
+  for i = 1, n do t[ i ] = i; val[ i ] = gas end
+  table.sort( t, function( x, y )
+    count = count + 1
+    if val[ x ] == gas and val[ y ] == gas then
+      nsolid = nsolid + 1
+      if x == candidate then val[ x ] = nsolid else val[ y ] = nsolid end
+    end
+    if val[ x ] == gas then candidate = x elseif val[ y ] == gas then candidate = y end
+    return val[ x ] < val[ y ]
+  end )
+  check( count < 5 * n * 11, "sort: adversary needed " .. count .. " comparisons" )
+end
+
+print( string.format( "table: %d checks, %d failed", checked, failed ) )
+assert( failed == 0, "table tests failed" )
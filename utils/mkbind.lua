@@ -0,0 +1,344 @@
+-- A module that generates rotables and argument unpacking stubs for native
+-- Lua bindings from a declarative spec
+--
+-- A spec is a Lua file that returns a table like this one:
+--
+--   return {
+--     opt_level = 2,        -- MIN_OPT_LEVEL of the maps (default 2)
+--     types = {             -- argument types besides the builtin ones
+--       array = { ctype = "storm_array_t*", check = "arr_checkarray" },
+--     },
+--     maps = {              -- emitted in this order
+--       { name = "array_meta_map", static = true,
+--         funcs = { get = { "arr_get", "array", "int" } },
+--         maps = { __index = "array_meta_map" } },
+--       { name = "libstorm_array_map",
+--         funcs = { create = { "arr_create", "int", "int=ARR_TYPE_INT32" },
+--                   fromstr = "arr_from_str" },
+--         nums = { INT8 = "ARR_TYPE_INT8" } },
+--     },
+--   }
+--
+-- A function given as { impl, arg types... } is bound through a generated stub
+-- that unpacks its arguments and calls
+--   static int impl( lua_State *L, <C type of each argument>... );
+-- which the module defines after including the generated header. A function
+-- given as a plain name is put in the map as it is (a lua_CFunction that must
+-- be declared before the header). An argument type followed by '?' is optional
+-- and defaults to 0 (NULL for strings), 'type=expr' defaults to the C
+-- expression 'expr'. Custom types name a function with the signature
+--   ctype check( lua_State *L, int narg );
+-- which must also be declared before the header; they can't be optional.
+--
+-- Functions with the same argument types share one unpacking helper. When
+-- every argument of the call already has the expected Lua type, and only
+-- trailing optional ones are missing, the helper converts them without any
+-- checks; otherwise it goes through the usual luaL_check*/luaL_opt*
+-- functions, which produce the standard error messages. The keys of every
+-- map are sorted, and the map starts with a LRO_SORTEDKEY marker so
+-- lrotable.c can bisect it.
+
+module( ..., package.seeall )
+local sf = string.format
+
+-- Builtin argument types: the C type, the Lua type accepted by the fast path
+-- and the conversions for the fast path, the checked path and optional args.
+-- In the conversions $i is the argument index, $d the default value and $l
+-- the length variable of an 'lstring' (passed as an extra size_t argument)
+local builtin_types = {
+  int = { ctype = "lua_Integer", tag = "LUA_TNUMBER", fast = "lua_tointeger( L, $i )",
+    check = "luaL_checkinteger( L, $i )", opt = "luaL_optinteger( L, $i, $d )", def = "0" },
+  number = { ctype = "lua_Number", tag = "LUA_TNUMBER", fast = "lua_tonumber( L, $i )",
+    check = "luaL_checknumber( L, $i )", opt = "luaL_optnumber( L, $i, $d )", def = "0" },
+  string = { ctype = "const char*", tag = "LUA_TSTRING", fast = "lua_tostring( L, $i )",
+    check = "luaL_checkstring( L, $i )", opt = "luaL_optstring( L, $i, $d )", def = "NULL" },
+  lstring = { ctype = "const char*", len = true, tag = "LUA_TSTRING", fast = "lua_tolstring( L, $i, &$l )",
+    check = "luaL_checklstring( L, $i, &$l )", opt = "luaL_optlstring( L, $i, $d, &$l )", def = "NULL" },
+  bool = { ctype = "int", fast = "lua_toboolean( L, $i )", check = "lua_toboolean( L, $i )",
+    opt = "( lua_isnoneornil( L, $i ) ? ( $d ) : lua_toboolean( L, $i ) )", def = "0" },
+  value = { ctype = "int", fast = "$i", check = "$i" },
+}
+
+-- Maximum length of a key, see LUA_MAX_ROTABLE_NAME in lrotable.h
+local MAX_KEY = 32
+
+-- Byte order comparison, to sort the keys the way strcmp does
+local function strless( a, b )
+  for i = 1, math.min( #a, #b ) do
+    local x, y = a:byte( i ), b:byte( i )
+    if x ~= y then return x < y end
+  end
+  return #a < #b
+end
+
+local function expand( tmpl, i, def, lenvar )
+  return ( tmpl:gsub( "%$(%a)", { i = tostring( i ), d = def or "", l = lenvar or "" } ) )
+end
+
+-- Parse the argument list of a bound function into descriptors
+local function parse_args( spec, fname, decl )
+  local args = {}
+  for i = 2, #decl do
+    local tname, mod, def = decl[ i ]:match( "^([%w_]+)([%?=]?)(.*)$" )
+    local t = tname and builtin_types[ tname ]
+    local custom = tname and spec.types and spec.types[ tname ]
+    if not t and custom then
+      if not custom.ctype or not custom.check then
+        return nil, sf( "%s: type '%s' needs a ctype and a check function", fname, tname )
+      end
+      t = { ctype = custom.ctype, check = custom.check .. "( L, $i )" }
+    end
+    if not t then
+      return nil, sf( "%s: unknown argument type '%s'", fname, decl[ i ] )
+    end
+    local a = { name = tname, t = t }
+    if mod ~= "" then
+      if not t.opt then
+        return nil, sf( "%s: argument type '%s' can't be optional", fname, tname )
+      end
+      a.def = mod == "=" and def or t.def
+      if a.def == "" then
+        return nil, sf( "%s: missing default value in '%s'", fname, decl[ i ] )
+      end
+    end
+    args[ #args + 1 ] = a
+  end
+  return args
+end
+
+-- C types of the implementation's arguments
+local function c_params( args )
+  local p = { "lua_State*" }
+  for _, a in ipairs( args ) do
+    p[ #p + 1 ] = a.t.ctype
+    if a.t.len then p[ #p + 1 ] = "size_t" end
+  end
+  return table.concat( p, ", " )
+end
+
+-- Unique description of a signature, used to share the unpacking helpers
+local function sig_key( args )
+  local k = {}
+  for _, a in ipairs( args ) do
+    k[ #k + 1 ] = a.def and sf( "%s=%s", a.name, a.def ) or a.name
+  end
+  return table.concat( k, ", " )
+end
+
+-- Unpacking helper for one signature
+local function gen_helper( hname, args )
+  local out = {}
+  local function w( s, ... ) out[ #out + 1 ] = sf( s, ... ) end
+  w( "// ( %s )\n", sig_key( args ) )
+  w( "typedef int ( *%s_f )( %s );\n", hname, c_params( args ) )
+  w( "static int %s( lua_State *L, %s_f f )\n{\n", hname, hname )
+  local call, tags = { "L" }, {}
+  local nreq = 0  -- arguments up to this one must be there
+  for i, a in ipairs( args ) do
+    if not a.def then nreq = i end
+  end
+  for i, a in ipairs( args ) do
+    w( "  %s a%d;\n", a.t.ctype, i )
+    call[ #call + 1 ] = sf( "a%d", i )
+    if a.t.len then
+      w( "  size_t a%d_len;\n", i )
+      call[ #call + 1 ] = sf( "a%d_len", i )
+    end
+    if a.t.tag then
+      local tag = sf( "lua_type( L, %d ) == %s", i, a.t.tag )
+      tags[ #tags + 1 ] = i > nreq and sf( "( top < %d || %s )", i, tag ) or tag
+    end
+  end
+  local function unpack( indent, fast )
+    for i, a in ipairs( args ) do
+      local lenvar = sf( "a%d_len", i )
+      local conv
+      if fast and i > nreq then
+        -- A trailing optional argument may be missing
+        local absent = a.t.len and expand( a.t.opt, i, a.def, lenvar ) or sf( "( %s )", a.def )
+        conv = sf( "top >= %d ? %s : %s", i, expand( a.t.fast, i, nil, lenvar ), absent )
+      else
+        local tmpl = ( fast and a.t.fast ) or ( a.def and a.t.opt ) or a.t.check
+        conv = expand( tmpl, i, a.def, lenvar )
+      end
+      w( "%sa%d = %s;\n", indent, i, conv )
+    end
+  end
+  if #tags > 0 then
+    w( "  int top = lua_gettop( L );\n\n" )
+    -- Fast path: the arguments that are there have the expected types, and
+    -- only trailing optional ones are missing
+    local arity = nreq == #args and sf( "top == %d", #args ) or sf( "top >= %d && top <= %d", nreq, #args )
+    w( "  if( %s && %s )\n  {\n", arity, table.concat( tags, " && " ) )
+    unpack( "    ", true )
+    w( "  }\n  else\n  {\n" )
+    unpack( "    ", false )
+    w( "  }\n" )
+  else
+    w( "\n" )
+    unpack( "  ", false )
+  end
+  w( "  return f( %s );\n}\n\n", table.concat( call, ", " ) )
+  return table.concat( out )
+end
+
+-- Sorted entries of a map
+local function map_entries( m, known )
+  local entries = {}
+  local function add( key, kind, value )
+    if type( key ) ~= "string" or #key == 0 or #key > MAX_KEY then
+      return sf( "%s: invalid key '%s'", m.name, tostring( key ) )
+    end
+    entries[ #entries + 1 ] = { key = key, kind = kind, value = value }
+  end
+  for k, v in pairs( m.funcs or {} ) do
+    if type( v ) ~= "string" and ( type( v ) ~= "table" or type( v[ 1 ] ) ~= "string" ) then
+      return nil, sf( "%s: invalid function '%s'", m.name, tostring( k ) )
+    end
+    local err = add( k, "func", v )
+    if err then return nil, err end
+  end
+  for k, v in pairs( m.nums or {} ) do
+    local err = add( k, "num", tostring( v ) )
+    if err then return nil, err end
+  end
+  for k, v in pairs( m.maps or {} ) do
+    if not known[ v ] and v ~= m.name then
+      return nil, sf( "%s: map '%s' must be declared before it is used", m.name, v )
+    end
+    local err = add( k, "map", v )
+    if err then return nil, err end
+  end
+  table.sort( entries, function( a, b ) return strless( a.key, b.key ) end )
+  for i = 2, #entries do
+    if entries[ i ].key == entries[ i - 1 ].key then
+      return nil, sf( "%s: duplicate key '%s'", m.name, entries[ i ].key )
+    end
+  end
+  return entries
+end
+
+-- Generate the header for the spec in 'specname'
+-- Returns the header text, or nil and an error message
+function generate( specname, outname )
+  local chunk, err = loadfile( specname )
+  if not chunk then return nil, err end
+  local ok, spec = pcall( chunk )
+  if not ok then return nil, spec end
+  if type( spec ) ~= "table" or type( spec.maps ) ~= "table" then
+    return nil, sf( "%s: the spec must return a table with a 'maps' array", specname )
+  end
+  local opt_level = spec.opt_level or 2
+  if opt_level < 1 then
+    return nil, sf( "%s: opt_level must be at least 1", specname )
+  end
+  local prefix = outname:gsub( "[^%w_]", "_" )
+  local guard = sf( "__%s_H__", prefix:upper() )
+
+  local out = {}
+  local function w( s, ... ) out[ #out + 1 ] = sf( s, ... ) end
+  w( "// Generated by mkbind.lua from %s\n// DO NOT MODIFY\n\n", specname:match( "[^/\\]+$" ) )
+  w( "#ifndef %s\n#define %s\n\n", guard, guard )
+  w( "#undef MIN_OPT_LEVEL\n#define MIN_OPT_LEVEL %d\n#include \"lrodefs.h\"\n\n", opt_level )
+
+  -- Collect the bound functions first, so that each implementation gets a
+  -- single prototype and each signature a single helper
+  local impls, helpers, sigs, known = {}, {}, {}, {}
+  local maps = {}
+  for _, m in ipairs( spec.maps ) do
+    if type( m.name ) ~= "string" then
+      return nil, sf( "%s: map without a name", specname )
+    end
+    local entries, err = map_entries( m, known )
+    if not entries then return nil, sf( "%s: %s", specname, err ) end
+    for _, e in ipairs( entries ) do
+      if e.kind == "func" and type( e.value ) == "table" then
+        local impl = e.value[ 1 ]
+        local args, err = parse_args( spec, impl, e.value )
+        if not args then return nil, sf( "%s: %s", specname, err ) end
+        if impls[ impl ] and sig_key( impls[ impl ].args ) ~= sig_key( args ) then
+          return nil, sf( "%s: %s is bound with different signatures", specname, impl )
+        end
+        if not impls[ impl ] then
+          impls[ impl ] = { args = args }
+          impls[ #impls + 1 ] = impl
+          if #args > 0 then
+            local key = sig_key( args )
+            if not sigs[ key ] then
+              sigs[ key ] = sf( "%s_sig%d", prefix, #helpers + 1 )
+              helpers[ #helpers + 1 ] = gen_helper( sigs[ key ], args )
+            end
+            impls[ impl ].helper = sigs[ key ]
+          end
+        end
+        e.cfunc = #args > 0 and ( impl .. "_bind" ) or impl
+      elseif e.kind == "func" then
+        e.cfunc = e.value
+      end
+    end
+    known[ m.name ] = true
+    maps[ #maps + 1 ] = { m = m, entries = entries }
+  end
+
+  -- Prototypes of the implementations
+  for _, impl in ipairs( impls ) do
+    w( "static int %s( %s );\n", impl, c_params( impls[ impl ].args ) )
+  end
+  w( "\n" )
+
+  -- Unpacking helpers and stubs
+  for _, h in ipairs( helpers ) do w( "%s", h ) end
+  for _, impl in ipairs( impls ) do
+    local b = impls[ impl ]
+    if b.helper then
+      w( "static int %s_bind( lua_State *L )\n{\n  return %s( L, %s );\n}\n\n", impl, b.helper, impl )
+    end
+  end
+
+  -- The maps themselves
+  for _, map in ipairs( maps ) do
+    local m, entries = map.m, map.entries
+    w( "%sconst LUA_REG_TYPE %s[] =\n{\n", m.static and "static " or "", m.name )
+    -- The sorted key marker, numbers and rotables only exist in LTR maps
+    w( "#if LUA_OPTIMIZE_MEMORY >= %d\n  { LRO_SORTEDKEY( %d ), LNILVAL },\n", opt_level, #entries )
+    local guarded = true
+    local function guard( on )
+      if on ~= guarded then w( on and "#if LUA_OPTIMIZE_MEMORY >= %d\n" or "#endif\n", opt_level ) end
+      guarded = on
+    end
+    for _, e in ipairs( entries ) do
+      guard( e.kind ~= "func" )
+      if e.kind == "func" then
+        w( "  { LSTRKEY( \"%s\" ), LFUNCVAL( %s ) },\n", e.key, e.cfunc )
+      else
+        local v = e.kind == "num" and sf( "LNUMVAL( %s )", e.value ) or sf( "LROVAL( %s )", e.value )
+        w( "  { LSTRKEY( \"%s\" ), %s },\n", e.key, v )
+      end
+    end
+    guard( false )
+    w( "  { LNILKEY, LNILVAL }\n};\n\n" )
+  end
+  w( "#endif\n" )
+  return table.concat( out )
+end
+
+-- Generate the header for the spec in 'specname' and write it to 'outname'.h,
+-- leaving the file alone if its content doesn't change
+-- Returns true if the file was written, false if it was already up to date,
+-- or nil and an error message
+function mkbind( specname, outname )
+  local data, err = generate( specname, outname:match( "[^/\\]+$" ) )
+  if not data then return nil, err end
+  local outfname = outname .. ".h"
+  local f = io.open( outfname, "rb" )
+  if f then
+    local old = f:read( "*a" )
+    f:close()
+    if old == data then return false end
+  end
+  f = io.open( outfname, "wb" )
+  if not f then return nil, "Unable to create " .. outfname end
+  f:write( data )
+  f:close()
+  return true
+end